@@ -6,14 +6,28 @@
  */
 
 #include <gtk/gtk.h>
+#include <gst/gst.h>
 
 #include "audite_app.h"
 #include "audite_app_win.h"
 #include "audite_app_prefs.h"
+#include "audite_bench.h"
+#include "audite_cache.h"
+#include "audite_mpris_check.h"
+#include "audite_profile.h"
+#include "audite_search.h"
+#include "audite_soak.h"
 
 struct _AuditeApp
 {
-  GtkApplication parent;
+  GtkApplication    parent;
+
+  GSettings        *settings;
+  AuditeLibrary    *library;
+  AuditeSearch     *search;
+  AuditeSoak       *soak;
+  AuditeMprisCheck *mpris_check;
+  gint              status;
 };
 
 G_DEFINE_TYPE(AuditeApp, audite_app, GTK_TYPE_APPLICATION);
@@ -21,6 +35,12 @@ G_DEFINE_TYPE(AuditeApp, audite_app, GTK_TYPE_APPLICATION);
 static void
 audite_app_init (AuditeApp *app)
 {
+  g_application_add_main_option_entries (G_APPLICATION (app),
+                                         audite_bench_option_entries);
+  g_application_add_main_option_entries (G_APPLICATION (app),
+                                         audite_soak_option_entries);
+  g_application_add_main_option_entries (G_APPLICATION (app),
+                                         audite_mpris_check_option_entries);
 }
 
 static void
@@ -100,6 +120,60 @@ quit_activated (GSimpleAction *action,
   g_application_quit (G_APPLICATION (app));
 }
 
+static void
+library_book_added_handler (AuditeLibrary *library, AuditeBookInfo *info, AuditeApp *app)
+{
+  audite_search_add_book (app->search, info);
+}
+
+static void
+library_book_removed_handler (AuditeLibrary *library, const gchar *uri, AuditeApp *app)
+{
+  audite_search_remove_book (app->search, uri);
+}
+
+static void
+library_scan_finished_handler (AuditeLibrary *library, AuditeApp *app)
+{
+  GList *books;
+
+  books = audite_library_get_books (library);
+  audite_search_retain (app->search, books);
+  g_list_free (books);
+  audite_search_save (app->search);
+}
+
+static void
+audite_app_start_library (AuditeApp *app)
+{
+  gchar **folders;
+  gchar *filename;
+  GFile *folder;
+  guint i;
+
+  app->settings = g_settings_new ("com.github.alkesta.audite");
+  app->library = audite_library_new ();
+  filename = audite_cache_build_filename ("search", "library", ".gvariant");
+  app->search = audite_search_new (filename);
+  g_free (filename);
+  g_signal_connect (app->library, "book-added",
+                    G_CALLBACK (library_book_added_handler), app);
+  g_signal_connect (app->library, "book-removed",
+                    G_CALLBACK (library_book_removed_handler), app);
+  g_signal_connect (app->library, "scan-finished",
+                    G_CALLBACK (library_scan_finished_handler), app);
+
+  folders = g_settings_get_strv (app->settings, "library-folders");
+  for (i = 0; folders[i] != NULL; i++) {
+    folder = g_file_new_for_commandline_arg (folders[i]);
+    audite_library_add_folder (app->library, folder);
+    g_object_unref (folder);
+  }
+  g_strfreev (folders);
+
+  audite_library_scan (app->library);
+}
+
 static GActionEntry app_entries[] =
 {
   { "open", open_activated, NULL, NULL, NULL },
@@ -132,15 +206,52 @@ audite_app_startup (GApplication *app)
   app_menu = G_MENU_MODEL (gtk_builder_get_object (builder, "appmenu"));
   gtk_application_set_app_menu (GTK_APPLICATION (app), app_menu);
   g_object_unref (builder);
+
+  /* the library scan discovers files on its own threads, before any
+   * window has made a player; this also loads the registry */
+  audite_profile_begin ("gst_init");
+  gst_init (NULL, NULL);
+  audite_profile_end ("gst_init");
+  audite_app_start_library (AUDITE_APP (app));
+}
+
+static void
+audite_app_shutdown (GApplication *app)
+{
+  AuditeApp *self = AUDITE_APP (app);
+
+  if (self->library)
+    audite_library_stop (self->library);
+  g_clear_object (&self->library);
+  g_clear_pointer (&self->search, audite_search_free);
+  g_clear_object (&self->settings);
+  g_clear_pointer (&self->soak, audite_soak_free);
+  if (self->mpris_check && audite_mpris_check_failed (self->mpris_check))
+    self->status = 1;
+  g_clear_pointer (&self->mpris_check, audite_mpris_check_free);
+
+  G_APPLICATION_CLASS (audite_app_parent_class)->shutdown (app);
 }
 
 static void
 audite_app_activate (GApplication *app)
 {
+  AuditeApp *self = AUDITE_APP (app);
   AuditeAppWindow *win;
 
-  win = audite_app_window_new (AUDITE_APP (app));
-  gtk_window_present (GTK_WINDOW (win));
+  win = audite_app_window_new (self);
+  if (self->soak) {
+    gtk_window_present (GTK_WINDOW (win));
+    audite_soak_start (self->soak, win);
+    return;
+  }
+  if (self->mpris_check) {
+    gtk_window_present (GTK_WINDOW (win));
+    audite_mpris_check_start (self->mpris_check, win);
+    return;
+  }
+  if (!audite_app_window_restore (win))
+    gtk_window_present (GTK_WINDOW (win));
 }
 
 static void
@@ -151,26 +262,88 @@ audite_app_open (GApplication  *app,
 {
   GList *windows;
   AuditeAppWindow *win;
-  int i = 0;
   gchar **uris;
+  gint i;
+
   windows = gtk_application_get_windows (GTK_APPLICATION (app));
   if (windows)
     win = AUDITE_APP_WINDOW (windows->data);
   else 
     win = audite_app_window_new (AUDITE_APP (app));
 
-  uris[i] = g_file_get_uri(((GFile **)files)[i]);
-  audite_app_window_open (win, uris[i]);
+  /* every file given becomes an entry of the play queue */
+  uris = g_new0 (gchar *, n_files + 1);
+  for (i = 0; i < n_files; i++)
+    uris[i] = g_file_get_uri (files[i]);
+  audite_app_window_open_queue (win, uris);
+  g_strfreev (uris);
   gtk_window_present (GTK_WINDOW (win));
 }
 
+/* Runs before registration and GTK initialization, so the benchmark
+ * needs neither a display nor a running instance. A soak run and the
+ * MPRIS check keep to their own instance, since they swap the settings
+ * backend and cache directory. */
+static gint
+audite_app_handle_local_options (GApplication *app,
+                                 GVariantDict *options)
+{
+  AuditeApp *self = AUDITE_APP (app);
+  GError *error = NULL;
+
+  if (g_variant_dict_contains (options, "benchmark"))
+    return audite_bench_run (options);
+
+  if (g_variant_dict_contains (options, "soak")) {
+    self->soak = audite_soak_new (options, &error);
+    if (!self->soak) {
+      g_print ("Soak: %s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+    g_application_set_flags (app, g_application_get_flags (app)
+                                  | G_APPLICATION_NON_UNIQUE);
+  }
+  else if (g_variant_dict_contains (options, "mpris-check")) {
+    self->mpris_check = audite_mpris_check_new (&error);
+    if (!self->mpris_check) {
+      g_print ("MPRIS check: %s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+    g_application_set_flags (app, g_application_get_flags (app)
+                                  | G_APPLICATION_NON_UNIQUE);
+  }
+  return -1;
+}
 
 static void
 audite_app_class_init (AuditeAppClass *class)
 {
   G_APPLICATION_CLASS (class)->startup = audite_app_startup;
+  G_APPLICATION_CLASS (class)->shutdown = audite_app_shutdown;
   G_APPLICATION_CLASS (class)->activate = audite_app_activate;
   G_APPLICATION_CLASS (class)->open = audite_app_open;
+  G_APPLICATION_CLASS (class)->handle_local_options = audite_app_handle_local_options;
+}
+
+AuditeLibrary *
+audite_app_get_library (AuditeApp *app)
+{
+  return app->library;
+}
+
+AuditeSearch *
+audite_app_get_search (AuditeApp *app)
+{
+  return app->search;
+}
+
+/* What the run adds to the exit status, 1 after a failed MPRIS check. */
+gint
+audite_app_get_status (AuditeApp *app)
+{
+  return app->status;
 }
 
 AuditeApp *
@@ -179,5 +352,7 @@ audite_app_new (void)
   return g_object_new (AUDITE_APP_TYPE,
                        "application-id", "org.gtk.audite",
                        "flags", G_APPLICATION_HANDLES_OPEN,
+                       /* lets windows see when the screen is locked */
+                       "register-session", TRUE,
                        NULL);
 }
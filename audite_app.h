@@ -9,6 +9,8 @@
 #define __AUDITE_APP_H
 
 #include <gtk/gtk.h>
+#include "audite_library.h"
+#include "audite_search.h"
 
 
 #define AUDITE_APP_TYPE (audite_app_get_type ())
@@ -16,6 +18,9 @@ G_DECLARE_FINAL_TYPE (AuditeApp, audite_app, AUDITE, APP, GtkApplication)
 
 
 AuditeApp     *audite_app_new         (void);
+AuditeLibrary *audite_app_get_library (AuditeApp *app);
+AuditeSearch  *audite_app_get_search  (AuditeApp *app);
+gint           audite_app_get_status  (AuditeApp *app);
 
 
 #endif /* __AUDITE_APP_H */
@@ -15,13 +15,78 @@
 #include <gtk/gtk.h>
 #include <gst/player/player.h>
 #include <gst/gst.h>
+#include <gst/audio/audio.h>
+#include <gst/base/gstbasesrc.h>
 #include <gst/tag/tag.h>
-#include <mp4v2/mp4v2.h>
 #include "audite_app.h"
 #include "audite_app_win.h"
+#include "audite_cache.h"
+#include "audite_chapter_model.h"
+#include "audite_chapters.h"
+#include "audite_cover.h"
+#include "audite_export.h"
+#include "audite_gain.h"
+#include "audite_loader.h"
+#include "audite_loudness.h"
+#include "audite_mpris.h"
+#include "audite_playlist.h"
+#include "audite_probe.h"
+#include "audite_profile.h"
+#include "audite_queue.h"
+#include "audite_search.h"
+#include "audite_seeker.h"
+#include "audite_segment.h"
+#include "audite_waveform.h"
 
-#define MP4V2_SECOND 1000
 #define CONFIG_FILE "audite.conf"
+#define COVER_SIZE 300
+#define RESTORE_PRESENT_TIMEOUT 500
+#define TICK_SLACK_MS 5
+#define HIDDEN_SAVE_INTERVAL 60
+#define VISIBLE_SAVE_INTERVAL (60 * G_USEC_PER_SEC)
+/* the low power profile: the sink is woken once per latency time, the
+ * source reads in large blocks and a hidden window saves less often */
+#define LOW_POWER_BUFFER_TIME (2 * G_USEC_PER_SEC)
+#define LOW_POWER_LATENCY_TIME (500 * 1000)
+#define LOW_POWER_BLOCKSIZE (512 * 1024)
+#define LOW_POWER_SAVE_INTERVAL 300
+/* GstPlayFlags of playbin, which has no public header */
+#define PLAY_FLAG_DOWNLOAD (1 << 7)
+/* how long before the end of a book the next one in the queue prerolls */
+#define QUEUE_PREROLL_AHEAD (30 * GST_SECOND)
+/* rows shown for a search, more only means typing another letter */
+#define SEARCH_RESULT_LIMIT 50
+
+/* The last TOC posted on the bus of a deck, with the stream it came from.
+ * It stays with the deck, so a standby deck still has the one it prerolled
+ * with when the window takes it over. Set on the thread of the player. */
+typedef struct
+{
+  AuditeAppWindow *win;
+  GMutex           lock;
+  gchar           *uri;
+  GstToc          *toc;
+} DeckToc;
+
+/* A player with everything that hangs off its pipeline. The window plays
+ * one and keeps the next book of the queue prerolled in another. */
+typedef struct
+{
+  GstPlayer      *player;
+  GstElement     *pipeline;
+  AuditeSegment  *segment;
+  AuditePlaylist *playlist;
+  AuditeGain     *gain;
+  AuditeSeeker   *seeker;
+  DeckToc        *toc;
+} WindowDeck;
+
+/* Tells the window that @toc has a new TOC. */
+typedef struct
+{
+  AuditeAppWindow *win;
+  DeckToc         *toc;
+} WindowToc;
 
 struct _AuditeAppWindow
 {
@@ -33,11 +98,57 @@ struct _AuditeAppWindow
   gboolean   audiobook;
   gint       amount_of_chapters;
   gint       current_chapter_number;
-  guint64    current_chapter_end;
-  guint64    current_chapter_start;
+  gint       shown_chapter;      /* index the list and the labels show */
+  GstClockTime current_chapter_end;
+  GstClockTime current_chapter_start;
+
+  GCancellable   *load_cancellable;
+  guint           load_id;        /* names the open span in the profile */
+  AuditeBookInfo *book;
+  AuditeChapterModel *chapter_model;
+  AuditeSegment  *segment;
+  AuditePlaylist *playlist;
+  AuditeSeeker   *seeker;
+  gboolean        seek_dragging;
+  GSource        *tick_source;
+  GstElement     *pipeline;
+  GstQuery       *position_query;
+  DeckToc        *toc;           /* of the playing pipeline */
+  const gchar    *stream_caps;   /* read on streaming threads */
+  guint8         *waveform;      /* level pairs, see audite_waveform.h */
+  guint           waveform_levels;
+  GCancellable   *waveform_cancellable;
+  AuditeGain     *gain;
+  AuditeMpris    *mpris;
+  GCancellable   *loudness_cancellable;
+  AuditeQueue    *queue;
+  WindowDeck     *standby;       /* the next book of the queue, prerolled */
+  gboolean        standby_tried;
+  gboolean        prerolled;
+  gint            low_power;     /* read on streaming threads */
+  GCancellable   *export_cancellable;
+  GtkWidget      *export_dialog;
+  GtkWidget      *export_bar;
+  gdouble        *export_fractions;
+  guint           export_chapters;
+  guint           export_done;
+  gdouble         export_total;
+  GtkWidget      *search_entry;
+  GtkWidget      *search_list;
+  GPtrArray      *search_results; /* AuditeSearchResult by row */
+  GtkTreePath    *cursor_path;
+  GstClockTime    shown_second;
+  gboolean        load_play;
+  GstClockTime    loop_start;
+  GCancellable   *cover_cancellable;
+  gboolean        cover_requested;
+  GstClockTime    restore_position;
+  guint           restore_timeout_id;
+  gint64          saved_time;
 
   GSettings *settings;
   GtkWidget *gears;
+  GtkWidget *search_button;
   GtkWidget *volume_button;
   GtkWidget *previous_button;
   GtkWidget *rewind_button;
@@ -53,7 +164,6 @@ struct _AuditeAppWindow
   GtkWidget *seek_bar;
   GtkWidget *cover_art_image;
   GtkWidget *cover_image;
-  GtkWidget *chapter_list_store;
   GtkWidget *chapters_tree_view;
   GtkWidget *progress;
   GtkWidget *genre_value_label;
@@ -68,15 +178,6 @@ struct _AuditeAppWindow
 
 };
 
-enum {
-	ICON,
-	NUMBER,
-	NAME,
-	DURATION,
-	START,
-	END
-};
-
 G_DEFINE_TYPE(AuditeAppWindow, audite_app_window, GTK_TYPE_APPLICATION_WINDOW);
 
 static void play_button_clicked_handler(GtkButton * button, AuditeAppWindow *win);
@@ -88,24 +189,60 @@ static void next_button_clicked_handler (GtkButton * button, AuditeAppWindow *wi
 static void gst_media_info_updated_handler (GstPlayer * player, GstPlayerMediaInfo * media_info, AuditeAppWindow *win);
 static void gst_volume_changed_handler(GstPlayer * unused, AuditeAppWindow *win);
 static void gst_duration_changed_handler (GstPlayer * unused, GstClockTime duration, AuditeAppWindow *win);
-static void gst_position_updated_handler(GstPlayer * unused, GstClockTime position, AuditeAppWindow *win);
 static void gst_state_changed_handler (GstPlayer * unused, GstPlayerState state, AuditeAppWindow *win);
 static void gst_media_eos_handler (GstPlayer * unused, AuditeAppWindow *win);
 
 
-static GdkPixbuf *get_cover_image (GstPlayerMediaInfo * media_info);
+static GstSample *get_cover_sample (GstPlayerMediaInfo * media_info);
+static void cover_loaded_handler (GObject *source, GAsyncResult *res, gpointer user_data);
 static void update_position_label (GtkLabel * label, guint64 seconds);
 static GObject *
 audite_app_window_constructor (GType type, guint n_construct_params,
     GObjectConstructParam * construct_params);
 static void seek_bar_value_changed_handler(GtkRange * range, gpointer data);
-static gchar * seconds_to_hhmmss (guint64 seconds);
+static gboolean seek_bar_button_press_handler (GtkWidget *widget, GdkEventButton *event,
+				AuditeAppWindow *win);
+static gboolean seek_bar_button_release_handler (GtkWidget *widget, GdkEventButton *event,
+				AuditeAppWindow *win);
+static void seconds_to_hhmmss (gchar *buffer, gsize size, guint64 seconds);
 static void seek_bar_set_range (AuditeAppWindow *win, guint64 start, guint64 end);
 static void set_curent_chapter (AuditeAppWindow *win, GstClockTime position);
+static void window_track_chapter (AuditeAppWindow *win, GstClockTime position);
+static void window_check_preroll (AuditeAppWindow *win, GstClockTime position);
+static gboolean window_is_visible (AuditeAppWindow *win);
 static void cover_art_dialog (AuditeAppWindow *win);
 
 
 static void set_chapter (AuditeAppWindow *win, gint next);
+static void update_book_layout (AuditeAppWindow *win);
+static void window_seek (AuditeAppWindow *win, GstClockTime position);
+static guint32 window_seek_func (GstClockTime position, GstSeekFlags flags, gpointer data);
+static void window_set_playing (AuditeAppWindow *win, gboolean play);
+static GstClockTime window_get_position (AuditeAppWindow *win);
+static GstClockTime window_get_duration (AuditeAppWindow *win);
+static void window_update_position (AuditeAppWindow *win, GstClockTime position);
+static void window_schedule_tick (AuditeAppWindow *win);
+static void window_visibility_changed (AuditeAppWindow *win);
+static gboolean gapless_chapters_enabled (AuditeAppWindow *win);
+static void window_load (AuditeAppWindow *win, const gchar *uri, GstClockTime position, gboolean play);
+static void window_preroll_next (AuditeAppWindow *win);
+static gboolean window_play_next (AuditeAppWindow *win);
+static void window_deck_free (WindowDeck *deck);
+static void save_position (AuditeAppWindow *win);
+static void present_restored (AuditeAppWindow *win);
+static gboolean restore_timeout_handler (gpointer data);
+static void window_start_waveform (AuditeAppWindow *win);
+static void window_clear_waveform (AuditeAppWindow *win);
+static void window_start_loudness (AuditeAppWindow *win);
+static void window_clear_loudness (AuditeAppWindow *win);
+static void window_clear_export (AuditeAppWindow *win);
+static void window_publish_art (AuditeAppWindow *win);
+static gboolean waveform_draw_handler (GtkWidget *widget, cairo_t *cr, AuditeAppWindow *win);
+static void set_stream_properties (AuditeAppWindow *win, gint channels, gint samplerate,
+				gint bitrate, const gchar *codec);
+static void set_genre_and_year (AuditeAppWindow *win, const gchar *genre, const gchar *year);
+static void window_fill_book (AuditeAppWindow *win, GstPlayerMediaInfo *media_info,
+				const gchar *artist, const gchar *album);
 
 static void row_activated_handler(GtkTreeView *view, GtkTreePath *path,
                         GtkTreeViewColumn *col, AuditeAppWindow *win) {
@@ -113,22 +250,16 @@ static void row_activated_handler(GtkTreeView *view, GtkTreePath *path,
   GtkTreeModel *model;
 
   model = gtk_tree_view_get_model(view);
-  if (gtk_tree_model_get_iter(model, &iter, path)) {
-    gchar *title;
+  if (win->book && win->book->chapters && gtk_tree_model_get_iter(model, &iter, path)) {
+    const AuditeChapter *chapter;
     gint number;
-    guint64 start, end;
     gtk_tree_model_get(model, &iter,
-                        NUMBER,&number,
-			NAME,  &title,
-			START, &start,
-			END,   &end,
+                        AUDITE_CHAPTER_COLUMN_NUMBER, &number,
 			-1);
-    win->current_chapter_number = number;
-    win->current_chapter_start = start;
-    win->current_chapter_end = end;
+    chapter = &g_array_index (win->book->chapters, AuditeChapter, number - 1);
 
-    gst_player_seek (win->player, gst_util_uint64_scale ( (gdouble) win->current_chapter_start, GST_SECOND, 1) );
-    set_curent_chapter (win, (gint64) start * GST_SECOND);
+    window_seek (win, chapter->start);
+    set_curent_chapter (win, chapter->start);
     gst_player_play (win->player);
   }
 }
@@ -142,8 +273,9 @@ volume_button_value_changed_handler (GtkScaleButton * button, gdouble value, Aud
 static void gst_media_info_updated_handler (GstPlayer * player,
 				GstPlayerMediaInfo * media_info,
 				AuditeAppWindow *win) {
-	GdkPixbuf  *pixbuf;
-	gchar      *title;
+	GstSample  *sample;
+	const gchar *title;
+	gchar      *display_title = NULL;
 	gchar      *basename = NULL;
 	gchar      *filename = NULL;
 	GstTagList *tags =     NULL;
@@ -154,12 +286,11 @@ static void gst_media_info_updated_handler (GstPlayer * player,
 	gchar      *codec =    NULL;
 	gint        bitrate =    0;
 	gint        channels =   0;
-	gchar      *ch =       NULL;
 	gint        samplerate = 0;
 	gchar       year[5] =  "";
 	GList      *list, *l;
-	gchar      *prop =     NULL;
 
+	audite_profile_mark_once ("media-info-updated");
 	list = gst_player_media_info_get_stream_list (media_info);
 	if (list) {
 		for (l = list; l != NULL; l = l->next) {
@@ -184,72 +315,146 @@ static void gst_media_info_updated_handler (GstPlayer * player,
 	}
 
 	if (date) 
-		g_date_strftime (year, sizeof(year), "%Y-%M-%D", date);
-	
-	gtk_label_set_text (GTK_LABEL (win->year_value_label), date ? year : NULL);
-	gtk_label_set_text (GTK_LABEL (win->genre_value_label), genre ? genre : NULL);
-
-	if (channels) {
-		switch (channels) {
-			case 1: ch = g_strdup_printf ("Mono");	break;
-			case 2: ch = g_strdup_printf ("Stereo"); break;
-			default : ch = g_strdup_printf ("%d channels", channels); break;
-		}
+		g_date_strftime (year, sizeof(year), "%Y", date);
+
+	set_genre_and_year (win, genre, date ? year : NULL);
+	set_stream_properties (win, channels, samplerate, bitrate, codec);
+
+	/* complete the book with what only the pipeline knows */
+	if (win->book && !win->book->codec && codec) {
+		win->book->codec = g_strdup (codec);
+		win->book->sample_rate = samplerate;
+		win->book->channels = channels;
+		win->book->bitrate = bitrate;
+		if (!win->book->genre)
+			win->book->genre = g_strdup (genre);
+		if (!win->book->date && date)
+			win->book->date = g_strdup (year);
+		if (win->book->cache_key && !win->book->from_pipeline)
+			audite_cache_store_book (win->book);
 	}
-	gtk_label_set_text (GTK_LABEL (win->stream_properties_label),
-			g_strdup_printf ("%s | %d Hz | %d kbps | %s",
-					ch ? ch : NULL,
-					samplerate ? samplerate : NULL,
-					bitrate ? bitrate/1000 : NULL,
-					codec ? codec : NULL ) );
+	if (win->book && win->book->from_pipeline)
+		window_fill_book (win, media_info, artist, album);
 
-	title = gst_player_media_info_get_title (media_info);
-	if (!title) {
+	/* a book made of several files keeps its own title across tracks */
+	if (win->book && win->book->tracks)
+		title = NULL;
+	else if (!(title = gst_player_media_info_get_title (media_info))) {
 		filename =
 			g_filename_from_uri (gst_player_media_info_get_uri (media_info),
 									NULL, NULL);
 		basename = g_path_get_basename (filename);
 	}
-	else {
-		if (artist)
-			title = g_strdup_printf ("%s - %s", title, artist);
-	}
-	gtk_label_set_text (GTK_LABEL (win->window_title_label), title ? title : basename);
+	else if (artist)
+		title = display_title = g_strdup_printf ("%s - %s", title, artist);
+	if (title || basename)
+		gtk_label_set_text (GTK_LABEL (win->window_title_label), title ? title : basename);
 
+	g_free (display_title);
 	g_free (basename);
 	g_free (filename);
-
-	pixbuf = get_cover_image (media_info);
-	if (pixbuf) {
-		pixbuf = gdk_pixbuf_scale_simple (pixbuf, 300, 300, GDK_INTERP_BILINEAR);
-		gtk_image_set_from_pixbuf (GTK_IMAGE(win->cover_art_image),  pixbuf);
-		g_object_unref (pixbuf);
+	g_free (artist);
+	g_free (album);
+	g_free (genre);
+	if (date)
+		g_date_free (date);
+
+	/* media info is updated several times per stream, decode only once */
+	if (!win->cover_requested) {
+		sample = get_cover_sample (media_info);
+		if (sample) {
+			win->cover_requested = TRUE;
+			/* the thumbnail belongs to the file playing, a track of a folder */
+			audite_cover_load_async (win, gst_player_media_info_get_uri (media_info),
+					sample, COVER_SIZE, win->cover_cancellable, cover_loaded_handler, NULL);
+		}
 	}
-	if (win->audiobook) {
-		update_position_label (GTK_LABEL (win->total_dur_label), gst_player_get_duration (win->player) / GST_SECOND);
-		gtk_widget_show(GTK_BOX (win->status_box));
-		gtk_widget_show(GTK_SCROLLED_WINDOW (win->tree_scroll_win));
-		gtk_widget_show(GTK_PROGRESS_BAR (win->progress));
+	update_book_layout (win);
+}
 
+/* A book the loader left to the pipeline takes its tags and duration from
+ * the media info. Once the stream and its duration are known it goes to
+ * the book cache, with the chapters of the TOC if one has been posted. */
+static void window_fill_book (AuditeAppWindow *win, GstPlayerMediaInfo *media_info,
+				const gchar *artist, const gchar *album) {
+
+	AuditeBookInfo *book = win->book;
+	AuditeChapter *last;
+	GstClockTime duration;
+
+	if (!book->artist)
+		book->artist = g_strdup (artist);
+	if (!book->album)
+		book->album = g_strdup (album);
+	if (!book->title && gst_player_media_info_get_title (media_info)) {
+		book->title = g_strdup (gst_player_media_info_get_title (media_info));
+		audite_mpris_set_book (win->mpris, book->title, book->artist);
 	}
-	else {
-		gtk_widget_hide(GTK_BOX (win->status_box));
-		gtk_widget_hide(GTK_SCROLLED_WINDOW (win->tree_scroll_win));
-		gtk_widget_hide(GTK_PROGRESS_BAR (win->progress));
-		gtk_window_resize (win, 500, 1);
+	if (!book->has_cover && book->cache_key
+			&& gst_player_media_info_get_image_sample (media_info)) {
+		book->has_cover = TRUE;
+		book->cover_key = g_strdup (book->cache_key);
+		window_publish_art (win);
 	}
-	if (genre || date)
+
+	duration = gst_player_media_info_get_duration (media_info);
+	if (!GST_CLOCK_TIME_IS_VALID (book->duration) && GST_CLOCK_TIME_IS_VALID (duration)) {
+		book->duration = duration;
+		/* an open end of ID3 chapters is written as all ones */
+		if (book->chapters) {
+			last = &g_array_index (book->chapters, AuditeChapter, book->chapters->len - 1);
+			last->end = MIN (last->end, duration);
+		}
+		window_start_waveform (win);
+	}
+
+	if (!book->codec || !GST_CLOCK_TIME_IS_VALID (book->duration))
+		return;
+	book->from_pipeline = FALSE;
+	if (book->cache_key)
+		audite_cache_store_book (book);
+}
+
+static void set_genre_and_year (AuditeAppWindow *win, const gchar *genre, const gchar *year) {
+
+	gtk_label_set_text (GTK_LABEL (win->year_value_label), year);
+	gtk_label_set_text (GTK_LABEL (win->genre_value_label), genre);
+	if (genre || year)
 		gtk_widget_show(GTK_BOX (win->genre_box));
 	else
 		gtk_widget_hide(GTK_BOX (win->genre_box));
 }
 
+static void set_stream_properties (AuditeAppWindow *win, gint channels, gint samplerate,
+				gint bitrate, const gchar *codec) {
+
+	gchar *ch = NULL;
+	gchar *prop;
+
+	if (channels) {
+		switch (channels) {
+			case 1: ch = g_strdup_printf ("Mono");	break;
+			case 2: ch = g_strdup_printf ("Stereo"); break;
+			default : ch = g_strdup_printf ("%d channels", channels); break;
+		}
+	}
+	prop = g_strdup_printf ("%s | %d Hz | %d kbps | %s",
+				ch ? ch : "",
+				samplerate,
+				bitrate/1000,
+				codec ? codec : "");
+	gtk_label_set_text (GTK_LABEL (win->stream_properties_label), prop);
+	g_free (prop);
+	g_free (ch);
+}
+
 static void gst_volume_changed_handler(GstPlayer * unused, AuditeAppWindow *win) {
 
   gdouble new_val, cur_val;
 
   cur_val = gtk_scale_button_get_value (GTK_SCALE_BUTTON (win->volume_button));
   new_val = gst_player_get_volume (win->player);
+  audite_mpris_set_volume (win->mpris, new_val);
 
   if (fabs (cur_val - new_val) > 0.001) {
     g_signal_handlers_block_by_func (win->volume_button,
@@ -263,133 +468,833 @@ static void gst_volume_changed_handler(GstPlayer * unused, AuditeAppWindow *win)
 
 static void gst_duration_changed_handler (GstPlayer * unused, GstClockTime duration, AuditeAppWindow *win) {
 
-	if (!(win->audiobook))
+	if (!(win->audiobook)) {
 		seek_bar_set_range (win, 0, duration / GST_SECOND);
+		/* without chapters the whole file is the one track */
+		audite_mpris_set_track (win->mpris, 0, 1, 0, duration, NULL);
+	}
+	win->shown_second = GST_CLOCK_TIME_NONE;
 }
 
-static void gst_position_updated_handler(GstPlayer * unused, GstClockTime position, AuditeAppWindow *win) {
+/* @position is on the book timeline. Everything shown has a resolution of
+ * one second, so nothing is redrawn until that second changes. */
+static void window_update_position (AuditeAppWindow *win, GstClockTime position) {
+
+	if (!GST_CLOCK_TIME_IS_VALID (position))
+		return;
+	audite_mpris_update_position (win->mpris, position);
+	window_track_chapter (win, position);
+	/* the list and the labels are left alone while the window is hidden */
+	if (win->audiobook && win->shown_chapter != win->current_chapter_number - 1)
+		set_curent_chapter (win, position);
+	if (position / GST_SECOND == win->shown_second)
+		return;
+	win->shown_second = position / GST_SECOND;
+	window_check_preroll (win, position);
 
 	if (win->audiobook) {
 		gtk_progress_bar_set_fraction ( (GtkProgressBar *) (win->progress),
-			(gdouble) position / gst_player_get_duration (win->player));
+			(gdouble) position / window_get_duration (win));
 		update_position_label (GTK_LABEL (win->pos_label), position / GST_SECOND);
-
-
-		if ( (position/GST_SECOND >= win->current_chapter_end)
-				|| (position/GST_SECOND < win->current_chapter_start) ) {// if out of range
-			set_curent_chapter(win, position);
-		}
 		update_position_label (GTK_LABEL (win->elapsed_time_label),
-			(position  / GST_SECOND - (gint64) win->current_chapter_start) );
+			GST_CLOCK_DIFF (win->current_chapter_start, position) / GST_SECOND);
 		update_position_label (GTK_LABEL (win->remain_time_label),
-			( (gint64) win->current_chapter_end - (gint64) win->current_chapter_start ) );
+			GST_CLOCK_DIFF (win->current_chapter_start, win->current_chapter_end) / GST_SECOND);
 	}
 	else {
 		update_position_label (GTK_LABEL (win->elapsed_time_label), position / GST_SECOND);
 		update_position_label (GTK_LABEL (win->remain_time_label),
-		GST_CLOCK_DIFF (position, gst_player_get_duration (win->player)) / GST_SECOND);
+		GST_CLOCK_DIFF (position, window_get_duration (win)) / GST_SECOND);
 	}
+	/* the slider belongs to the user while it is dragged */
+	if (win->seek_dragging)
+		return;
 	g_signal_handlers_block_by_func (win->seek_bar,	seek_bar_value_changed_handler, win);
 	gtk_range_set_value (GTK_RANGE (win->seek_bar),
 		(gdouble) position / GST_SECOND);
 	g_signal_handlers_unblock_by_func (win->seek_bar, seek_bar_value_changed_handler, win);
 }
 
+static gboolean window_is_visible (AuditeAppWindow *win) {
+
+	GdkWindow *window = gtk_widget_get_window (GTK_WIDGET (win));
+	GtkApplication *app = gtk_window_get_application (GTK_WINDOW (win));
+	gboolean locked = FALSE;
+
+	if (!window || !gtk_widget_get_mapped (GTK_WIDGET (win)))
+		return FALSE;
+	if (gdk_window_get_state (window) & (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN))
+		return FALSE;
+	if (app)
+		g_object_get (app, "screensaver-active", &locked, NULL);
+	return !locked;
+}
+
+static gboolean position_tick_handler (gpointer data) {
+
+	AuditeAppWindow *win = data;
+	GstClockTime position;
+
+	if (window_is_visible (win)) {
+		window_update_position (win, window_get_position (win));
+		/* a crash loses at most this much, settings are not written per chapter */
+		if (g_get_monotonic_time () - win->saved_time >= VISIBLE_SAVE_INTERVAL)
+			save_position (win);
+	}
+	else {
+		/* woken at the end of a chapter too, see window_schedule_tick */
+		position = window_get_position (win);
+		window_track_chapter (win, position);
+		window_check_preroll (win, position);
+		if (g_get_monotonic_time () - win->saved_time >= G_USEC_PER_SEC
+				* (win->low_power ? LOW_POWER_SAVE_INTERVAL : HIDDEN_SAVE_INTERVAL) - TICK_SLACK_MS * 1000)
+			save_position (win);
+	}
+	window_schedule_tick (win);
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean tick_source_dispatch (GSource *source, GSourceFunc callback, gpointer data) {
+
+	g_source_set_ready_time (source, -1);
+	return callback (data);
+}
+
+/* One source for the life of the window, re-armed by ready time, so a
+ * tick costs no allocation. */
+static GSourceFuncs tick_source_funcs = {
+	NULL, NULL, tick_source_dispatch, NULL
+};
+
+/* While visible the next tick lands just after the displayed second
+ * changes, so there is one wakeup per second of media at any rate. A
+ * hidden window only wakes to keep the saved position fresh, at the end
+ * of the chapter so MPRIS moves on to the next one, and in time to
+ * preroll the next book of the queue. */
+static void window_schedule_tick (AuditeAppWindow *win) {
+
+	GstClockTime position, duration;
+	gdouble rate;
+	guint delay = 1000;
+	gint64 hidden_delay;
+
+	if (!win->tick_source)
+		return;
+	if (!win->playing) {
+		g_source_set_ready_time (win->tick_source, -1);
+		return;
+	}
+
+	position = window_get_position (win);
+	rate = gst_player_get_rate (win->player);
+	if (!window_is_visible (win)) {
+		hidden_delay = G_USEC_PER_SEC
+				* (win->low_power ? LOW_POWER_SAVE_INTERVAL : HIDDEN_SAVE_INTERVAL);
+		if (win->audiobook && GST_CLOCK_TIME_IS_VALID (position) && rate > 0
+				&& win->current_chapter_end > position)
+			hidden_delay = MIN (hidden_delay, (gint64) ((win->current_chapter_end - position)
+					/ rate / GST_USECOND) + TICK_SLACK_MS * 1000);
+		duration = window_get_duration (win);
+		if (!win->standby_tried && GST_CLOCK_TIME_IS_VALID (position)
+				&& GST_CLOCK_TIME_IS_VALID (duration) && rate > 0)
+			hidden_delay = MIN (hidden_delay, position + QUEUE_PREROLL_AHEAD >= duration ? 0 :
+					(gint64) ((duration - QUEUE_PREROLL_AHEAD - position) / rate / GST_USECOND));
+		g_source_set_ready_time (win->tick_source, g_get_monotonic_time () + hidden_delay);
+		return;
+	}
+	if (GST_CLOCK_TIME_IS_VALID (position) && rate > 0)
+		delay = (GST_SECOND - position % GST_SECOND) / rate / GST_MSECOND;
+	g_source_set_ready_time (win->tick_source,
+			g_get_monotonic_time () + (gint64) (delay + TICK_SLACK_MS) * 1000);
+}
+
+/* Coming back into view catches up at once instead of on the next tick. */
+static void window_visibility_changed (AuditeAppWindow *win) {
+
+	if (window_is_visible (win)) {
+		win->shown_second = GST_CLOCK_TIME_NONE;
+		window_update_position (win, window_get_position (win));
+	}
+	else if (win->playing)
+		save_position (win);
+	window_schedule_tick (win);
+}
+
+static gboolean window_state_event_handler (GtkWidget *widget, GdkEventWindowState *event,
+				gpointer data) {
+
+	if (event->changed_mask & (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN))
+		window_visibility_changed (AUDITE_APP_WINDOW (widget));
+	return FALSE;
+}
+
 static void gst_state_changed_handler (GstPlayer * unused, GstPlayerState state, AuditeAppWindow *win) {
 
 	gint rc = strcmp(gst_player_state_get_name (state), "playing");
 	if (rc == 0) {
+		if (audite_profile_mark_once ("first-playing"))
+			audite_profile_write ();
 		win->playing = TRUE;
 		gtk_button_set_image (GTK_BUTTON (win->play_button), win->pause_image);
+		window_schedule_tick (win);
 	}
 	else {
 		win->playing = FALSE;
 		gtk_button_set_image (GTK_BUTTON (win->play_button), win->play_image);
+		window_schedule_tick (win);
+		if (state == GST_PLAYER_STATE_PAUSED) {
+			/* the stream of a load has prerolled */
+			if (GST_CLOCK_TIME_IS_VALID (win->restore_position))
+				present_restored (win);
+			else
+				save_position (win);
+		}
 	}
+	audite_mpris_set_playing (win->mpris, win->playing, window_get_position (win),
+			gst_player_get_rate (win->player));
 }
 
 static void gst_media_eos_handler (GstPlayer * unused, AuditeAppWindow *win) {
 
-	gst_player_seek (win->player, gst_util_uint64_scale ( (gdouble) 0, GST_SECOND, 1) );
+	if (window_play_next (win))
+		return;
+	window_seek (win, 0);
 	gst_player_pause (win->player);
 	gtk_button_set_image (GTK_BUTTON (win->play_button), win->play_image);
 }
 
 static inline void seekbar_add_delta (AuditeAppWindow *win, gint delta_sec) {
 
-  gdouble value = gtk_range_get_value (GTK_RANGE (win->seek_bar));
-  gtk_range_set_value (GTK_RANGE (win->seek_bar), value + delta_sec);
-}
-
-static void mp4v2_get_chapters (AuditeAppWindow *win) {
-
-    gchar *f = g_filename_from_uri (win->current_uri, NULL, NULL);
-    gchar *dur_hh_mm_ss;
-    gint index = 0, chapterCount = 0;
-    guint64 dur = 0, startpos = 0, endpos = 0;
-    GtkTreeIter iter;
-    GError *error = NULL;
-
-    MP4FileHandle file = MP4Read( f );
-    if( file == MP4_INVALID_FILE_HANDLE ) {
-        printf( "MP4Read failed\n" );
-        return;
-    }
-    MP4Chapter_t *chapterList;
-    MP4ChapterType chapters = MP4GetChapters( file, &chapterList, &chapterCount, MP4ChapterTypeQt );
-    if (chapterCount == 0) {
-		MP4Close( file, 0 );
-		printf( "Chapters not found\n" );
-		return;
-    }
-    win->audiobook = TRUE;
-    win->amount_of_chapters = chapterCount;
-    win->current_chapter_number = 0;
-	/* fill chapter list */
-    for(index; index < chapterCount; index++) {
-
-	dur = chapterList[index].duration;
-	dur_hh_mm_ss = seconds_to_hhmmss (dur/1000);
-	endpos = endpos + dur;
-
-	gtk_list_store_append(GTK_LIST_STORE( win->chapter_list_store ), &iter);
-	gtk_list_store_set(GTK_LIST_STORE(win->chapter_list_store), &iter, 
-			ICON, (index == 0) ? "►" : NULL,  //set icon to first row only
-			NUMBER,   (index+1),
-			NAME,      chapterList[index].title,
-			DURATION,  dur_hh_mm_ss,
-			START,    (startpos == 0) ? 0 : startpos/MP4V2_SECOND,
-			END,      (endpos/MP4V2_SECOND),
-			-1 );
-	startpos = endpos;
-	if (index == 0)
-	        win->current_chapter_end = endpos/MP4V2_SECOND;
-    }
-    set_curent_chapter (win, GST_SECOND);
-    MP4Close( file, 0 );
-    g_free(f);
-    g_free(dur_hh_mm_ss);
-    if (error != NULL)
-	    g_error_free (error);
+	GstClockTime position, duration;
+	gint64 target;
+
+	/* build on a seek still under way, so repeated clicks add up */
+	position = audite_seeker_get_target (win->seeker);
+	if (!GST_CLOCK_TIME_IS_VALID (position))
+		position = window_get_position (win);
+	if (!GST_CLOCK_TIME_IS_VALID (position))
+		return;
+
+	target = (gint64) position + (gint64) delta_sec * GST_SECOND;
+	duration = window_get_duration (win);
+	if (GST_CLOCK_TIME_IS_VALID (duration) && target > (gint64) duration)
+		target = duration;
+	window_seek (win, MAX (target, 0));
+}
+
+static void update_book_layout (AuditeAppWindow *win) {
+
+	GstClockTime duration;
+
+	if (win->audiobook) {
+		duration = window_get_duration (win);
+		if (!GST_CLOCK_TIME_IS_VALID (duration) && win->book)
+			duration = win->book->duration;
+		update_position_label (GTK_LABEL (win->total_dur_label), duration / GST_SECOND);
+		gtk_widget_show(GTK_BOX (win->status_box));
+		gtk_widget_show(GTK_SCROLLED_WINDOW (win->tree_scroll_win));
+		gtk_widget_show(GTK_PROGRESS_BAR (win->progress));
+
+	}
+	else {
+		gtk_widget_hide(GTK_BOX (win->status_box));
+		gtk_widget_hide(GTK_SCROLLED_WINDOW (win->tree_scroll_win));
+		gtk_widget_hide(GTK_PROGRESS_BAR (win->progress));
+		gtk_window_resize (win, 500, 1);
+	}
+}
+
+/* The rows of another book come in a new model, which the view takes in
+ * one go; only a batch growing the shown array adds rows one by one. */
+static void window_set_chapter_rows (AuditeAppWindow *win, GArray *chapters, guint n_rows) {
+
+	if (audite_chapter_model_add_rows (win->chapter_model, chapters, n_rows))
+		return;
+	g_object_unref (win->chapter_model);
+	win->chapter_model = audite_chapter_model_new (chapters, n_rows);
+	if (win->current_chapter_number > 0)
+		audite_chapter_model_set_current (win->chapter_model, win->current_chapter_number - 1);
+	gtk_tree_view_set_model (GTK_TREE_VIEW (win->chapters_tree_view),
+			GTK_TREE_MODEL (win->chapter_model));
+}
+
+static void chapters_batch_handler (GArray *chapters, guint first,
+				guint n_chapters, gpointer user_data) {
+
+	AuditeAppWindow *win = user_data;
+
+	/* the model reads the array itself, nothing is copied per row */
+	window_set_chapter_rows (win, chapters, first + n_chapters);
 }
 
+static void window_show_chapters (AuditeAppWindow *win) {
+
+	AuditeBookInfo *info = win->book;
+	GstClockTime position;
+
+	if (!info->chapters)
+		return;
+	win->audiobook = TRUE;
+	win->amount_of_chapters = info->chapters->len;
+	win->current_chapter_number = 0;
+	position = GST_CLOCK_TIME_IS_VALID (win->restore_position) ?
+			win->restore_position : window_get_position (win);
+	if (!GST_CLOCK_TIME_IS_VALID (position))
+		position = 0;
+	set_curent_chapter (win, position);
+	/* tracks change gaplessly anyway, segments only work inside one file */
+	if (!info->tracks) {
+		audite_segment_set_chapters (win->segment, info->chapters);
+		if (gapless_chapters_enabled (win))
+			audite_segment_play_chapters (win->segment, position);
+	}
+}
+
+/* A book the loader found no chapters in takes them from the TOC of the
+ * playing pipeline, which the demuxer has parsed anyway. They go to the
+ * book cache, so the next open has them at once. */
+static gboolean window_apply_toc (AuditeAppWindow *win) {
+
+	GArray *chapters;
+	GstClockTime duration;
+	GstToc *toc = NULL;
+
+	if (!win->book || win->book->chapters || win->book->tracks)
+		return FALSE;
+	/* the pipeline may still hold the TOC of the book before */
+	g_mutex_lock (&win->toc->lock);
+	if (win->toc->toc && g_strcmp0 (win->toc->uri, win->current_uri) == 0)
+		toc = gst_toc_ref (win->toc->toc);
+	g_mutex_unlock (&win->toc->lock);
+	if (!toc)
+		return FALSE;
+	duration = GST_CLOCK_TIME_IS_VALID (win->book->duration) ?
+			win->book->duration : gst_player_get_duration (win->player);
+	chapters = audite_chapters_from_toc (toc, duration);
+	gst_toc_unref (toc);
+	if (!chapters)
+		return FALSE;
+	win->book->chapters = chapters;
+	window_set_chapter_rows (win, chapters, chapters->len);
+	/* a book still being filled in is stored by window_fill_book */
+	if (win->book->cache_key && !win->book->from_pipeline)
+		audite_cache_store_book (win->book);
+	return TRUE;
+}
+
+static void deck_toc_clear (gpointer data) {
+
+	DeckToc *toc = data;
+
+	g_mutex_clear (&toc->lock);
+	g_free (toc->uri);
+	if (toc->toc)
+		gst_toc_unref (toc->toc);
+}
+
+static void window_toc_free (gpointer user_data) {
+
+	WindowToc *data = user_data;
+
+	g_object_unref (data->win);
+	g_atomic_rc_box_release_full (data->toc, deck_toc_clear);
+	g_slice_free (WindowToc, data);
+}
+
+static gboolean window_toc_dispatch (gpointer user_data) {
+
+	WindowToc *data = user_data;
+	AuditeAppWindow *win = data->win;
+
+	/* a standby deck keeps its TOC until window_attach */
+	if (data->toc != win->toc)
+		return G_SOURCE_REMOVE;
+
+	/* before the book is loaded book_loaded_handler takes it */
+	if (window_apply_toc (win)) {
+		window_show_chapters (win);
+		update_book_layout (win);
+		window_start_loudness (win);
+	}
+	return G_SOURCE_REMOVE;
+}
+
+/* Called on the thread of the player for every TOC a demuxer posts,
+ * whether or not the deck is attached. */
+static void bus_toc_handler (GstBus *bus, GstMessage *message, DeckToc *deck_toc) {
+
+	WindowToc *data;
+	GstObject *pipeline, *parent;
+	GstToc *toc;
+	gboolean updated;
+	gchar *uri = NULL;
+
+	if (!GST_MESSAGE_SRC (message))
+		return;
+	gst_message_parse_toc (message, &toc, &updated);
+	pipeline = gst_object_ref (GST_MESSAGE_SRC (message));
+	while ((parent = gst_object_get_parent (pipeline))) {
+		gst_object_unref (pipeline);
+		pipeline = parent;
+	}
+	g_object_get (pipeline, "current-uri", &uri, NULL);
+	gst_object_unref (pipeline);
+
+	g_mutex_lock (&deck_toc->lock);
+	g_free (deck_toc->uri);
+	deck_toc->uri = uri;
+	if (deck_toc->toc)
+		gst_toc_unref (deck_toc->toc);
+	deck_toc->toc = toc;
+	g_mutex_unlock (&deck_toc->lock);
+
+	data = g_slice_new0 (WindowToc);
+	data->win = g_object_ref (deck_toc->win);
+	data->toc = g_atomic_rc_box_acquire (deck_toc);
+	g_main_context_invoke_full (NULL, G_PRIORITY_DEFAULT,
+			window_toc_dispatch, data, window_toc_free);
+}
+
+static void book_loaded_handler (GObject *source, GAsyncResult *res, gpointer user_data) {
+
+	AuditeAppWindow *win = AUDITE_APP_WINDOW (source);
+	AuditeBookInfo *info;
+	GstPlayerMediaInfo *media_info;
+	GstClockTime position;
+	GError *error = NULL;
+	gchar *title;
+
+	info = audite_loader_open_finish (res, &error);
+	if (!info && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		/* window_load ended the span of the load it superseded */
+		g_error_free (error);
+		return;
+	}
+	audite_profile_end_async ("audite_app_window_open", win->load_id);
+	g_clear_object (&win->load_cancellable);
+	if (!info) {
+		g_print ("Loading failed: %s\n", error->message);
+		g_error_free (error);
+		return;
+	}
+	g_clear_pointer (&win->book, audite_book_info_free);
+	win->book = info;
+	g_atomic_pointer_set (&win->stream_caps, audite_probe_container_caps (info->container));
+
+	if (info->codec) {
+		set_stream_properties (win, info->channels, info->sample_rate, info->bitrate, info->codec);
+		set_genre_and_year (win, info->genre, info->date);
+	}
+	else {
+		/* the pipeline may have prerolled while the container was parsed */
+		media_info = gst_player_get_media_info (win->player);
+		if (media_info) {
+			gst_media_info_updated_handler (win->player, media_info, win);
+			g_object_unref (media_info);
+		}
+	}
+
+	if (info->title) {
+		title = info->artist ? g_strdup_printf ("%s - %s", info->title, info->artist)
+				     : g_strdup (info->title);
+		gtk_label_set_text (GTK_LABEL (win->window_title_label), title);
+		g_free (title);
+	}
+	audite_mpris_set_book (win->mpris, info->title, info->artist);
+	window_publish_art (win);
+
+	if (info->tracks) {
+		/* nothing is playing yet, window_load left that to us */
+		audite_playlist_set_tracks (win->playlist, info->chapters, info->tracks);
+		position = GST_CLOCK_TIME_IS_VALID (win->restore_position) ? win->restore_position : 0;
+		audite_playlist_seek (win->playlist, position, NULL);
+		window_set_playing (win, win->load_play);
+	}
+
+	window_apply_toc (win);
+	window_show_chapters (win);
+	/* playing, the track never pauses for present_restored; it started
+	 * at the position anyway */
+	if (info->tracks && win->load_play)
+		win->restore_position = GST_CLOCK_TIME_NONE;
+	update_book_layout (win);
+	/* unless window_fill_book has, with the duration of the pipeline */
+	if (!win->waveform_cancellable)
+		window_start_waveform (win);
+	window_start_loudness (win);
+	audite_queue_prefetch_next (win->queue);
+}
+
+static gboolean gapless_chapters_enabled (AuditeAppWindow *win) {
+
+	GVariant *state;
+	gboolean enabled;
+
+	state = g_action_get_state (g_action_map_lookup_action (G_ACTION_MAP (win), "gapless-chapters"));
+	enabled = g_variant_get_boolean (state);
+	g_variant_unref (state);
+	return enabled;
+}
+
+static void gapless_chapters_change_state (GSimpleAction *action, GVariant *state, gpointer data) {
+
+	AuditeAppWindow *win = data;
+	GstClockTime position = gst_player_get_position (win->player);
+
+	if (g_variant_get_boolean (state))
+		audite_segment_play_chapters (win->segment, position);
+	else if (audite_segment_get_mode (win->segment) == AUDITE_SEGMENT_MODE_CHAPTERS)
+		audite_segment_stop (win->segment, position);
+	g_simple_action_set_state (action, state);
+}
+
+static void loop_start_activated (GSimpleAction *action, GVariant *parameter, gpointer data) {
+
+	AuditeAppWindow *win = data;
+
+	win->loop_start = gst_player_get_position (win->player);
+}
+
+static void loop_end_activated (GSimpleAction *action, GVariant *parameter, gpointer data) {
+
+	AuditeAppWindow *win = data;
+	GstClockTime loop_end = gst_player_get_position (win->player);
+
+	if (!GST_CLOCK_TIME_IS_VALID (win->loop_start) || !GST_CLOCK_TIME_IS_VALID (loop_end)
+			|| loop_end <= win->loop_start)
+		return;
+	audite_segment_play_loop (win->segment, win->loop_start, loop_end);
+}
+
+static void loop_clear_activated (GSimpleAction *action, GVariant *parameter, gpointer data) {
+
+	AuditeAppWindow *win = data;
+	GstClockTime position = gst_player_get_position (win->player);
+
+	win->loop_start = GST_CLOCK_TIME_NONE;
+	if (audite_segment_get_mode (win->segment) != AUDITE_SEGMENT_MODE_LOOP)
+		return;
+	if (gapless_chapters_enabled (win))
+		audite_segment_play_chapters (win->segment, position);
+	else
+		audite_segment_stop (win->segment, position);
+}
+
+static void normalize_chapters_changed_handler (GSettings *settings, gchar *key, AuditeAppWindow *win) {
+
+	window_start_loudness (win);
+}
+
+/* Sizes the buffer playbin keeps ahead of a network stream. In memory it
+ * is the queue of the source; on disk the stream is downloaded into a
+ * temporary file, which also keeps seeks back within the book from going
+ * out to the server again. Applies from the next book that is opened. */
+static void window_configure_buffer (AuditeAppWindow *win, GstElement *pipeline) {
+
+	guint64 size = (guint64) g_settings_get_uint (win->settings, "stream-buffer-size") << 20;
+	gchar *mode = g_settings_get_string (win->settings, "stream-buffer");
+	guint flags;
+
+	g_object_get (pipeline, "flags", &flags, NULL);
+	if (g_strcmp0 (mode, "disk") == 0) {
+		flags |= PLAY_FLAG_DOWNLOAD;
+		/* zero keeps the whole file */
+		g_object_set (pipeline, "flags", flags,
+				"ring-buffer-max-size", size, NULL);
+	}
+	else {
+		flags &= ~PLAY_FLAG_DOWNLOAD;
+		g_object_set (pipeline, "flags", flags,
+				"buffer-size", size ? (gint) MIN (size, G_MAXINT) : -1, NULL);
+	}
+	g_free (mode);
+}
+
+static void stream_buffer_changed_handler (GSettings *settings, gchar *key, AuditeAppWindow *win) {
+
+	window_configure_buffer (win, win->pipeline);
+}
+
+/* The sink only takes its buffer sizes when it starts, so switching the
+ * profile reopens the book where it is, much like a seek. */
+static void low_power_changed_handler (GSettings *settings, gchar *key, AuditeAppWindow *win) {
+
+	GstClockTime position;
+	gboolean loading, play;
+	gchar *uri;
+
+	g_atomic_int_set (&win->low_power, g_settings_get_boolean (settings, "low-power"));
+	window_schedule_tick (win);
+	if (!win->current_uri || !win->player)
+		return;
+
+	/* a load still waiting for its stream has not got there yet */
+	loading = GST_CLOCK_TIME_IS_VALID (win->restore_position);
+	position = loading ? win->restore_position : window_get_position (win);
+	if (!GST_CLOCK_TIME_IS_VALID (position))
+		position = 0;
+	play = win->playing || (loading && win->load_play);
+	uri = g_strdup (win->current_uri);
+	window_load (win, uri, position, play);
+	g_free (uri);
+}
+
+static void export_progress_handler (guint index, gdouble fraction, gpointer user_data) {
+
+	AuditeAppWindow *win = user_data;
+	gchar *text;
+
+	if (!win->export_bar || index >= win->export_chapters)
+		return;
+	/* a running sum, books can have thousands of chapters */
+	win->export_total += fraction - win->export_fractions[index];
+	if (fraction >= 1.0 && win->export_fractions[index] < 1.0)
+		win->export_done++;
+	win->export_fractions[index] = fraction;
+
+	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (win->export_bar),
+			win->export_total / win->export_chapters);
+	text = g_strdup_printf ("%u of %u chapters", win->export_done, win->export_chapters);
+	gtk_progress_bar_set_text (GTK_PROGRESS_BAR (win->export_bar), text);
+	g_free (text);
+}
+
+static void export_finished_handler (GObject *source, GAsyncResult *res, gpointer user_data) {
+
+	AuditeAppWindow *win = AUDITE_APP_WINDOW (source);
+	GtkWidget *dialog;
+	GError *error = NULL;
+
+	if (!audite_export_chapters_finish (res, &error)
+	    && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		g_error_free (error);
+		return;
+	}
+	/* a cancelled export may finish after the next one has started,
+	 * any other one is the export the progress dialog shows */
+	if (error) {
+		g_print ("Export failed: %s\n", error->message);
+		dialog = gtk_message_dialog_new (GTK_WINDOW (win),
+				GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+				"Exporting chapters failed");
+		gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (dialog),
+				"%s", error->message);
+		g_error_free (error);
+	} else
+		dialog = gtk_message_dialog_new (GTK_WINDOW (win),
+				GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_INFO, GTK_BUTTONS_CLOSE,
+				"Exported %u chapters", win->export_chapters);
+	window_clear_export (win);
+	g_signal_connect (dialog, "response", G_CALLBACK (gtk_widget_destroy), NULL);
+	gtk_widget_show (dialog);
+}
+
+static void export_dialog_response_handler (GtkDialog *dialog, gint response, AuditeAppWindow *win) {
+
+	window_clear_export (win);
+}
+
+/* Asks for a folder and writes a file per chapter into it, showing the
+ * progress until all are written or the export is cancelled. */
+static void export_chapters_activated (GSimpleAction *action, GVariant *parameter, gpointer data) {
+
+	AuditeAppWindow *win = data;
+	GtkWidget *chooser, *area;
+	GFile *folder = NULL;
+
+	if (win->export_dialog) {
+		gtk_window_present (GTK_WINDOW (win->export_dialog));
+		return;
+	}
+	if (!win->book || !win->book->chapters || win->book->chapters->len == 0)
+		return;
+
+	chooser = gtk_file_chooser_dialog_new ("Export Chapters", GTK_WINDOW (win),
+			GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
+			"_Cancel", GTK_RESPONSE_CANCEL,
+			"_Export", GTK_RESPONSE_ACCEPT,
+			NULL);
+	gtk_file_chooser_set_create_folders (GTK_FILE_CHOOSER (chooser), TRUE);
+	if (gtk_dialog_run (GTK_DIALOG (chooser)) == GTK_RESPONSE_ACCEPT)
+		folder = gtk_file_chooser_get_file (GTK_FILE_CHOOSER (chooser));
+	gtk_widget_destroy (chooser);
+	if (!folder)
+		return;
+
+	win->export_chapters = win->book->chapters->len;
+	win->export_fractions = g_new0 (gdouble, win->export_chapters);
+	win->export_done = 0;
+	win->export_total = 0;
+	win->export_dialog = gtk_message_dialog_new (GTK_WINDOW (win),
+			GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_OTHER, GTK_BUTTONS_CANCEL,
+			"Exporting chapters");
+	area = gtk_message_dialog_get_message_area (GTK_MESSAGE_DIALOG (win->export_dialog));
+	win->export_bar = gtk_progress_bar_new ();
+	gtk_progress_bar_set_show_text (GTK_PROGRESS_BAR (win->export_bar), TRUE);
+	gtk_container_add (GTK_CONTAINER (area), win->export_bar);
+	g_signal_connect (win->export_dialog, "response",
+			G_CALLBACK (export_dialog_response_handler), win);
+	gtk_widget_show_all (win->export_dialog);
+	export_progress_handler (0, 0.0, win);
+
+	win->export_cancellable = g_cancellable_new ();
+	audite_export_chapters_async (win, win->book, folder, win->export_cancellable,
+			export_progress_handler, win, export_finished_handler, NULL);
+	g_object_unref (folder);
+}
+
+static AuditeSearch *window_get_search (AuditeAppWindow *win) {
+
+	GtkApplication *app = gtk_window_get_application (GTK_WINDOW (win));
+
+	return app ? audite_app_get_search (AUDITE_APP (app)) : NULL;
+}
+
+/* The entry already waits for a pause in typing before it asks. */
+static void search_changed_handler (GtkSearchEntry *entry, AuditeAppWindow *win) {
+
+	AuditeSearch *search = window_get_search (win);
+	const gchar *text = gtk_entry_get_text (GTK_ENTRY (entry));
+	AuditeSearchResult *result;
+	GtkWidget *label;
+	gchar *markup;
+	guint i;
+
+	gtk_container_foreach (GTK_CONTAINER (win->search_list), (GtkCallback) gtk_widget_destroy, NULL);
+	g_clear_pointer (&win->search_results, g_ptr_array_unref);
+	if (!search || !*text)
+		return;
+
+	win->search_results = audite_search_query (search, text, SEARCH_RESULT_LIMIT);
+	for (i = 0; i < win->search_results->len; i++) {
+		result = g_ptr_array_index (win->search_results, i);
+		markup = g_markup_printf_escaped ("<b>%s</b>\n<small>%s</small>", result->title,
+				result->detail ? result->detail : "");
+		label = gtk_label_new (NULL);
+		gtk_label_set_markup (GTK_LABEL (label), markup);
+		gtk_label_set_xalign (GTK_LABEL (label), 0.0);
+		gtk_label_set_ellipsize (GTK_LABEL (label), PANGO_ELLIPSIZE_END);
+		gtk_widget_show (label);
+		gtk_list_box_insert (GTK_LIST_BOX (win->search_list), label, -1);
+		g_free (markup);
+	}
+}
+
+/* Jumps to the chapter found, as activating it in the chapter list does,
+ * opening its book first when another one is playing. */
+static void search_row_activated_handler (GtkListBox *list, GtkListBoxRow *row, AuditeAppWindow *win) {
+
+	AuditeSearchResult *result;
+	gchar *uris[2] = { NULL, NULL };
+
+	result = g_ptr_array_index (win->search_results, gtk_list_box_row_get_index (row));
+	gtk_popover_popdown (gtk_menu_button_get_popover (GTK_MENU_BUTTON (win->search_button)));
+
+	if (g_strcmp0 (result->uri, win->current_uri) == 0 && win->book) {
+		if (result->chapter < 0 || !win->book->chapters)
+			return;
+		window_seek (win, result->start);
+		set_curent_chapter (win, result->start);
+		gst_player_play (win->player);
+		return;
+	}
+	uris[0] = result->uri;
+	audite_queue_set_uris (win->queue, uris);
+	/* played from the chapter once the book has prerolled */
+	window_load (win, result->uri, result->start, TRUE);
+}
+
+static void search_entry_activate_handler (GtkEntry *entry, AuditeAppWindow *win) {
+
+	GtkListBoxRow *row = gtk_list_box_get_row_at_index (GTK_LIST_BOX (win->search_list), 0);
+
+	if (row)
+		search_row_activated_handler (GTK_LIST_BOX (win->search_list), row, win);
+}
+
+static void window_build_search (AuditeAppWindow *win) {
+
+	GtkWidget *popover, *box, *scroll;
+
+	popover = gtk_popover_new (win->search_button);
+	box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 6);
+	gtk_container_set_border_width (GTK_CONTAINER (box), 6);
+	win->search_entry = gtk_search_entry_new ();
+	gtk_container_add (GTK_CONTAINER (box), win->search_entry);
+	scroll = gtk_scrolled_window_new (NULL, NULL);
+	gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scroll),
+			GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+	gtk_scrolled_window_set_min_content_width (GTK_SCROLLED_WINDOW (scroll), 360);
+	gtk_scrolled_window_set_min_content_height (GTK_SCROLLED_WINDOW (scroll), 320);
+	win->search_list = gtk_list_box_new ();
+	gtk_container_add (GTK_CONTAINER (scroll), win->search_list);
+	gtk_container_add (GTK_CONTAINER (box), scroll);
+	gtk_container_add (GTK_CONTAINER (popover), box);
+	gtk_widget_show_all (box);
+	gtk_menu_button_set_popover (GTK_MENU_BUTTON (win->search_button), popover);
+
+	g_signal_connect (win->search_entry, "search-changed",
+			G_CALLBACK (search_changed_handler), win);
+	g_signal_connect (win->search_entry, "activate",
+			G_CALLBACK (search_entry_activate_handler), win);
+	g_signal_connect (win->search_list, "row-activated",
+			G_CALLBACK (search_row_activated_handler), win);
+}
+
+static GActionEntry win_entries[] =
+{
+  { "gapless-chapters", NULL, NULL, "false", gapless_chapters_change_state },
+  { "loop-start", loop_start_activated, NULL, NULL, NULL },
+  { "loop-end", loop_end_activated, NULL, NULL, NULL },
+  { "loop-clear", loop_clear_activated, NULL, NULL, NULL },
+  { "export-chapters", export_chapters_activated, NULL, NULL, NULL }
+};
+
 static void audite_app_window_init (AuditeAppWindow *win) {
 
   GtkBuilder *builder;
   GMenuModel *menu;
-  GAction *action;
+  GAction    *action;
  
+  audite_profile_begin ("window.ui template");
   gtk_widget_init_template (GTK_WIDGET (win));
+  audite_profile_end ("window.ui template");
+  win->chapter_model = audite_chapter_model_new (NULL, 0);
+  gtk_tree_view_set_model (GTK_TREE_VIEW (win->chapters_tree_view),
+			GTK_TREE_MODEL (win->chapter_model));
   win->settings = g_settings_new ("com.github.alkesta.audite");
+  win->loop_start = GST_CLOCK_TIME_NONE;
+  win->restore_position = GST_CLOCK_TIME_NONE;
+  win->shown_second = GST_CLOCK_TIME_NONE;
+  win->shown_chapter = -1;
+  win->cursor_path = gtk_tree_path_new_first ();
+  g_signal_connect (win->seek_bar, "draw", G_CALLBACK (waveform_draw_handler), win);
+  g_signal_connect (win->progress, "draw", G_CALLBACK (waveform_draw_handler), win);
+
+  win->tick_source = g_source_new (&tick_source_funcs, sizeof (GSource));
+  g_source_set_callback (win->tick_source, position_tick_handler, win, NULL);
+  g_source_attach (win->tick_source, NULL);
+
+  g_action_map_add_action_entries (G_ACTION_MAP (win),
+                                   win_entries, G_N_ELEMENTS (win_entries),
+                                   win);
+  action = g_settings_create_action (win->settings, "normalize-chapters");
+  g_action_map_add_action (G_ACTION_MAP (win), action);
+  g_object_unref (action);
+  g_signal_connect (win->settings, "changed::normalize-chapters",
+			G_CALLBACK (normalize_chapters_changed_handler), win);
+  action = g_settings_create_action (win->settings, "low-power");
+  g_action_map_add_action (G_ACTION_MAP (win), action);
+  g_object_unref (action);
+  win->low_power = g_settings_get_boolean (win->settings, "low-power");
+  g_signal_connect (win->settings, "changed::low-power",
+			G_CALLBACK (low_power_changed_handler), win);
 
   builder = gtk_builder_new_from_resource ("/com/github/alkesta/audite/gears-menu.ui");
   menu = G_MENU_MODEL (gtk_builder_get_object (builder, "menu"));
   gtk_menu_button_set_menu_model (GTK_MENU_BUTTON (win->gears), menu);
   g_object_unref (builder);
-
-  action = g_settings_create_action (win->settings, "show-words");
-  g_action_map_add_action (G_ACTION_MAP (win), action);
-  g_object_unref (action);
+  window_build_search (win);
 
 //  action = (GAction*) g_property_action_new.........
 
@@ -397,57 +1302,227 @@ static void audite_app_window_init (AuditeAppWindow *win) {
   gtk_application_window_set_show_menubar (GTK_APPLICATION_WINDOW (win), TRUE);
 }
 
+/* Called on a streaming thread while playbin builds the decoding chain.
+ * When the loader has already probed the container, typefind is told the
+ * answer instead of reading the head of the file once more. The first
+ * open of a file usually races the probe; the tracks of a folder and
+ * books read from the cache are known in time. */
+static void playbin_element_setup_handler (GstElement *playbin, GstElement *element, AuditeAppWindow *win) {
+
+	GstElementFactory *factory = gst_element_get_factory (element);
+	const gchar *caps_string;
+	GstCaps *caps;
+
+	if (!factory || g_strcmp0 (GST_OBJECT_NAME (factory), "typefind") != 0)
+		return;
+	caps_string = g_atomic_pointer_get (&win->stream_caps);
+	if (!caps_string)
+		return;
+	caps = gst_caps_from_string (caps_string);
+	g_object_set (element, "force-caps", caps, NULL);
+	gst_caps_unref (caps);
+}
+
+/* Called on a streaming thread for every element of a deck's pipeline.
+ * In the low power profile spoken word plays from large buffers: the
+ * audio sink wakes a few times a second instead of every few
+ * milliseconds, and sources that push read in large sequential blocks. */
+static void deck_element_setup_handler (GstElement *playbin, GstElement *element, AuditeAppWindow *win) {
+
+	if (!g_atomic_int_get (&win->low_power))
+		return;
+	if (GST_IS_AUDIO_BASE_SINK (element))
+		g_object_set (element, "buffer-time", (gint64) LOW_POWER_BUFFER_TIME,
+				"latency-time", (gint64) LOW_POWER_LATENCY_TIME, NULL);
+	else if (GST_IS_BASE_SRC (element))
+		g_object_set (element, "blocksize", (guint) LOW_POWER_BLOCKSIZE, NULL);
+}
+
+/* Builds a player the way the window drives it. Nothing is connected to
+ * the window yet, so a standby deck prerolls without touching the UI. */
+static WindowDeck *window_deck_new (AuditeAppWindow *win) {
+
+	WindowDeck *deck = g_slice_new0 (WindowDeck);
+	GstStructure *config;
+	GstBus *bus;
+
+	deck->player = gst_player_new (NULL,
+			gst_player_g_main_context_signal_dispatcher_new (NULL));
+	deck->pipeline = gst_player_get_pipeline (deck->player);
+	deck->segment = audite_segment_new (deck->player);
+	deck->playlist = audite_playlist_new (deck->player);
+	deck->gain = audite_gain_new (deck->player, deck->playlist);
+	deck->seeker = audite_seeker_new (deck->player, window_seek_func, win);
+	window_configure_buffer (win, deck->pipeline);
+	g_signal_connect (deck->pipeline, "element-setup",
+			G_CALLBACK (deck_element_setup_handler), win);
+	/* GstPlayer emits the messages of its bus as signals; a standby deck
+	 * posts its TOC while it prerolls, before it is attached */
+	deck->toc = g_atomic_rc_box_new0 (DeckToc);
+	deck->toc->win = win;
+	g_mutex_init (&deck->toc->lock);
+	bus = gst_element_get_bus (deck->pipeline);
+	g_signal_connect (bus, "message::toc",
+			G_CALLBACK (bus_toc_handler), deck->toc);
+	gst_object_unref (bus);
+
+	/* the window runs its own position ticks, see window_schedule_tick */
+	config = gst_player_get_config (deck->player);
+	gst_player_config_set_position_update_interval (config, 0);
+	gst_player_set_config (deck->player, config);
+	return deck;
+}
+
+static void window_deck_free (WindowDeck *deck) {
+
+	GstBus *bus;
+
+	g_signal_handlers_disconnect_matched (deck->pipeline, G_SIGNAL_MATCH_FUNC,
+			0, 0, NULL, deck_element_setup_handler, NULL);
+	bus = gst_element_get_bus (deck->pipeline);
+	g_signal_handlers_disconnect_by_data (bus, deck->toc);
+	gst_object_unref (bus);
+	g_atomic_rc_box_release_full (deck->toc, deck_toc_clear);
+	audite_seeker_free (deck->seeker);
+	audite_segment_free (deck->segment);
+	audite_gain_free (deck->gain);
+	audite_playlist_free (deck->playlist);
+	gst_object_unref (deck->pipeline);
+	g_object_unref (deck->player);
+	g_slice_free (WindowDeck, deck);
+}
+
+/* Makes @deck the one the window plays and shows. */
+static void window_attach (AuditeAppWindow *win, WindowDeck *deck) {
+
+	win->player = deck->player;
+	win->pipeline = deck->pipeline;
+	win->segment = deck->segment;
+	win->playlist = deck->playlist;
+	win->gain = deck->gain;
+	win->seeker = deck->seeker;
+	win->toc = deck->toc;
+	g_slice_free (WindowDeck, deck);
+
+	g_signal_connect (win->pipeline, "element-setup",
+			G_CALLBACK (playbin_element_setup_handler), win);
+	g_signal_connect (win->player, "duration-changed",
+			G_CALLBACK (gst_duration_changed_handler), win);
+	g_signal_connect (win->player, "end-of-stream",
+			G_CALLBACK (gst_media_eos_handler), win);
+	g_signal_connect (win->player, "media-info-updated",
+			G_CALLBACK (gst_media_info_updated_handler), win);
+	g_signal_connect (win->player, "volume-changed",
+			G_CALLBACK (gst_volume_changed_handler), win);
+	g_signal_connect (win->player, "state-changed",
+			G_CALLBACK (gst_state_changed_handler), win);
+}
+
+static WindowDeck *window_detach (AuditeAppWindow *win) {
+
+	WindowDeck *deck = g_slice_new0 (WindowDeck);
+
+	g_signal_handlers_disconnect_by_data (win->pipeline, win);
+	g_signal_handlers_disconnect_by_data (win->player, win);
+	deck->player = g_steal_pointer (&win->player);
+	deck->pipeline = g_steal_pointer (&win->pipeline);
+	deck->segment = g_steal_pointer (&win->segment);
+	deck->playlist = g_steal_pointer (&win->playlist);
+	deck->gain = g_steal_pointer (&win->gain);
+	deck->seeker = g_steal_pointer (&win->seeker);
+	deck->toc = g_steal_pointer (&win->toc);
+	return deck;
+}
+
 static GObject *
 audite_app_window_constructor (GType type, guint n_construct_params,
     GObjectConstructParam * construct_params) {
 
   AuditeAppWindow *win;
 
+  audite_profile_begin ("audite_app_window_constructor");
   win = (AuditeAppWindow *) G_OBJECT_CLASS (audite_app_window_parent_class)->constructor (type,
  					     n_construct_params, construct_params);
-  g_clear_object (&win->settings);
-
-  win->player = gst_player_new (NULL,
-		gst_player_g_main_context_signal_dispatcher_new (NULL));
-
-  g_signal_connect (GST_PLAYER(win->player),
-			"position-updated",
-			G_CALLBACK (gst_position_updated_handler),
-			win);
-  g_signal_connect (GST_PLAYER(win->player),
-			"duration-changed",
-			G_CALLBACK (gst_duration_changed_handler),
-			win);
-  g_signal_connect (GST_PLAYER(win->player),
-			"end-of-stream",
-			G_CALLBACK (gst_media_eos_handler),
-			win);
-  g_signal_connect (GST_PLAYER(win->player),
-			"media-info-updated",
-			G_CALLBACK (gst_media_info_updated_handler),
-			win);
-  g_signal_connect (GST_PLAYER(win->player),
-			"volume-changed",
-			G_CALLBACK (gst_volume_changed_handler),
-			win);
-  g_signal_connect (GST_PLAYER(win->player),
-			"state-changed",
-			G_CALLBACK (gst_state_changed_handler),
-			win);
 
+  audite_profile_begin ("gst_player_new");
+  window_attach (win, window_deck_new (win));
+  audite_profile_end ("gst_player_new");
+  win->mpris = audite_mpris_new (win);
+  audite_mpris_set_volume (win->mpris, gst_player_get_volume (win->player));
+  win->position_query = gst_query_new_position (GST_FORMAT_TIME);
+  win->queue = audite_queue_new ();
+  g_signal_connect (win->settings, "changed::stream-buffer",
+			G_CALLBACK (stream_buffer_changed_handler), win);
+  g_signal_connect (win->settings, "changed::stream-buffer-size",
+			G_CALLBACK (stream_buffer_changed_handler), win);
+
+  g_signal_connect (win, "window-state-event",
+			G_CALLBACK (window_state_event_handler), NULL);
+  g_signal_connect (win, "map",
+			G_CALLBACK (window_visibility_changed), NULL);
+  g_signal_connect (win, "unmap",
+			G_CALLBACK (window_visibility_changed), NULL);
+  if (gtk_window_get_application (GTK_WINDOW (win)))
+    g_signal_connect_object (gtk_window_get_application (GTK_WINDOW (win)),
+			"notify::screensaver-active",
+			G_CALLBACK (window_visibility_changed), win, G_CONNECT_SWAPPED);
+  audite_profile_end ("audite_app_window_constructor");
   return G_OBJECT (win);
 }
 
+static void
+audite_app_window_dispose (GObject *object)
+{
+  AuditeAppWindow *win = AUDITE_APP_WINDOW (object);
+
+  if (win->player && !GST_CLOCK_TIME_IS_VALID (win->restore_position))
+    save_position (win);
+  if (win->restore_timeout_id) {
+    g_source_remove (win->restore_timeout_id);
+    win->restore_timeout_id = 0;
+  }
+  if (win->tick_source) {
+    g_source_destroy (win->tick_source);
+    g_clear_pointer (&win->tick_source, g_source_unref);
+  }
+  g_clear_pointer (&win->position_query, gst_query_unref);
+  g_clear_pointer (&win->cursor_path, gtk_tree_path_free);
+  /* the settings action keeps the object alive past the window */
+  if (win->settings)
+    g_signal_handlers_disconnect_by_data (win->settings, win);
+  g_clear_object (&win->settings);
+
+  g_cancellable_cancel (win->load_cancellable);
+  g_clear_object (&win->load_cancellable);
+  g_clear_pointer (&win->book, audite_book_info_free);
+  g_clear_object (&win->chapter_model);
+  g_cancellable_cancel (win->cover_cancellable);
+  g_clear_object (&win->cover_cancellable);
+  window_clear_waveform (win);
+  window_clear_loudness (win);
+  window_clear_export (win);
+  g_clear_pointer (&win->search_results, g_ptr_array_unref);
+  g_clear_pointer (&win->current_uri, g_free);
+  g_clear_pointer (&win->mpris, audite_mpris_free);
+  g_clear_pointer (&win->queue, audite_queue_free);
+  g_clear_pointer (&win->standby, window_deck_free);
+  if (win->player)
+    window_deck_free (window_detach (win));
+
+  G_OBJECT_CLASS (audite_app_window_parent_class)->dispose (object);
+}
+
 static void
 audite_app_window_class_init (AuditeAppWindowClass *class)
 {
- // G_OBJECT_CLASS (class)->dispose = audite_app_window_dispose;
+  G_OBJECT_CLASS (class)->dispose = audite_app_window_dispose;
   G_OBJECT_CLASS (class)->constructor = audite_app_window_constructor;
 
   gtk_widget_class_set_template_from_resource (GTK_WIDGET_CLASS (class),
                                                "/com/github/alkesta/audite/window.ui");
 
   gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (class), AuditeAppWindow, gears);
+  gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (class), AuditeAppWindow, search_button);
   gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (class), AuditeAppWindow, volume_button);
   gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (class), AuditeAppWindow, previous_button);
   gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (class), AuditeAppWindow, rewind_button);
@@ -462,7 +1537,6 @@ audite_app_window_class_init (AuditeAppWindowClass *class)
   gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (class), AuditeAppWindow, remain_time_label);
   gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (class), AuditeAppWindow, seek_bar);
   gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (class), AuditeAppWindow, cover_art_image);
-  gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (class), AuditeAppWindow, chapter_list_store);
   gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (class), AuditeAppWindow, chapters_tree_view);
   gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (class), AuditeAppWindow, progress);
   gtk_widget_class_bind_template_child (GTK_WIDGET_CLASS (class), AuditeAppWindow, genre_value_label);
@@ -476,6 +1550,8 @@ audite_app_window_class_init (AuditeAppWindowClass *class)
 
 
   gtk_widget_class_bind_template_callback (GTK_WIDGET_CLASS (class), seek_bar_value_changed_handler);
+  gtk_widget_class_bind_template_callback (GTK_WIDGET_CLASS (class), seek_bar_button_press_handler);
+  gtk_widget_class_bind_template_callback (GTK_WIDGET_CLASS (class), seek_bar_button_release_handler);
   gtk_widget_class_bind_template_callback (GTK_WIDGET_CLASS (class), play_button_clicked_handler);
   gtk_widget_class_bind_template_callback (GTK_WIDGET_CLASS (class), volume_button_value_changed_handler);
   gtk_widget_class_bind_template_callback (GTK_WIDGET_CLASS (class), forward_button_clicked_handler);
@@ -493,35 +1569,282 @@ audite_app_window_new (AuditeApp *app) {
 
 void audite_app_window_open (AuditeAppWindow *win, gchar *uri) {
 
-	gchar *filename;
-	win->current_uri = uri;
+	gchar *uris[] = { uri, NULL };
+
+	audite_app_window_open_queue (win, uris);
+}
+
+/* Plays @uris one after the other, starting at once with the first. */
+void audite_app_window_open_queue (AuditeAppWindow *win, gchar **uris) {
+
+	g_return_if_fail (uris && uris[0]);
+
+	audite_queue_set_uris (win->queue, uris);
+	window_load (win, uris[0], 0, TRUE);
+}
+
+/* Brings back the last book paused at its saved position. The window
+ * presents itself once the pipeline has prerolled there, so Play starts
+ * sound at once; chapters come from the book cache. Returns FALSE when
+ * there is nothing to restore and the caller has to present the window. */
+gboolean audite_app_window_restore (AuditeAppWindow *win) {
+
+	gchar *uri;
+	GFile *file;
+	gboolean exists;
+	GstClockTime position = 0;
+
+	uri = g_settings_get_string (win->settings, "last-uri");
+	if (!*uri) {
+		g_free (uri);
+		return FALSE;
+	}
+	file = g_file_new_for_uri (uri);
+	exists = g_file_query_exists (file, NULL);
+	g_object_unref (file);
+	if (!exists) {
+		g_free (uri);
+		return FALSE;
+	}
+
+	if (g_settings_get_boolean (win->settings, "las-pos"))
+		position = g_settings_get_uint64 (win->settings, "last-position");
+	window_load (win, uri, position, FALSE);
+	win->restore_position = position;
+	win->restore_timeout_id = g_timeout_add (RESTORE_PRESENT_TIMEOUT, restore_timeout_handler, win);
+	g_free (uri);
+	return TRUE;
+}
+
+/* Lets the soak run drive the playback rate. */
+GstPlayer *audite_app_window_get_player (AuditeAppWindow *win) {
+
+	return win->player;
+}
+
+/* Remote control entry points, for MPRIS. @position is on the book
+ * timeline. */
+void audite_app_window_seek (AuditeAppWindow *win, GstClockTime position) {
+
+	window_seek (win, position);
+}
+
+void audite_app_window_step_chapter (AuditeAppWindow *win, gint delta) {
+
+	set_chapter (win, delta);
+}
+
+/* Brings the current chapter up to date before MPRIS answers a call. */
+void audite_app_window_sync_chapter (AuditeAppWindow *win) {
+
+	window_track_chapter (win, window_get_position (win));
+}
+
+void audite_app_window_set_playing (AuditeAppWindow *win, gboolean play) {
+
+	window_set_playing (win, play);
+}
+
+static void window_load (AuditeAppWindow *win, const gchar *uri, GstClockTime position, gboolean play) {
+
+	/* drop whatever the previous load has not delivered yet */
+	if (win->load_cancellable) {
+		g_cancellable_cancel (win->load_cancellable);
+		g_clear_object (&win->load_cancellable);
+		audite_profile_end_async ("audite_app_window_open", win->load_id);
+	}
+	audite_profile_begin_async ("audite_app_window_open", ++win->load_id);
+	if (!win->prerolled)
+		g_clear_pointer (&win->standby, window_deck_free);
+	win->standby_tried = FALSE;
+	g_clear_pointer (&win->book, audite_book_info_free);
+	audite_segment_set_chapters (win->segment, NULL);
+	audite_playlist_set_tracks (win->playlist, NULL, NULL);
+	audite_seeker_reset (win->seeker);
+	win->loop_start = GST_CLOCK_TIME_NONE;
+	g_cancellable_cancel (win->cover_cancellable);
+	g_clear_object (&win->cover_cancellable);
+	win->cover_requested = FALSE;
+	window_clear_waveform (win);
+	window_clear_loudness (win);
+
+	g_free (win->current_uri);
+	win->current_uri = g_strdup (uri);
 	win->current_chapter_number = -1;
 	win->amount_of_chapters = -1;
-	win->current_chapter_number = -1;
+	win->shown_chapter = -1;
 	win->current_chapter_end = 0;
 	win->current_chapter_start = 0;
+	win->shown_second = GST_CLOCK_TIME_NONE;
+	g_atomic_pointer_set (&win->stream_caps, NULL);
+	audite_mpris_set_book (win->mpris, NULL, NULL);
+	audite_mpris_set_track (win->mpris, -1, 0, 0, GST_CLOCK_TIME_NONE, NULL);
+	audite_mpris_set_art (win->mpris, NULL);
 
 	/* restore ui */
-	gtk_list_store_clear (GTK_LIST_STORE(win->chapter_list_store));
+	window_set_chapter_rows (win, NULL, 0);
 	gtk_image_clear (GTK_IMAGE(win->cover_art_image));
 	gtk_label_set_text (GTK_LABEL (win->window_title_label), "m4b Player");
 	gtk_label_set_text (GTK_LABEL (win->chapter_count_label), NULL);
 	gtk_progress_bar_set_fraction ( (GtkProgressBar *) (win->progress), 0);
 	win->audiobook = FALSE;
 
-	gst_player_set_uri (win->player,  uri);
 	seek_bar_set_range (win, 0, 10);
-	gst_player_play (win->player);
-	
-	if ( is_mp4_container (uri) )
-			mp4v2_get_chapters (win);
+	win->load_play = play;
+	/* present_restored seeks there once the stream has prerolled */
+	win->restore_position = position > 0 ? position : GST_CLOCK_TIME_NONE;
+	if (play) {
+		g_settings_set_string (win->settings, "last-uri", uri);
+		g_settings_set_boolean (win->settings, "las-pos", FALSE);
+	}
+	if (audite_loader_is_collection (uri))
+		/* which file to start is known once the loader has listed them */
+		gst_player_stop (win->player);
+	else if (win->prerolled)
+		/* the standby player waits at the start of the book */
+		window_set_playing (win, play);
+	else {
+		/* a seek sent now would be lost: the player stops the stream it
+		 * had before it takes the new one, and a stop forgets seeks */
+		gst_player_set_uri (win->player,  uri);
+		window_set_playing (win, play && position == 0);
+	}
+	win->prerolled = FALSE;
+
+	win->load_cancellable = g_cancellable_new ();
+	audite_loader_open_async (win, uri, FALSE, win->load_cancellable,
+			chapters_batch_handler, book_loaded_handler, win);
+
+	/* a cached thumbnail can be shown before the stream is even prerolled;
+	 * which track of a folder holds the cover is not known yet */
+	win->cover_cancellable = g_cancellable_new ();
+	if (!audite_loader_is_collection (uri))
+		audite_cover_load_async (win, uri, NULL, COVER_SIZE,
+				win->cover_cancellable, cover_loaded_handler, NULL);
+}
+
+/* Runs on the ticks of a visible window and the few a hidden one makes,
+ * see window_schedule_tick. */
+static void window_check_preroll (AuditeAppWindow *win, GstClockTime position) {
+
+	if (!win->standby_tried && win->playing && GST_CLOCK_TIME_IS_VALID (position)
+			&& position + QUEUE_PREROLL_AHEAD >= window_get_duration (win))
+		window_preroll_next (win);
+}
+
+/* Near the end of a book, opens the next one of the queue in a player of
+ * its own and pauses it there, so moving on is instant. A folder is left
+ * to window_load, the loader has to list it first. */
+static void window_preroll_next (AuditeAppWindow *win) {
+
+	const gchar *uri = audite_queue_peek_next (win->queue);
+
+	win->standby_tried = TRUE;
+	if (win->standby || !uri || audite_loader_is_collection (uri))
+		return;
+	win->standby = window_deck_new (win);
+	gst_player_set_uri (win->standby->player, uri);
+	gst_player_pause (win->standby->player);
 }
 
+/* Moves on to the next book of the queue, taking over the standby player
+ * prerolled for it. Returns FALSE at the end of the queue. */
+static gboolean window_play_next (AuditeAppWindow *win) {
+
+	const gchar *uri = audite_queue_advance (win->queue);
+	gdouble volume;
+	gboolean mute;
+
+	if (!uri)
+		return FALSE;
+	if (win->standby) {
+		volume = gst_player_get_volume (win->player);
+		mute = gst_player_get_mute (win->player);
+		window_deck_free (window_detach (win));
+		window_attach (win, g_steal_pointer (&win->standby));
+		gst_player_set_volume (win->player, volume);
+		gst_player_set_mute (win->player, mute);
+		win->prerolled = TRUE;
+	}
+	window_load (win, uri, 0, TRUE);
+	return TRUE;
+}
+
+/* The stream of a load has prerolled, paused: moves it to the position
+ * window_load was given and starts it if asked to, and shows a window
+ * restored at startup. A book made of several files has started its
+ * track at the position already. */
+static void present_restored (AuditeAppWindow *win) {
+
+	GstClockTime position = win->restore_position;
+	gboolean restoring = win->restore_timeout_id != 0;
+
+	win->restore_position = GST_CLOCK_TIME_NONE;
+	if (restoring) {
+		g_source_remove (win->restore_timeout_id);
+		win->restore_timeout_id = 0;
+	}
+	if (position > 0 && !(win->book && win->book->tracks))
+		window_seek (win, position);
+	if (win->load_play)
+		window_set_playing (win, TRUE);
+	/* no position ticks arrive while paused */
+	window_update_position (win, position);
+	if (restoring)
+		gtk_window_present (GTK_WINDOW (win));
+}
+
+static gboolean restore_timeout_handler (gpointer data) {
+
+	AuditeAppWindow *win = data;
+
+	present_restored (win);
+	return G_SOURCE_REMOVE;
+}
+
+static void save_position (AuditeAppWindow *win) {
+
+	GstClockTime position;
+
+	if (!win->current_uri)
+		return;
+	position = window_get_position (win);
+	if (!GST_CLOCK_TIME_IS_VALID (position))
+		return;
+	win->saved_time = g_get_monotonic_time ();
+	g_settings_set_string (win->settings, "last-uri", win->current_uri);
+	g_settings_set_uint64 (win->settings, "last-position", position);
+	g_settings_set_boolean (win->settings, "las-pos", TRUE);
+}
+
+/* A drag produces a stream of values; they become fast inexact seeks and
+ * the release settles on the exact spot. */
 static void seek_bar_value_changed_handler (GtkRange * range, gpointer data) {
 	AuditeAppWindow *win = data;
 
 	gdouble value = gtk_range_get_value (GTK_RANGE (win->seek_bar));
-	gst_player_seek (win->player, gst_util_uint64_scale (value, GST_SECOND, 1));
+	audite_seeker_seek (win->seeker, gst_util_uint64_scale (value, GST_SECOND, 1),
+			!win->seek_dragging);
+}
+
+static gboolean seek_bar_button_press_handler (GtkWidget *widget, GdkEventButton *event,
+				AuditeAppWindow *win) {
+
+	win->seek_dragging = TRUE;
+	return FALSE;
+}
+
+static gboolean seek_bar_button_release_handler (GtkWidget *widget, GdkEventButton *event,
+				AuditeAppWindow *win) {
+
+	gdouble value;
+
+	if (!win->seek_dragging)
+		return FALSE;
+	win->seek_dragging = FALSE;
+	value = gtk_range_get_value (GTK_RANGE (win->seek_bar));
+	audite_seeker_seek (win->seeker, gst_util_uint64_scale (value, GST_SECOND, 1), TRUE);
+	return FALSE;
 }
 
 static void play_button_clicked_handler (GtkButton * button, AuditeAppWindow *win) {
@@ -552,21 +1875,15 @@ static void next_button_clicked_handler (GtkButton * button, AuditeAppWindow *wi
 		set_chapter (win, 1);
 }
 
-static GdkPixbuf * get_cover_image (GstPlayerMediaInfo * media_info) {
+static GstSample * get_cover_sample (GstPlayerMediaInfo * media_info) {
   GstSample *sample;
-  GstMapInfo info;
-  GstBuffer *buffer;
-  GError *err = NULL;
-  GdkPixbufLoader *loader;
-  GdkPixbuf *pixbuf = NULL;
   const GstStructure *caps_struct;
   GstTagImageType type = GST_TAG_IMAGE_TYPE_UNDEFINED;
-  /* get image sample buffer from media */
+  /* get image sample from media */
 
   sample = gst_player_media_info_get_image_sample (media_info);
   if (!sample)
 	return NULL;
-  buffer = gst_sample_get_buffer (sample);
   caps_struct = gst_sample_get_info (sample);
   /* if sample is retrieved from preview-image tag then caps struct
    * will not be defined. */
@@ -580,29 +1897,47 @@ static GdkPixbuf * get_cover_image (GstPlayerMediaInfo * media_info) {
     g_print ("unsupport type ... %d \n", type);
     return NULL;
   }
-  if (!gst_buffer_map (buffer, &info, GST_MAP_READ)) {
-    g_print ("failed to map gst buffer \n");
-    return NULL;
-  }
-  loader = gdk_pixbuf_loader_new ();
-  if (gdk_pixbuf_loader_write (loader, info.data, info.size, &err) &&
-      gdk_pixbuf_loader_close (loader, &err)) {
-    pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
-    if (pixbuf) {
-      g_object_ref (pixbuf);
-    } else {
-      g_print ("failed to convert gst buffer to pixbuf %s \n", err->message);
-      g_error_free (err);
-    }
+  return sample;
+}
+
+static void cover_loaded_handler (GObject *source, GAsyncResult *res, gpointer user_data) {
+
+  AuditeAppWindow *win = AUDITE_APP_WINDOW (source);
+  GdkPixbuf *pixbuf;
+  GError *error = NULL;
+
+  pixbuf = audite_cover_load_finish (res, &error);
+  if (!pixbuf) {
+    if (error && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_print ("failed to load cover %s \n", error->message);
+    g_clear_error (&error);
+    return;
   }
-  g_object_unref (loader);
-  gst_buffer_unmap (buffer, &info);
-  return pixbuf;
+  win->cover_requested = TRUE;
+  gtk_image_set_from_pixbuf (GTK_IMAGE(win->cover_art_image), pixbuf);
+  g_object_unref (pixbuf);
+  window_publish_art (win);
+}
+
+/* MPRIS clients want the cover as a file; the thumbnail cache has one
+ * once the cover is shown. */
+static void window_publish_art (AuditeAppWindow *win) {
+
+	gchar *filename, *uri = NULL;
+
+	if (!win->book || !win->book->cover_key
+			|| gtk_image_get_storage_type (GTK_IMAGE (win->cover_art_image)) != GTK_IMAGE_PIXBUF)
+		return;
+	filename = audite_cover_cache_filename (win->book->cover_key, COVER_SIZE);
+	if (g_file_test (filename, G_FILE_TEST_EXISTS))
+		uri = g_filename_to_uri (filename, NULL, NULL);
+	audite_mpris_set_art (win->mpris, uri);
+	g_free (uri);
+	g_free (filename);
 }
 
-static gchar * seconds_to_hhmmss (guint64 seconds) {
+static void seconds_to_hhmmss (gchar *buffer, gsize size, guint64 seconds) {
 
-	gchar *hhmmss;
 	guint hrs, mins;
 
 	hrs = seconds / 3600;
@@ -611,11 +1946,9 @@ static gchar * seconds_to_hhmmss (guint64 seconds) {
 	seconds -= mins * 60;
 
 	if (hrs)
-		hhmmss = g_strdup_printf ("%d:%02d:%02" G_GUINT64_FORMAT, hrs, mins, seconds);
+		g_snprintf (buffer, size, "%d:%02d:%02" G_GUINT64_FORMAT, hrs, mins, seconds);
 	else
-		hhmmss = g_strdup_printf ("%02d:%02" G_GUINT64_FORMAT, mins, seconds);
-
-	return hhmmss;
+		g_snprintf (buffer, size, "%02d:%02" G_GUINT64_FORMAT, mins, seconds);
 }
 
 static void seek_bar_set_range (AuditeAppWindow *win, guint64 start, guint64 end) {
@@ -629,103 +1962,302 @@ static void seek_bar_set_range (AuditeAppWindow *win, guint64 start, guint64 end
 
 static void set_curent_chapter (AuditeAppWindow *win, GstClockTime position) {
 
-	GtkTreePath *path;
+	const AuditeChapter *chapter;
 	GtkTreeIter iter;
-	gint index = 0, chapter_amount, number;
-	gchar *title, *i;
-	GtkTreeModel *model;
-	guint64 start_c, end_c;
-
-	model = gtk_tree_view_get_model(GTK_TREE_VIEW(win->chapters_tree_view));
-	chapter_amount = win->amount_of_chapters;
-	for(index; index < chapter_amount; index++) { // find valid range
- 		path = gtk_tree_path_new_from_indices (index, -1);
-  		gtk_tree_model_get_iter (model, &iter, path);
-    		gtk_tree_model_get(model, &iter,
-        				NUMBER, &number,
-					NAME,   &title,
-					START,  &start_c,
-					END,    &end_c,
-					-1);
-		gtk_list_store_set (GTK_LIST_STORE(win->chapter_list_store), &iter,
-					ICON, NULL,
-		                        -1);
-
-		if ( (position/GST_SECOND < end_c) && (position/GST_SECOND >= start_c) ) { // if valid range found
-			win->current_chapter_start = start_c;
-			win->current_chapter_end = end_c;
-			win->current_chapter_number = number;
-			gtk_label_set_text (GTK_LABEL (win->chapter_count_label),
-				g_strdup_printf ("%u / %u", win->current_chapter_number, win->amount_of_chapters));
-			seek_bar_set_range (win, start_c, end_c);
-			gtk_list_store_set (GTK_LIST_STORE(win->chapter_list_store), &iter,
-						ICON, "►",
-			                        -1);
-gtk_tree_view_set_cursor (GTK_TREE_VIEW(win->chapters_tree_view),
-                          path,
-                          NULL,
-                          FALSE);
-		}
+	gchar count[32];
+	gint index;
+
+	if (!win->book)
+		return;
+	index = audite_chapters_lookup (win->book->chapters, position);
+	if (index < 0)
+		return;
+
+	chapter = &g_array_index (win->book->chapters, AuditeChapter, index);
+	win->current_chapter_start = chapter->start;
+	win->current_chapter_end = chapter->end;
+	if (index + 1 != win->current_chapter_number) {
+		win->current_chapter_number = index + 1;
+		audite_mpris_set_track (win->mpris, index, win->amount_of_chapters,
+				chapter->start, chapter->end, chapter->title);
+		win->shown_second = GST_CLOCK_TIME_NONE;
+	}
+	/* the rest catches up in window_update_position once it is seen */
+	if (index == win->shown_chapter || !window_is_visible (win))
+		return;
+
+	win->shown_chapter = index;
+	audite_chapter_model_set_current (win->chapter_model, index);
+	g_snprintf (count, sizeof (count), "%u / %u", win->current_chapter_number, win->amount_of_chapters);
+	gtk_label_set_text (GTK_LABEL (win->chapter_count_label), count);
+	seek_bar_set_range (win, chapter->start / GST_SECOND, chapter->end / GST_SECOND);
+
+	if (gtk_tree_model_iter_nth_child (GTK_TREE_MODEL (win->chapter_model), &iter, NULL, index)) {
+		/* a flat list path is a single index, reuse it */
+		gtk_tree_path_get_indices (win->cursor_path)[0] = index;
+		gtk_tree_view_set_cursor (GTK_TREE_VIEW(win->chapters_tree_view),
+		                          win->cursor_path,
+		                          NULL,
+		                          FALSE);
 	}
 }
 
+/* Keeps the current chapter, and the MPRIS track, in step with @position;
+ * runs while the window is hidden too. */
+static void window_track_chapter (AuditeAppWindow *win, GstClockTime position) {
+
+	if (win->audiobook && GST_CLOCK_TIME_IS_VALID (position)
+			&& (position >= win->current_chapter_end || position < win->current_chapter_start))
+		set_curent_chapter (win, position);
+}
+
 static void update_position_label (GtkLabel * label, guint64 seconds) {
 
-	gchar *data = seconds_to_hhmmss (seconds);
-	gtk_label_set_text (label, data);
-	g_free (data);
+	gchar text[32];
+
+	seconds_to_hhmmss (text, sizeof (text), seconds);
+	/* setting the same text still invalidates the layout */
+	if (strcmp (gtk_label_get_text (label), text) != 0)
+		gtk_label_set_text (label, text);
 }
 
+/* Steps from the chapter playing now, or from the one a seek under way is
+ * going to, so repeated steps add up. current_chapter_number can be a
+ * tick behind. */
 static void set_chapter (AuditeAppWindow *win, gint next) {
 
-	GtkTreePath *path;
-	GtkTreeIter iter;
-	gint index = 0, chapter_amount, current_chapter, number;
-	gchar *title, *i;
-	GtkTreeModel *model;
-	guint64 start, end;
-	chapter_amount = win->amount_of_chapters;
-	current_chapter = win->current_chapter_number;
-	model = gtk_tree_view_get_model(GTK_TREE_VIEW (win->chapters_tree_view));
-	for (index; index < chapter_amount; index++) { 
- 		path = gtk_tree_path_new_from_indices (index, -1);
-  		gtk_tree_model_get_iter (model, &iter, path);
-    		gtk_tree_model_get(model, &iter,
-        				NUMBER, &number,
-					NAME,   &title,
-					START,  &start,
-					END,    &end,
-					-1);
-		if (number == (current_chapter + next) ) {
-			gst_player_seek ( win->player, gst_util_uint64_scale ( (gdouble) start, GST_SECOND, 1) );
-			break;
-		}
+	GstClockTime position;
+	gint index;
+
+	if (!win->book || !win->book->chapters)
+		return;
+	position = audite_seeker_get_target (win->seeker);
+	if (!GST_CLOCK_TIME_IS_VALID (position))
+		position = window_get_position (win);
+	index = audite_chapters_lookup (win->book->chapters, position);
+	if (index < 0)
+		return;
+	index += next;
+	if (index < 0 || index >= (gint) win->book->chapters->len)
+		return;
+	window_seek (win, g_array_index (win->book->chapters, AuditeChapter, index).start);
+}
+
+/* @position is on the book timeline. Every seek goes through the seeker,
+ * so there is never more than one in flight. */
+static void window_seek (AuditeAppWindow *win, GstClockTime position) {
+
+	audite_seeker_seek (win->seeker, position, TRUE);
+}
+
+/* Seeks stay inside a running chapter or A-B segment run when they can,
+ * so the next range is still queued without a flush; in a book made of
+ * several files a seek into another track loads that file at the right
+ * offset. */
+static guint32 window_seek_func (GstClockTime position, GstSeekFlags flags, gpointer data) {
+
+	AuditeAppWindow *win = data;
+	GstClockTime track_position;
+	GstElement *pipeline;
+	GstEvent *seek;
+	guint32 seqnum;
+
+	audite_mpris_seeked (win->mpris, position);
+	if (audite_playlist_seek (win->playlist, position, &track_position)) {
+		/* a new stream, any A-B loop belonged to the previous one */
+		audite_segment_set_chapters (win->segment, NULL);
+		win->loop_start = GST_CLOCK_TIME_NONE;
+		window_set_playing (win, win->playing);
+		window_update_position (win, position);
+		return GST_SEQNUM_INVALID;
+	}
+	if (audite_segment_seek (win->segment, track_position, flags))
+		return GST_SEQNUM_INVALID;
+
+	pipeline = gst_player_get_pipeline (win->player);
+	seek = gst_event_new_seek (gst_player_get_rate (win->player),
+			GST_FORMAT_TIME, flags,
+			GST_SEEK_TYPE_SET, track_position,
+			GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+	seqnum = gst_event_get_seqnum (seek);
+	/* before preroll the player keeps the seek until it can be done */
+	if (!gst_element_send_event (pipeline, seek)) {
+		gst_player_seek (win->player, track_position);
+		seqnum = GST_SEQNUM_INVALID;
 	}
+	gst_object_unref (pipeline);
+	/* no tick comes while paused, show where we are going right away */
+	window_update_position (win, position);
+	return seqnum;
+}
+
+static void window_set_playing (AuditeAppWindow *win, gboolean play) {
+
+	if (play)
+		gst_player_play (win->player);
+	else
+		gst_player_pause (win->player);
 }
 
-gboolean is_mp4_container (gchar* uri) {
+/* Asked on every tick, so the query is made once and reused. */
+static GstClockTime window_get_position (AuditeAppWindow *win) {
 
-	const gchar mp4ftyp[4] = {0x66, 0x74, 0x79, 0x70};
-	gchar typ[4];
-	gshort i = 0;
-	FILE *file = NULL;
+	gint64 position;
 
-	file = fopen (
-		g_filename_from_uri (uri, NULL, NULL),
-		"rb" );
+	if (!gst_element_query (win->pipeline, win->position_query))
+		return GST_CLOCK_TIME_NONE;
+	gst_query_parse_position (win->position_query, NULL, &position);
+	if (position < 0)
+		return GST_CLOCK_TIME_NONE;
+	return audite_playlist_to_book (win->playlist, position);
+}
 
-	if ( file ) {
-		fseek ( file, 4, SEEK_SET );
-		for ( i = 0; i < 4; i++ ) {
-			fread ( &typ[i], 1, 1, file );
-			if ( mp4ftyp[i] != typ[i] ) {
-				fclose ( file );
-				return FALSE;
-			}
+/* The player only knows the duration of the file it is playing. */
+static GstClockTime window_get_duration (AuditeAppWindow *win) {
+
+	if (win->book && win->book->tracks)
+		return win->book->duration;
+	return gst_player_get_duration (win->player);
+}
+
+/* Paints the overview behind @widget before it draws itself: peaks faint,
+ * RMS stronger, in the widget's own foreground colour. The seek bar shows
+ * the stretch of its range, the progress bar the whole book. */
+static gboolean waveform_draw_handler (GtkWidget *widget, cairo_t *cr, AuditeAppWindow *win) {
+
+	GtkStyleContext *context;
+	GtkAdjustment *adjustment;
+	GdkRGBA color;
+	guint first = 0, last, start, end, i, pass;
+	gint width, height, x;
+	guint8 level;
+
+	if (!win->waveform)
+		return FALSE;
+	last = win->waveform_levels;
+	if (widget == win->seek_bar) {
+		adjustment = gtk_range_get_adjustment (GTK_RANGE (widget));
+		first = MIN ((guint) gtk_adjustment_get_lower (adjustment), last);
+		last = MIN ((guint) gtk_adjustment_get_upper (adjustment), last);
+	}
+	width = gtk_widget_get_allocated_width (widget);
+	height = gtk_widget_get_allocated_height (widget);
+	if (last <= first || width <= 0)
+		return FALSE;
+
+	context = gtk_widget_get_style_context (widget);
+	gtk_style_context_get_color (context, gtk_style_context_get_state (context), &color);
+	for (pass = 0; pass < 2; pass++) {
+		for (x = 0; x < width; x++) {
+			start = first + (guint64) (last - first) * x / width;
+			end = MAX (start + 1, first + (guint64) (last - first) * (x + 1) / width);
+			level = 0;
+			for (i = start; i < end; i++)
+				level = MAX (level, win->waveform[i * 2 + pass]);
+			if (level)
+				cairo_rectangle (cr, x, height * (255 - level) / 510.0, 1, height * level / 255.0);
 		}
-		fclose ( file );
-		return TRUE;
+		cairo_set_source_rgba (cr, color.red, color.green, color.blue, pass ? 0.3 : 0.15);
+		cairo_fill (cr);
 	}
 	return FALSE;
 }
 
+static void waveform_levels_handler (const guint8 *levels, guint first, guint n_levels, gpointer user_data) {
+
+	AuditeAppWindow *win = user_data;
+
+	if (!win->waveform || first >= win->waveform_levels)
+		return;
+	memcpy (win->waveform + first * 2, levels, MIN (n_levels, win->waveform_levels - first) * 2);
+	gtk_widget_queue_draw (win->seek_bar);
+	gtk_widget_queue_draw (win->progress);
+}
+
+static void waveform_loaded_handler (GObject *source, GAsyncResult *res, gpointer user_data) {
+
+	GError *error = NULL;
+
+	if (!audite_waveform_load_finish (res, &error)) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_print ("Waveform failed: %s\n", error->message);
+		g_error_free (error);
+	}
+}
+
+/* The overview fills in while the book plays, chunk by chunk. */
+static void window_start_waveform (AuditeAppWindow *win) {
+
+	window_clear_waveform (win);
+	win->waveform_levels = audite_waveform_n_levels (win->book->duration);
+	if (!win->waveform_levels)
+		return;
+	win->waveform = g_malloc0 (win->waveform_levels * 2);
+	win->waveform_cancellable = g_cancellable_new ();
+	audite_waveform_load_async (win, win->book, win->waveform_cancellable,
+			waveform_levels_handler, waveform_loaded_handler, win);
+}
+
+static void window_clear_waveform (AuditeAppWindow *win) {
+
+	g_cancellable_cancel (win->waveform_cancellable);
+	g_clear_object (&win->waveform_cancellable);
+	g_clear_pointer (&win->waveform, g_free);
+	win->waveform_levels = 0;
+	if (win->seek_bar)
+		gtk_widget_queue_draw (win->seek_bar);
+}
+
+static void loudness_analyzed_handler (GObject *source, GAsyncResult *res, gpointer user_data) {
+
+	AuditeAppWindow *win = AUDITE_APP_WINDOW (source);
+	GError *error = NULL;
+	GArray *gains;
+
+	gains = audite_loudness_analyze_finish (res, &error);
+	if (!gains) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_print ("Loudness analysis failed: %s\n", error->message);
+		g_error_free (error);
+		return;
+	}
+	audite_gain_set_chapters (win->gain, win->book->chapters, gains, win->book->tracks != NULL);
+	g_array_unref (gains);
+}
+
+/* Evens out the chapters of the book when the user asked for it. The
+ * first time a book is measured this takes a while, afterwards the gains
+ * come from the cache. */
+static void window_start_loudness (AuditeAppWindow *win) {
+
+	window_clear_loudness (win);
+	if (!win->book || !win->book->chapters || win->book->chapters->len < 2
+			|| !g_settings_get_boolean (win->settings, "normalize-chapters"))
+		return;
+	win->loudness_cancellable = g_cancellable_new ();
+	audite_loudness_analyze_async (win, win->book, win->loudness_cancellable,
+			loudness_analyzed_handler, win);
+}
+
+static void window_clear_loudness (AuditeAppWindow *win) {
+
+	g_cancellable_cancel (win->loudness_cancellable);
+	g_clear_object (&win->loudness_cancellable);
+	if (win->gain)
+		audite_gain_set_chapters (win->gain, NULL, NULL, FALSE);
+}
+
+/* Stops an export under way, or closes the dialog of a finished one. */
+static void window_clear_export (AuditeAppWindow *win) {
+
+	g_cancellable_cancel (win->export_cancellable);
+	g_clear_object (&win->export_cancellable);
+	if (win->export_dialog) {
+		g_signal_handlers_disconnect_by_data (win->export_dialog, win);
+		gtk_widget_destroy (win->export_dialog);
+		win->export_dialog = NULL;
+		win->export_bar = NULL;
+	}
+	g_clear_pointer (&win->export_fractions, g_free);
+	win->export_chapters = 0;
+}
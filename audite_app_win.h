@@ -9,6 +9,7 @@
 #define __AUDITE_APP_WIN_H
 
 #include <gtk/gtk.h>
+#include <gst/player/player.h>
 #include "audite_app.h"
 
 
@@ -18,6 +19,17 @@ G_DECLARE_FINAL_TYPE (AuditeAppWindow, audite_app_window, AUDITE, APP_WINDOW, Gt
 AuditeAppWindow       *audite_app_window_new          (AuditeApp *app);
 void                    audite_app_window_open         (AuditeAppWindow *win,
                                                          gchar            *uri);
+void                    audite_app_window_open_queue   (AuditeAppWindow *win,
+                                                         gchar           **uris);
+gboolean                audite_app_window_restore      (AuditeAppWindow *win);
+GstPlayer              *audite_app_window_get_player   (AuditeAppWindow *win);
+void                    audite_app_window_seek         (AuditeAppWindow *win,
+                                                         GstClockTime     position);
+void                    audite_app_window_step_chapter (AuditeAppWindow *win,
+                                                         gint             delta);
+void                    audite_app_window_sync_chapter (AuditeAppWindow *win);
+void                    audite_app_window_set_playing  (AuditeAppWindow *win,
+                                                         gboolean         play);
 
 
 #endif /* __AUDITE_APP_WIN_H */
@@ -0,0 +1,647 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Headless benchmark, run with --benchmark. A synthetic m4b is written
+ * with mp4v2 into a temporary directory and the hot paths are timed
+ * against it without opening a display. The report has one tab separated
+ * line per case with a fixed name and order, so reports from different
+ * versions can be diffed directly.
+ */
+
+#include <gio/gio.h>
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+#include <mp4v2/mp4v2.h>
+
+#include "audite_bench.h"
+#include "audite_cache.h"
+#include "audite_chapter_model.h"
+#include "audite_chapters.h"
+#include "audite_cover.h"
+#include "audite_export.h"
+#include "audite_loader.h"
+#include "audite_probe.h"
+#include "audite_search.h"
+
+#define BENCH_REPORT_VERSION 3
+#define BENCH_SAMPLE_RATE 44100
+#define BENCH_FRAME_SIZE 1024
+#define BENCH_SEED 20170401
+#define BENCH_COVER_SIZE 300
+#define BENCH_CACHE_WAIT (5 * G_USEC_PER_SEC)
+#define BENCH_SEEK_TIMEOUT (10 * GST_SECOND)
+#define BENCH_SCREEN_ROWS 40
+
+#define BENCH_SNIFF_ITERATIONS 1000
+#define BENCH_READ_ITERATIONS 5
+#define BENCH_CACHED_ITERATIONS 50
+#define BENCH_MODEL_ITERATIONS 5
+#define BENCH_LOOKUP_ITERATIONS 1000000
+#define BENCH_SEEK_ITERATIONS 100
+#define BENCH_COVER_ITERATIONS 10
+#define BENCH_SEARCH_DOCS 250000
+#define BENCH_SEARCH_ITERATIONS 1000
+
+const GOptionEntry audite_bench_option_entries[] =
+{
+  { "benchmark", 0, 0, G_OPTION_ARG_NONE, NULL,
+    "Time the hot paths on a synthetic book and exit", NULL },
+  { "bench-hours", 0, 0, G_OPTION_ARG_INT, NULL,
+    "Synthetic book duration, 1 to 100 hours (default 10)", "HOURS" },
+  { "bench-chapters", 0, 0, G_OPTION_ARG_INT, NULL,
+    "Synthetic chapter count, 1 to 10000 (default 100)", "N" },
+  { "bench-cover", 0, 0, G_OPTION_ARG_INT, NULL,
+    "Synthetic cover edge in pixels, 0 for none (default 1400)", "PIXELS" },
+  { "bench-report", 0, 0, G_OPTION_ARG_FILENAME, NULL,
+    "Write the report to FILE instead of stdout", "FILE" },
+  { NULL }
+};
+
+typedef struct
+{
+  gint   hours;
+  gint   n_chapters;
+  gint   cover_size;
+  gchar *filename;
+  gchar *uri;
+  GBytes *cover;
+} BenchBook;
+
+/* Random noise keeps the JPEG close to the size of a real scanned cover. */
+static GBytes *
+bench_make_cover (gint size)
+{
+  GdkPixbuf *pixbuf;
+  GRand *rand;
+  guchar *pixels;
+  gchar *data;
+  gsize length;
+  gint rowstride, x, y;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, size, size);
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  rand = g_rand_new_with_seed (BENCH_SEED);
+  for (y = 0; y < size; y++)
+    for (x = 0; x < size * 3; x++)
+      pixels[y * rowstride + x] = (x + y + g_rand_int_range (rand, 0, 64)) & 0xff;
+  g_rand_free (rand);
+
+  if (!gdk_pixbuf_save_to_buffer (pixbuf, &data, &length, "jpeg", NULL,
+                                  "quality", "90", NULL)) {
+    g_object_unref (pixbuf);
+    return NULL;
+  }
+  g_object_unref (pixbuf);
+  return g_bytes_new_take (data, length);
+}
+
+/* Writes a mono AAC track of silent frames, a QuickTime chapter track and
+ * optionally a JPEG cover. Sample tables are as big as a real book's. */
+static gboolean
+bench_make_book (BenchBook *book)
+{
+  static const guint8 aac_config[] = { 0x12, 0x08 };  /* AAC LC, 44.1 kHz, mono */
+  static const guint8 silent_frame[] = { 0x21, 0x10, 0x04, 0x60, 0x8c, 0x1c };
+  MP4FileHandle file;
+  MP4TrackId track;
+  MP4Chapter_t *chapters;
+  const MP4Tags *tags;
+  MP4TagArtwork artwork;
+  guint64 n_frames, i, duration_ms, chapter_ms;
+
+  file = MP4Create (book->filename, 0);
+  if (file == MP4_INVALID_FILE_HANDLE)
+    return FALSE;
+
+  MP4SetTimeScale (file, BENCH_SAMPLE_RATE);
+  track = MP4AddAudioTrack (file, BENCH_SAMPLE_RATE, BENCH_FRAME_SIZE,
+                            MP4_MPEG4_AUDIO_TYPE);
+  MP4SetAudioProfileLevel (file, 0x0f);
+  MP4SetTrackESConfiguration (file, track, aac_config, sizeof (aac_config));
+
+  n_frames = (guint64) book->hours * 3600 * BENCH_SAMPLE_RATE / BENCH_FRAME_SIZE;
+  for (i = 0; i < n_frames; i++)
+    MP4WriteSample (file, track, silent_frame, sizeof (silent_frame),
+                    MP4_INVALID_DURATION, 0, TRUE);
+
+  /* mp4v2 chapter durations are in milliseconds */
+  duration_ms = n_frames * BENCH_FRAME_SIZE * 1000 / BENCH_SAMPLE_RATE;
+  chapter_ms = duration_ms / book->n_chapters;
+  chapters = g_new0 (MP4Chapter_t, book->n_chapters);
+  for (i = 0; i < (guint64) book->n_chapters; i++) {
+    chapters[i].duration = i + 1 < (guint64) book->n_chapters
+                           ? chapter_ms
+                           : duration_ms - chapter_ms * i;
+    g_snprintf (chapters[i].title, sizeof (chapters[i].title),
+                "Chapter %" G_GUINT64_FORMAT, i + 1);
+  }
+  MP4SetChapters (file, chapters, book->n_chapters, MP4ChapterTypeQt);
+  g_free (chapters);
+  MP4Close (file, 0);
+
+  if (!book->cover)
+    return TRUE;
+
+  file = MP4Modify (book->filename, 0);
+  if (file == MP4_INVALID_FILE_HANDLE)
+    return FALSE;
+  tags = MP4TagsAlloc ();
+  MP4TagsFetch (tags, file);
+  MP4TagsSetName (tags, "Synthetic book");
+  artwork.data = (void *) g_bytes_get_data (book->cover, NULL);
+  artwork.size = g_bytes_get_size (book->cover);
+  artwork.type = MP4_ART_JPEG;
+  MP4TagsAddArtwork (tags, &artwork);
+  MP4TagsStore (tags, file);
+  MP4TagsFree (tags);
+  MP4Close (file, 0);
+  return TRUE;
+}
+
+/* Writes a synthetic book for the other headless modes, such as the soak
+ * run; @cover_size 0 leaves out the cover. */
+gboolean
+audite_bench_write_book (const gchar *filename,
+                         gint         hours,
+                         gint         n_chapters,
+                         gint         cover_size)
+{
+  BenchBook book = { 0 };
+  gboolean written;
+
+  book.hours = hours;
+  book.n_chapters = n_chapters;
+  book.cover_size = cover_size;
+  book.filename = (gchar *) filename;
+  if (cover_size > 0)
+    book.cover = bench_make_cover (cover_size);
+  written = bench_make_book (&book);
+  if (book.cover)
+    g_bytes_unref (book.cover);
+  return written;
+}
+
+static void
+bench_report (GString *report, const gchar *name, guint iterations, gint64 elapsed)
+{
+  g_string_append_printf (report, "%s\t%u\t%" G_GINT64_FORMAT "\n", name,
+                          iterations, elapsed * 1000 / MAX (iterations, 1));
+}
+
+static void
+bench_sniff (BenchBook *book, GString *report)
+{
+  gint64 start;
+  guint i;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCH_SNIFF_ITERATIONS; i++)
+    audite_probe_free (audite_probe_uri (book->uri, NULL, NULL));
+  bench_report (report, "sniff", BENCH_SNIFF_ITERATIONS,
+                g_get_monotonic_time () - start);
+}
+
+static void
+bench_read (BenchBook *book, GString *report)
+{
+  AuditeBookInfo *info;
+  gint64 start;
+  guint i;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCH_READ_ITERATIONS; i++) {
+    info = audite_loader_read_container (book->uri, NULL, NULL);
+    if (info)
+      audite_book_info_free (info);
+  }
+  bench_report (report, "chapters-read", BENCH_READ_ITERATIONS,
+                g_get_monotonic_time () - start);
+}
+
+/* The cache is written on a worker, so the first load fills it and the
+ * timed loop waits until it is readable. */
+static void
+bench_read_cached (BenchBook *book, GString *report)
+{
+  AuditeBookInfo *info;
+  gchar *key;
+  gint64 start, deadline;
+  guint i;
+
+  info = audite_loader_read_book (book->uri, NULL, NULL);
+  if (info)
+    audite_book_info_free (info);
+
+  key = audite_cache_file_key (book->uri, NULL);
+  if (!key)
+    return;
+  deadline = g_get_monotonic_time () + BENCH_CACHE_WAIT;
+  while (!(info = audite_cache_load_book (key)) && g_get_monotonic_time () < deadline)
+    g_usleep (G_USEC_PER_SEC / 100);
+  if (info)
+    audite_book_info_free (info);
+  g_free (key);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCH_CACHED_ITERATIONS; i++) {
+    info = audite_loader_read_book (book->uri, NULL, NULL);
+    if (info)
+      audite_book_info_free (info);
+  }
+  bench_report (report, "chapters-read-cached", BENCH_CACHED_ITERATIONS,
+                g_get_monotonic_time () - start);
+}
+
+/* Fills the chapter model and reads one screen of rows, which is what the
+ * chapter view asks for after a book is opened. */
+static void
+bench_model (GArray *chapters, GString *report)
+{
+  AuditeChapterModel *model;
+  GtkTreeIter iter;
+  GValue value = G_VALUE_INIT;
+  gint64 start;
+  guint i, row, column;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCH_MODEL_ITERATIONS; i++) {
+    model = audite_chapter_model_new (chapters, chapters->len);
+    if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter)) {
+      for (row = 0; row < BENCH_SCREEN_ROWS; row++) {
+        for (column = 0; column < AUDITE_CHAPTER_N_COLUMNS; column++) {
+          gtk_tree_model_get_value (GTK_TREE_MODEL (model), &iter, column, &value);
+          g_value_unset (&value);
+        }
+        if (!gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter))
+          break;
+      }
+    }
+    g_object_unref (model);
+  }
+  bench_report (report, "chapters-model", BENCH_MODEL_ITERATIONS,
+                g_get_monotonic_time () - start);
+}
+
+static void
+bench_lookup (GArray *chapters, GstClockTime duration, GString *report)
+{
+  GRand *rand;
+  gint64 start;
+  guint i;
+  volatile gint index;
+
+  rand = g_rand_new_with_seed (BENCH_SEED);
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCH_LOOKUP_ITERATIONS; i++)
+    index = audite_chapters_lookup (chapters,
+                                    (GstClockTime) (g_rand_double (rand) * duration));
+  bench_report (report, "chapter-lookup", BENCH_LOOKUP_ITERATIONS,
+                g_get_monotonic_time () - start);
+  g_rand_free (rand);
+  (void) index;
+}
+
+static gboolean
+bench_wait_async_done (GstBus *bus)
+{
+  GstMessage *message;
+  gboolean done;
+
+  message = gst_bus_timed_pop_filtered (bus, BENCH_SEEK_TIMEOUT,
+                                        GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR);
+  done = message && GST_MESSAGE_TYPE (message) == GST_MESSAGE_ASYNC_DONE;
+  if (message)
+    gst_message_unref (message);
+  return done;
+}
+
+/* Flushing seeks through the demuxer only: what matters is how fast the
+ * sample tables answer a chapter jump, not decoding. */
+static void
+bench_seek (BenchBook *book, GArray *chapters, GString *report)
+{
+  GstElement *pipeline, *src;
+  GstBus *bus;
+  GError *error = NULL;
+  const AuditeChapter *chapter;
+  gint64 start;
+  guint i, n_seeks = 0;
+
+  pipeline = gst_parse_launch ("filesrc name=src ! qtdemux ! fakesink sync=false",
+                               &error);
+  if (!pipeline) {
+    g_print ("Benchmark: %s\n", error->message);
+    g_error_free (error);
+    return;
+  }
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  g_object_set (src, "location", book->filename, NULL);
+  gst_object_unref (src);
+  bus = gst_element_get_bus (pipeline);
+
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  if (bench_wait_async_done (bus)) {
+    start = g_get_monotonic_time ();
+    for (i = 0; i < BENCH_SEEK_ITERATIONS; i++) {
+      /* stride through the book so consecutive seeks are never adjacent */
+      chapter = &g_array_index (chapters, AuditeChapter,
+                                (i * 7919) % chapters->len);
+      if (!gst_element_seek_simple (pipeline, GST_FORMAT_TIME,
+                                    GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+                                    chapter->start)
+          || !bench_wait_async_done (bus))
+        break;
+      n_seeks++;
+    }
+    bench_report (report, "chapter-seek", n_seeks, g_get_monotonic_time () - start);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+}
+
+static void
+bench_cover (BenchBook *book, GString *report)
+{
+  GstSample *sample;
+  GdkPixbuf *pixbuf;
+  gint64 start;
+  guint i;
+
+  if (!book->cover)
+    return;
+
+  sample = gst_sample_new (gst_buffer_new_wrapped_bytes (book->cover),
+                           NULL, NULL, NULL);
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCH_COVER_ITERATIONS; i++) {
+    pixbuf = audite_cover_decode (sample, BENCH_COVER_SIZE, NULL);
+    if (pixbuf)
+      g_object_unref (pixbuf);
+  }
+  bench_report (report, "cover-decode", BENCH_COVER_ITERATIONS,
+                g_get_monotonic_time () - start);
+  gst_sample_unref (sample);
+}
+
+/* Made up words, so that prefixes are shared the way real ones are. */
+static gchar *
+bench_make_words (GRand *rand, guint n_words)
+{
+  static const gchar *syllables[] = { "ka", "lo", "mi", "re", "tu", "san", "dor",
+                                      "vel", "qui", "ber", "no", "sha", "ét", "ün" };
+  GString *text;
+  guint word, n_syllables;
+
+  text = g_string_new (NULL);
+  for (word = 0; word < n_words; word++) {
+    if (word > 0)
+      g_string_append_c (text, ' ');
+    for (n_syllables = g_rand_int_range (rand, 1, 5); n_syllables > 0; n_syllables--)
+      g_string_append (text, syllables[g_rand_int_range (rand, 0, G_N_ELEMENTS (syllables))]);
+  }
+  return g_string_free (text, FALSE);
+}
+
+/* Indexes a library of about BENCH_SEARCH_DOCS books and chapters, books
+ * having as many chapters as the synthetic one, then asks for prefixes of
+ * its words as they would be typed. */
+static void
+bench_search (GArray *chapters, GString *report)
+{
+  AuditeSearch *search;
+  AuditeBookInfo **books;
+  const AuditeChapter *chapter;
+  GPtrArray *results;
+  GRand *rand;
+  gchar **queries, **words;
+  gchar *title;
+  gint64 start;
+  guint n_books, i, j;
+
+  rand = g_rand_new_with_seed (BENCH_SEED);
+  n_books = MAX (1, BENCH_SEARCH_DOCS / (chapters->len + 1));
+  books = g_new0 (AuditeBookInfo *, n_books);
+  for (i = 0; i < n_books; i++) {
+    books[i] = g_slice_new0 (AuditeBookInfo);
+    books[i]->uri = g_strdup_printf ("file:///bench/%u.m4b", i);
+    books[i]->title = bench_make_words (rand, 3);
+    books[i]->artist = bench_make_words (rand, 2);
+    books[i]->genre = g_strdup ("Audiobook");
+    books[i]->chapters = audite_chapters_new (chapters->len);
+    for (j = 0; j < chapters->len; j++) {
+      chapter = &g_array_index (chapters, AuditeChapter, j);
+      title = bench_make_words (rand, g_rand_int_range (rand, 1, 6));
+      audite_chapters_append (books[i]->chapters, title, chapter->start, chapter->end);
+      g_free (title);
+    }
+  }
+
+  /* the first letters of one word, sometimes with a second one */
+  queries = g_new0 (gchar *, BENCH_SEARCH_ITERATIONS + 1);
+  for (i = 0; i < BENCH_SEARCH_ITERATIONS; i++) {
+    title = bench_make_words (rand, 2);
+    words = g_strsplit (title, " ", 2);
+    queries[i] = g_rand_boolean (rand)
+        ? g_utf8_substring (words[0], 0, g_rand_int_range (rand, 1, g_utf8_strlen (words[0], -1) + 1))
+        : g_strdup_printf ("%s %.2s", words[0], words[1]);
+    g_strfreev (words);
+    g_free (title);
+  }
+
+  search = audite_search_new (NULL);
+  start = g_get_monotonic_time ();
+  for (i = 0; i < n_books; i++)
+    audite_search_add_book (search, books[i]);
+  bench_report (report, "search-index", n_books, g_get_monotonic_time () - start);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCH_SEARCH_ITERATIONS; i++) {
+    results = audite_search_query (search, queries[i], 50);
+    g_ptr_array_unref (results);
+  }
+  bench_report (report, "search-query", BENCH_SEARCH_ITERATIONS,
+                g_get_monotonic_time () - start);
+
+  audite_search_free (search);
+  for (i = 0; i < n_books; i++)
+    audite_book_info_free (books[i]);
+  g_free (books);
+  g_strfreev (queries);
+  g_rand_free (rand);
+}
+
+static void
+bench_export_done_handler (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  GMainLoop *loop = user_data;
+  GError *error = NULL;
+
+  if (!audite_export_chapters_finish (res, &error)) {
+    g_print ("Benchmark: %s\n", error->message);
+    g_error_free (error);
+  }
+  g_main_loop_quit (loop);
+}
+
+/* One export of the whole book, reported per chapter. The synthetic book
+ * is AAC, so this times the copy path end to end. */
+static void
+bench_export (AuditeBookInfo *info, const gchar *dir, GString *report)
+{
+  GMainLoop *loop;
+  GFile *folder;
+  gchar *path;
+  gint64 start;
+
+  path = g_build_filename (dir, "export", NULL);
+  folder = g_file_new_for_path (path);
+  g_free (path);
+  loop = g_main_loop_new (NULL, FALSE);
+  start = g_get_monotonic_time ();
+  audite_export_chapters_async (NULL, info, folder, NULL, NULL, NULL,
+                                bench_export_done_handler, loop);
+  g_main_loop_run (loop);
+  bench_report (report, "chapter-export", info->chapters->len,
+                g_get_monotonic_time () - start);
+  g_main_loop_unref (loop);
+  g_object_unref (folder);
+}
+
+static void
+bench_remove_tree (GFile *file)
+{
+  GFileEnumerator *children;
+  GFileInfo *info;
+  GFile *child;
+
+  children = g_file_enumerate_children (file, G_FILE_ATTRIBUTE_STANDARD_NAME,
+                                        G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                        NULL, NULL);
+  if (children) {
+    while ((info = g_file_enumerator_next_file (children, NULL, NULL))) {
+      child = g_file_get_child (file, g_file_info_get_name (info));
+      bench_remove_tree (child);
+      g_object_unref (child);
+      g_object_unref (info);
+    }
+    g_object_unref (children);
+  }
+  g_file_delete (file, NULL, NULL);
+}
+
+/* Deletes a temporary directory made for a headless run, with its contents. */
+void
+audite_bench_remove_dir (const gchar *path)
+{
+  GFile *root = g_file_new_for_path (path);
+
+  bench_remove_tree (root);
+  g_object_unref (root);
+}
+
+static gint
+bench_option_int (GVariantDict *options, const gchar *name,
+                  gint fallback, gint min, gint max)
+{
+  gint value;
+
+  if (!g_variant_dict_lookup (options, name, "i", &value))
+    return fallback;
+  return CLAMP (value, min, max);
+}
+
+/* Called from handle-local-options, before the application registers or
+ * initializes GTK, so it runs without a display. Returns the exit status. */
+gint
+audite_bench_run (GVariantDict *options)
+{
+  BenchBook book = { 0 };
+  AuditeBookInfo *info;
+  GString *report;
+  GError *error = NULL;
+  const gchar *report_filename = NULL;
+  gchar *dir;
+  gint status = 0;
+
+  book.hours = bench_option_int (options, "bench-hours", 10, 1, 100);
+  book.n_chapters = bench_option_int (options, "bench-chapters", 100, 1, 10000);
+  book.cover_size = bench_option_int (options, "bench-cover", 1400, 0, 8192);
+  g_variant_dict_lookup (options, "bench-report", "^&ay", &report_filename);
+
+  dir = g_dir_make_tmp ("audite-bench-XXXXXX", &error);
+  if (!dir) {
+    g_print ("Benchmark: %s\n", error->message);
+    g_error_free (error);
+    return 1;
+  }
+  /* keep the caches of this run out of the user's, and GLib remembers
+   * the cache directory from its first use, which gst_init makes while
+   * looking for the registry; the registry is rebuilt in @dir, untimed */
+  g_setenv ("XDG_CACHE_HOME", dir, TRUE);
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+  gst_init (NULL, NULL);
+  book.filename = g_build_filename (dir, "synthetic.m4b", NULL);
+  book.uri = g_filename_to_uri (book.filename, NULL, NULL);
+  if (book.cover_size > 0)
+    book.cover = bench_make_cover (book.cover_size);
+
+  if (!bench_make_book (&book)) {
+    g_print ("Benchmark: could not write %s\n", book.filename);
+    status = 1;
+    goto out;
+  }
+
+  info = audite_loader_read_container (book.uri, NULL, NULL);
+  if (!info || !info->chapters || info->chapters->len == 0) {
+    g_print ("Benchmark: no chapters read back from %s\n", book.filename);
+    if (info)
+      audite_book_info_free (info);
+    status = 1;
+    goto out;
+  }
+
+  report = g_string_new (NULL);
+  g_string_append_printf (report, "# audite benchmark %d\n", BENCH_REPORT_VERSION);
+  g_string_append_printf (report, "# hours %d chapters %d cover %d\n",
+                          book.hours, book.n_chapters, book.cover_size);
+  g_string_append (report, "# case\titerations\tns/op\n");
+
+  bench_sniff (&book, report);
+  bench_read (&book, report);
+  bench_read_cached (&book, report);
+  bench_model (info->chapters, report);
+  bench_lookup (info->chapters, info->duration, report);
+  bench_seek (&book, info->chapters, report);
+  bench_cover (&book, report);
+  bench_export (info, dir, report);
+  bench_search (info->chapters, report);
+  audite_book_info_free (info);
+
+  if (report_filename) {
+    if (!g_file_set_contents (report_filename, report->str, report->len, &error)) {
+      g_print ("Benchmark: %s\n", error->message);
+      g_error_free (error);
+      status = 1;
+    }
+  }
+  else
+    g_print ("%s", report->str);
+  g_string_free (report, TRUE);
+
+out:
+  audite_bench_remove_dir (dir);
+  g_free (dir);
+  g_free (book.filename);
+  g_free (book.uri);
+  if (book.cover)
+    g_bytes_unref (book.cover);
+  return status;
+}
@@ -0,0 +1,24 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_BENCH_H
+#define __AUDITE_BENCH_H
+
+#include <gio/gio.h>
+
+
+extern const GOptionEntry audite_bench_option_entries[];
+
+gint           audite_bench_run                (GVariantDict *options);
+gboolean       audite_bench_write_book         (const gchar  *filename,
+                                                gint          hours,
+                                                gint          n_chapters,
+                                                gint          cover_size);
+void           audite_bench_remove_dir         (const gchar  *path);
+
+
+#endif /* __AUDITE_BENCH_H */
@@ -0,0 +1,256 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "audite_cache.h"
+#include "audite_chapters.h"
+#include "audite_loader.h"
+
+#define BOOK_CACHE_VERSION 5
+#define BOOK_CACHE_TYPE "(uubsssssstiiia(tts))"
+
+#define CACHE_FILE_ATTRIBUTES G_FILE_ATTRIBUTE_STANDARD_SIZE "," \
+                              G_FILE_ATTRIBUTE_TIME_MODIFIED "," \
+                              G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC
+
+/* Identifies a file by uri, size and modification time, so any cached
+ * data derived from it goes stale as soon as the file is replaced or
+ * rewritten. Returns NULL when the file cannot be queried. */
+gchar *
+audite_cache_file_key (const gchar *uri, GCancellable *cancellable)
+{
+  GFile *file;
+  GFileInfo *info;
+  gchar *identity, *key;
+
+  file = g_file_new_for_uri (uri);
+  info = g_file_query_info (file, CACHE_FILE_ATTRIBUTES, G_FILE_QUERY_INFO_NONE,
+                            cancellable, NULL);
+  g_object_unref (file);
+  if (!info)
+    return NULL;
+
+  identity = g_strdup_printf ("%s\n%" G_GOFFSET_FORMAT "\n%" G_GUINT64_FORMAT ".%06u",
+                              uri,
+                              g_file_info_get_size (info),
+                              g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED),
+                              g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC));
+  key = g_compute_checksum_for_string (G_CHECKSUM_SHA1, identity, -1);
+  g_free (identity);
+  g_object_unref (info);
+  return key;
+}
+
+/* Returns $XDG_CACHE_HOME/audite/@subdir/@key@suffix, creating the
+ * directory on first use. */
+gchar *
+audite_cache_build_filename (const gchar *subdir,
+                             const gchar *key,
+                             const gchar *suffix)
+{
+  gchar *dir, *basename, *filename;
+
+  dir = g_build_filename (g_get_user_cache_dir (), "audite", subdir, NULL);
+  g_mkdir_with_parents (dir, 0700);
+  basename = g_strconcat (key, suffix, NULL);
+  filename = g_build_filename (dir, basename, NULL);
+  g_free (basename);
+  g_free (dir);
+  return filename;
+}
+
+/* Fills @items, @n_items of @item_size bytes each, from the file
+ * audite_cache_store_items wrote for @key. A file of another @version or
+ * count is a miss, so a changed layout or a changed book never reads
+ * back wrong. */
+gboolean
+audite_cache_load_items (const gchar *subdir,
+                         const gchar *key,
+                         const gchar *suffix,
+                         guint32      version,
+                         gpointer     items,
+                         guint        n_items,
+                         gsize        item_size)
+{
+  gchar *filename, *contents;
+  gsize length;
+  gboolean loaded = FALSE;
+
+  if (!key)
+    return FALSE;
+  filename = audite_cache_build_filename (subdir, key, suffix);
+  if (g_file_get_contents (filename, &contents, &length, NULL)) {
+    if (length == 8 + n_items * item_size
+        && ((guint32 *) contents)[0] == version
+        && ((guint32 *) contents)[1] == n_items) {
+      memcpy (items, contents + 8, n_items * item_size);
+      loaded = TRUE;
+    }
+    g_free (contents);
+  }
+  g_free (filename);
+  return loaded;
+}
+
+/* Writes @items behind a header of @version and @n_items, in host byte
+ * order; the cache never leaves the machine. */
+void
+audite_cache_store_items (const gchar   *subdir,
+                          const gchar   *key,
+                          const gchar   *suffix,
+                          guint32        version,
+                          gconstpointer  items,
+                          guint          n_items,
+                          gsize          item_size)
+{
+  guint8 *contents;
+  gchar *filename;
+  gsize length;
+
+  if (!key)
+    return;
+  length = 8 + n_items * item_size;
+  contents = g_malloc (length);
+  ((guint32 *) contents)[0] = version;
+  ((guint32 *) contents)[1] = n_items;
+  memcpy (contents + 8, items, n_items * item_size);
+  filename = audite_cache_build_filename (subdir, key, suffix);
+  g_file_set_contents (filename, (const gchar *) contents, length, NULL);
+  g_free (filename);
+  g_free (contents);
+}
+
+static gchar *
+cache_strdup (const gchar *value)
+{
+  return (value && *value) ? g_strdup (value) : NULL;
+}
+
+/* The book cache is a single serialized GVariant, mapped straight from
+ * disk on load. Untrusted data is validated lazily by GVariant, so a
+ * damaged file reads back as empty values instead of crashing. */
+AuditeBookInfo *
+audite_cache_load_book (const gchar *key)
+{
+  AuditeBookInfo *info;
+  GMappedFile *mapped;
+  GVariant *variant, *chapters;
+  GBytes *bytes;
+  gchar *filename;
+  const gchar *title, *artist, *album, *genre, *date, *codec;
+  guint32 version, container;
+  guint64 start, end;
+  gsize index, n_chapters;
+
+  filename = audite_cache_build_filename ("books", key, ".gvariant");
+  mapped = g_mapped_file_new (filename, FALSE, NULL);
+  g_free (filename);
+  if (!mapped)
+    return NULL;
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  g_mapped_file_unref (mapped);
+  variant = g_variant_new_from_bytes (G_VARIANT_TYPE (BOOK_CACHE_TYPE), bytes, FALSE);
+  g_bytes_unref (bytes);
+
+  g_variant_get_child (variant, 0, "u", &version);
+  if (version != BOOK_CACHE_VERSION) {
+    g_variant_unref (variant);
+    return NULL;
+  }
+
+  info = g_slice_new0 (AuditeBookInfo);
+  info->from_cache = TRUE;
+  g_variant_get (variant, "(uub&s&s&s&s&s&stiii@a(tts))",
+                 &version, &container, &info->has_cover,
+                 &title, &artist, &album, &genre, &date, &codec,
+                 &info->duration,
+                 &info->sample_rate, &info->channels, &info->bitrate,
+                 &chapters);
+  info->container = container;
+  info->title = cache_strdup (title);
+  info->artist = cache_strdup (artist);
+  info->album = cache_strdup (album);
+  info->genre = cache_strdup (genre);
+  info->date = cache_strdup (date);
+  info->codec = cache_strdup (codec);
+
+  n_chapters = g_variant_n_children (chapters);
+  if (n_chapters > 0) {
+    info->chapters = audite_chapters_new (n_chapters);
+    for (index = 0; index < n_chapters; index++) {
+      g_variant_get_child (chapters, index, "(tt&s)", &start, &end, &title);
+      audite_chapters_append (info->chapters, title, start, end);
+    }
+  }
+
+  g_variant_unref (chapters);
+  g_variant_unref (variant);
+  return info;
+}
+
+static void
+cache_write_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+  GBytes *bytes = task_data;
+  const gchar *filename = g_object_get_data (G_OBJECT (task), "filename");
+
+  g_file_set_contents (filename,
+                       g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes),
+                       NULL);
+}
+
+/* Serializes @info on the calling thread and writes it out on a worker,
+ * atomically, so a reader never maps a half written file. */
+void
+audite_cache_store_book (const AuditeBookInfo *info)
+{
+  GVariantBuilder chapters;
+  GVariant *variant;
+  GTask *task;
+  const AuditeChapter *chapter;
+  guint index;
+
+  g_return_if_fail (info->cache_key != NULL);
+
+  g_variant_builder_init (&chapters, G_VARIANT_TYPE ("a(tts)"));
+  for (index = 0; info->chapters && index < info->chapters->len; index++) {
+    chapter = &g_array_index (info->chapters, AuditeChapter, index);
+    g_variant_builder_add (&chapters, "(tts)",
+                           chapter->start, chapter->end,
+                           chapter->title ? chapter->title : "");
+  }
+
+  variant = g_variant_new (BOOK_CACHE_TYPE,
+                           BOOK_CACHE_VERSION, (guint32) info->container, info->has_cover,
+                           info->title ? info->title : "",
+                           info->artist ? info->artist : "",
+                           info->album ? info->album : "",
+                           info->genre ? info->genre : "",
+                           info->date ? info->date : "",
+                           info->codec ? info->codec : "",
+                           info->duration,
+                           info->sample_rate, info->channels, info->bitrate,
+                           &chapters);
+  g_variant_ref_sink (variant);
+
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  g_object_set_data_full (G_OBJECT (task), "filename",
+                          audite_cache_build_filename ("books", info->cache_key, ".gvariant"),
+                          g_free);
+  g_task_set_task_data (task, g_variant_get_data_as_bytes (variant),
+                        (GDestroyNotify) g_bytes_unref);
+  g_task_run_in_thread (task, cache_write_thread);
+  g_object_unref (task);
+  g_variant_unref (variant);
+}
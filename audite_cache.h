@@ -0,0 +1,39 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_CACHE_H
+#define __AUDITE_CACHE_H
+
+#include <gio/gio.h>
+#include "audite_loader.h"
+
+
+gchar         *audite_cache_file_key           (const gchar  *uri,
+                                                GCancellable *cancellable);
+gchar         *audite_cache_build_filename     (const gchar  *subdir,
+                                                const gchar  *key,
+                                                const gchar  *suffix);
+gboolean       audite_cache_load_items         (const gchar  *subdir,
+                                                const gchar  *key,
+                                                const gchar  *suffix,
+                                                guint32       version,
+                                                gpointer      items,
+                                                guint         n_items,
+                                                gsize         item_size);
+void           audite_cache_store_items        (const gchar  *subdir,
+                                                const gchar  *key,
+                                                const gchar  *suffix,
+                                                guint32       version,
+                                                gconstpointer items,
+                                                guint         n_items,
+                                                gsize         item_size);
+
+AuditeBookInfo *audite_cache_load_book         (const gchar          *key);
+void            audite_cache_store_book        (const AuditeBookInfo *info);
+
+
+#endif /* __AUDITE_CACHE_H */
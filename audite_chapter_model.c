@@ -0,0 +1,318 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * A flat GtkTreeModel over the chapter array of a book. Rows are not
+ * stored anywhere: an iter is just a chapter index and every cell is
+ * produced on request, so the duration string is only formatted for rows
+ * the view actually draws.
+ */
+
+#include <gtk/gtk.h>
+
+#include "audite_chapter_model.h"
+#include "audite_chapters.h"
+
+struct _AuditeChapterModel
+{
+  GObject  parent;
+
+  GArray  *chapters;
+  guint    n_rows;
+  gint     current;
+  gint     stamp;
+};
+
+static void audite_chapter_model_tree_model_init (GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (AuditeChapterModel, audite_chapter_model, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL,
+                                                audite_chapter_model_tree_model_init));
+
+static gboolean
+chapter_model_set_iter (AuditeChapterModel *model, GtkTreeIter *iter, gint index)
+{
+  if (index < 0 || index >= (gint) model->n_rows) {
+    iter->stamp = 0;
+    return FALSE;
+  }
+  iter->stamp = model->stamp;
+  iter->user_data = GINT_TO_POINTER (index);
+  return TRUE;
+}
+
+static gint
+chapter_model_iter_index (AuditeChapterModel *model, GtkTreeIter *iter)
+{
+  g_return_val_if_fail (iter->stamp == model->stamp, -1);
+
+  return GPOINTER_TO_INT (iter->user_data);
+}
+
+static gchar *
+chapter_model_format_duration (guint64 seconds)
+{
+  guint hrs = seconds / 3600;
+  guint mins = seconds / 60 % 60;
+
+  if (hrs)
+    return g_strdup_printf ("%u:%02u:%02u", hrs, mins, (guint) (seconds % 60));
+  return g_strdup_printf ("%02u:%02u", mins, (guint) (seconds % 60));
+}
+
+static void
+chapter_model_row_changed (AuditeChapterModel *model, gint index)
+{
+  GtkTreePath *path;
+  GtkTreeIter iter;
+
+  if (!chapter_model_set_iter (model, &iter, index))
+    return;
+  path = gtk_tree_path_new_from_indices (index, -1);
+  gtk_tree_model_row_changed (GTK_TREE_MODEL (model), path, &iter);
+  gtk_tree_path_free (path);
+}
+
+static GtkTreeModelFlags
+chapter_model_get_flags (GtkTreeModel *tree_model)
+{
+  return GTK_TREE_MODEL_LIST_ONLY | GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+static gint
+chapter_model_get_n_columns (GtkTreeModel *tree_model)
+{
+  return AUDITE_CHAPTER_N_COLUMNS;
+}
+
+static GType
+chapter_model_get_column_type (GtkTreeModel *tree_model, gint column)
+{
+  switch (column) {
+    case AUDITE_CHAPTER_COLUMN_NUMBER:
+      return G_TYPE_INT;
+    case AUDITE_CHAPTER_COLUMN_START:
+    case AUDITE_CHAPTER_COLUMN_END:
+      return G_TYPE_UINT64;
+    default:
+      return G_TYPE_STRING;
+  }
+}
+
+static gboolean
+chapter_model_get_iter (GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path)
+{
+  if (gtk_tree_path_get_depth (path) != 1)
+    return FALSE;
+  return chapter_model_set_iter (AUDITE_CHAPTER_MODEL (tree_model), iter,
+                                 gtk_tree_path_get_indices (path)[0]);
+}
+
+static GtkTreePath *
+chapter_model_get_path (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+  gint index = chapter_model_iter_index (AUDITE_CHAPTER_MODEL (tree_model), iter);
+
+  return gtk_tree_path_new_from_indices (index, -1);
+}
+
+static void
+chapter_model_get_value (GtkTreeModel *tree_model,
+                         GtkTreeIter  *iter,
+                         gint          column,
+                         GValue       *value)
+{
+  AuditeChapterModel *model = AUDITE_CHAPTER_MODEL (tree_model);
+  const AuditeChapter *chapter;
+  gint index;
+
+  g_value_init (value, chapter_model_get_column_type (tree_model, column));
+  index = chapter_model_iter_index (model, iter);
+  if (index < 0 || index >= (gint) model->n_rows)
+    return;
+  chapter = &g_array_index (model->chapters, AuditeChapter, index);
+
+  switch (column) {
+    case AUDITE_CHAPTER_COLUMN_ICON:
+      g_value_set_static_string (value, index == model->current ? "►" : NULL);
+      break;
+    case AUDITE_CHAPTER_COLUMN_NUMBER:
+      g_value_set_int (value, index + 1);
+      break;
+    case AUDITE_CHAPTER_COLUMN_NAME:
+      g_value_set_string (value, chapter->title);
+      break;
+    case AUDITE_CHAPTER_COLUMN_DURATION:
+      g_value_take_string (value,
+                           chapter_model_format_duration ((chapter->end - chapter->start) / GST_SECOND));
+      break;
+    case AUDITE_CHAPTER_COLUMN_START:
+      g_value_set_uint64 (value, chapter->start / GST_SECOND);
+      break;
+    case AUDITE_CHAPTER_COLUMN_END:
+      g_value_set_uint64 (value, chapter->end / GST_SECOND);
+      break;
+    default:
+      g_warn_if_reached ();
+  }
+}
+
+static gboolean
+chapter_model_iter_next (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+  AuditeChapterModel *model = AUDITE_CHAPTER_MODEL (tree_model);
+
+  return chapter_model_set_iter (model, iter, chapter_model_iter_index (model, iter) + 1);
+}
+
+static gboolean
+chapter_model_iter_previous (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+  AuditeChapterModel *model = AUDITE_CHAPTER_MODEL (tree_model);
+
+  return chapter_model_set_iter (model, iter, chapter_model_iter_index (model, iter) - 1);
+}
+
+static gboolean
+chapter_model_iter_children (GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent)
+{
+  if (parent) {
+    iter->stamp = 0;
+    return FALSE;
+  }
+  return chapter_model_set_iter (AUDITE_CHAPTER_MODEL (tree_model), iter, 0);
+}
+
+static gboolean
+chapter_model_iter_has_child (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+  return FALSE;
+}
+
+static gint
+chapter_model_iter_n_children (GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+  return iter ? 0 : (gint) AUDITE_CHAPTER_MODEL (tree_model)->n_rows;
+}
+
+static gboolean
+chapter_model_iter_nth_child (GtkTreeModel *tree_model,
+                              GtkTreeIter  *iter,
+                              GtkTreeIter  *parent,
+                              gint          n)
+{
+  if (parent) {
+    iter->stamp = 0;
+    return FALSE;
+  }
+  return chapter_model_set_iter (AUDITE_CHAPTER_MODEL (tree_model), iter, n);
+}
+
+static gboolean
+chapter_model_iter_parent (GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *child)
+{
+  iter->stamp = 0;
+  return FALSE;
+}
+
+static void
+audite_chapter_model_tree_model_init (GtkTreeModelIface *iface)
+{
+  iface->get_flags = chapter_model_get_flags;
+  iface->get_n_columns = chapter_model_get_n_columns;
+  iface->get_column_type = chapter_model_get_column_type;
+  iface->get_iter = chapter_model_get_iter;
+  iface->get_path = chapter_model_get_path;
+  iface->get_value = chapter_model_get_value;
+  iface->iter_next = chapter_model_iter_next;
+  iface->iter_previous = chapter_model_iter_previous;
+  iface->iter_children = chapter_model_iter_children;
+  iface->iter_has_child = chapter_model_iter_has_child;
+  iface->iter_n_children = chapter_model_iter_n_children;
+  iface->iter_nth_child = chapter_model_iter_nth_child;
+  iface->iter_parent = chapter_model_iter_parent;
+}
+
+static void
+audite_chapter_model_finalize (GObject *object)
+{
+  AuditeChapterModel *model = AUDITE_CHAPTER_MODEL (object);
+
+  if (model->chapters)
+    g_array_unref (model->chapters);
+
+  G_OBJECT_CLASS (audite_chapter_model_parent_class)->finalize (object);
+}
+
+static void
+audite_chapter_model_init (AuditeChapterModel *model)
+{
+  model->current = -1;
+  model->stamp = g_random_int_range (1, G_MAXINT);
+}
+
+static void
+audite_chapter_model_class_init (AuditeChapterModelClass *class)
+{
+  G_OBJECT_CLASS (class)->finalize = audite_chapter_model_finalize;
+}
+
+/* Shows the first @n_rows of @chapters, which may be NULL for an empty
+ * list. A new book gets a new model: set on the view in one call, its
+ * rows are read once instead of announced one by one. The array is
+ * referenced, not copied. */
+AuditeChapterModel *
+audite_chapter_model_new (GArray *chapters, guint n_rows)
+{
+  AuditeChapterModel *model;
+
+  g_return_val_if_fail (chapters ? n_rows <= chapters->len : n_rows == 0, NULL);
+
+  model = g_object_new (AUDITE_CHAPTER_MODEL_TYPE, NULL);
+  model->chapters = chapters ? g_array_ref (chapters) : NULL;
+  model->n_rows = n_rows;
+  return model;
+}
+
+/* Grows the rows shown of the same array, as the loader batches do, and
+ * announces only the new ones. Returns FALSE for any other array or a
+ * shorter list; those take a new model. */
+gboolean
+audite_chapter_model_add_rows (AuditeChapterModel *model,
+                               GArray             *chapters,
+                               guint               n_rows)
+{
+  GtkTreePath *path;
+  GtkTreeIter iter;
+  guint index;
+
+  if (!chapters || chapters != model->chapters || n_rows < model->n_rows)
+    return FALSE;
+  g_return_val_if_fail (n_rows <= chapters->len, FALSE);
+
+  for (index = model->n_rows; index < n_rows; index++) {
+    model->n_rows = index + 1;
+    chapter_model_set_iter (model, &iter, index);
+    path = gtk_tree_path_new_from_indices (index, -1);
+    gtk_tree_model_row_inserted (GTK_TREE_MODEL (model), path, &iter);
+    gtk_tree_path_free (path);
+  }
+  return TRUE;
+}
+
+/* Moves the play marker; only the row left and the row entered change. */
+void
+audite_chapter_model_set_current (AuditeChapterModel *model, gint index)
+{
+  gint previous = model->current;
+
+  if (index == previous)
+    return;
+  model->current = index;
+  chapter_model_row_changed (model, previous);
+  chapter_model_row_changed (model, index);
+}
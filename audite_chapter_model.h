@@ -0,0 +1,39 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_CHAPTER_MODEL_H
+#define __AUDITE_CHAPTER_MODEL_H
+
+#include <gtk/gtk.h>
+#include "audite_chapters.h"
+
+
+enum
+{
+  AUDITE_CHAPTER_COLUMN_ICON,
+  AUDITE_CHAPTER_COLUMN_NUMBER,
+  AUDITE_CHAPTER_COLUMN_NAME,
+  AUDITE_CHAPTER_COLUMN_DURATION,
+  AUDITE_CHAPTER_COLUMN_START,
+  AUDITE_CHAPTER_COLUMN_END,
+  AUDITE_CHAPTER_N_COLUMNS
+};
+
+#define AUDITE_CHAPTER_MODEL_TYPE (audite_chapter_model_get_type ())
+G_DECLARE_FINAL_TYPE (AuditeChapterModel, audite_chapter_model, AUDITE, CHAPTER_MODEL, GObject)
+
+
+AuditeChapterModel *audite_chapter_model_new          (GArray             *chapters,
+                                                       guint               n_rows);
+gboolean            audite_chapter_model_add_rows     (AuditeChapterModel *model,
+                                                       GArray             *chapters,
+                                                       guint               n_rows);
+void                audite_chapter_model_set_current  (AuditeChapterModel *model,
+                                                       gint                index);
+
+
+#endif /* __AUDITE_CHAPTER_MODEL_H */
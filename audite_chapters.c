@@ -0,0 +1,139 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <gst/gst.h>
+
+#include "audite_chapters.h"
+
+static void
+chapter_clear (gpointer data)
+{
+  AuditeChapter *chapter = data;
+
+  g_free (chapter->title);
+}
+
+GArray *
+audite_chapters_new (guint reserved_size)
+{
+  GArray *chapters;
+
+  chapters = g_array_sized_new (FALSE, FALSE, sizeof (AuditeChapter), reserved_size);
+  g_array_set_clear_func (chapters, chapter_clear);
+  return chapters;
+}
+
+void
+audite_chapters_append (GArray      *chapters,
+                        const gchar *title,
+                        GstClockTime start,
+                        GstClockTime end)
+{
+  AuditeChapter chapter;
+
+  chapter.title = g_strdup (title);
+  chapter.start = start;
+  chapter.end = end;
+  g_array_append_val (chapters, chapter);
+}
+
+/* Chapters are kept sorted by start time and never overlap, so the
+ * chapter containing @position is found by bisection. Returns -1 when
+ * @position falls outside every chapter. */
+gint
+audite_chapters_lookup (GArray *chapters, GstClockTime position)
+{
+  const AuditeChapter *chapter;
+  guint low = 0, high, middle;
+
+  if (!chapters || !GST_CLOCK_TIME_IS_VALID (position))
+    return -1;
+
+  high = chapters->len;
+  while (low < high) {
+    middle = low + (high - low) / 2;
+    chapter = &g_array_index (chapters, AuditeChapter, middle);
+    if (position < chapter->start)
+      high = middle;
+    else if (position >= chapter->end)
+      low = middle + 1;
+    else
+      return middle;
+  }
+  return -1;
+}
+
+static void
+chapters_add_toc_entries (GArray *chapters, GList *entries)
+{
+  GstTocEntry *entry;
+  GstTagList *tags;
+  GList *l, *sub;
+  gchar *title;
+  gint64 start, stop;
+
+  for (l = entries; l; l = l->next) {
+    entry = l->data;
+    sub = gst_toc_entry_get_sub_entries (entry);
+    /* editions only group chapters, and of nested chapters the
+     * innermost are the ones to navigate by */
+    if (gst_toc_entry_get_entry_type (entry) != GST_TOC_ENTRY_TYPE_CHAPTER || sub) {
+      chapters_add_toc_entries (chapters, sub);
+      continue;
+    }
+    if (!gst_toc_entry_get_start_stop_times (entry, &start, &stop) || start < 0)
+      continue;
+
+    title = NULL;
+    tags = gst_toc_entry_get_tags (entry);
+    if (tags)
+      gst_tag_list_get_string (tags, GST_TAG_TITLE, &title);
+    audite_chapters_append (chapters, title, start,
+                            stop > start ? (GstClockTime) stop : GST_CLOCK_TIME_NONE);
+    g_free (title);
+  }
+}
+
+static gint
+chapters_compare_start (gconstpointer a, gconstpointer b)
+{
+  const AuditeChapter *first = a, *second = b;
+
+  if (first->start == second->start)
+    return 0;
+  return first->start < second->start ? -1 : 1;
+}
+
+/* Returns the chapters of the GStreamer @toc, sorted and not overlapping,
+ * or NULL when it has none. Demuxers leave the end of the last chapter
+ * open at times; it then ends at @duration. */
+GArray *
+audite_chapters_from_toc (GstToc *toc, GstClockTime duration)
+{
+  AuditeChapter *chapter, *next;
+  GArray *chapters;
+  guint i;
+
+  chapters = audite_chapters_new (0);
+  chapters_add_toc_entries (chapters, gst_toc_get_entries (toc));
+  if (chapters->len == 0) {
+    g_array_unref (chapters);
+    return NULL;
+  }
+
+  g_array_sort (chapters, chapters_compare_start);
+  for (i = 0; i < chapters->len; i++) {
+    chapter = &g_array_index (chapters, AuditeChapter, i);
+    next = i + 1 < chapters->len ? &g_array_index (chapters, AuditeChapter, i + 1) : NULL;
+    if (next && (!GST_CLOCK_TIME_IS_VALID (chapter->end) || chapter->end > next->start))
+      chapter->end = next->start;
+    else if (!next && GST_CLOCK_TIME_IS_VALID (duration)
+             && (!GST_CLOCK_TIME_IS_VALID (chapter->end) || chapter->end > duration))
+      chapter->end = duration;
+  }
+  return chapters;
+}
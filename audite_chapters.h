@@ -0,0 +1,35 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_CHAPTERS_H
+#define __AUDITE_CHAPTERS_H
+
+#include <gst/gst.h>
+
+
+typedef struct _AuditeChapter AuditeChapter;
+
+struct _AuditeChapter
+{
+  gchar        *title;
+  GstClockTime  start;
+  GstClockTime  end;
+};
+
+
+GArray        *audite_chapters_new             (guint reserved_size);
+void           audite_chapters_append          (GArray      *chapters,
+                                                const gchar *title,
+                                                GstClockTime start,
+                                                GstClockTime end);
+gint           audite_chapters_lookup          (GArray      *chapters,
+                                                GstClockTime position);
+GArray        *audite_chapters_from_toc        (GstToc      *toc,
+                                                GstClockTime duration);
+
+
+#endif /* __AUDITE_CHAPTERS_H */
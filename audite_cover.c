@@ -0,0 +1,174 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gst/gst.h>
+
+#include "audite_cache.h"
+#include "audite_cover.h"
+
+typedef struct
+{
+  gchar     *uri;
+  GstSample *sample;
+  gint       size;
+} CoverData;
+
+static void
+cover_data_free (CoverData *data)
+{
+  g_free (data->uri);
+  if (data->sample)
+    gst_sample_unref (data->sample);
+  g_slice_free (CoverData, data);
+}
+
+/* Lets the loader scale while decoding (JPEG does it in the DCT), so the
+ * full size image is never materialized. */
+static void
+cover_size_prepared (GdkPixbufLoader *loader,
+                     gint             width,
+                     gint             height,
+                     gpointer         user_data)
+{
+  gint size = GPOINTER_TO_INT (user_data);
+
+  if (width >= height)
+    gdk_pixbuf_loader_set_size (loader, size, MAX (1, height * size / width));
+  else
+    gdk_pixbuf_loader_set_size (loader, MAX (1, width * size / height), size);
+}
+
+GdkPixbuf *
+audite_cover_decode (GstSample *sample, gint size, GError **error)
+{
+  GstBuffer *buffer;
+  GstMapInfo info;
+  GdkPixbufLoader *loader;
+  GdkPixbuf *pixbuf = NULL;
+
+  buffer = gst_sample_get_buffer (sample);
+  if (!buffer || !gst_buffer_map (buffer, &info, GST_MAP_READ)) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                         "failed to map gst buffer");
+    return NULL;
+  }
+
+  loader = gdk_pixbuf_loader_new ();
+  g_signal_connect (loader, "size-prepared",
+                    G_CALLBACK (cover_size_prepared), GINT_TO_POINTER (size));
+  if (gdk_pixbuf_loader_write (loader, info.data, info.size, error)) {
+    if (gdk_pixbuf_loader_close (loader, error)) {
+      pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+      if (pixbuf)
+        g_object_ref (pixbuf);
+    }
+  }
+  else
+    gdk_pixbuf_loader_close (loader, NULL);
+
+  g_object_unref (loader);
+  gst_buffer_unmap (buffer, &info);
+  return pixbuf;
+}
+
+static void
+cover_store (GdkPixbuf *pixbuf, const gchar *filename)
+{
+  gchar *data;
+  gsize length;
+
+  if (gdk_pixbuf_save_to_buffer (pixbuf, &data, &length, "png", NULL, NULL)) {
+    g_file_set_contents (filename, data, length, NULL);
+    g_free (data);
+  }
+}
+
+/* Where the thumbnail of the file with cache @key is kept at @size. */
+gchar *
+audite_cover_cache_filename (const gchar *key, gint size)
+{
+  gchar *suffix, *filename;
+
+  suffix = g_strdup_printf ("-%d.png", size);
+  filename = audite_cache_build_filename ("covers", key, suffix);
+  g_free (suffix);
+  return filename;
+}
+
+static void
+cover_thread (GTask        *task,
+              gpointer      source_object,
+              gpointer      task_data,
+              GCancellable *cancellable)
+{
+  CoverData *data = task_data;
+  GdkPixbuf *pixbuf = NULL;
+  GError *error = NULL;
+  gchar *key, *filename = NULL;
+
+  key = audite_cache_file_key (data->uri, cancellable);
+  if (key) {
+    filename = audite_cover_cache_filename (key, data->size);
+    pixbuf = gdk_pixbuf_new_from_file (filename, NULL);
+    g_free (key);
+  }
+
+  if (!pixbuf && data->sample && !g_cancellable_is_cancelled (cancellable)) {
+    pixbuf = audite_cover_decode (data->sample, data->size, &error);
+    if (pixbuf && filename)
+      cover_store (pixbuf, filename);
+  }
+  g_free (filename);
+
+  if (error) {
+    g_clear_object (&pixbuf);
+    g_task_return_error (task, error);
+  }
+  else if (!g_task_return_error_if_cancelled (task))
+    g_task_return_pointer (task, pixbuf, g_object_unref);
+  else
+    g_clear_object (&pixbuf);
+}
+
+/* Produces the cover of @uri fitted into a @size box. @uri is the file the
+ * cover is embedded in, whose cache key, and so its modification time,
+ * names the thumbnail. The thumbnail cache is tried first; @sample is only
+ * decoded on a miss, and may be NULL to probe the cache alone, in which
+ * case a miss yields NULL without an error. */
+void
+audite_cover_load_async (gpointer             source_object,
+                         const gchar         *uri,
+                         GstSample           *sample,
+                         gint                 size,
+                         GCancellable        *cancellable,
+                         GAsyncReadyCallback  callback,
+                         gpointer             user_data)
+{
+  GTask *task;
+  CoverData *data;
+
+  data = g_slice_new0 (CoverData);
+  data->uri = g_strdup (uri);
+  data->sample = sample ? gst_sample_ref (sample) : NULL;
+  data->size = size;
+
+  task = g_task_new (source_object, cancellable, callback, user_data);
+  g_task_set_source_tag (task, audite_cover_load_async);
+  g_task_set_task_data (task, data, (GDestroyNotify) cover_data_free);
+  g_task_run_in_thread (task, cover_thread);
+  g_object_unref (task);
+}
+
+GdkPixbuf *
+audite_cover_load_finish (GAsyncResult *result, GError **error)
+{
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
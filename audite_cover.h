@@ -0,0 +1,32 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_COVER_H
+#define __AUDITE_COVER_H
+
+#include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gst/gst.h>
+
+
+GdkPixbuf     *audite_cover_decode             (GstSample           *sample,
+                                                gint                 size,
+                                                GError             **error);
+void           audite_cover_load_async         (gpointer             source_object,
+                                                const gchar         *uri,
+                                                GstSample           *sample,
+                                                gint                 size,
+                                                GCancellable        *cancellable,
+                                                GAsyncReadyCallback  callback,
+                                                gpointer             user_data);
+GdkPixbuf     *audite_cover_load_finish        (GAsyncResult        *result,
+                                                GError             **error);
+gchar         *audite_cover_cache_filename     (const gchar         *key,
+                                                gint                 size);
+
+
+#endif /* __AUDITE_COVER_H */
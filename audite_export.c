@@ -0,0 +1,471 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Writes every chapter of a book to a file of its own, named after its
+ * number and title. AAC and MP3 are copied as they are: the demuxer seeks
+ * to the chapter and stops at its end, and the frames go straight into a
+ * new container, so nothing is decoded. Anything else is encoded to Opus.
+ * Chapters run in parallel on all cores, each with its own pipeline.
+ */
+
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+#include "audite_export.h"
+#include "audite_chapters.h"
+
+#define EXPORT_PREROLL_TIMEOUT (10 * GST_SECOND)
+#define EXPORT_POLL_INTERVAL (200 * GST_MSECOND)
+
+/* decoding stops at the formats that can be copied */
+#define EXPORT_CAPS \
+  "audio/mpeg, mpegversion=(int)4; audio/mpeg, mpegversion=(int)1, layer=(int)3; audio/x-raw"
+#define EXPORT_AAC_TAIL "aacparse ! mp4mux ! filesink name=sink async=false"
+#define EXPORT_MP3_TAIL "mpegaudioparse ! id3v2mux ! filesink name=sink async=false"
+#define EXPORT_RAW_TAIL \
+  "audioconvert ! audioresample ! opusenc bitrate=64000 ! oggmux ! " \
+  "filesink name=sink async=false"
+
+typedef struct
+{
+  gchar        *uri;
+  GstClockTime  start;          /* inside its file */
+  GstClockTime  stop;           /* NONE for the whole file */
+  GstClockTime  duration;
+  guint         index;
+  gchar        *title;
+  gchar        *filename;       /* known once the format is */
+  GTask        *task;
+  gboolean      linked;
+  gint          seeked;         /* set on the streaming thread */
+  gint          done_ms;
+} ExportChapter;
+
+typedef struct
+{
+  GPtrArray        *chapters;   /* ExportChapter */
+  gchar            *folder;
+  gchar            *album;
+  gchar            *artist;
+  guint             width;      /* digits of the chapter numbers */
+  AuditeExportFunc  progress_func;
+  gpointer          progress_data;
+
+  GMutex            lock;
+  guint             n_failed;
+  gchar            *first_error;
+} ExportData;
+
+typedef struct
+{
+  GTask   *task;
+  guint    index;
+  gdouble  fraction;
+} ExportProgress;
+
+static void
+export_chapter_free (gpointer data)
+{
+  ExportChapter *chapter = data;
+
+  g_free (chapter->uri);
+  g_free (chapter->title);
+  g_free (chapter->filename);
+  g_slice_free (ExportChapter, chapter);
+}
+
+static void
+export_data_free (gpointer user_data)
+{
+  ExportData *data = user_data;
+
+  g_ptr_array_unref (data->chapters);
+  g_free (data->folder);
+  g_free (data->album);
+  g_free (data->artist);
+  g_free (data->first_error);
+  g_mutex_clear (&data->lock);
+  g_slice_free (ExportData, data);
+}
+
+static gboolean
+export_progress_dispatch (gpointer user_data)
+{
+  ExportProgress *progress = user_data;
+  ExportData *data = g_task_get_task_data (progress->task);
+
+  if (!g_cancellable_is_cancelled (g_task_get_cancellable (progress->task)))
+    data->progress_func (progress->index, progress->fraction, data->progress_data);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+export_progress_free (gpointer user_data)
+{
+  ExportProgress *progress = user_data;
+
+  g_object_unref (progress->task);
+  g_slice_free (ExportProgress, progress);
+}
+
+static void
+export_report (ExportChapter *chapter, gdouble fraction)
+{
+  ExportData *data = g_task_get_task_data (chapter->task);
+  ExportProgress *progress;
+
+  if (!data->progress_func)
+    return;
+  progress = g_slice_new (ExportProgress);
+  progress->task = g_object_ref (chapter->task);
+  progress->index = chapter->index;
+  progress->fraction = CLAMP (fraction, 0.0, 1.0);
+  g_main_context_invoke_full (g_task_get_context (chapter->task), G_PRIORITY_DEFAULT,
+                              export_progress_dispatch, progress,
+                              export_progress_free);
+}
+
+/* "07 - Title.m4a", with characters a file system may refuse replaced. */
+static gchar *
+export_build_filename (ExportData *data, ExportChapter *chapter, const gchar *extension)
+{
+  gchar *title, *name, *filename;
+
+  if (chapter->title && *chapter->title)
+    title = g_strdup (chapter->title);
+  else
+    title = g_strdup_printf ("Chapter %u", chapter->index + 1);
+  g_strdelimit (title, "/\\:*?\"<>|", '_');
+  g_strdelimit (title, "\n\r\t", ' ');
+
+  name = g_strdup_printf ("%0*u - %s.%s", data->width, chapter->index + 1,
+                          g_strstrip (title), extension);
+  filename = g_build_filename (data->folder, name, NULL);
+  g_free (name);
+  g_free (title);
+  return filename;
+}
+
+/* Runs on a streaming thread. Buffers before the seek to the chapter are
+ * dropped, so the muxer never starts a file with the head of the book;
+ * afterwards they only leave their position for the progress. */
+static GstPadProbeReturn
+export_probe (GstPad *pad, GstPadProbeInfo *info, ExportChapter *chapter)
+{
+  GstBuffer *buffer;
+  GstEvent *event;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_FLUSH) {
+    event = GST_PAD_PROBE_INFO_EVENT (info);
+    if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+      g_atomic_int_set (&chapter->seeked, TRUE);
+    return GST_PAD_PROBE_OK;
+  }
+  if (!g_atomic_int_get (&chapter->seeked))
+    return GST_PAD_PROBE_DROP;
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  if (GST_BUFFER_PTS_IS_VALID (buffer) && GST_BUFFER_PTS (buffer) >= chapter->start)
+    g_atomic_int_set (&chapter->done_ms,
+                      (gint) ((GST_BUFFER_PTS (buffer) - chapter->start) / GST_MSECOND));
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+export_tag (ExportData *data, ExportChapter *chapter, GstElement *tail)
+{
+  GstElement *setter;
+  GstTagList *tags;
+
+  setter = gst_bin_get_by_interface (GST_BIN (tail), GST_TYPE_TAG_SETTER);
+  if (!setter)
+    return;
+  tags = gst_tag_list_new (GST_TAG_TRACK_NUMBER, chapter->index + 1,
+                           GST_TAG_TRACK_COUNT, data->chapters->len, NULL);
+  if (chapter->title)
+    gst_tag_list_add (tags, GST_TAG_MERGE_REPLACE, GST_TAG_TITLE, chapter->title, NULL);
+  if (data->album)
+    gst_tag_list_add (tags, GST_TAG_MERGE_REPLACE, GST_TAG_ALBUM, data->album, NULL);
+  if (data->artist)
+    gst_tag_list_add (tags, GST_TAG_MERGE_REPLACE, GST_TAG_ARTIST, data->artist, NULL);
+  gst_tag_setter_merge_tags (GST_TAG_SETTER (setter), tags, GST_TAG_MERGE_REPLACE);
+  gst_tag_list_unref (tags);
+  gst_object_unref (setter);
+}
+
+/* Picks the rest of the pipeline for the first audio stream: a muxer for
+ * the formats that are copied, an encoder for decoded audio. */
+static void
+export_pad_added_handler (GstElement *source, GstPad *pad, ExportChapter *chapter)
+{
+  ExportData *data = g_task_get_task_data (chapter->task);
+  GstStructure *structure;
+  GstElement *tail, *sink;
+  GstCaps *caps;
+  GstPad *sink_pad;
+  const gchar *description = NULL, *extension = NULL;
+  gint version = 0, layer = 0;
+
+  if (chapter->linked)
+    return;
+  caps = gst_pad_get_current_caps (pad);
+  if (!caps)
+    caps = gst_pad_query_caps (pad, NULL);
+  structure = gst_caps_get_structure (caps, 0);
+  if (gst_structure_has_name (structure, "audio/mpeg")) {
+    gst_structure_get_int (structure, "mpegversion", &version);
+    gst_structure_get_int (structure, "layer", &layer);
+    if (version == 4) {
+      description = EXPORT_AAC_TAIL;
+      extension = "m4a";
+    }
+    else if (version == 1 && layer == 3) {
+      description = EXPORT_MP3_TAIL;
+      extension = "mp3";
+    }
+  }
+  else if (gst_structure_has_name (structure, "audio/x-raw")) {
+    description = EXPORT_RAW_TAIL;
+    extension = "opus";
+  }
+  gst_caps_unref (caps);
+  if (!description)
+    return;
+
+  tail = gst_parse_bin_from_description (description, TRUE, NULL);
+  if (!tail)
+    return;
+  chapter->filename = export_build_filename (data, chapter, extension);
+  sink = gst_bin_get_by_name (GST_BIN (tail), "sink");
+  g_object_set (sink, "location", chapter->filename, NULL);
+  gst_object_unref (sink);
+  export_tag (data, chapter, tail);
+
+  gst_bin_add (GST_BIN (GST_ELEMENT_PARENT (source)), tail);
+  gst_element_sync_state_with_parent (tail);
+  sink_pad = gst_element_get_static_pad (tail, "sink");
+  if (gst_pad_link (pad, sink_pad) == GST_PAD_LINK_OK) {
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+                       (GstPadProbeCallback) export_probe, chapter, NULL);
+    chapter->linked = TRUE;
+  }
+  gst_object_unref (sink_pad);
+}
+
+/* Writes one chapter. FALSE with @error set when it could not be, or
+ * when the export was cancelled; a partial file is removed. */
+static gboolean
+export_run_chapter (ExportChapter *chapter, GCancellable *cancellable, GError **error)
+{
+  GstElement *pipeline, *source;
+  GstMessage *message;
+  GstCaps *caps;
+  GstBus *bus;
+  gboolean done = FALSE, written = FALSE;
+  GstClockTime length;
+
+  pipeline = gst_pipeline_new (NULL);
+  source = gst_element_factory_make ("uridecodebin", NULL);
+  if (!source) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "uridecodebin is missing");
+    gst_object_unref (pipeline);
+    return FALSE;
+  }
+  caps = gst_caps_from_string (EXPORT_CAPS);
+  g_object_set (source, "uri", chapter->uri, "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_signal_connect (source, "pad-added", G_CALLBACK (export_pad_added_handler), chapter);
+  gst_bin_add (GST_BIN (pipeline), source);
+  bus = gst_element_get_bus (pipeline);
+
+  /* a whole file needs no seek, so nothing is held back */
+  chapter->seeked = !GST_CLOCK_TIME_IS_VALID (chapter->stop);
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  if (gst_element_get_state (pipeline, NULL, NULL, EXPORT_PREROLL_TIMEOUT)
+      == GST_STATE_CHANGE_FAILURE || !chapter->linked) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "No audio stream to export");
+    goto out;
+  }
+  if (GST_CLOCK_TIME_IS_VALID (chapter->stop)
+      && !gst_element_seek (pipeline, 1.0, GST_FORMAT_TIME,
+                            GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+                            GST_SEEK_TYPE_SET, chapter->start,
+                            GST_SEEK_TYPE_SET, chapter->stop)) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Could not seek to the chapter");
+    goto out;
+  }
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  length = chapter->duration;
+  while (!done) {
+    if (g_cancellable_set_error_if_cancelled (cancellable, error))
+      break;
+    message = gst_bus_timed_pop_filtered (bus, EXPORT_POLL_INTERVAL,
+                                          GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    if (!message) {
+      if (length > 0)
+        export_report (chapter, (gdouble) g_atomic_int_get (&chapter->done_ms)
+                                * GST_MSECOND / length);
+      continue;
+    }
+    done = TRUE;
+    written = GST_MESSAGE_TYPE (message) == GST_MESSAGE_EOS;
+    if (!written)
+      gst_message_parse_error (message, error, NULL);
+    gst_message_unref (message);
+  }
+
+out:
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+  if (!written && chapter->filename)
+    g_unlink (chapter->filename);
+  return written;
+}
+
+static void
+export_run (gpointer item, gpointer user_data)
+{
+  ExportChapter *chapter = item;
+  ExportData *data = g_task_get_task_data (chapter->task);
+  GCancellable *cancellable = g_task_get_cancellable (chapter->task);
+  GError *error = NULL;
+
+  /* chapters still queued when the export is cancelled are not started */
+  if (!g_cancellable_is_cancelled (cancellable)
+      && export_run_chapter (chapter, cancellable, &error))
+    export_report (chapter, 1.0);
+  else if (error && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    g_mutex_lock (&data->lock);
+    if (!data->n_failed++)
+      data->first_error = g_strdup_printf ("%s: %s", chapter->filename ? chapter->filename
+                                           : chapter->uri, error->message);
+    g_mutex_unlock (&data->lock);
+  }
+  g_clear_error (&error);
+  g_clear_object (&chapter->task);
+}
+
+static void
+export_thread (GTask        *task,
+               gpointer      source_object,
+               gpointer      task_data,
+               GCancellable *cancellable)
+{
+  ExportData *data = task_data;
+  ExportChapter *chapter;
+  GThreadPool *pool;
+  GError *error = NULL;
+  GFile *folder;
+  guint i;
+
+  folder = g_file_new_for_path (data->folder);
+  if (!g_file_make_directory_with_parents (folder, cancellable, &error)
+      && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
+    g_object_unref (folder);
+    g_task_return_error (task, error);
+    return;
+  }
+  g_clear_error (&error);
+  g_object_unref (folder);
+
+  /* copying is bound by the disk and encoding by the cores; one chapter
+   * per core does well for both */
+  pool = g_thread_pool_new (export_run, NULL, g_get_num_processors (), TRUE, NULL);
+  for (i = 0; i < data->chapters->len; i++) {
+    chapter = g_ptr_array_index (data->chapters, i);
+    chapter->task = g_object_ref (task);
+    g_thread_pool_push (pool, chapter, NULL);
+  }
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+  if (data->n_failed)
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "%u of %u chapters could not be exported; %s",
+                             data->n_failed, data->chapters->len, data->first_error);
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+/* Exports every chapter of @book into @folder, which is created when
+ * missing: chapters of a single file, or the tracks of a folder, each of
+ * which is a chapter. @progress_func is called on the calling thread's
+ * main context; cancelling @cancellable stops all chapters and removes
+ * the ones not finished. */
+void
+audite_export_chapters_async (gpointer              source_object,
+                              const AuditeBookInfo *book,
+                              GFile                *folder,
+                              GCancellable         *cancellable,
+                              AuditeExportFunc      progress_func,
+                              gpointer              progress_data,
+                              GAsyncReadyCallback   callback,
+                              gpointer              user_data)
+{
+  ExportData *data;
+  ExportChapter *chapter;
+  const AuditeChapter *source;
+  GTask *task;
+  guint i, n_chapters;
+
+  task = g_task_new (source_object, cancellable, callback, user_data);
+  g_task_set_source_tag (task, audite_export_chapters_async);
+
+  data = g_slice_new0 (ExportData);
+  data->chapters = g_ptr_array_new_with_free_func (export_chapter_free);
+  data->folder = g_file_get_path (folder);
+  data->album = g_strdup (book->title ? book->title : book->album);
+  data->artist = g_strdup (book->artist);
+  data->progress_func = progress_func;
+  data->progress_data = progress_data;
+  g_mutex_init (&data->lock);
+  g_task_set_task_data (task, data, export_data_free);
+
+  n_chapters = book->chapters ? book->chapters->len : 0;
+  for (i = 0; i < n_chapters && (!book->tracks || book->tracks[i]); i++) {
+    source = &g_array_index (book->chapters, AuditeChapter, i);
+    chapter = g_slice_new0 (ExportChapter);
+    chapter->index = i;
+    chapter->title = g_strdup (source->title);
+    chapter->duration = source->end - source->start;
+    if (book->tracks) {
+      chapter->uri = g_strdup (book->tracks[i]);
+      chapter->stop = GST_CLOCK_TIME_NONE;
+    }
+    else {
+      chapter->uri = g_strdup (book->uri);
+      chapter->start = source->start;
+      chapter->stop = source->end;
+    }
+    g_ptr_array_add (data->chapters, chapter);
+  }
+  for (n_chapters = data->chapters->len, data->width = 2; n_chapters >= 100; n_chapters /= 10)
+    data->width++;
+
+  if (!data->folder)
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "Chapters can only be exported to a local folder");
+  else if (data->chapters->len == 0)
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "The book has no chapters");
+  else
+    g_task_run_in_thread (task, export_thread);
+  g_object_unref (task);
+}
+
+gboolean
+audite_export_chapters_finish (GAsyncResult *result, GError **error)
+{
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
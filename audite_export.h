@@ -0,0 +1,34 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_EXPORT_H
+#define __AUDITE_EXPORT_H
+
+#include <gio/gio.h>
+#include "audite_loader.h"
+
+
+/* Called on the main context while chapter @index is written, with the
+ * share of it that is done; 1.0 once its file is complete. */
+typedef void (*AuditeExportFunc) (guint    index,
+                                  gdouble  fraction,
+                                  gpointer user_data);
+
+
+void           audite_export_chapters_async    (gpointer              source_object,
+                                                const AuditeBookInfo *book,
+                                                GFile                *folder,
+                                                GCancellable         *cancellable,
+                                                AuditeExportFunc      progress_func,
+                                                gpointer              progress_data,
+                                                GAsyncReadyCallback   callback,
+                                                gpointer              user_data);
+gboolean       audite_export_chapters_finish   (GAsyncResult         *result,
+                                                GError              **error);
+
+
+#endif /* __AUDITE_EXPORT_H */
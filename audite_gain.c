@@ -0,0 +1,181 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Per chapter gain on the playing stream. A volume element sits in
+ * playbin's audio-filter slot and its volume follows a linear control
+ * curve in stream time, so every sample gets its own value and a change
+ * of gain ramps over a fraction of a second instead of stepping. In a
+ * single file the curve is laid out once with a ramp across each chapter
+ * boundary. Tracks of a folder all start at stream time zero, so there
+ * the curve is redrawn as each new stream starts to pass the element.
+ */
+
+#include <gst/gst.h>
+#include <gst/player/player.h>
+#include <gst/controller/controller.h>
+
+#include "audite_chapters.h"
+#include "audite_gain.h"
+
+#define GAIN_RAMP (500 * GST_MSECOND)
+
+struct _AuditeGain
+{
+  AuditePlaylist             *playlist;
+  GstElement                 *volume;
+  GstControlBinding          *binding;
+  GstTimedValueControlSource *curve;
+  GstPad                     *pad;
+  gulong                      probe_id;
+
+  GMutex                      lock;
+  GArray                     *gains;       /* linear, per chapter; NULL when off */
+  gboolean                    tracks;
+  gdouble                     track_gain;  /* the last track started at this */
+};
+
+static gdouble
+gain_for_chapter (AuditeGain *gain, gint index)
+{
+  if (index < 0 || (guint) index >= gain->gains->len)
+    return 1.0;
+  return g_array_index (gain->gains, gdouble, index);
+}
+
+/* Runs on the streaming thread, in order with the data: the first buffer
+ * of the new track is right behind the event. */
+static GstPadProbeReturn
+gain_event_probe (GstPad *pad, GstPadProbeInfo *info, AuditeGain *gain)
+{
+  gdouble value;
+
+  if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) != GST_EVENT_STREAM_START)
+    return GST_PAD_PROBE_OK;
+
+  g_mutex_lock (&gain->lock);
+  if (gain->gains && gain->tracks) {
+    value = gain_for_chapter (gain, audite_playlist_get_starting_track (gain->playlist));
+    gst_timed_value_control_source_unset_all (gain->curve);
+    gst_timed_value_control_source_set (gain->curve, 0, gain->track_gain);
+    gst_timed_value_control_source_set (gain->curve, GAIN_RAMP, value);
+    gain->track_gain = value;
+  }
+  g_mutex_unlock (&gain->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+AuditeGain *
+audite_gain_new (GstPlayer *player, AuditePlaylist *playlist)
+{
+  AuditeGain *gain;
+  GstElement *pipeline;
+  GstControlSource *curve;
+
+  gain = g_slice_new0 (AuditeGain);
+  gain->playlist = playlist;
+  gain->track_gain = 1.0;
+  g_mutex_init (&gain->lock);
+
+  gain->volume = gst_element_factory_make ("volume", "chapter-gain");
+  if (!gain->volume)
+    return gain;
+  gst_object_ref_sink (gain->volume);
+
+  curve = gst_interpolation_control_source_new ();
+  g_object_set (curve, "mode", GST_INTERPOLATION_MODE_LINEAR, NULL);
+  gain->curve = GST_TIMED_VALUE_CONTROL_SOURCE (curve);
+  gain->binding = gst_direct_control_binding_new_absolute (GST_OBJECT (gain->volume),
+                                                          "volume", curve);
+  gst_object_ref (gain->binding);
+  gst_object_add_control_binding (GST_OBJECT (gain->volume), gain->binding);
+  /* passthrough until there are gains to apply */
+  gst_control_binding_set_disabled (gain->binding, TRUE);
+
+  gain->pad = gst_element_get_static_pad (gain->volume, "sink");
+  gain->probe_id = gst_pad_add_probe (gain->pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                                      (GstPadProbeCallback) gain_event_probe, gain, NULL);
+
+  pipeline = gst_player_get_pipeline (player);
+  g_object_set (pipeline, "audio-filter", gain->volume, NULL);
+  gst_object_unref (pipeline);
+  return gain;
+}
+
+void
+audite_gain_free (AuditeGain *gain)
+{
+  if (!gain)
+    return;
+
+  if (gain->volume) {
+    gst_pad_remove_probe (gain->pad, gain->probe_id);
+    gst_object_unref (gain->pad);
+    gst_object_unref (gain->binding);
+    gst_object_unref (gain->curve);
+    gst_object_unref (gain->volume);
+  }
+  if (gain->gains)
+    g_array_unref (gain->gains);
+  g_mutex_clear (&gain->lock);
+  g_slice_free (AuditeGain, gain);
+}
+
+/* @gains holds a linear gain for each of @chapters, NULL turns the gain
+ * off. With @tracks every chapter is a file of its own. */
+void
+audite_gain_set_chapters (AuditeGain *gain,
+                          GArray     *chapters,
+                          GArray     *gains,
+                          gboolean    tracks)
+{
+  const AuditeChapter *chapter;
+  GstClockTime start;
+  gdouble previous = 1.0, value;
+  guint i;
+
+  if (!gain->volume)
+    return;
+
+  g_mutex_lock (&gain->lock);
+  if (gain->gains)
+    g_array_unref (gain->gains);
+  gain->gains = chapters && gains ? g_array_ref (gains) : NULL;
+  gain->tracks = tracks;
+  gst_timed_value_control_source_unset_all (gain->curve);
+
+  if (!gain->gains) {
+    gst_control_binding_set_disabled (gain->binding, TRUE);
+    g_object_set (gain->volume, "volume", 1.0, NULL);
+    gain->track_gain = 1.0;
+  }
+  else if (tracks) {
+    gain->track_gain = gain_for_chapter (gain,
+                                         audite_playlist_get_starting_track (gain->playlist));
+    gst_timed_value_control_source_set (gain->curve, 0, gain->track_gain);
+    gst_control_binding_set_disabled (gain->binding, FALSE);
+  }
+  else {
+    for (i = 0; i < chapters->len && i < gains->len; i++) {
+      chapter = &g_array_index (chapters, AuditeChapter, i);
+      value = g_array_index (gains, gdouble, i);
+      if (i == 0)
+        gst_timed_value_control_source_set (gain->curve, 0, value);
+      else {
+        /* ramp across the boundary, half on either side */
+        start = chapter->start;
+        gst_timed_value_control_source_set (gain->curve,
+                                            start > GAIN_RAMP / 2 ? start - GAIN_RAMP / 2 : 0,
+                                            previous);
+        gst_timed_value_control_source_set (gain->curve, start + GAIN_RAMP / 2, value);
+      }
+      previous = value;
+    }
+    gst_control_binding_set_disabled (gain->binding, FALSE);
+  }
+  g_mutex_unlock (&gain->lock);
+}
@@ -0,0 +1,28 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_GAIN_H
+#define __AUDITE_GAIN_H
+
+#include <gst/gst.h>
+#include <gst/player/player.h>
+#include "audite_playlist.h"
+
+
+typedef struct _AuditeGain AuditeGain;
+
+
+AuditeGain    *audite_gain_new                 (GstPlayer      *player,
+                                                AuditePlaylist *playlist);
+void           audite_gain_free                (AuditeGain     *gain);
+void           audite_gain_set_chapters        (AuditeGain     *gain,
+                                                GArray         *chapters,
+                                                GArray         *gains,
+                                                gboolean        tracks);
+
+
+#endif /* __AUDITE_GAIN_H */
@@ -0,0 +1,246 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Chapters of an MP3 from the CHAP frames of its ID3v2.3 or v2.4 tag.
+ * The probe has already read the whole tag, so this only walks memory.
+ * Each CHAP frame carries its start and end in milliseconds and usually a
+ * TIT2 subframe with the title. The table of contents frame (CTOC) is not
+ * needed: chapters are played in time order anyway.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <gst/gst.h>
+
+#include "audite_id3.h"
+#include "audite_chapters.h"
+
+#define ID3_HEADER_SIZE 10
+#define ID3_FRAME_HEADER_SIZE 10
+#define ID3_CHAP_TIMES_SIZE 16
+
+#define ID3_FRAME_ID(a, b, c, d) \
+  (((guint32) (a) << 24) | ((guint32) (b) << 16) | ((guint32) (c) << 8) | (guint32) (d))
+
+typedef struct
+{
+  guint         version;
+  const guint8 *data;
+  gsize         size;
+  gsize         pos;
+} Id3Frames;
+
+static guint32
+id3_syncsafe (const guint8 *data)
+{
+  return (guint32) data[0] << 21 | (guint32) data[1] << 14 | (guint32) data[2] << 7 | data[3];
+}
+
+/* Drops the zero byte the writer put after every 0xff. */
+static guint8 *
+id3_resync (const guint8 *data, gsize size, gsize *out_size)
+{
+  guint8 *out = g_malloc (size ? size : 1);
+  gsize i, n = 0;
+
+  for (i = 0; i < size; i++) {
+    out[n++] = data[i];
+    if (data[i] == 0xff && i + 1 < size && data[i + 1] == 0x00)
+      i++;
+  }
+  *out_size = n;
+  return out;
+}
+
+/* Steps to the next frame; FALSE at the padding or at a frame that does
+ * not fit, after which nothing more can be trusted. */
+static gboolean
+id3_next_frame (Id3Frames     *frames,
+                guint32       *id,
+                guint16       *flags,
+                const guint8 **body,
+                gsize         *body_size)
+{
+  const guint8 *header;
+  gsize size;
+
+  if (frames->size - frames->pos < ID3_FRAME_HEADER_SIZE)
+    return FALSE;
+  header = frames->data + frames->pos;
+  if (header[0] == 0)
+    return FALSE;
+
+  *id = GST_READ_UINT32_BE (header);
+  size = frames->version == 4 ? id3_syncsafe (header + 4) : GST_READ_UINT32_BE (header + 4);
+  *flags = GST_READ_UINT16_BE (header + 8);
+  if (size > frames->size - frames->pos - ID3_FRAME_HEADER_SIZE)
+    return FALSE;
+
+  *body = header + ID3_FRAME_HEADER_SIZE;
+  *body_size = size;
+  frames->pos += ID3_FRAME_HEADER_SIZE + size;
+  return TRUE;
+}
+
+/* Text frames start with an encoding byte; only the first string of a
+ * list is used. */
+static gchar *
+id3_read_text (const guint8 *data, gsize size)
+{
+  const gchar *text = (const gchar *) data + 1;
+  gchar *result;
+
+  if (size < 1)
+    return NULL;
+  switch (data[0]) {
+    case 0:
+      return g_convert (text, size - 1, "UTF-8", "ISO-8859-1", NULL, NULL, NULL);
+    case 1:
+      return g_convert (text, size - 1, "UTF-8", "UTF-16", NULL, NULL, NULL);
+    case 2:
+      return g_convert (text, size - 1, "UTF-8", "UTF-16BE", NULL, NULL, NULL);
+    case 3:
+      result = g_strndup (text, size - 1);
+      if (g_utf8_validate (result, -1, NULL))
+        return result;
+      g_free (result);
+      return NULL;
+    default:
+      return NULL;
+  }
+}
+
+static void
+id3_read_chap (guint version, const guint8 *data, gsize size, GArray *chapters)
+{
+  Id3Frames subframes;
+  const guint8 *end, *body;
+  gsize body_size;
+  guint32 id, start, stop;
+  guint16 flags;
+  gchar *title = NULL;
+
+  /* the element ID comes first and is only used by CTOC */
+  end = memchr (data, 0, size);
+  if (!end || (gsize) (end + 1 - data) + ID3_CHAP_TIMES_SIZE > size)
+    return;
+  end++;
+  start = GST_READ_UINT32_BE (end);
+  stop = GST_READ_UINT32_BE (end + 4);
+
+  subframes.version = version;
+  subframes.data = end + ID3_CHAP_TIMES_SIZE;
+  subframes.size = size - (subframes.data - data);
+  subframes.pos = 0;
+  while (!title && id3_next_frame (&subframes, &id, &flags, &body, &body_size))
+    if (id == ID3_FRAME_ID ('T', 'I', 'T', '2'))
+      title = id3_read_text (body, body_size);
+
+  audite_chapters_append (chapters, title, start * GST_MSECOND, stop * GST_MSECOND);
+  g_free (title);
+}
+
+static gint
+id3_compare_chapters (gconstpointer a, gconstpointer b)
+{
+  const AuditeChapter *first = a, *second = b;
+
+  if (first->start == second->start)
+    return 0;
+  return first->start < second->start ? -1 : 1;
+}
+
+/* Frames are in any order and writers are sloppy about ends; chapters
+ * must be sorted and must not overlap for the lookup to work. */
+static void
+id3_fix_chapters (GArray *chapters)
+{
+  AuditeChapter *chapter, *next;
+  guint i;
+
+  g_array_sort (chapters, id3_compare_chapters);
+  for (i = 0; i + 1 < chapters->len; i++) {
+    chapter = &g_array_index (chapters, AuditeChapter, i);
+    next = &g_array_index (chapters, AuditeChapter, i + 1);
+    if (chapter->end <= chapter->start || chapter->end > next->start)
+      chapter->end = next->start;
+  }
+}
+
+/* Returns the chapters of the ID3v2 @tag, or NULL when it has none. */
+GArray *
+audite_id3_read_chapters (GBytes *tag)
+{
+  Id3Frames frames;
+  GArray *chapters;
+  const guint8 *data, *body;
+  guint8 *copy = NULL, *frame_copy;
+  gsize size, body_size;
+  guint32 id, extended;
+  guint16 flags;
+  guint8 tag_flags;
+
+  data = g_bytes_get_data (tag, &size);
+  if (size < ID3_HEADER_SIZE || memcmp (data, "ID3", 3) != 0
+      || (data[3] != 3 && data[3] != 4))
+    return NULL;
+
+  frames.version = data[3];
+  tag_flags = data[5];
+  frames.data = data + ID3_HEADER_SIZE;
+  frames.size = size - ID3_HEADER_SIZE;
+  if (frames.version == 4 && tag_flags & 0x10 && frames.size >= ID3_HEADER_SIZE)
+    frames.size -= ID3_HEADER_SIZE;
+  frames.pos = 0;
+
+  /* version 3 unsynchronises the tag as a whole, version 4 per frame */
+  if (frames.version == 3 && tag_flags & 0x80) {
+    copy = id3_resync (frames.data, frames.size, &frames.size);
+    frames.data = copy;
+  }
+  if (tag_flags & 0x40 && frames.size >= 4) {
+    if (frames.version == 3)
+      extended = GST_READ_UINT32_BE (frames.data) + 4;
+    else
+      extended = id3_syncsafe (frames.data);
+    frames.pos = MIN (extended, frames.size);
+  }
+
+  chapters = audite_chapters_new (0);
+  while (id3_next_frame (&frames, &id, &flags, &body, &body_size)) {
+    if (id != ID3_FRAME_ID ('C', 'H', 'A', 'P'))
+      continue;
+    /* compressed and encrypted frames are left alone */
+    if (frames.version == 3 ? flags & 0x00c0 : flags & 0x000c)
+      continue;
+    /* a group byte and a data length come before the frame data */
+    if ((frames.version == 3 ? flags & 0x0020 : flags & 0x0040) && body_size > 0) {
+      body++;
+      body_size--;
+    }
+    if (frames.version == 4 && flags & 0x0001 && body_size >= 4) {
+      body += 4;
+      body_size -= 4;
+    }
+    if (frames.version == 4 && flags & 0x0002) {
+      frame_copy = id3_resync (body, body_size, &body_size);
+      id3_read_chap (frames.version, frame_copy, body_size, chapters);
+      g_free (frame_copy);
+    }
+    else
+      id3_read_chap (frames.version, body, body_size, chapters);
+  }
+  g_free (copy);
+
+  if (chapters->len == 0) {
+    g_array_unref (chapters);
+    return NULL;
+  }
+  id3_fix_chapters (chapters);
+  return chapters;
+}
@@ -0,0 +1,18 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_ID3_H
+#define __AUDITE_ID3_H
+
+#include <glib.h>
+#include "audite_chapters.h"
+
+
+GArray        *audite_id3_read_chapters        (GBytes *tag);
+
+
+#endif /* __AUDITE_ID3_H */
@@ -0,0 +1,292 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Threads for background passes that only run when nothing else wants
+ * the CPU, playback included. Each thread here is made for the pass and
+ * ends with it, at idle scheduling priority from start to finish, so none
+ * is ever put back to normal priority or handed to a shared pool where
+ * the playing pipeline could pick it up.
+ *
+ * AuditeIdlePool is a fixed set of workers over a queue, for the chunks
+ * of a pass. The task pool does the same for the streaming threads of
+ * the pipelines that decode them: audite_idle_bus_sync_handler moves each
+ * GstTask onto it as it is created, and every task gets a thread of its
+ * own. audite_idle_decode runs one such pipeline over a stretch of a file.
+ */
+
+#include <gst/gst.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "audite_idle.h"
+
+#define IDLE_PREROLL_TIMEOUT (10 * GST_SECOND)
+#define IDLE_POLL_INTERVAL (100 * GST_MSECOND)
+
+struct _AuditeIdlePool
+{
+  GFunc        func;
+  gpointer     user_data;
+  GAsyncQueue *queue;
+  GPtrArray   *threads;
+};
+
+typedef struct
+{
+  GstTaskPoolFunction  func;
+  gpointer             user_data;
+} IdleJob;
+
+typedef struct
+{
+  GstTaskPool parent;
+} AuditeIdleTaskPool;
+
+typedef struct
+{
+  GstTaskPoolClass parent_class;
+} AuditeIdleTaskPoolClass;
+
+GType audite_idle_task_pool_get_type (void);
+
+G_DEFINE_TYPE (AuditeIdleTaskPool, audite_idle_task_pool, GST_TYPE_TASK_POOL)
+
+/* Called once at the start of every thread made here. */
+static void
+idle_enter (void)
+{
+#if defined(__linux__) && defined(SCHED_IDLE)
+  static gint warned = FALSE;
+  struct sched_param param = { 0 };
+  gint err;
+
+  /* the pass still runs, it just no longer keeps out of the way */
+  err = pthread_setschedparam (pthread_self (), SCHED_IDLE, &param);
+  if (err != 0 && g_atomic_int_compare_and_exchange (&warned, FALSE, TRUE))
+    g_print ("Idle scheduling not available: %s\n", g_strerror (err));
+#endif
+}
+
+static gpointer
+idle_pool_thread (gpointer data)
+{
+  AuditeIdlePool *pool = data;
+  gpointer item;
+
+  idle_enter ();
+  /* the pool itself is the sign to stop */
+  while ((item = g_async_queue_pop (pool->queue)) != pool)
+    pool->func (item, pool->user_data);
+  return NULL;
+}
+
+/* Like an exclusive GThreadPool of @n_threads calling @func, except that
+ * the threads end with the pool. When none can be started, items run on
+ * the pushing thread instead. */
+AuditeIdlePool *
+audite_idle_pool_new (GFunc func, gpointer user_data, guint n_threads)
+{
+  AuditeIdlePool *pool;
+  GThread *thread;
+  guint i;
+
+  pool = g_slice_new (AuditeIdlePool);
+  pool->func = func;
+  pool->user_data = user_data;
+  pool->queue = g_async_queue_new ();
+  pool->threads = g_ptr_array_new ();
+  for (i = 0; i < MAX (n_threads, 1); i++) {
+    thread = g_thread_try_new ("audite-idle", idle_pool_thread, pool, NULL);
+    if (thread)
+      g_ptr_array_add (pool->threads, thread);
+  }
+  return pool;
+}
+
+void
+audite_idle_pool_push (AuditeIdlePool *pool, gpointer item)
+{
+  g_return_if_fail (item != NULL);
+
+  if (pool->threads->len == 0)
+    pool->func (item, pool->user_data);
+  else
+    g_async_queue_push (pool->queue, item);
+}
+
+/* Waits until every item pushed is done and the workers have ended. */
+void
+audite_idle_pool_free (AuditeIdlePool *pool)
+{
+  guint i;
+
+  if (!pool)
+    return;
+
+  for (i = 0; i < pool->threads->len; i++)
+    g_async_queue_push (pool->queue, pool);
+  for (i = 0; i < pool->threads->len; i++)
+    g_thread_join (g_ptr_array_index (pool->threads, i));
+  g_ptr_array_unref (pool->threads);
+  g_async_queue_unref (pool->queue);
+  g_slice_free (AuditeIdlePool, pool);
+}
+
+static gpointer
+idle_task_thread (gpointer data)
+{
+  IdleJob *job = data;
+
+  idle_enter ();
+  job->func (job->user_data);
+  g_slice_free (IdleJob, job);
+  return NULL;
+}
+
+/* Threads are made per task, there is nothing to set up or tear down. */
+static void
+idle_task_pool_prepare (GstTaskPool *pool, GError **error)
+{
+}
+
+static void
+idle_task_pool_cleanup (GstTaskPool *pool)
+{
+}
+
+static gpointer
+idle_task_pool_push (GstTaskPool         *pool,
+                     GstTaskPoolFunction  func,
+                     gpointer             user_data,
+                     GError             **error)
+{
+  IdleJob *job;
+  GThread *thread;
+
+  job = g_slice_new (IdleJob);
+  job->func = func;
+  job->user_data = user_data;
+  thread = g_thread_try_new ("audite-stream", idle_task_thread, job, error);
+  if (!thread)
+    g_slice_free (IdleJob, job);
+  return thread;
+}
+
+/* The task has returned from its thread function, the thread ends. */
+static void
+idle_task_pool_join (GstTaskPool *pool, gpointer id)
+{
+  g_thread_join (id);
+}
+
+static void
+audite_idle_task_pool_init (AuditeIdleTaskPool *pool)
+{
+}
+
+static void
+audite_idle_task_pool_class_init (AuditeIdleTaskPoolClass *class)
+{
+  GstTaskPoolClass *pool_class = GST_TASK_POOL_CLASS (class);
+
+  pool_class->prepare = idle_task_pool_prepare;
+  pool_class->cleanup = idle_task_pool_cleanup;
+  pool_class->push = idle_task_pool_push;
+  pool_class->join = idle_task_pool_join;
+}
+
+GstTaskPool *
+audite_idle_task_pool_new (void)
+{
+  GstTaskPool *pool;
+
+  pool = g_object_new (audite_idle_task_pool_get_type (), NULL);
+  return gst_object_ref_sink (pool);
+}
+
+/* Sync handler for the bus of a pipeline whose streaming threads should
+ * run on @task_pool, see audite_idle_task_pool_new. A task is created
+ * before it is started, so it never runs on a thread of the default
+ * pool. */
+GstBusSyncReply
+audite_idle_bus_sync_handler (GstBus *bus, GstMessage *message, gpointer task_pool)
+{
+  GstStreamStatusType type;
+  const GValue *value;
+
+  if (GST_MESSAGE_TYPE (message) != GST_MESSAGE_STREAM_STATUS)
+    return GST_BUS_PASS;
+  gst_message_parse_stream_status (message, &type, NULL);
+  value = gst_message_get_stream_status_object (message);
+  if (type == GST_STREAM_STATUS_TYPE_CREATE && value
+      && G_VALUE_TYPE (value) == GST_TYPE_TASK)
+    gst_task_set_pool (g_value_get_object (value), task_pool);
+  return GST_BUS_PASS;
+}
+
+/* Decodes [@start, @stop) of @uri with the pipeline @description, which
+ * has a uridecodebin named "source" and a fakesink named "sink" that
+ * signals handoffs; @handoff gets every buffer with @user_data, on a
+ * streaming thread of @task_pool. FALSE when it could not be decoded or
+ * @cancellable was cancelled. */
+gboolean
+audite_idle_decode (const gchar  *description,
+                    const gchar  *uri,
+                    GstClockTime  start,
+                    GstClockTime  stop,
+                    GstTaskPool  *task_pool,
+                    GCallback     handoff,
+                    gpointer      user_data,
+                    GCancellable *cancellable)
+{
+  GstElement *pipeline, *source, *sink;
+  GstMessage *message;
+  GstBus *bus;
+  gboolean done = FALSE, decoded = FALSE;
+
+  pipeline = gst_parse_launch (description, NULL);
+  if (!pipeline)
+    return FALSE;
+  source = gst_bin_get_by_name (GST_BIN (pipeline), "source");
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_object_set (source, "uri", uri, NULL);
+  g_signal_connect (sink, "handoff", handoff, user_data);
+  bus = gst_element_get_bus (pipeline);
+  gst_bus_set_sync_handler (bus, audite_idle_bus_sync_handler,
+                            gst_object_ref (task_pool), gst_object_unref);
+
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  if (gst_element_get_state (pipeline, NULL, NULL, IDLE_PREROLL_TIMEOUT)
+      == GST_STATE_CHANGE_FAILURE)
+    goto out;
+  if (!gst_element_seek (pipeline, 1.0, GST_FORMAT_TIME,
+                         GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+                         GST_SEEK_TYPE_SET, start, GST_SEEK_TYPE_SET, stop))
+    goto out;
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  while (!done && !g_cancellable_is_cancelled (cancellable)) {
+    message = gst_bus_timed_pop_filtered (bus, IDLE_POLL_INTERVAL,
+                                          GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    if (!message)
+      continue;
+    done = TRUE;
+    decoded = GST_MESSAGE_TYPE (message) == GST_MESSAGE_EOS;
+    gst_message_unref (message);
+  }
+
+out:
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (bus);
+  gst_object_unref (source);
+  gst_object_unref (sink);
+  gst_object_unref (pipeline);
+  return decoded;
+}
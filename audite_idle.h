@@ -0,0 +1,38 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_IDLE_H
+#define __AUDITE_IDLE_H
+
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+
+typedef struct _AuditeIdlePool AuditeIdlePool;
+
+AuditeIdlePool *audite_idle_pool_new            (GFunc           func,
+                                                 gpointer        user_data,
+                                                 guint           n_threads);
+void            audite_idle_pool_push           (AuditeIdlePool *pool,
+                                                 gpointer        item);
+void            audite_idle_pool_free           (AuditeIdlePool *pool);
+
+GstTaskPool    *audite_idle_task_pool_new       (void);
+GstBusSyncReply audite_idle_bus_sync_handler    (GstBus         *bus,
+                                                 GstMessage     *message,
+                                                 gpointer        task_pool);
+gboolean        audite_idle_decode              (const gchar    *description,
+                                                 const gchar    *uri,
+                                                 GstClockTime    start,
+                                                 GstClockTime    stop,
+                                                 GstTaskPool    *task_pool,
+                                                 GCallback       handoff,
+                                                 gpointer        user_data,
+                                                 GCancellable   *cancellable);
+
+
+#endif /* __AUDITE_IDLE_H */
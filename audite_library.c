@@ -0,0 +1,453 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * The library walks its folders once on a worker, hands every audio file
+ * to a pool bounded by the number of processors and keeps one
+ * GFileMonitor per directory afterwards. Monitor events queue only the
+ * files they name, so keeping the library current costs work in
+ * proportion to what changed. Unchanged books are answered from the book
+ * cache by audite_loader_read_book() and are never parsed twice.
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+
+#include "audite_library.h"
+#include "audite_loader.h"
+
+struct _AuditeLibrary
+{
+  GObject       parent;
+
+  GMainContext *context;
+  GCancellable *cancellable;
+  GThreadPool  *pool;
+  GList        *folders;
+  GHashTable   *books;          /* uri -> AuditeBookInfo */
+  GHashTable   *monitors;       /* directory uri -> GFileMonitor */
+  gint          pending;
+  gint          walking;
+};
+
+typedef struct
+{
+  AuditeLibrary  *library;
+  GCancellable   *cancellable;
+  gchar          *uri;
+  AuditeBookInfo *info;
+} LibraryResult;
+
+typedef struct
+{
+  AuditeLibrary *library;
+  GCancellable  *cancellable;
+  GFile         *directory;
+} LibraryMonitor;
+
+enum {
+  BOOK_ADDED,
+  BOOK_REMOVED,
+  SCAN_FINISHED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+G_DEFINE_TYPE (AuditeLibrary, audite_library, G_TYPE_OBJECT);
+
+static void library_walk_file (AuditeLibrary *library, GFile *file, gboolean with_files);
+
+static void
+library_check_finished (AuditeLibrary *library)
+{
+  if (g_atomic_int_get (&library->walking) == 0
+      && g_atomic_int_get (&library->pending) == 0)
+    g_signal_emit (library, signals[SCAN_FINISHED], 0);
+}
+
+static void
+library_result_free (gpointer user_data)
+{
+  LibraryResult *result = user_data;
+
+  g_object_unref (result->cancellable);
+  g_free (result->uri);
+  audite_book_info_free (result->info);
+  g_slice_free (LibraryResult, result);
+}
+
+static gboolean
+library_result_dispatch (gpointer user_data)
+{
+  LibraryResult *result = user_data;
+  AuditeLibrary *library = result->library;
+
+  /* after dispose the library pointer must not be touched */
+  if (g_cancellable_is_cancelled (result->cancellable))
+    return G_SOURCE_REMOVE;
+
+  if (result->info) {
+    g_hash_table_replace (library->books, g_strdup (result->uri), result->info);
+    g_signal_emit (library, signals[BOOK_ADDED], 0, result->info);
+    result->info = NULL;
+  }
+  /* a book that no longer reads is no longer in the library */
+  else if (g_hash_table_remove (library->books, result->uri))
+    g_signal_emit (library, signals[BOOK_REMOVED], 0, result->uri);
+  g_atomic_int_add (&library->pending, -1);
+  library_check_finished (library);
+  return G_SOURCE_REMOVE;
+}
+
+/* GThreadPool worker: one file per call */
+static void
+library_scan_file (gpointer data, gpointer user_data)
+{
+  AuditeLibrary *library = user_data;
+  LibraryResult *result;
+
+  result = g_slice_new0 (LibraryResult);
+  result->library = library;
+  result->cancellable = g_object_ref (library->cancellable);
+  result->uri = data;
+
+  if (!g_cancellable_is_cancelled (library->cancellable))
+    result->info = audite_loader_read_book (result->uri, library->cancellable, NULL);
+
+  g_main_context_invoke_full (library->context, G_PRIORITY_DEFAULT_IDLE,
+                              library_result_dispatch, result, library_result_free);
+}
+
+static void
+library_queue (AuditeLibrary *library, gchar *uri)
+{
+  g_atomic_int_inc (&library->pending);
+  g_thread_pool_push (library->pool, uri, NULL);
+}
+
+static void
+library_forget (AuditeLibrary *library, const gchar *uri)
+{
+  GHashTableIter iter;
+  gpointer key;
+  gchar *prefix;
+
+  if (g_hash_table_remove (library->books, uri)) {
+    g_signal_emit (library, signals[BOOK_REMOVED], 0, uri);
+    return;
+  }
+
+  /* a directory went away, with everything below it */
+  prefix = g_strconcat (uri, "/", NULL);
+  g_hash_table_remove (library->monitors, uri);
+  g_hash_table_iter_init (&iter, library->monitors);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    if (g_str_has_prefix (key, prefix))
+      g_hash_table_iter_remove (&iter);
+  g_hash_table_iter_init (&iter, library->books);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    if (g_str_has_prefix (key, prefix)) {
+      g_signal_emit (library, signals[BOOK_REMOVED], 0, key);
+      g_hash_table_iter_remove (&iter);
+    }
+  g_free (prefix);
+}
+
+static void
+library_monitor_changed (GFileMonitor      *monitor,
+                         GFile             *file,
+                         GFile             *other_file,
+                         GFileMonitorEvent  event,
+                         AuditeLibrary     *library)
+{
+  gchar *uri, *name;
+
+  switch (event) {
+    case G_FILE_MONITOR_EVENT_CREATED:
+      /* a new file is read once it has been written, on the hint that
+       * follows; only a new directory is walked now */
+      library_walk_file (library, file, FALSE);
+      break;
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+      /* may be a whole directory; the walker sorts it out off the main loop */
+      library_walk_file (library, file, TRUE);
+      break;
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+      name = g_file_get_basename (file);
+      if (audite_loader_is_audio_name (name))
+        library_queue (library, g_file_get_uri (file));
+      g_free (name);
+      break;
+    case G_FILE_MONITOR_EVENT_RENAMED:
+      uri = g_file_get_uri (file);
+      library_forget (library, uri);
+      g_free (uri);
+      library_walk_file (library, other_file, TRUE);
+      break;
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+      uri = g_file_get_uri (file);
+      library_forget (library, uri);
+      g_free (uri);
+      break;
+    default:
+      break;
+  }
+}
+
+static void
+library_monitor_free (gpointer user_data)
+{
+  LibraryMonitor *data = user_data;
+
+  g_object_unref (data->cancellable);
+  g_object_unref (data->directory);
+  g_slice_free (LibraryMonitor, data);
+}
+
+static gboolean
+library_monitor_dispatch (gpointer user_data)
+{
+  LibraryMonitor *data = user_data;
+  AuditeLibrary *library = data->library;
+  GFileMonitor *monitor;
+  gchar *uri;
+
+  if (g_cancellable_is_cancelled (data->cancellable))
+    return G_SOURCE_REMOVE;
+
+  uri = g_file_get_uri (data->directory);
+  if (g_hash_table_contains (library->monitors, uri)) {
+    g_free (uri);
+    return G_SOURCE_REMOVE;
+  }
+  monitor = g_file_monitor_directory (data->directory, G_FILE_MONITOR_WATCH_MOVES,
+                                      NULL, NULL);
+  if (monitor) {
+    g_signal_connect (monitor, "changed",
+                      G_CALLBACK (library_monitor_changed), library);
+    g_hash_table_insert (library->monitors, uri, monitor);
+  }
+  else
+    g_free (uri);
+  return G_SOURCE_REMOVE;
+}
+
+/* Monitors deliver their events to the thread default context of the
+ * thread that created them, so they are set up on the library's context. */
+static void
+library_post_monitor (AuditeLibrary *library, GFile *directory, GCancellable *cancellable)
+{
+  LibraryMonitor *data;
+
+  data = g_slice_new0 (LibraryMonitor);
+  data->library = library;
+  data->cancellable = g_object_ref (cancellable);
+  data->directory = g_object_ref (directory);
+  g_main_context_invoke_full (library->context, G_PRIORITY_DEFAULT,
+                              library_monitor_dispatch, data, library_monitor_free);
+}
+
+static void
+library_walk_directory (AuditeLibrary *library, GFile *directory, GCancellable *cancellable)
+{
+  GFileEnumerator *enumerator;
+  GFileInfo *info;
+  GFile *child;
+
+  library_post_monitor (library, directory, cancellable);
+
+  enumerator = g_file_enumerate_children (directory,
+                                          G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                          G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          cancellable, NULL);
+  if (!enumerator)
+    return;
+
+  while ((info = g_file_enumerator_next_file (enumerator, cancellable, NULL))) {
+    child = g_file_enumerator_get_child (enumerator, info);
+    switch (g_file_info_get_file_type (info)) {
+      case G_FILE_TYPE_DIRECTORY:
+        library_walk_directory (library, child, cancellable);
+        break;
+      case G_FILE_TYPE_REGULAR:
+        if (audite_loader_is_audio_name (g_file_info_get_name (info)))
+          library_queue (library, g_file_get_uri (child));
+        break;
+      default:
+        break;
+    }
+    g_object_unref (child);
+    g_object_unref (info);
+  }
+  g_object_unref (enumerator);
+}
+
+static void
+library_walk_thread (GTask        *task,
+                     gpointer      source_object,
+                     gpointer      task_data,
+                     GCancellable *cancellable)
+{
+  AuditeLibrary *library = source_object;
+  GFile *file = task_data;
+  gboolean with_files = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (task), "with-files"));
+  gchar *name;
+
+  switch (g_file_query_file_type (file, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, cancellable)) {
+    case G_FILE_TYPE_DIRECTORY:
+      library_walk_directory (library, file, cancellable);
+      break;
+    case G_FILE_TYPE_REGULAR:
+      name = g_file_get_basename (file);
+      if (with_files && audite_loader_is_audio_name (name))
+        library_queue (library, g_file_get_uri (file));
+      g_free (name);
+      break;
+    default:
+      break;
+  }
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+library_walk_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  AuditeLibrary *library = AUDITE_LIBRARY (source);
+
+  if (!g_task_propagate_boolean (G_TASK (res), NULL))
+    return;
+  g_atomic_int_add (&library->walking, -1);
+  library_check_finished (library);
+}
+
+/* Walks @file if it is a directory, or queues it if it is an audio file
+ * and @with_files is set. */
+static void
+library_walk_file (AuditeLibrary *library, GFile *file, gboolean with_files)
+{
+  GTask *task;
+
+  g_atomic_int_inc (&library->walking);
+  task = g_task_new (library, library->cancellable, library_walk_done, NULL);
+  g_task_set_task_data (task, g_object_ref (file), g_object_unref);
+  g_object_set_data (G_OBJECT (task), "with-files", GINT_TO_POINTER (with_files));
+  g_task_run_in_thread (task, library_walk_thread);
+  g_object_unref (task);
+}
+
+static void
+audite_library_init (AuditeLibrary *library)
+{
+  library->context = g_main_context_ref_thread_default ();
+  library->cancellable = g_cancellable_new ();
+  library->pool = g_thread_pool_new (library_scan_file, library,
+                                     g_get_num_processors (), FALSE, NULL);
+  library->books = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                          (GDestroyNotify) audite_book_info_free);
+  library->monitors = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                             g_object_unref);
+}
+
+static void
+audite_library_dispose (GObject *object)
+{
+  AuditeLibrary *library = AUDITE_LIBRARY (object);
+
+  audite_library_stop (library);
+  if (library->pool) {
+    /* queued files bail out on the cancelled cancellable */
+    g_thread_pool_free (library->pool, FALSE, TRUE);
+    library->pool = NULL;
+  }
+  g_list_free_full (library->folders, g_object_unref);
+  library->folders = NULL;
+
+  G_OBJECT_CLASS (audite_library_parent_class)->dispose (object);
+}
+
+static void
+audite_library_finalize (GObject *object)
+{
+  AuditeLibrary *library = AUDITE_LIBRARY (object);
+
+  g_hash_table_destroy (library->books);
+  g_hash_table_destroy (library->monitors);
+  g_object_unref (library->cancellable);
+  g_main_context_unref (library->context);
+
+  G_OBJECT_CLASS (audite_library_parent_class)->finalize (object);
+}
+
+static void
+audite_library_class_init (AuditeLibraryClass *class)
+{
+  G_OBJECT_CLASS (class)->dispose = audite_library_dispose;
+  G_OBJECT_CLASS (class)->finalize = audite_library_finalize;
+
+  signals[BOOK_ADDED] = g_signal_new ("book-added",
+                                      G_TYPE_FROM_CLASS (class),
+                                      G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+                                      G_TYPE_NONE, 1, G_TYPE_POINTER);
+  signals[BOOK_REMOVED] = g_signal_new ("book-removed",
+                                        G_TYPE_FROM_CLASS (class),
+                                        G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+                                        G_TYPE_NONE, 1, G_TYPE_STRING);
+  signals[SCAN_FINISHED] = g_signal_new ("scan-finished",
+                                         G_TYPE_FROM_CLASS (class),
+                                         G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+                                         G_TYPE_NONE, 0);
+}
+
+AuditeLibrary *
+audite_library_new (void)
+{
+  return g_object_new (AUDITE_LIBRARY_TYPE, NULL);
+}
+
+void
+audite_library_add_folder (AuditeLibrary *library, GFile *folder)
+{
+  library->folders = g_list_append (library->folders, g_object_ref (folder));
+}
+
+/* Full scan of every folder. Books already known are replaced as they are
+ * re-read, which for unchanged files is a stat and a cache hit. */
+void
+audite_library_scan (AuditeLibrary *library)
+{
+  GList *l;
+
+  for (l = library->folders; l != NULL; l = l->next)
+    library_walk_file (library, l->data, TRUE);
+}
+
+/* Cancels running walks and queued files and stops watching folders for
+ * good. Has to be called before the last reference is dropped while a scan is
+ * running, since every walk holds a reference on the library. */
+void
+audite_library_stop (AuditeLibrary *library)
+{
+  g_cancellable_cancel (library->cancellable);
+  g_hash_table_remove_all (library->monitors);
+}
+
+AuditeBookInfo *
+audite_library_lookup (AuditeLibrary *library, const gchar *uri)
+{
+  return g_hash_table_lookup (library->books, uri);
+}
+
+/* Returns a list of the AuditeBookInfo owned by the library, free with
+ * g_list_free(). */
+GList *
+audite_library_get_books (AuditeLibrary *library)
+{
+  return g_hash_table_get_values (library->books);
+}
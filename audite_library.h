@@ -0,0 +1,29 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_LIBRARY_H
+#define __AUDITE_LIBRARY_H
+
+#include <gio/gio.h>
+#include "audite_loader.h"
+
+
+#define AUDITE_LIBRARY_TYPE (audite_library_get_type ())
+G_DECLARE_FINAL_TYPE (AuditeLibrary, audite_library, AUDITE, LIBRARY, GObject)
+
+
+AuditeLibrary  *audite_library_new           (void);
+void            audite_library_add_folder    (AuditeLibrary *library,
+                                              GFile         *folder);
+void            audite_library_scan          (AuditeLibrary *library);
+void            audite_library_stop          (AuditeLibrary *library);
+AuditeBookInfo *audite_library_lookup        (AuditeLibrary *library,
+                                              const gchar   *uri);
+GList          *audite_library_get_books     (AuditeLibrary *library);
+
+
+#endif /* __AUDITE_LIBRARY_H */
@@ -0,0 +1,661 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+#include <gst/pbutils/pbutils.h>
+#include <mp4v2/mp4v2.h>
+
+#include "audite_cache.h"
+#include "audite_chapters.h"
+#include "audite_id3.h"
+#include "audite_loader.h"
+#include "audite_mp4.h"
+#include "audite_profile.h"
+
+#define MP4V2_SECOND 1000
+#define LOADER_BATCH_SIZE 256
+#define LOADER_DISCOVER_TIMEOUT (10 * GST_SECOND)
+
+typedef struct
+{
+  gchar                 *uri;
+  gboolean               discover;
+  AuditeLoaderBatchFunc  batch_func;
+  gpointer               user_data;
+} LoaderData;
+
+typedef struct
+{
+  GTask   *task;
+  GArray  *chapters;
+  guint    first;
+  guint    n_chapters;
+} LoaderBatch;
+
+typedef struct
+{
+  gchar          *uri;
+  GCancellable   *cancellable;
+  AuditeBookInfo *info;
+} LoaderTrack;
+
+static const gchar *audio_suffixes[] = {
+  ".m4b", ".m4a", ".mp4", ".mp3", ".ogg", ".oga", ".opus", ".flac", ".mka"
+};
+
+static const gchar *playlist_suffixes[] = {
+  ".m3u", ".m3u8"
+};
+
+static void
+loader_data_free (LoaderData *data)
+{
+  g_free (data->uri);
+  g_slice_free (LoaderData, data);
+}
+
+void
+audite_book_info_free (AuditeBookInfo *info)
+{
+  if (!info)
+    return;
+  g_free (info->uri);
+  g_free (info->cache_key);
+  g_free (info->cover_key);
+  g_free (info->title);
+  g_free (info->artist);
+  g_free (info->album);
+  g_free (info->genre);
+  g_free (info->date);
+  g_free (info->codec);
+  if (info->chapters)
+    g_array_unref (info->chapters);
+  g_strfreev (info->tracks);
+  g_slice_free (AuditeBookInfo, info);
+}
+
+static gboolean
+loader_has_suffix (const gchar *name, const gchar **suffixes, guint n_suffixes)
+{
+  gchar *lower;
+  gboolean found = FALSE;
+  guint i;
+
+  lower = g_utf8_strdown (name, -1);
+  for (i = 0; i < n_suffixes && !found; i++)
+    found = g_str_has_suffix (lower, suffixes[i]);
+  g_free (lower);
+  return found;
+}
+
+gboolean
+audite_loader_is_audio_name (const gchar *name)
+{
+  return loader_has_suffix (name, audio_suffixes, G_N_ELEMENTS (audio_suffixes));
+}
+
+/* A folder or a playlist is played as one book with a file per chapter.
+ * Cheap enough for the main thread: a suffix test and at most one stat. */
+gboolean
+audite_loader_is_collection (const gchar *uri)
+{
+  GFile *file;
+  gboolean collection;
+
+  if (loader_has_suffix (uri, playlist_suffixes, G_N_ELEMENTS (playlist_suffixes)))
+    return TRUE;
+
+  file = g_file_new_for_uri (uri);
+  /* a web server has no folders, and the stat would be a request */
+  collection = !g_file_has_uri_scheme (file, "http")
+               && !g_file_has_uri_scheme (file, "https")
+               && g_file_query_file_type (file, G_FILE_QUERY_INFO_NONE, NULL)
+                  == G_FILE_TYPE_DIRECTORY;
+  g_object_unref (file);
+  return collection;
+}
+
+static void
+loader_read_mp4 (const gchar *filename, AuditeBookInfo *info)
+{
+  MP4FileHandle file;
+  const MP4Tags *tags;
+  MP4Chapter_t *chapter_list = NULL;
+  guint32 chapter_count = 0, index;
+  guint64 startpos = 0, endpos = 0;
+
+  audite_profile_begin ("mp4v2_get_chapters");
+  file = MP4Read (filename);
+  if (file == MP4_INVALID_FILE_HANDLE) {
+    audite_profile_end ("mp4v2_get_chapters");
+    g_print ("MP4Read failed\n");
+    return;
+  }
+
+  tags = MP4TagsAlloc ();
+  if (MP4TagsFetch (tags, file)) {
+    info->title = g_strdup (tags->name);
+    info->artist = g_strdup (tags->artist);
+    info->album = g_strdup (tags->album);
+    info->genre = g_strdup (tags->genre);
+    info->has_cover = tags->artworkCount > 0;
+  }
+  MP4TagsFree (tags);
+
+  info->duration = gst_util_uint64_scale (MP4ConvertFromMovieDuration (file,
+                                              MP4GetDuration (file),
+                                              MP4_MSECS_TIME_SCALE),
+                                          GST_SECOND, MP4V2_SECOND);
+
+  MP4GetChapters (file, &chapter_list, &chapter_count, MP4ChapterTypeQt);
+  if (chapter_count == 0) {
+    MP4Close (file, 0);
+    audite_profile_end ("mp4v2_get_chapters");
+    g_print ("Chapters not found\n");
+    return;
+  }
+
+  info->chapters = audite_chapters_new (chapter_count);
+  for (index = 0; index < chapter_count; index++) {
+    endpos = startpos + chapter_list[index].duration;
+    audite_chapters_append (info->chapters, chapter_list[index].title,
+                            gst_util_uint64_scale (startpos, GST_SECOND, MP4V2_SECOND),
+                            gst_util_uint64_scale (endpos, GST_SECOND, MP4V2_SECOND));
+    startpos = endpos;
+  }
+
+  MP4Free (chapter_list);
+  MP4Close (file, 0);
+  audite_profile_end ("mp4v2_get_chapters");
+}
+
+/* Files without an MP4 chapter table still need a duration and tags to
+ * take their place in a book made of several files. Their chapters come
+ * from the TOC the demuxer hands the discoverer: Matroska editions, Ogg
+ * chapters, or whatever else GStreamer can read. */
+static void
+loader_discover (const gchar *uri, AuditeBookInfo *info)
+{
+  GstDiscoverer *discoverer;
+  GstDiscovererInfo *result;
+  GstDiscovererAudioInfo *audio;
+  const GstTagList *tags;
+  const GstToc *toc;
+  GList *streams;
+  GstCaps *caps;
+
+  discoverer = gst_discoverer_new (LOADER_DISCOVER_TIMEOUT, NULL);
+  if (!discoverer)
+    return;
+
+  result = gst_discoverer_discover_uri (discoverer, uri, NULL);
+  if (result && gst_discoverer_info_get_result (result) == GST_DISCOVERER_OK) {
+    info->duration = gst_discoverer_info_get_duration (result);
+
+    tags = gst_discoverer_info_get_tags (result);
+    if (tags) {
+      gst_tag_list_get_string (tags, GST_TAG_TITLE, &info->title);
+      gst_tag_list_get_string (tags, GST_TAG_ARTIST, &info->artist);
+      gst_tag_list_get_string (tags, GST_TAG_ALBUM, &info->album);
+      gst_tag_list_get_string (tags, GST_TAG_GENRE, &info->genre);
+      info->has_cover = gst_tag_list_get_tag_size (tags, GST_TAG_IMAGE) > 0;
+    }
+
+    toc = gst_discoverer_info_get_toc (result);
+    if (toc)
+      info->chapters = audite_chapters_from_toc ((GstToc *) toc, info->duration);
+
+    streams = gst_discoverer_info_get_audio_streams (result);
+    if (streams) {
+      audio = streams->data;
+      info->sample_rate = gst_discoverer_audio_info_get_sample_rate (audio);
+      info->channels = gst_discoverer_audio_info_get_channels (audio);
+      info->bitrate = gst_discoverer_audio_info_get_bitrate (audio);
+      caps = gst_discoverer_stream_info_get_caps (GST_DISCOVERER_STREAM_INFO (audio));
+      if (caps) {
+        info->codec = gst_pb_utils_get_codec_description (caps);
+        gst_caps_unref (caps);
+      }
+    }
+    gst_discoverer_stream_info_list_free (streams);
+  }
+
+  if (result)
+    g_object_unref (result);
+  g_object_unref (discoverer);
+}
+
+static gboolean
+loader_batch_dispatch (gpointer user_data)
+{
+  LoaderBatch *batch = user_data;
+  LoaderData *data = g_task_get_task_data (batch->task);
+
+  if (!g_cancellable_is_cancelled (g_task_get_cancellable (batch->task)))
+    data->batch_func (batch->chapters, batch->first, batch->n_chapters, data->user_data);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+loader_batch_free (gpointer user_data)
+{
+  LoaderBatch *batch = user_data;
+
+  g_object_unref (batch->task);
+  g_array_unref (batch->chapters);
+  g_slice_free (LoaderBatch, batch);
+}
+
+static void
+loader_push_batches (GTask *task, GArray *chapters, GCancellable *cancellable)
+{
+  guint first;
+
+  for (first = 0; first < chapters->len; first += LOADER_BATCH_SIZE) {
+    LoaderBatch *batch;
+
+    if (g_cancellable_is_cancelled (cancellable))
+      return;
+
+    batch = g_slice_new (LoaderBatch);
+    batch->task = g_object_ref (task);
+    batch->chapters = g_array_ref (chapters);
+    batch->first = first;
+    batch->n_chapters = MIN (LOADER_BATCH_SIZE, chapters->len - first);
+    g_main_context_invoke_full (g_task_get_context (task), G_PRIORITY_DEFAULT,
+                                loader_batch_dispatch, batch, loader_batch_free);
+  }
+}
+
+/* Without @discover a file MP4 parsing cannot read is not run through a
+ * discoverer of its own: the book is marked from_pipeline and the player
+ * opening it fills in the rest. */
+static AuditeBookInfo *
+loader_read_container (const gchar   *uri,
+                       gboolean       discover,
+                       GCancellable  *cancellable,
+                       GError       **error)
+{
+  AuditeBookInfo *info;
+  AuditeProbe *probe;
+  AuditeChapter *last;
+  gchar *filename;
+
+  audite_profile_begin ("probe");
+  probe = audite_probe_uri (uri, cancellable, error);
+  audite_profile_end ("probe");
+  if (!probe)
+    return NULL;
+
+  info = g_slice_new0 (AuditeBookInfo);
+  info->uri = g_strdup (uri);
+  info->duration = GST_CLOCK_TIME_NONE;
+  info->container = probe->container;
+
+  /* mp4v2 needs a local file; a remote MP4 is read in ranges, fetching
+   * moov and the chapter titles instead of the whole book, and anything
+   * else goes through GStreamer */
+  filename = g_filename_from_uri (uri, NULL, NULL);
+  if (!g_cancellable_is_cancelled (cancellable)) {
+    if (info->container == AUDITE_CONTAINER_MP4 && filename) {
+      /* mp4v2 builds every sample table of the file; it is only needed
+       * when the mapped reader does not understand the layout */
+      if (!audite_mp4_read (filename, info))
+        loader_read_mp4 (filename, info);
+    }
+    else if (info->container != AUDITE_CONTAINER_MP4
+             || !audite_mp4_read_uri (uri, cancellable, info)) {
+      if (discover)
+        loader_discover (uri, info);
+      else
+        info->from_pipeline = TRUE;
+      if (!info->chapters && info->container == AUDITE_CONTAINER_MP3 && probe->id3_tag)
+        info->chapters = audite_id3_read_chapters (probe->id3_tag);
+      /* an open end is written as all ones */
+      if (info->chapters && GST_CLOCK_TIME_IS_VALID (info->duration)) {
+        last = &g_array_index (info->chapters, AuditeChapter, info->chapters->len - 1);
+        last->end = MIN (last->end, info->duration);
+      }
+    }
+  }
+  g_free (filename);
+  audite_probe_free (probe);
+  return info;
+}
+
+/* Parses the container itself, without looking at or filling the cache.
+ * The probe reads the head of the file once and picks the reader: MP4
+ * chapter tables, or GStreamer and its TOC for the rest, with ID3 chapter
+ * frames for MP3 files whose TOC has none. */
+AuditeBookInfo *
+audite_loader_read_container (const gchar   *uri,
+                              GCancellable  *cancellable,
+                              GError       **error)
+{
+  return loader_read_container (uri, TRUE, cancellable, error);
+}
+
+/* A book filled in from the pipeline is stored by whoever fills it. */
+static AuditeBookInfo *
+loader_read_book (const gchar   *uri,
+                  gboolean       discover,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+  AuditeBookInfo *info = NULL;
+  gchar *key;
+
+  /* a cache hit needs no container parsing at all */
+  key = audite_cache_file_key (uri, cancellable);
+  if (key)
+    info = audite_cache_load_book (key);
+
+  if (info) {
+    audite_profile_mark ("book-cache-hit");
+    info->uri = g_strdup (uri);
+    info->cache_key = key;
+    if (info->has_cover)
+      info->cover_key = g_strdup (key);
+    return info;
+  }
+
+  info = loader_read_container (uri, discover, cancellable, error);
+  if (!info) {
+    g_free (key);
+    return NULL;
+  }
+  info->cache_key = key;
+  /* a cover replaced in place changes the key along with the file */
+  if (info->has_cover)
+    info->cover_key = g_strdup (key);
+
+  if (info->cache_key && !info->from_pipeline && !g_cancellable_is_cancelled (cancellable))
+    audite_cache_store_book (info);
+  return info;
+}
+
+/* Reads everything Audite knows about @uri without touching the main
+ * loop: from the book cache when the file is unchanged, otherwise by
+ * parsing the container, after which the cache is refreshed. */
+AuditeBookInfo *
+audite_loader_read_book (const gchar   *uri,
+                         GCancellable  *cancellable,
+                         GError       **error)
+{
+  return loader_read_book (uri, TRUE, cancellable, error);
+}
+
+static gint
+loader_compare_names (gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* Audio files of a folder in natural order ("2" before "10"). */
+static GPtrArray *
+loader_list_folder (GFile *folder, GCancellable *cancellable, GError **error)
+{
+  GFileEnumerator *children;
+  GFileInfo *child_info;
+  GPtrArray *keys, *uris;
+  GFile *child;
+  const gchar *name;
+  guint i;
+
+  children = g_file_enumerate_children (folder,
+                                        G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                        G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                        G_FILE_QUERY_INFO_NONE, cancellable, error);
+  if (!children)
+    return NULL;
+
+  /* each entry is the collation key followed by the name */
+  keys = g_ptr_array_new_with_free_func (g_free);
+  while ((child_info = g_file_enumerator_next_file (children, cancellable, NULL))) {
+    name = g_file_info_get_name (child_info);
+    if (g_file_info_get_file_type (child_info) == G_FILE_TYPE_REGULAR
+        && audite_loader_is_audio_name (name)) {
+      gchar *key = g_utf8_collate_key_for_filename (name, -1);
+      g_ptr_array_add (keys, g_strconcat (key, "/", name, NULL));
+      g_free (key);
+    }
+    g_object_unref (child_info);
+  }
+  g_object_unref (children);
+  g_ptr_array_sort (keys, loader_compare_names);
+
+  uris = g_ptr_array_new_with_free_func (g_free);
+  for (i = 0; i < keys->len; i++) {
+    name = strrchr (g_ptr_array_index (keys, i), '/') + 1;
+    child = g_file_get_child (folder, name);
+    g_ptr_array_add (uris, g_file_get_uri (child));
+    g_object_unref (child);
+  }
+  g_ptr_array_unref (keys);
+  return uris;
+}
+
+/* Entries of an M3U playlist, relative ones resolved against its folder. */
+static GPtrArray *
+loader_list_playlist (GFile *playlist, GCancellable *cancellable, GError **error)
+{
+  GFile *parent, *track;
+  GPtrArray *uris;
+  gchar *contents, **lines, *line, *scheme;
+  guint i;
+
+  if (!g_file_load_contents (playlist, cancellable, &contents, NULL, NULL, error))
+    return NULL;
+
+  parent = g_file_get_parent (playlist);
+  uris = g_ptr_array_new_with_free_func (g_free);
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++) {
+    line = g_strstrip (lines[i]);
+    if (*line == '\0' || *line == '#')
+      continue;
+    scheme = g_uri_parse_scheme (line);
+    if (scheme)
+      g_ptr_array_add (uris, g_strdup (line));
+    else {
+      track = g_file_resolve_relative_path (parent, line);
+      g_ptr_array_add (uris, g_file_get_uri (track));
+      g_object_unref (track);
+    }
+    g_free (scheme);
+  }
+  g_strfreev (lines);
+  g_free (contents);
+  g_object_unref (parent);
+  return uris;
+}
+
+static void
+loader_read_track (gpointer data, gpointer user_data)
+{
+  LoaderTrack *track = data;
+
+  if (!g_cancellable_is_cancelled (track->cancellable))
+    track->info = audite_loader_read_book (track->uri, track->cancellable, NULL);
+}
+
+/* Every track goes through the per-file book cache, so only files that
+ * changed since the last open are parsed, and those in parallel. Tracks
+ * without a known duration cannot be placed on the timeline and are
+ * left out. */
+static AuditeBookInfo *
+loader_read_collection (const gchar *uri, GCancellable *cancellable, GError **error)
+{
+  AuditeBookInfo *info, *first = NULL;
+  LoaderTrack *tracks;
+  GThreadPool *pool;
+  GPtrArray *uris, *track_uris;
+  GFile *file;
+  GstClockTime start = 0;
+  gchar *title;
+  guint i;
+
+  file = g_file_new_for_uri (uri);
+  if (g_file_query_file_type (file, G_FILE_QUERY_INFO_NONE, cancellable) == G_FILE_TYPE_DIRECTORY)
+    uris = loader_list_folder (file, cancellable, error);
+  else
+    uris = loader_list_playlist (file, cancellable, error);
+  if (!uris) {
+    g_object_unref (file);
+    return NULL;
+  }
+
+  tracks = g_new0 (LoaderTrack, uris->len);
+  pool = g_thread_pool_new (loader_read_track, NULL, g_get_num_processors (), FALSE, NULL);
+  for (i = 0; i < uris->len; i++) {
+    tracks[i].uri = g_ptr_array_index (uris, i);
+    tracks[i].cancellable = cancellable;
+    g_thread_pool_push (pool, &tracks[i], NULL);
+  }
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  info = g_slice_new0 (AuditeBookInfo);
+  info->uri = g_strdup (uri);
+  info->chapters = audite_chapters_new (uris->len);
+  track_uris = g_ptr_array_new ();
+  for (i = 0; i < uris->len; i++) {
+    AuditeBookInfo *track = tracks[i].info;
+
+    if (!track || !GST_CLOCK_TIME_IS_VALID (track->duration)) {
+      audite_book_info_free (track);
+      continue;
+    }
+    if (track->title)
+      title = g_strdup (track->title);
+    else {
+      gchar *basename = g_path_get_basename (tracks[i].uri);
+      gchar *dot = strrchr (basename, '.');
+
+      if (dot)
+        *dot = '\0';
+      title = g_uri_unescape_string (basename, NULL);
+      g_free (basename);
+    }
+    audite_chapters_append (info->chapters, title, start, start + track->duration);
+    g_free (title);
+    start += track->duration;
+    g_ptr_array_add (track_uris, g_strdup (tracks[i].uri));
+
+    if (!first) {
+      first = track;
+      info->container = track->container;
+    }
+    else {
+      /* typefind may only be skipped when every track is alike */
+      if (track->container != info->container)
+        info->container = AUDITE_CONTAINER_UNKNOWN;
+      audite_book_info_free (track);
+    }
+  }
+  g_ptr_array_add (track_uris, NULL);
+  info->tracks = (gchar **) g_ptr_array_free (track_uris, FALSE);
+  info->duration = start;
+  g_free (tracks);
+  g_ptr_array_unref (uris);
+
+  if (!first) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                 "No playable audio files in %s", uri);
+    g_object_unref (file);
+    audite_book_info_free (info);
+    return NULL;
+  }
+
+  /* the book is named after the album, the folder or the playlist */
+  info->title = first->album ? g_strdup (first->album) : g_file_get_basename (file);
+  info->artist = g_strdup (first->artist);
+  info->genre = g_strdup (first->genre);
+  info->date = g_strdup (first->date);
+  info->has_cover = first->has_cover;
+  /* the folder does not change when the track holding the cover does */
+  info->cover_key = g_strdup (first->cover_key);
+  info->codec = g_strdup (first->codec);
+  info->sample_rate = first->sample_rate;
+  info->channels = first->channels;
+  info->bitrate = first->bitrate;
+  audite_book_info_free (first);
+  g_object_unref (file);
+  return info;
+}
+
+static void
+loader_thread (GTask        *task,
+               gpointer      source_object,
+               gpointer      task_data,
+               GCancellable *cancellable)
+{
+  LoaderData *data = task_data;
+  AuditeBookInfo *info;
+  GError *error = NULL;
+
+  if (audite_loader_is_collection (data->uri))
+    info = loader_read_collection (data->uri, cancellable, &error);
+  else
+    info = loader_read_book (data->uri, data->discover, cancellable, &error);
+  if (!info) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  if (info->chapters && data->batch_func)
+    loader_push_batches (task, info->chapters, cancellable);
+
+  if (g_task_return_error_if_cancelled (task)) {
+    audite_book_info_free (info);
+    return;
+  }
+  g_task_return_pointer (task, info, (GDestroyNotify) audite_book_info_free);
+}
+
+/* Sniffs the container, reads tags and the chapter table of @uri on a
+ * worker thread. Chapters are handed to @batch_func on the calling thread's
+ * main context as they become available; @callback runs once everything
+ * has been delivered. Cancelling @cancellable drops any batch that has not
+ * been dispatched yet.
+ *
+ * A caller that plays @uri passes FALSE for @discover: a single file only
+ * GStreamer can read is then not opened a second time, and the book comes
+ * back with from_pipeline set, see AuditeBookInfo. */
+void
+audite_loader_open_async (gpointer               source_object,
+                          const gchar           *uri,
+                          gboolean               discover,
+                          GCancellable          *cancellable,
+                          AuditeLoaderBatchFunc  batch_func,
+                          GAsyncReadyCallback    callback,
+                          gpointer               user_data)
+{
+  GTask *task;
+  LoaderData *data;
+
+  data = g_slice_new0 (LoaderData);
+  data->uri = g_strdup (uri);
+  data->discover = discover;
+  data->batch_func = batch_func;
+  data->user_data = user_data;
+
+  task = g_task_new (source_object, cancellable, callback, user_data);
+  g_task_set_source_tag (task, audite_loader_open_async);
+  g_task_set_task_data (task, data, (GDestroyNotify) loader_data_free);
+  g_task_run_in_thread (task, loader_thread);
+  g_object_unref (task);
+}
+
+AuditeBookInfo *
+audite_loader_open_finish (GAsyncResult *result, GError **error)
+{
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
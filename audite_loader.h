@@ -0,0 +1,79 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_LOADER_H
+#define __AUDITE_LOADER_H
+
+#include <gio/gio.h>
+#include <gst/gst.h>
+#include "audite_chapters.h"
+#include "audite_probe.h"
+
+
+typedef struct _AuditeBookInfo AuditeBookInfo;
+
+struct _AuditeBookInfo
+{
+  gchar        *uri;
+  gchar        *cache_key;
+  gboolean      from_cache;
+  /* read without GStreamer, which left the tags, the duration and the
+   * chapters of the TOC to the pipeline playing it; not cached yet */
+  gboolean      from_pipeline;
+  AuditeContainer container;
+  gchar        *title;
+  gchar        *artist;
+  gchar        *album;
+  gchar        *genre;
+  gchar        *date;
+  gboolean      has_cover;
+  gchar        *cover_key;      /* cache key of the file holding the cover */
+  GstClockTime  duration;
+  GArray       *chapters;       /* AuditeChapter, sorted by start */
+  gchar       **tracks;         /* one file per chapter for folders and playlists */
+
+  /* stream properties, known once the pipeline has prerolled */
+  gchar        *codec;
+  gint          sample_rate;
+  gint          channels;
+  gint          bitrate;
+};
+
+/* Called on the main context for every chunk of chapters the worker has
+ * read, in order, and only while the load has not been cancelled. The
+ * chunk is @n_chapters entries of @chapters starting at @first; the array
+ * is the one the finished book will carry and is never changed. */
+typedef void (*AuditeLoaderBatchFunc) (GArray              *chapters,
+                                       guint                first,
+                                       guint                n_chapters,
+                                       gpointer             user_data);
+
+
+void            audite_book_info_free        (AuditeBookInfo        *info);
+
+gboolean        audite_loader_is_audio_name  (const gchar           *name);
+gboolean        audite_loader_is_collection  (const gchar           *uri);
+AuditeBookInfo *audite_loader_read_container (const gchar           *uri,
+                                              GCancellable          *cancellable,
+                                              GError               **error);
+
+AuditeBookInfo *audite_loader_read_book      (const gchar           *uri,
+                                              GCancellable          *cancellable,
+                                              GError               **error);
+
+void            audite_loader_open_async     (gpointer               source_object,
+                                              const gchar           *uri,
+                                              gboolean               discover,
+                                              GCancellable          *cancellable,
+                                              AuditeLoaderBatchFunc  batch_func,
+                                              GAsyncReadyCallback    callback,
+                                              gpointer               user_data);
+AuditeBookInfo *audite_loader_open_finish    (GAsyncResult          *result,
+                                              GError               **error);
+
+
+#endif /* __AUDITE_LOADER_H */
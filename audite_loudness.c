@@ -0,0 +1,534 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Integrated loudness of every chapter after EBU R128 (ITU-R BS.1770):
+ * K-weighted power over 400 ms blocks every 100 ms, gated at -70 LUFS
+ * and again at 10 LU below the ungated mean. Chapters are cut into chunks
+ * of a few minutes that decode in parallel on all cores, on threads of
+ * the pass's own at idle priority (see audite_idle.c);
+ * each chunk keeps a histogram of its block loudness, and the histograms
+ * of a chapter add up to the gated result. Chapters of a file are cached
+ * by its file key, so a book is measured only once.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+#include "audite_loudness.h"
+#include "audite_cache.h"
+#include "audite_chapters.h"
+#include "audite_idle.h"
+
+#define LOUDNESS_CACHE_VERSION 1
+#define LOUDNESS_CHUNK (5 * 60 * GST_SECOND)
+#define LOUDNESS_MAX_CHANNELS 2
+#define LOUDNESS_SUB_BLOCKS 4           /* 400 ms blocks of 100 ms steps */
+#define LOUDNESS_GATE_ABSOLUTE -70.0
+#define LOUDNESS_GATE_RELATIVE -10.0
+#define LOUDNESS_BINS 800               /* 0.1 LU each, up to +10 LUFS */
+#define LOUDNESS_MAX_GAIN 10.0          /* dB either way */
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define LOUDNESS_FORMAT "F32LE"
+#else
+#define LOUDNESS_FORMAT "F32BE"
+#endif
+
+/* K-weighting depends on the sample rate, so the stream keeps its own;
+ * anything beyond stereo is folded down, audiobooks rarely have it */
+#define LOUDNESS_PIPELINE \
+  "uridecodebin name=source caps=audio/x-raw ! audioconvert ! " \
+  "audio/x-raw,format=" LOUDNESS_FORMAT ",layout=interleaved,channels=[1,2] ! " \
+  "fakesink name=sink sync=false signal-handoffs=true"
+
+typedef struct
+{
+  GstClockTime  start;          /* inside its file */
+  GstClockTime  end;
+  gint          chunks_left;
+  guint32      *counts;         /* histogram, while chunks are merged */
+  gdouble      *energy;
+  gdouble       loudness;       /* LUFS, NAN when silent */
+} LoudnessChapter;
+
+typedef struct
+{
+  gchar   *uri;
+  gchar   *cache_key;
+  guint    first;               /* first chapter of the file in the book */
+  guint    n_chapters;
+  guint    chapters_left;
+  gboolean failed;
+} LoudnessFile;
+
+typedef struct
+{
+  GArray      *files;           /* LoudnessFile */
+  GArray      *chapters;        /* LoudnessChapter, in book order */
+  GstTaskPool *task_pool;       /* streaming threads of the chunks */
+  GMutex       lock;            /* merging and the counts left */
+} LoudnessData;
+
+typedef struct
+{
+  GTask           *task;
+  LoudnessFile    *file;
+  LoudnessChapter *chapter;
+  GstClockTime     start;
+  GstClockTime     stop;
+
+  gint             channels;
+  gdouble          b[5];
+  gdouble          a[5];
+  gdouble          v[LOUDNESS_MAX_CHANNELS][5];
+  guint            sub_length;
+  guint            sub_count;
+  gdouble          sub_power;
+  gdouble          sub_blocks[LOUDNESS_SUB_BLOCKS];
+  guint            n_sub_blocks;
+
+  guint32          counts[LOUDNESS_BINS];
+  gdouble          energy[LOUDNESS_BINS];
+} LoudnessChunk;
+
+static void
+loudness_file_clear (gpointer data)
+{
+  LoudnessFile *file = data;
+
+  g_free (file->uri);
+  g_free (file->cache_key);
+}
+
+static void
+loudness_chapter_clear (gpointer data)
+{
+  LoudnessChapter *chapter = data;
+
+  g_free (chapter->counts);
+  g_free (chapter->energy);
+}
+
+static void
+loudness_data_free (LoudnessData *data)
+{
+  g_array_unref (data->files);
+  g_array_unref (data->chapters);
+  g_clear_object (&data->task_pool);
+  g_mutex_clear (&data->lock);
+  g_slice_free (LoudnessData, data);
+}
+
+/* The BS.1770 head shelf and RLB high pass for @rate, folded into one
+ * fourth order filter. */
+static void
+loudness_filter_init (LoudnessChunk *chunk, gint rate)
+{
+  gdouble pb[3], pa[3], rb[3] = { 1.0, -2.0, 1.0 }, ra[3];
+  gdouble f0, q, k, vh, vb, a0;
+  guint i, j;
+
+  f0 = 1681.974450955533;
+  q = 0.7071752369554196;
+  k = tan (G_PI * f0 / rate);
+  vh = pow (10.0, 3.999843853973347 / 20.0);
+  vb = pow (vh, 0.4996667741545416);
+  a0 = 1.0 + k / q + k * k;
+  pb[0] = (vh + vb * k / q + k * k) / a0;
+  pb[1] = 2.0 * (k * k - vh) / a0;
+  pb[2] = (vh - vb * k / q + k * k) / a0;
+  pa[0] = 1.0;
+  pa[1] = 2.0 * (k * k - 1.0) / a0;
+  pa[2] = (1.0 - k / q + k * k) / a0;
+
+  f0 = 38.13547087602444;
+  q = 0.5003270373238773;
+  k = tan (G_PI * f0 / rate);
+  a0 = 1.0 + k / q + k * k;
+  ra[0] = 1.0;
+  ra[1] = 2.0 * (k * k - 1.0) / a0;
+  ra[2] = (1.0 - k / q + k * k) / a0;
+
+  memset (chunk->b, 0, sizeof (chunk->b));
+  memset (chunk->a, 0, sizeof (chunk->a));
+  for (i = 0; i < 3; i++) {
+    for (j = 0; j < 3; j++) {
+      chunk->b[i + j] += pb[i] * rb[j];
+      chunk->a[i + j] += pa[i] * ra[j];
+    }
+  }
+  memset (chunk->v, 0, sizeof (chunk->v));
+  chunk->sub_length = MAX (1, rate / 10);
+}
+
+static gdouble
+loudness_from_energy (gdouble energy)
+{
+  return -0.691 + 10.0 * log10 (energy);
+}
+
+static gint
+loudness_bin (gdouble loudness)
+{
+  return CLAMP ((gint) ((loudness - LOUDNESS_GATE_ABSOLUTE) * 10.0), 0, LOUDNESS_BINS - 1);
+}
+
+/* A 100 ms step is complete; the 400 ms block ending here counts when
+ * it is above the absolute gate. */
+static void
+loudness_end_sub_block (LoudnessChunk *chunk)
+{
+  gdouble energy = 0.0, loudness;
+  gint bin;
+  guint i;
+
+  chunk->sub_blocks[chunk->n_sub_blocks++ % LOUDNESS_SUB_BLOCKS] = chunk->sub_power;
+  chunk->sub_power = 0.0;
+  chunk->sub_count = 0;
+  if (chunk->n_sub_blocks < LOUDNESS_SUB_BLOCKS)
+    return;
+
+  for (i = 0; i < LOUDNESS_SUB_BLOCKS; i++)
+    energy += chunk->sub_blocks[i];
+  energy /= (gdouble) chunk->sub_length * LOUDNESS_SUB_BLOCKS;
+  if (energy <= 0.0)
+    return;
+  loudness = loudness_from_energy (energy);
+  if (loudness < LOUDNESS_GATE_ABSOLUTE)
+    return;
+  bin = loudness_bin (loudness);
+  chunk->counts[bin]++;
+  chunk->energy[bin] += energy;
+}
+
+/* Runs on the streaming thread of a chunk pipeline. */
+static void
+loudness_handoff_handler (GstElement    *sink,
+                          GstBuffer     *buffer,
+                          GstPad        *pad,
+                          LoudnessChunk *chunk)
+{
+  GstMapInfo map;
+  GstCaps *caps;
+  const gfloat *samples;
+  gdouble x, y, power, *v;
+  const gdouble *a = chunk->a, *b = chunk->b;
+  gsize n_frames, i;
+  gint rate = 0, c;
+
+  if (!chunk->channels) {
+    caps = gst_pad_get_current_caps (pad);
+    if (!caps)
+      return;
+    gst_structure_get_int (gst_caps_get_structure (caps, 0), "rate", &rate);
+    gst_structure_get_int (gst_caps_get_structure (caps, 0), "channels", &chunk->channels);
+    gst_caps_unref (caps);
+    if (rate <= 0 || chunk->channels <= 0 || chunk->channels > LOUDNESS_MAX_CHANNELS) {
+      chunk->channels = 0;
+      return;
+    }
+    loudness_filter_init (chunk, rate);
+  }
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return;
+  samples = (const gfloat *) map.data;
+  n_frames = map.size / (sizeof (gfloat) * chunk->channels);
+
+  for (i = 0; i < n_frames; i++) {
+    power = 0.0;
+    for (c = 0; c < chunk->channels; c++) {
+      v = chunk->v[c];
+      x = samples[i * chunk->channels + c];
+      v[0] = x - a[1] * v[1] - a[2] * v[2] - a[3] * v[3] - a[4] * v[4];
+      y = b[0] * v[0] + b[1] * v[1] + b[2] * v[2] + b[3] * v[3] + b[4] * v[4];
+      v[4] = v[3];
+      v[3] = v[2];
+      v[2] = v[1];
+      v[1] = v[0];
+      power += y * y;
+    }
+    chunk->sub_power += power;
+    if (++chunk->sub_count == chunk->sub_length)
+      loudness_end_sub_block (chunk);
+  }
+  gst_buffer_unmap (buffer, &map);
+}
+
+/* Gated integrated loudness of a histogram, NAN when nothing passed the
+ * absolute gate. */
+static gdouble
+loudness_integrate (const guint32 *counts, const gdouble *energy)
+{
+  gdouble sum = 0.0;
+  guint64 n = 0;
+  gint i, first;
+
+  for (i = 0; i < LOUDNESS_BINS; i++) {
+    sum += energy[i];
+    n += counts[i];
+  }
+  if (!n)
+    return NAN;
+
+  first = loudness_bin (loudness_from_energy (sum / n) + LOUDNESS_GATE_RELATIVE);
+  sum = 0.0;
+  n = 0;
+  for (i = first; i < LOUDNESS_BINS; i++) {
+    sum += energy[i];
+    n += counts[i];
+  }
+  return n ? loudness_from_energy (sum / n) : NAN;
+}
+
+/* The cache holds the loudness of each chapter of the file, in order. */
+static gboolean
+loudness_load_cached (LoudnessData *data, LoudnessFile *file)
+{
+  gdouble *loudness;
+  gboolean loaded;
+  guint i;
+
+  loudness = g_new (gdouble, file->n_chapters);
+  loaded = audite_cache_load_items ("loudness", file->cache_key, ".lufs",
+                                    LOUDNESS_CACHE_VERSION, loudness,
+                                    file->n_chapters, sizeof (gdouble));
+  for (i = 0; loaded && i < file->n_chapters; i++)
+    g_array_index (data->chapters, LoudnessChapter, file->first + i).loudness = loudness[i];
+  g_free (loudness);
+  return loaded;
+}
+
+static void
+loudness_store_cached (LoudnessData *data, LoudnessFile *file)
+{
+  gdouble *loudness;
+  guint i;
+
+  loudness = g_new (gdouble, file->n_chapters);
+  for (i = 0; i < file->n_chapters; i++)
+    loudness[i] = g_array_index (data->chapters, LoudnessChapter, file->first + i).loudness;
+  audite_cache_store_items ("loudness", file->cache_key, ".lufs", LOUDNESS_CACHE_VERSION,
+                            loudness, file->n_chapters, sizeof (gdouble));
+  g_free (loudness);
+}
+
+/* Pool worker: one chunk from decode to its share of the chapter. */
+static void
+loudness_run_chunk (gpointer item, gpointer user_data)
+{
+  LoudnessChunk *chunk = item;
+  LoudnessData *data = g_task_get_task_data (chunk->task);
+  LoudnessChapter *chapter = chunk->chapter;
+  LoudnessFile *file = chunk->file;
+  GCancellable *cancellable = g_task_get_cancellable (chunk->task);
+  gboolean decoded, store = FALSE;
+  guint i;
+
+  decoded = !g_cancellable_is_cancelled (cancellable)
+            && audite_idle_decode (LOUDNESS_PIPELINE, file->uri, chunk->start, chunk->stop,
+                                   data->task_pool, G_CALLBACK (loudness_handoff_handler),
+                                   chunk, cancellable);
+
+  g_mutex_lock (&data->lock);
+  if (decoded) {
+    if (!chapter->counts) {
+      chapter->counts = g_new0 (guint32, LOUDNESS_BINS);
+      chapter->energy = g_new0 (gdouble, LOUDNESS_BINS);
+    }
+    for (i = 0; i < LOUDNESS_BINS; i++) {
+      chapter->counts[i] += chunk->counts[i];
+      chapter->energy[i] += chunk->energy[i];
+    }
+  }
+  else
+    file->failed = TRUE;
+  if (--chapter->chunks_left == 0) {
+    if (chapter->counts)
+      chapter->loudness = loudness_integrate (chapter->counts, chapter->energy);
+    g_clear_pointer (&chapter->counts, g_free);
+    g_clear_pointer (&chapter->energy, g_free);
+    store = --file->chapters_left == 0 && !file->failed;
+  }
+  g_mutex_unlock (&data->lock);
+
+  /* a file that failed in part is measured again next time */
+  if (store)
+    loudness_store_cached (data, file);
+
+  g_object_unref (chunk->task);
+  g_free (chunk);
+}
+
+static gint
+loudness_compare (gconstpointer a, gconstpointer b)
+{
+  gdouble first = *(const gdouble *) a, second = *(const gdouble *) b;
+
+  return first < second ? -1 : first > second;
+}
+
+/* Linear gain per chapter that brings it to the median chapter, so the
+ * book keeps its level and only the outliers move. */
+static GArray *
+loudness_gains (GArray *chapters)
+{
+  GArray *gains, *measured;
+  LoudnessChapter *chapter;
+  gdouble target = 0.0, gain;
+  guint i;
+
+  measured = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  for (i = 0; i < chapters->len; i++) {
+    chapter = &g_array_index (chapters, LoudnessChapter, i);
+    if (isfinite (chapter->loudness))
+      g_array_append_val (measured, chapter->loudness);
+  }
+  if (measured->len > 0) {
+    g_array_sort (measured, loudness_compare);
+    target = g_array_index (measured, gdouble, measured->len / 2);
+  }
+  g_array_unref (measured);
+
+  gains = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), chapters->len);
+  for (i = 0; i < chapters->len; i++) {
+    chapter = &g_array_index (chapters, LoudnessChapter, i);
+    gain = 1.0;
+    if (isfinite (chapter->loudness))
+      gain = pow (10.0, CLAMP (target - chapter->loudness,
+                               -LOUDNESS_MAX_GAIN, LOUDNESS_MAX_GAIN) / 20.0);
+    g_array_append_val (gains, gain);
+  }
+  return gains;
+}
+
+static void
+loudness_thread (GTask        *task,
+                 gpointer      source_object,
+                 gpointer      task_data,
+                 GCancellable *cancellable)
+{
+  LoudnessData *data = task_data;
+  LoudnessFile *file;
+  LoudnessChapter *chapter;
+  LoudnessChunk *chunk;
+  AuditeIdlePool *pool;
+  GstClockTime start;
+  guint i, j;
+
+  /* all cores: the threads run at idle priority, so playback still gets
+   * what it asks for */
+  data->task_pool = audite_idle_task_pool_new ();
+  pool = audite_idle_pool_new (loudness_run_chunk, NULL, g_get_num_processors ());
+
+  for (i = 0; i < data->files->len && !g_cancellable_is_cancelled (cancellable); i++) {
+    file = &g_array_index (data->files, LoudnessFile, i);
+    file->cache_key = audite_cache_file_key (file->uri, cancellable);
+    if (loudness_load_cached (data, file))
+      continue;
+
+    /* every count is in place before the first chunk can finish */
+    file->chapters_left = file->n_chapters;
+    for (j = 0; j < file->n_chapters; j++) {
+      chapter = &g_array_index (data->chapters, LoudnessChapter, file->first + j);
+      if (chapter->end > chapter->start)
+        chapter->chunks_left = (chapter->end - chapter->start + LOUDNESS_CHUNK - 1)
+                               / LOUDNESS_CHUNK;
+      else
+        file->chapters_left--;
+    }
+    for (j = 0; j < file->n_chapters; j++) {
+      chapter = &g_array_index (data->chapters, LoudnessChapter, file->first + j);
+      start = chapter->start;
+      while (start < chapter->end) {
+        chunk = g_new0 (LoudnessChunk, 1);
+        chunk->task = g_object_ref (task);
+        chunk->file = file;
+        chunk->chapter = chapter;
+        chunk->start = start;
+        chunk->stop = MIN (start + LOUDNESS_CHUNK, chapter->end);
+        audite_idle_pool_push (pool, chunk);
+        start += LOUDNESS_CHUNK;
+      }
+    }
+  }
+  audite_idle_pool_free (pool);
+
+  if (!g_task_return_error_if_cancelled (task))
+    g_task_return_pointer (task, loudness_gains (data->chapters),
+                           (GDestroyNotify) g_array_unref);
+}
+
+/* Measures every chapter of @book: chapters of a single file, or the
+ * tracks of a folder, one per chapter. The result is a gain per chapter,
+ * see audite_loudness_analyze_finish. */
+void
+audite_loudness_analyze_async (gpointer              source_object,
+                               const AuditeBookInfo *book,
+                               GCancellable         *cancellable,
+                               GAsyncReadyCallback   callback,
+                               gpointer              user_data)
+{
+  LoudnessData *data;
+  LoudnessFile file = { 0 };
+  LoudnessChapter region = { 0 };
+  const AuditeChapter *chapter;
+  GTask *task;
+  guint i, n_chapters;
+
+  data = g_slice_new0 (LoudnessData);
+  data->files = g_array_new (FALSE, FALSE, sizeof (LoudnessFile));
+  g_array_set_clear_func (data->files, loudness_file_clear);
+  data->chapters = g_array_new (FALSE, FALSE, sizeof (LoudnessChapter));
+  g_array_set_clear_func (data->chapters, loudness_chapter_clear);
+  g_mutex_init (&data->lock);
+
+  n_chapters = book->chapters ? book->chapters->len : 0;
+  region.loudness = NAN;
+  if (book->tracks) {
+    for (i = 0; book->tracks[i] && i < n_chapters; i++) {
+      chapter = &g_array_index (book->chapters, AuditeChapter, i);
+      file.uri = g_strdup (book->tracks[i]);
+      file.first = i;
+      file.n_chapters = 1;
+      g_array_append_val (data->files, file);
+      region.start = 0;
+      region.end = chapter->end - chapter->start;
+      g_array_append_val (data->chapters, region);
+    }
+  }
+  else if (n_chapters > 0) {
+    file.uri = g_strdup (book->uri);
+    file.n_chapters = n_chapters;
+    g_array_append_val (data->files, file);
+    for (i = 0; i < n_chapters; i++) {
+      chapter = &g_array_index (book->chapters, AuditeChapter, i);
+      region.start = chapter->start;
+      region.end = chapter->end;
+      g_array_append_val (data->chapters, region);
+    }
+  }
+
+  task = g_task_new (source_object, cancellable, callback, user_data);
+  g_task_set_source_tag (task, audite_loudness_analyze_async);
+  g_task_set_task_data (task, data, (GDestroyNotify) loudness_data_free);
+  g_task_run_in_thread (task, loudness_thread);
+  g_object_unref (task);
+}
+
+/* Returns a linear gain (gdouble) for every chapter, 1.0 where nothing
+ * could be measured; the caller unrefs it. */
+GArray *
+audite_loudness_analyze_finish (GAsyncResult *result, GError **error)
+{
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
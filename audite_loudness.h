@@ -0,0 +1,24 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_LOUDNESS_H
+#define __AUDITE_LOUDNESS_H
+
+#include <gio/gio.h>
+#include "audite_loader.h"
+
+
+void           audite_loudness_analyze_async   (gpointer              source_object,
+                                                const AuditeBookInfo *book,
+                                                GCancellable         *cancellable,
+                                                GAsyncReadyCallback   callback,
+                                                gpointer              user_data);
+GArray        *audite_loudness_analyze_finish  (GAsyncResult         *result,
+                                                GError              **error);
+
+
+#endif /* __AUDITE_LOUDNESS_H */
@@ -0,0 +1,623 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * A minimal MP4 reader for what the loader needs: duration, a handful of
+ * iTunes tags and the chapter list. Only the box headers on the way to
+ * moov, the few boxes of interest inside it and the chapter text samples
+ * are touched, so the sample tables of the audio track, tens of megabytes
+ * for a long book, are never read. A local file is mapped; a remote one
+ * is read through GIO in byte ranges, fetching the top level headers,
+ * the moov box and the stretch of mdat holding the chapter titles. Any
+ * layout it does not expect (fragments, broken sizes, odd text samples)
+ * makes it give up without changing the book, and the caller falls back
+ * to mp4v2 or GStreamer.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+#include "audite_mp4.h"
+#include "audite_chapters.h"
+#include "audite_profile.h"
+
+#define MP4_FOURCC(a, b, c, d) \
+  (((guint32) (guint8) (a) << 24) | ((guint32) (guint8) (b) << 16) | \
+   ((guint32) (guint8) (c) << 8) | (guint32) (guint8) (d))
+
+/* Nero chapter starts are in units of 100 ns */
+#define MP4_CHPL_UNIT 100
+#define MP4_MAX_CHAPTERS 100000
+/* smallest range fetched from a remote file; chapter titles sit next to
+ * each other, so one range usually holds them all */
+#define MP4_RANGE_SIZE (64 * 1024)
+#define MP4_MAX_MOOV_SIZE (64 * 1024 * 1024)
+
+typedef struct
+{
+  const guint8 *data;
+  gsize         size;
+} Mp4Box;
+
+/* The whole file when it is mapped, otherwise a seekable stream and the
+ * last range read from it. */
+typedef struct
+{
+  const guint8 *data;
+  guint64       size;
+  GInputStream *stream;
+  GCancellable *cancellable;
+  guint8       *range;
+  guint64       range_offset;
+  gsize         range_size;
+} Mp4Source;
+
+typedef struct
+{
+  guint32  id;
+  guint32  chapter_id;          /* from tref/chap, 0 when absent */
+  guint32  timescale;
+  Mp4Box   stts;
+  Mp4Box   stsz;
+  Mp4Box   stsc;
+  Mp4Box   stco;
+  gboolean co64;
+} Mp4Track;
+
+typedef struct
+{
+  gchar        *title;
+  gchar        *artist;
+  gchar        *album;
+  gchar        *genre;
+  gboolean      has_cover;
+  GstClockTime  duration;
+  GArray       *chapters;
+} Mp4Book;
+
+/* Returns @size bytes at @offset, valid until the next read, or NULL
+ * when they are not in the file or could not be fetched. */
+static const guint8 *
+mp4_source_read (Mp4Source *source, guint64 offset, gsize size)
+{
+  gsize length, n_read;
+
+  if (offset > source->size || size > source->size - offset)
+    return NULL;
+  if (source->data)
+    return source->data + offset;
+  if (offset >= source->range_offset
+      && offset + size <= source->range_offset + source->range_size)
+    return source->range + (offset - source->range_offset);
+
+  length = MIN (MAX (size, MP4_RANGE_SIZE), source->size - offset);
+  source->range = g_realloc (source->range, length);
+  source->range_size = 0;
+  if (!g_seekable_seek (G_SEEKABLE (source->stream), offset, G_SEEK_SET,
+                        source->cancellable, NULL)
+      || !g_input_stream_read_all (source->stream, source->range, length, &n_read,
+                                   source->cancellable, NULL)
+      || n_read < size)
+    return NULL;
+  source->range_offset = offset;
+  source->range_size = n_read;
+  return source->range;
+}
+
+/* Steps to the box at @pos within @parent. Returns FALSE at the end or
+ * when the size does not fit, which the callers treat alike. */
+static gboolean
+mp4_next_box (const Mp4Box *parent, gsize *pos, guint32 *type, Mp4Box *body)
+{
+  const guint8 *header;
+  guint64 size;
+  gsize header_size = 8;
+
+  if (*pos > parent->size || parent->size - *pos < 8)
+    return FALSE;
+  header = parent->data + *pos;
+  size = GST_READ_UINT32_BE (header);
+  *type = GST_READ_UINT32_BE (header + 4);
+
+  if (size == 1) {
+    if (parent->size - *pos < 16)
+      return FALSE;
+    size = GST_READ_UINT64_BE (header + 8);
+    header_size = 16;
+  }
+  else if (size == 0)
+    size = parent->size - *pos;
+
+  if (size < header_size || size > parent->size - *pos)
+    return FALSE;
+  body->data = header + header_size;
+  body->size = size - header_size;
+  *pos += size;
+  return TRUE;
+}
+
+static gboolean
+mp4_find_box (const Mp4Box *parent, guint32 type, Mp4Box *body)
+{
+  gsize pos = 0;
+  guint32 found;
+
+  while (mp4_next_box (parent, &pos, &found, body))
+    if (found == type)
+      return TRUE;
+  return FALSE;
+}
+
+/* Follows a path of box types, such as mdia/minf/stbl. */
+static gboolean
+mp4_find_path (const Mp4Box *parent, const guint32 *types, guint n_types, Mp4Box *body)
+{
+  Mp4Box box = *parent;
+  guint i;
+
+  for (i = 0; i < n_types; i++)
+    if (!mp4_find_box (&box, types[i], &box))
+      return FALSE;
+  *body = box;
+  return TRUE;
+}
+
+/* mvhd and mdhd share the layout up to the duration. */
+static gboolean
+mp4_read_header_times (const Mp4Box *box, guint32 *timescale, guint64 *duration)
+{
+  if (box->size < 4)
+    return FALSE;
+  if (box->data[0] == 1) {
+    if (box->size < 32)
+      return FALSE;
+    *timescale = GST_READ_UINT32_BE (box->data + 20);
+    *duration = GST_READ_UINT64_BE (box->data + 24);
+  }
+  else {
+    if (box->size < 20)
+      return FALSE;
+    *timescale = GST_READ_UINT32_BE (box->data + 12);
+    *duration = GST_READ_UINT32_BE (box->data + 16);
+  }
+  return *timescale > 0;
+}
+
+static gboolean
+mp4_read_track (const Mp4Box *trak, Mp4Track *track)
+{
+  static const guint32 stbl_path[] = {
+    MP4_FOURCC ('m', 'd', 'i', 'a'), MP4_FOURCC ('m', 'i', 'n', 'f'),
+    MP4_FOURCC ('s', 't', 'b', 'l')
+  };
+  Mp4Box box, stbl;
+  guint64 duration;
+
+  memset (track, 0, sizeof (Mp4Track));
+
+  if (!mp4_find_box (trak, MP4_FOURCC ('t', 'k', 'h', 'd'), &box) || box.size < 24)
+    return FALSE;
+  track->id = GST_READ_UINT32_BE (box.data + (box.data[0] == 1 ? 20 : 12));
+
+  if (mp4_find_box (trak, MP4_FOURCC ('t', 'r', 'e', 'f'), &box)
+      && mp4_find_box (&box, MP4_FOURCC ('c', 'h', 'a', 'p'), &box)
+      && box.size >= 4)
+    track->chapter_id = GST_READ_UINT32_BE (box.data);
+
+  if (!mp4_find_path (trak, stbl_path, 1, &box)
+      || !mp4_find_box (&box, MP4_FOURCC ('m', 'd', 'h', 'd'), &box)
+      || !mp4_read_header_times (&box, &track->timescale, &duration))
+    return FALSE;
+
+  /* the tables only matter for the chapter track; missing ones are
+   * noticed when it is read */
+  if (mp4_find_path (trak, stbl_path, G_N_ELEMENTS (stbl_path), &stbl)) {
+    mp4_find_box (&stbl, MP4_FOURCC ('s', 't', 't', 's'), &track->stts);
+    mp4_find_box (&stbl, MP4_FOURCC ('s', 't', 's', 'z'), &track->stsz);
+    mp4_find_box (&stbl, MP4_FOURCC ('s', 't', 's', 'c'), &track->stsc);
+    if (!mp4_find_box (&stbl, MP4_FOURCC ('s', 't', 'c', 'o'), &track->stco))
+      track->co64 = mp4_find_box (&stbl, MP4_FOURCC ('c', 'o', '6', '4'), &track->stco);
+  }
+  return TRUE;
+}
+
+/* A QuickTime text sample: a 16 bit length and the text, UTF-8 or
+ * UTF-16 with a byte order mark. */
+static gchar *
+mp4_read_text_sample (const guint8 *data, gsize size)
+{
+  guint length;
+
+  if (size < 2)
+    return NULL;
+  length = GST_READ_UINT16_BE (data);
+  if (length > size - 2)
+    return NULL;
+  data += 2;
+
+  if (length >= 2 && data[0] == 0xfe && data[1] == 0xff)
+    return g_convert ((const gchar *) data + 2, length - 2, "UTF-8", "UTF-16BE",
+                      NULL, NULL, NULL);
+  if (length >= 2 && data[0] == 0xff && data[1] == 0xfe)
+    return g_convert ((const gchar *) data + 2, length - 2, "UTF-8", "UTF-16LE",
+                      NULL, NULL, NULL);
+  if (!g_utf8_validate ((const gchar *) data, length, NULL))
+    return NULL;
+  return g_strndup ((const gchar *) data, length);
+}
+
+/* Reads every sample of the chapter text track: times from stts, places
+ * from stsc, stsz and stco. Each table is checked against its own size
+ * and each sample against the mapping. */
+static GArray *
+mp4_read_text_chapters (Mp4Source *source, const Mp4Track *track)
+{
+  const Mp4Box *stts = &track->stts, *stsz = &track->stsz;
+  const Mp4Box *stsc = &track->stsc, *stco = &track->stco;
+  GArray *chapters;
+  guint32 n_samples, sample_size, n_times, n_runs, n_chunks;
+  guint32 time_entry = 0, time_left, run = 0, chunk, in_chunk = 0, per_chunk;
+  guint64 time = 0, delta, offset, size;
+  const guint8 *data;
+  guint sample;
+  gchar *title;
+
+  if (!stts->data || !stsz->data || !stsc->data || !stco->data
+      || stts->size < 8 || stsz->size < 12 || stsc->size < 8 || stco->size < 8)
+    return NULL;
+
+  sample_size = GST_READ_UINT32_BE (stsz->data + 4);
+  n_samples = GST_READ_UINT32_BE (stsz->data + 8);
+  n_times = GST_READ_UINT32_BE (stts->data + 4);
+  n_runs = GST_READ_UINT32_BE (stsc->data + 4);
+  n_chunks = GST_READ_UINT32_BE (stco->data + 4);
+  if (n_samples == 0 || n_samples > MP4_MAX_CHAPTERS
+      || (sample_size == 0 && (stsz->size - 12) / 4 < n_samples)
+      || (stts->size - 8) / 8 < n_times || n_times == 0
+      || (stsc->size - 8) / 12 < n_runs || n_runs == 0
+      || (stco->size - 8) / (track->co64 ? 8 : 4) < n_chunks || n_chunks == 0
+      || GST_READ_UINT32_BE (stsc->data + 8) != 1)
+    return NULL;
+
+  chapters = audite_chapters_new (n_samples);
+  time_left = GST_READ_UINT32_BE (stts->data + 8);
+  chunk = 1;
+  per_chunk = GST_READ_UINT32_BE (stsc->data + 12);
+  offset = track->co64 ? GST_READ_UINT64_BE (stco->data + 8)
+                       : GST_READ_UINT32_BE (stco->data + 8);
+
+  for (sample = 0; sample < n_samples; sample++) {
+    /* move to the next chunk once this one is used up */
+    while (in_chunk == per_chunk) {
+      if (++chunk > n_chunks)
+        goto invalid;
+      if (run + 1 < n_runs && GST_READ_UINT32_BE (stsc->data + 8 + (run + 1) * 12) == chunk) {
+        run++;
+        per_chunk = GST_READ_UINT32_BE (stsc->data + 12 + run * 12);
+      }
+      in_chunk = 0;
+      offset = track->co64 ? GST_READ_UINT64_BE (stco->data + 8 + (chunk - 1) * 8)
+                           : GST_READ_UINT32_BE (stco->data + 8 + (chunk - 1) * 4);
+    }
+
+    while (time_left == 0) {
+      if (++time_entry >= n_times)
+        goto invalid;
+      time_left = GST_READ_UINT32_BE (stts->data + 8 + time_entry * 8);
+    }
+    delta = GST_READ_UINT32_BE (stts->data + 12 + time_entry * 8);
+    time_left--;
+
+    size = sample_size ? sample_size : GST_READ_UINT32_BE (stsz->data + 12 + sample * 4);
+    data = mp4_source_read (source, offset, size);
+    if (!data)
+      goto invalid;
+    title = mp4_read_text_sample (data, size);
+    if (!title)
+      goto invalid;
+
+    audite_chapters_append (chapters, title,
+                            gst_util_uint64_scale (time, GST_SECOND, track->timescale),
+                            gst_util_uint64_scale (time + delta, GST_SECOND, track->timescale));
+    g_free (title);
+    time += delta;
+    offset += size;
+    in_chunk++;
+  }
+  return chapters;
+
+invalid:
+  g_array_unref (chapters);
+  return NULL;
+}
+
+/* Nero chapters: start times only, so each chapter ends where the next
+ * begins and the last one at the end of the book. */
+static GArray *
+mp4_read_chpl (const Mp4Box *chpl, GstClockTime duration)
+{
+  GArray *chapters;
+  gsize pos;
+  guint n_chapters, index, length;
+  GstClockTime start, end;
+  gchar *title;
+
+  pos = chpl->size > 0 && chpl->data[0] ? 8 : 4;
+  if (chpl->size < pos + 1)
+    return NULL;
+  n_chapters = chpl->data[pos++];
+  if (n_chapters == 0)
+    return NULL;
+
+  chapters = audite_chapters_new (n_chapters);
+  for (index = 0; index < n_chapters; index++) {
+    if (chpl->size - pos < 9)
+      goto invalid;
+    start = GST_READ_UINT64_BE (chpl->data + pos) * MP4_CHPL_UNIT;
+    length = chpl->data[pos + 8];
+    pos += 9;
+    if (chpl->size - pos < length
+        || !g_utf8_validate ((const gchar *) chpl->data + pos, length, NULL))
+      goto invalid;
+    title = g_strndup ((const gchar *) chpl->data + pos, length);
+    pos += length;
+
+    /* the end is fixed up once the next start is known */
+    audite_chapters_append (chapters, title, start, duration);
+    g_free (title);
+    if (index > 0)
+      g_array_index (chapters, AuditeChapter, index - 1).end = start;
+  }
+  return chapters;
+
+invalid:
+  g_array_unref (chapters);
+  return NULL;
+}
+
+/* The string payload of an ilst item's data box. */
+static gchar *
+mp4_read_tag (const Mp4Box *ilst, guint32 type)
+{
+  Mp4Box item, data;
+
+  if (!mp4_find_box (ilst, type, &item)
+      || !mp4_find_box (&item, MP4_FOURCC ('d', 'a', 't', 'a'), &data)
+      || data.size < 8
+      || !g_utf8_validate ((const gchar *) data.data + 8, data.size - 8, NULL))
+    return NULL;
+  return g_strndup ((const gchar *) data.data + 8, data.size - 8);
+}
+
+static void
+mp4_read_tags (const Mp4Box *udta, Mp4Book *book)
+{
+  Mp4Box meta, ilst, item;
+
+  if (!mp4_find_box (udta, MP4_FOURCC ('m', 'e', 't', 'a'), &meta))
+    return;
+  /* iTunes writes meta as a full box, QuickTime without version */
+  if (meta.size >= 4 && GST_READ_UINT32_BE (meta.data) == 0) {
+    meta.data += 4;
+    meta.size -= 4;
+  }
+  if (!mp4_find_box (&meta, MP4_FOURCC ('i', 'l', 's', 't'), &ilst))
+    return;
+
+  book->title = mp4_read_tag (&ilst, MP4_FOURCC (0xa9, 'n', 'a', 'm'));
+  book->artist = mp4_read_tag (&ilst, MP4_FOURCC (0xa9, 'A', 'R', 'T'));
+  book->album = mp4_read_tag (&ilst, MP4_FOURCC (0xa9, 'a', 'l', 'b'));
+  book->genre = mp4_read_tag (&ilst, MP4_FOURCC (0xa9, 'g', 'e', 'n'));
+  book->has_cover = mp4_find_box (&ilst, MP4_FOURCC ('c', 'o', 'v', 'r'), &item)
+                    && mp4_find_box (&item, MP4_FOURCC ('d', 'a', 't', 'a'), &item);
+}
+
+static void
+mp4_book_clear (Mp4Book *book)
+{
+  g_free (book->title);
+  g_free (book->artist);
+  g_free (book->album);
+  g_free (book->genre);
+  if (book->chapters)
+    g_array_unref (book->chapters);
+}
+
+static gboolean
+mp4_read_moov (Mp4Source *source, const Mp4Box *moov, Mp4Book *book)
+{
+  GArray *tracks;
+  Mp4Track track, *chapter_track = NULL;
+  Mp4Box box;
+  gsize pos = 0;
+  guint32 type, timescale, chapter_id = 0;
+  guint64 duration;
+  guint i;
+
+  /* fragmented files keep their samples outside moov */
+  if (mp4_find_box (moov, MP4_FOURCC ('m', 'v', 'e', 'x'), &box))
+    return FALSE;
+  if (!mp4_find_box (moov, MP4_FOURCC ('m', 'v', 'h', 'd'), &box)
+      || !mp4_read_header_times (&box, &timescale, &duration))
+    return FALSE;
+  book->duration = gst_util_uint64_scale (duration, GST_SECOND, timescale);
+
+  tracks = g_array_new (FALSE, FALSE, sizeof (Mp4Track));
+  while (mp4_next_box (moov, &pos, &type, &box)) {
+    if (type != MP4_FOURCC ('t', 'r', 'a', 'k'))
+      continue;
+    if (!mp4_read_track (&box, &track)) {
+      g_array_unref (tracks);
+      return FALSE;
+    }
+    g_array_append_val (tracks, track);
+    if (!chapter_id)
+      chapter_id = track.chapter_id;
+  }
+
+  for (i = 0; i < tracks->len && chapter_id; i++)
+    if (g_array_index (tracks, Mp4Track, i).id == chapter_id)
+      chapter_track = &g_array_index (tracks, Mp4Track, i);
+
+  /* a reference to a chapter track that cannot be read is unusual */
+  if (chapter_id) {
+    book->chapters = chapter_track ? mp4_read_text_chapters (source, chapter_track) : NULL;
+    if (!book->chapters) {
+      g_array_unref (tracks);
+      return FALSE;
+    }
+  }
+  g_array_unref (tracks);
+
+  if (mp4_find_box (moov, MP4_FOURCC ('u', 'd', 't', 'a'), &box)) {
+    mp4_read_tags (&box, book);
+    if (!book->chapters && mp4_find_box (&box, MP4_FOURCC ('c', 'h', 'p', 'l'), &box))
+      book->chapters = mp4_read_chpl (&box, book->duration);
+  }
+  return TRUE;
+}
+
+static gboolean
+mp4_finish (Mp4Book *book, gboolean found, AuditeBookInfo *info)
+{
+  if (!found) {
+    mp4_book_clear (book);
+    return FALSE;
+  }
+
+  info->title = book->title;
+  info->artist = book->artist;
+  info->album = book->album;
+  info->genre = book->genre;
+  info->has_cover = book->has_cover;
+  info->duration = book->duration;
+  info->chapters = book->chapters;
+  return TRUE;
+}
+
+/* Fills duration, tags and chapters of @info from the MP4 @filename.
+ * Returns FALSE, leaving @info untouched, when the file has to be read
+ * with mp4v2 instead. */
+gboolean
+audite_mp4_read (const gchar *filename, AuditeBookInfo *info)
+{
+  GMappedFile *mapped;
+  Mp4Source source = { 0 };
+  Mp4Box file, moov;
+  Mp4Book book = { 0 };
+  gboolean found;
+
+  audite_profile_begin ("mp4_map_chapters");
+  mapped = g_mapped_file_new (filename, FALSE, NULL);
+  if (!mapped) {
+    audite_profile_end ("mp4_map_chapters");
+    return FALSE;
+  }
+  file.data = (const guint8 *) g_mapped_file_get_contents (mapped);
+  file.size = g_mapped_file_get_length (mapped);
+  source.data = file.data;
+  source.size = file.size;
+
+  /* only box headers are read on the way, mdat is stepped over */
+  found = file.data && mp4_find_box (&file, MP4_FOURCC ('m', 'o', 'o', 'v'), &moov)
+          && mp4_read_moov (&source, &moov, &book);
+  g_mapped_file_unref (mapped);
+  audite_profile_end ("mp4_map_chapters");
+
+  return mp4_finish (&book, found, info);
+}
+
+/* Walks the top level headers of a remote file, a range per box, and
+ * returns a copy of the body of moov. */
+static guint8 *
+mp4_fetch_moov (Mp4Source *source, gsize *moov_size)
+{
+  const guint8 *header;
+  guint64 pos = 0, size;
+  gsize header_size;
+  guint32 type;
+
+  while (source->size - pos >= 8) {
+    header = mp4_source_read (source, pos, MIN (16, source->size - pos));
+    if (!header)
+      return NULL;
+    size = GST_READ_UINT32_BE (header);
+    type = GST_READ_UINT32_BE (header + 4);
+    header_size = 8;
+    if (size == 1) {
+      if (source->size - pos < 16)
+        return NULL;
+      size = GST_READ_UINT64_BE (header + 8);
+      header_size = 16;
+    }
+    else if (size == 0)
+      size = source->size - pos;
+    if (size < header_size || size > source->size - pos)
+      return NULL;
+
+    if (type == MP4_FOURCC ('m', 'o', 'o', 'v')) {
+      if (size - header_size > MP4_MAX_MOOV_SIZE)
+        return NULL;
+      *moov_size = size - header_size;
+      header = mp4_source_read (source, pos + header_size, *moov_size);
+      return header ? g_memdup2 (header, *moov_size) : NULL;
+    }
+    pos += size;
+  }
+  return NULL;
+}
+
+/* Like audite_mp4_read, for a file that is not local, such as one on an
+ * HTTP server. Returns FALSE when the stream cannot seek, which is what
+ * a range request needs. */
+gboolean
+audite_mp4_read_uri (const gchar    *uri,
+                     GCancellable   *cancellable,
+                     AuditeBookInfo *info)
+{
+  GFile *file;
+  GFileInputStream *stream;
+  GFileInfo *file_info;
+  Mp4Source source = { 0 };
+  Mp4Box moov;
+  Mp4Book book = { 0 };
+  guint8 *moov_data = NULL;
+  gsize moov_size = 0;
+  gboolean found = FALSE;
+
+  audite_profile_begin ("mp4_fetch_chapters");
+  file = g_file_new_for_uri (uri);
+  stream = g_file_read (file, cancellable, NULL);
+  g_object_unref (file);
+  if (!stream) {
+    audite_profile_end ("mp4_fetch_chapters");
+    return FALSE;
+  }
+
+  file_info = g_file_input_stream_query_info (stream, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                              cancellable, NULL);
+  if (file_info && g_seekable_can_seek (G_SEEKABLE (stream))) {
+    source.size = g_file_info_get_size (file_info);
+    source.stream = G_INPUT_STREAM (stream);
+    source.cancellable = cancellable;
+    moov_data = mp4_fetch_moov (&source, &moov_size);
+  }
+  if (moov_data) {
+    moov.data = moov_data;
+    moov.size = moov_size;
+    found = mp4_read_moov (&source, &moov, &book);
+  }
+  g_free (moov_data);
+  g_free (source.range);
+  g_clear_object (&file_info);
+  g_object_unref (stream);
+  audite_profile_end ("mp4_fetch_chapters");
+
+  return mp4_finish (&book, found, info);
+}
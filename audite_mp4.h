@@ -0,0 +1,22 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_MP4_H
+#define __AUDITE_MP4_H
+
+#include <gio/gio.h>
+#include "audite_loader.h"
+
+
+gboolean       audite_mp4_read                 (const gchar    *filename,
+                                                AuditeBookInfo *info);
+gboolean       audite_mp4_read_uri             (const gchar    *uri,
+                                                GCancellable   *cancellable,
+                                                AuditeBookInfo *info);
+
+
+#endif /* __AUDITE_MP4_H */
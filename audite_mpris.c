@@ -0,0 +1,657 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * MPRIS2 on the session bus, for media keys, desktop shells and scripts.
+ * Every chapter is a track, so Next and Previous step through chapters
+ * and Position counts from the start of the current one. The window tells
+ * this module about real changes only: play state, chapter, book, cover
+ * and volume. Changes made in one main loop iteration go out together in
+ * a single PropertiesChanged. Position is never signalled; it is worked
+ * out on request from a clock snapshot (position, time and rate) that the
+ * window refreshes as it ticks, read without locking.
+ */
+
+#include <math.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+#include <gst/player/player.h>
+
+#include "audite_mpris.h"
+
+#define MPRIS_BUS_NAME "org.mpris.MediaPlayer2.audite"
+#define MPRIS_OBJECT_PATH "/org/mpris/MediaPlayer2"
+#define MPRIS_ROOT_INTERFACE "org.mpris.MediaPlayer2"
+#define MPRIS_PLAYER_INTERFACE "org.mpris.MediaPlayer2.Player"
+#define MPRIS_TRACK_PATH "/com/github/alkesta/audite/chapter/%d"
+#define MPRIS_NO_TRACK "/org/mpris/MediaPlayer2/TrackList/NoTrack"
+#define MPRIS_MIN_RATE 0.5
+#define MPRIS_MAX_RATE 4.0
+
+static const gchar mpris_introspection[] =
+  "<node>"
+  "  <interface name='org.mpris.MediaPlayer2'>"
+  "    <method name='Raise'/>"
+  "    <method name='Quit'/>"
+  "    <property name='CanQuit' type='b' access='read'/>"
+  "    <property name='CanRaise' type='b' access='read'/>"
+  "    <property name='HasTrackList' type='b' access='read'/>"
+  "    <property name='Identity' type='s' access='read'/>"
+  "    <property name='DesktopEntry' type='s' access='read'/>"
+  "    <property name='SupportedUriSchemes' type='as' access='read'/>"
+  "    <property name='SupportedMimeTypes' type='as' access='read'/>"
+  "  </interface>"
+  "  <interface name='org.mpris.MediaPlayer2.Player'>"
+  "    <method name='Next'/>"
+  "    <method name='Previous'/>"
+  "    <method name='Pause'/>"
+  "    <method name='PlayPause'/>"
+  "    <method name='Stop'/>"
+  "    <method name='Play'/>"
+  "    <method name='Seek'>"
+  "      <arg direction='in' name='Offset' type='x'/>"
+  "    </method>"
+  "    <method name='SetPosition'>"
+  "      <arg direction='in' name='TrackId' type='o'/>"
+  "      <arg direction='in' name='Position' type='x'/>"
+  "    </method>"
+  "    <method name='OpenUri'>"
+  "      <arg direction='in' name='Uri' type='s'/>"
+  "    </method>"
+  "    <signal name='Seeked'>"
+  "      <arg name='Position' type='x'/>"
+  "    </signal>"
+  "    <property name='PlaybackStatus' type='s' access='read'/>"
+  "    <property name='Rate' type='d' access='readwrite'/>"
+  "    <property name='Metadata' type='a{sv}' access='read'/>"
+  "    <property name='Volume' type='d' access='readwrite'/>"
+  "    <property name='Position' type='x' access='read'/>"
+  "    <property name='MinimumRate' type='d' access='read'/>"
+  "    <property name='MaximumRate' type='d' access='read'/>"
+  "    <property name='CanGoNext' type='b' access='read'/>"
+  "    <property name='CanGoPrevious' type='b' access='read'/>"
+  "    <property name='CanPlay' type='b' access='read'/>"
+  "    <property name='CanPause' type='b' access='read'/>"
+  "    <property name='CanSeek' type='b' access='read'/>"
+  "    <property name='CanControl' type='b' access='read'/>"
+  "  </interface>"
+  "</node>";
+
+typedef enum
+{
+  MPRIS_CHANGED_STATUS   = 1 << 0,
+  MPRIS_CHANGED_METADATA = 1 << 1,
+  MPRIS_CHANGED_VOLUME   = 1 << 2,
+  MPRIS_CHANGED_RATE     = 1 << 3,
+  MPRIS_CHANGED_CAN_GO   = 1 << 4,
+  MPRIS_CHANGED_CAN_PLAY = 1 << 5,
+  MPRIS_CHANGED_SEEKED   = 1 << 6
+} MprisChanged;
+
+/* Where playback stood at @time; later positions follow from the rate. */
+typedef struct
+{
+  GstClockTime  position;       /* book timeline */
+  gint64        time;           /* monotonic, microseconds */
+  gdouble       rate;
+  gboolean      playing;
+  GstClockTime  start;          /* of the current track */
+} MprisClock;
+
+struct _AuditeMpris
+{
+  AuditeAppWindow *win;
+  guint            owner_id;
+  GDBusNodeInfo   *node;
+  GDBusConnection *connection;
+  guint            root_id;
+  guint            player_id;
+  guint            dirty;
+  guint            flush_id;
+
+  /* written on the main thread only; odd while a write is under way */
+  gint             sequence;
+  MprisClock       clock;
+
+  gchar           *title;
+  gchar           *artist;
+  gchar           *art_uri;
+  gchar           *track_title;
+  gint             index;
+  gint             n_tracks;
+  GstClockTime     start;
+  GstClockTime     end;
+  gdouble          volume;
+};
+
+static void
+mpris_write_clock (AuditeMpris *mpris, const MprisClock *clock)
+{
+  g_atomic_int_inc (&mpris->sequence);
+  mpris->clock = *clock;
+  g_atomic_int_inc (&mpris->sequence);
+}
+
+/* Retries while a write overlaps; writes are rare and short. */
+static void
+mpris_read_clock (AuditeMpris *mpris, MprisClock *clock)
+{
+  gint sequence;
+
+  do {
+    sequence = g_atomic_int_get (&mpris->sequence);
+    *clock = mpris->clock;
+  } while (sequence & 1 || g_atomic_int_get (&mpris->sequence) != sequence);
+}
+
+static GstClockTime
+mpris_clock_position (const MprisClock *clock)
+{
+  gint64 elapsed;
+
+  if (!GST_CLOCK_TIME_IS_VALID (clock->position) || !clock->playing)
+    return clock->position;
+  elapsed = MAX (0, g_get_monotonic_time () - clock->time);
+  return clock->position + (GstClockTime) (elapsed * GST_USECOND * clock->rate);
+}
+
+/* Position on the book timeline, from the snapshot alone. Safe to call
+ * from any thread. */
+GstClockTime
+audite_mpris_get_position (AuditeMpris *mpris)
+{
+  MprisClock clock;
+
+  mpris_read_clock (mpris, &clock);
+  return mpris_clock_position (&clock);
+}
+
+/* Position inside the current track, in microseconds as MPRIS has it. */
+static gint64
+mpris_track_position (AuditeMpris *mpris)
+{
+  MprisClock clock;
+  GstClockTime position;
+
+  mpris_read_clock (mpris, &clock);
+  position = mpris_clock_position (&clock);
+  if (!GST_CLOCK_TIME_IS_VALID (position) || !GST_CLOCK_TIME_IS_VALID (clock.start)
+      || position < clock.start)
+    return 0;
+  return (position - clock.start) / GST_USECOND;
+}
+
+static GVariant *
+mpris_metadata (AuditeMpris *mpris)
+{
+  GVariantBuilder builder;
+  gchar path[64];
+  const gchar *title;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  if (mpris->index < 0) {
+    g_variant_builder_add (&builder, "{sv}", "mpris:trackid",
+                           g_variant_new_object_path (MPRIS_NO_TRACK));
+    return g_variant_builder_end (&builder);
+  }
+
+  g_snprintf (path, sizeof (path), MPRIS_TRACK_PATH, mpris->index);
+  g_variant_builder_add (&builder, "{sv}", "mpris:trackid", g_variant_new_object_path (path));
+  if (GST_CLOCK_TIME_IS_VALID (mpris->end) && mpris->end > mpris->start)
+    g_variant_builder_add (&builder, "{sv}", "mpris:length",
+                           g_variant_new_int64 ((mpris->end - mpris->start) / GST_USECOND));
+  title = mpris->track_title ? mpris->track_title : mpris->title;
+  if (title)
+    g_variant_builder_add (&builder, "{sv}", "xesam:title", g_variant_new_string (title));
+  if (mpris->title)
+    g_variant_builder_add (&builder, "{sv}", "xesam:album", g_variant_new_string (mpris->title));
+  if (mpris->artist)
+    g_variant_builder_add (&builder, "{sv}", "xesam:artist",
+                           g_variant_new_strv ((const gchar * const *) &mpris->artist, 1));
+  if (mpris->art_uri)
+    g_variant_builder_add (&builder, "{sv}", "mpris:artUrl", g_variant_new_string (mpris->art_uri));
+  g_variant_builder_add (&builder, "{sv}", "xesam:trackNumber", g_variant_new_int32 (mpris->index + 1));
+  return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+mpris_player_property (AuditeMpris *mpris, const gchar *name)
+{
+  MprisClock clock;
+
+  mpris_read_clock (mpris, &clock);
+  if (g_str_equal (name, "PlaybackStatus"))
+    return g_variant_new_string (mpris->index < 0 ? "Stopped" :
+                                 clock.playing ? "Playing" : "Paused");
+  if (g_str_equal (name, "Rate"))
+    return g_variant_new_double (clock.rate);
+  if (g_str_equal (name, "Metadata"))
+    return mpris_metadata (mpris);
+  if (g_str_equal (name, "Volume"))
+    return g_variant_new_double (mpris->volume);
+  if (g_str_equal (name, "Position"))
+    return g_variant_new_int64 (mpris_track_position (mpris));
+  if (g_str_equal (name, "MinimumRate"))
+    return g_variant_new_double (MPRIS_MIN_RATE);
+  if (g_str_equal (name, "MaximumRate"))
+    return g_variant_new_double (MPRIS_MAX_RATE);
+  if (g_str_equal (name, "CanGoNext"))
+    return g_variant_new_boolean (mpris->index >= 0 && mpris->index + 1 < mpris->n_tracks);
+  if (g_str_equal (name, "CanGoPrevious"))
+    return g_variant_new_boolean (mpris->index > 0);
+  if (g_str_equal (name, "CanPlay") || g_str_equal (name, "CanPause")
+      || g_str_equal (name, "CanSeek"))
+    return g_variant_new_boolean (mpris->index >= 0);
+  if (g_str_equal (name, "CanControl"))
+    return g_variant_new_boolean (TRUE);
+  return NULL;
+}
+
+static GVariant *
+mpris_root_property (AuditeMpris *mpris, const gchar *name)
+{
+  static const gchar *schemes[] = { "file", "http", "https", NULL };
+  static const gchar *mime_types[] = {
+    "audio/mp4", "audio/x-m4b", "audio/mpeg", "audio/ogg", "audio/flac", "audio/x-matroska", NULL
+  };
+
+  if (g_str_equal (name, "CanQuit") || g_str_equal (name, "CanRaise"))
+    return g_variant_new_boolean (TRUE);
+  if (g_str_equal (name, "HasTrackList"))
+    return g_variant_new_boolean (FALSE);
+  if (g_str_equal (name, "Identity"))
+    return g_variant_new_string ("Audite");
+  if (g_str_equal (name, "DesktopEntry"))
+    return g_variant_new_string ("audite");
+  if (g_str_equal (name, "SupportedUriSchemes"))
+    return g_variant_new_strv (schemes, -1);
+  if (g_str_equal (name, "SupportedMimeTypes"))
+    return g_variant_new_strv (mime_types, -1);
+  return NULL;
+}
+
+static gboolean
+mpris_flush (gpointer data)
+{
+  static const struct { guint changed; const gchar *name; } properties[] = {
+    { MPRIS_CHANGED_STATUS,   "PlaybackStatus" },
+    { MPRIS_CHANGED_METADATA, "Metadata" },
+    { MPRIS_CHANGED_VOLUME,   "Volume" },
+    { MPRIS_CHANGED_RATE,     "Rate" },
+    { MPRIS_CHANGED_CAN_GO,   "CanGoNext" },
+    { MPRIS_CHANGED_CAN_GO,   "CanGoPrevious" },
+    { MPRIS_CHANGED_CAN_PLAY, "CanPlay" },
+    { MPRIS_CHANGED_CAN_PLAY, "CanPause" },
+    { MPRIS_CHANGED_CAN_PLAY, "CanSeek" },
+  };
+  AuditeMpris *mpris = data;
+  GVariantBuilder builder;
+  guint i;
+
+  mpris->flush_id = 0;
+  if (!mpris->connection)
+    return G_SOURCE_REMOVE;
+
+  if (mpris->dirty & ~MPRIS_CHANGED_SEEKED) {
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+    for (i = 0; i < G_N_ELEMENTS (properties); i++)
+      if (mpris->dirty & properties[i].changed)
+        g_variant_builder_add (&builder, "{sv}", properties[i].name,
+                               mpris_player_property (mpris, properties[i].name));
+    g_dbus_connection_emit_signal (mpris->connection, NULL, MPRIS_OBJECT_PATH,
+                                   "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                                   g_variant_new ("(sa{sv}as)", MPRIS_PLAYER_INTERFACE,
+                                                  &builder, NULL),
+                                   NULL);
+  }
+  /* after the metadata, so the position is read against the new track */
+  if (mpris->dirty & MPRIS_CHANGED_SEEKED)
+    g_dbus_connection_emit_signal (mpris->connection, NULL, MPRIS_OBJECT_PATH,
+                                   MPRIS_PLAYER_INTERFACE, "Seeked",
+                                   g_variant_new ("(x)", mpris_track_position (mpris)),
+                                   NULL);
+  mpris->dirty = 0;
+  return G_SOURCE_REMOVE;
+}
+
+static void
+mpris_changed (AuditeMpris *mpris, guint changed)
+{
+  mpris->dirty |= changed;
+  if (!mpris->flush_id && mpris->connection)
+    mpris->flush_id = g_idle_add (mpris_flush, mpris);
+}
+
+static void
+mpris_seek (AuditeMpris *mpris, gint64 offset)
+{
+  GstClockTime position = audite_mpris_get_position (mpris);
+  gint64 target;
+
+  if (!GST_CLOCK_TIME_IS_VALID (position))
+    return;
+  target = (gint64) position + offset * (gint64) GST_USECOND;
+  audite_app_window_seek (mpris->win, MAX (target, 0));
+}
+
+static void
+mpris_set_position (AuditeMpris *mpris, const gchar *track, gint64 position)
+{
+  gchar path[64];
+
+  g_snprintf (path, sizeof (path), MPRIS_TRACK_PATH, mpris->index);
+  /* a stale track id means the client is behind, the spec says ignore it */
+  if (mpris->index < 0 || g_strcmp0 (track, path) != 0 || position < 0)
+    return;
+  if (GST_CLOCK_TIME_IS_VALID (mpris->end)
+      && (GstClockTime) position * GST_USECOND > mpris->end - mpris->start)
+    return;
+  audite_app_window_seek (mpris->win, mpris->start + position * GST_USECOND);
+}
+
+static void
+mpris_method_call (GDBusConnection       *connection,
+                   const gchar           *sender,
+                   const gchar           *object_path,
+                   const gchar           *interface_name,
+                   const gchar           *method_name,
+                   GVariant              *parameters,
+                   GDBusMethodInvocation *invocation,
+                   gpointer               user_data)
+{
+  AuditeMpris *mpris = user_data;
+  MprisClock clock;
+  const gchar *track, *uri;
+  gint64 offset;
+
+  /* a hidden window only checks the chapter when it should have ended */
+  if (g_str_equal (interface_name, MPRIS_PLAYER_INTERFACE))
+    audite_app_window_sync_chapter (mpris->win);
+  if (g_str_equal (method_name, "Raise"))
+    gtk_window_present (GTK_WINDOW (mpris->win));
+  else if (g_str_equal (method_name, "Quit"))
+    g_application_quit (G_APPLICATION (gtk_window_get_application (GTK_WINDOW (mpris->win))));
+  else if (g_str_equal (method_name, "Next"))
+    audite_app_window_step_chapter (mpris->win, 1);
+  else if (g_str_equal (method_name, "Previous"))
+    audite_app_window_step_chapter (mpris->win, -1);
+  else if (g_str_equal (method_name, "Play"))
+    audite_app_window_set_playing (mpris->win, TRUE);
+  /* stopping would lose the place in the book, so Stop pauses */
+  else if (g_str_equal (method_name, "Pause") || g_str_equal (method_name, "Stop"))
+    audite_app_window_set_playing (mpris->win, FALSE);
+  else if (g_str_equal (method_name, "PlayPause")) {
+    mpris_read_clock (mpris, &clock);
+    audite_app_window_set_playing (mpris->win, !clock.playing);
+  }
+  else if (g_str_equal (method_name, "Seek")) {
+    g_variant_get (parameters, "(x)", &offset);
+    mpris_seek (mpris, offset);
+  }
+  else if (g_str_equal (method_name, "SetPosition")) {
+    g_variant_get (parameters, "(&ox)", &track, &offset);
+    mpris_set_position (mpris, track, offset);
+  }
+  else if (g_str_equal (method_name, "OpenUri")) {
+    g_variant_get (parameters, "(&s)", &uri);
+    audite_app_window_open (mpris->win, (gchar *) uri);
+  }
+  g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static GVariant *
+mpris_get_property (GDBusConnection  *connection,
+                    const gchar      *sender,
+                    const gchar      *object_path,
+                    const gchar      *interface_name,
+                    const gchar      *property_name,
+                    GError          **error,
+                    gpointer          user_data)
+{
+  AuditeMpris *mpris = user_data;
+  GVariant *value;
+
+  if (g_str_equal (interface_name, MPRIS_ROOT_INTERFACE))
+    value = mpris_root_property (mpris, property_name);
+  else {
+    audite_app_window_sync_chapter (mpris->win);
+    value = mpris_player_property (mpris, property_name);
+  }
+  if (!value)
+    g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                 "No property %s", property_name);
+  return value;
+}
+
+static gboolean
+mpris_set_property (GDBusConnection  *connection,
+                    const gchar      *sender,
+                    const gchar      *object_path,
+                    const gchar      *interface_name,
+                    const gchar      *property_name,
+                    GVariant         *value,
+                    GError          **error,
+                    gpointer          user_data)
+{
+  AuditeMpris *mpris = user_data;
+  GstPlayer *player = audite_app_window_get_player (mpris->win);
+  MprisClock clock;
+  gdouble rate;
+
+  if (g_str_equal (property_name, "Volume")) {
+    /* comes back through the player's volume-changed signal */
+    gst_player_set_volume (player, CLAMP (g_variant_get_double (value), 0.0, 1.0));
+    return TRUE;
+  }
+  if (g_str_equal (property_name, "Rate")) {
+    rate = CLAMP (g_variant_get_double (value), MPRIS_MIN_RATE, MPRIS_MAX_RATE);
+    gst_player_set_rate (player, rate);
+    mpris_read_clock (mpris, &clock);
+    clock.position = mpris_clock_position (&clock);
+    clock.time = g_get_monotonic_time ();
+    clock.rate = rate;
+    mpris_write_clock (mpris, &clock);
+    mpris_changed (mpris, MPRIS_CHANGED_RATE);
+    return TRUE;
+  }
+  g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_PROPERTY_READ_ONLY,
+               "Property %s is read only", property_name);
+  return FALSE;
+}
+
+static const GDBusInterfaceVTable mpris_vtable =
+{
+  mpris_method_call,
+  mpris_get_property,
+  mpris_set_property
+};
+
+static void
+mpris_bus_acquired (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+  AuditeMpris *mpris = user_data;
+  GError *error = NULL;
+
+  mpris->connection = g_object_ref (connection);
+  mpris->root_id = g_dbus_connection_register_object (connection, MPRIS_OBJECT_PATH,
+                                                      mpris->node->interfaces[0],
+                                                      &mpris_vtable, mpris, NULL, &error);
+  if (mpris->root_id)
+    mpris->player_id = g_dbus_connection_register_object (connection, MPRIS_OBJECT_PATH,
+                                                          mpris->node->interfaces[1],
+                                                          &mpris_vtable, mpris, NULL, &error);
+  if (error) {
+    g_print ("MPRIS: %s\n", error->message);
+    g_error_free (error);
+  }
+}
+
+/* Registers on the session bus; a bus that is not there leaves the
+ * player working without it. */
+AuditeMpris *
+audite_mpris_new (AuditeAppWindow *win)
+{
+  AuditeMpris *mpris;
+
+  mpris = g_slice_new0 (AuditeMpris);
+  mpris->win = win;
+  mpris->index = -1;
+  mpris->start = 0;
+  mpris->end = GST_CLOCK_TIME_NONE;
+  mpris->volume = 1.0;
+  mpris->clock.position = GST_CLOCK_TIME_NONE;
+  mpris->clock.rate = 1.0;
+  mpris->clock.start = 0;
+  mpris->node = g_dbus_node_info_new_for_xml (mpris_introspection, NULL);
+  mpris->owner_id = g_bus_own_name (G_BUS_TYPE_SESSION, MPRIS_BUS_NAME,
+                                    G_BUS_NAME_OWNER_FLAGS_NONE,
+                                    mpris_bus_acquired, NULL, NULL, mpris, NULL);
+  return mpris;
+}
+
+void
+audite_mpris_free (AuditeMpris *mpris)
+{
+  if (!mpris)
+    return;
+
+  if (mpris->flush_id)
+    g_source_remove (mpris->flush_id);
+  if (mpris->connection) {
+    if (mpris->root_id)
+      g_dbus_connection_unregister_object (mpris->connection, mpris->root_id);
+    if (mpris->player_id)
+      g_dbus_connection_unregister_object (mpris->connection, mpris->player_id);
+    g_object_unref (mpris->connection);
+  }
+  g_bus_unown_name (mpris->owner_id);
+  g_dbus_node_info_unref (mpris->node);
+  g_free (mpris->title);
+  g_free (mpris->artist);
+  g_free (mpris->art_uri);
+  g_free (mpris->track_title);
+  g_slice_free (AuditeMpris, mpris);
+}
+
+/* Replaces *@field with a copy of @value; TRUE when it differs. */
+static gboolean
+mpris_set_string (gchar **field, const gchar *value)
+{
+  if (g_strcmp0 (*field, value) == 0)
+    return FALSE;
+  g_free (*field);
+  *field = g_strdup (value);
+  return TRUE;
+}
+
+void
+audite_mpris_set_playing (AuditeMpris  *mpris,
+                          gboolean      playing,
+                          GstClockTime  position,
+                          gdouble       rate)
+{
+  MprisClock clock = mpris->clock;
+  guint changed = 0;
+
+  if (playing != clock.playing)
+    changed |= MPRIS_CHANGED_STATUS;
+  if (rate > 0 && rate != clock.rate)
+    changed |= MPRIS_CHANGED_RATE;
+  if (!GST_CLOCK_TIME_IS_VALID (position))
+    position = mpris_clock_position (&clock);
+  clock.position = position;
+  clock.time = g_get_monotonic_time ();
+  clock.playing = playing;
+  if (rate > 0)
+    clock.rate = rate;
+  mpris_write_clock (mpris, &clock);
+  if (changed)
+    mpris_changed (mpris, changed);
+}
+
+void
+audite_mpris_set_book (AuditeMpris *mpris, const gchar *title, const gchar *artist)
+{
+  gboolean changed;
+
+  changed = mpris_set_string (&mpris->title, title);
+  changed |= mpris_set_string (&mpris->artist, artist);
+  if (changed)
+    mpris_changed (mpris, MPRIS_CHANGED_METADATA);
+}
+
+/* @index is -1 when nothing is loaded. A file without chapters is a book
+ * of one track. */
+void
+audite_mpris_set_track (AuditeMpris  *mpris,
+                        gint          index,
+                        gint          n_tracks,
+                        GstClockTime  start,
+                        GstClockTime  end,
+                        const gchar  *title)
+{
+  MprisClock clock = mpris->clock;
+  guint changed = 0;
+
+  if (index != mpris->index || start != mpris->start || end != mpris->end)
+    changed |= MPRIS_CHANGED_METADATA;
+  if (index != mpris->index || n_tracks != mpris->n_tracks)
+    changed |= MPRIS_CHANGED_CAN_GO;
+  if ((index < 0) != (mpris->index < 0))
+    changed |= MPRIS_CHANGED_CAN_PLAY | MPRIS_CHANGED_STATUS;
+  if (mpris_set_string (&mpris->track_title, title))
+    changed |= MPRIS_CHANGED_METADATA;
+
+  mpris->index = index;
+  mpris->n_tracks = n_tracks;
+  mpris->start = start;
+  mpris->end = end;
+  if (clock.start != start) {
+    clock.start = start;
+    mpris_write_clock (mpris, &clock);
+  }
+  if (changed)
+    mpris_changed (mpris, changed);
+}
+
+void
+audite_mpris_set_art (AuditeMpris *mpris, const gchar *art_uri)
+{
+  if (mpris_set_string (&mpris->art_uri, art_uri))
+    mpris_changed (mpris, MPRIS_CHANGED_METADATA);
+}
+
+void
+audite_mpris_set_volume (AuditeMpris *mpris, gdouble volume)
+{
+  if (fabs (volume - mpris->volume) < 0.001)
+    return;
+  mpris->volume = volume;
+  mpris_changed (mpris, MPRIS_CHANGED_VOLUME);
+}
+
+/* Called as the window ticks; keeps the snapshot from drifting and
+ * sends nothing. */
+void
+audite_mpris_update_position (AuditeMpris *mpris, GstClockTime position)
+{
+  MprisClock clock = mpris->clock;
+
+  if (!GST_CLOCK_TIME_IS_VALID (position))
+    return;
+  clock.position = position;
+  clock.time = g_get_monotonic_time ();
+  mpris_write_clock (mpris, &clock);
+}
+
+/* A jump in position, which clients are told about. */
+void
+audite_mpris_seeked (AuditeMpris *mpris, GstClockTime position)
+{
+  audite_mpris_update_position (mpris, position);
+  mpris_changed (mpris, MPRIS_CHANGED_SEEKED);
+}
@@ -0,0 +1,46 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_MPRIS_H
+#define __AUDITE_MPRIS_H
+
+#include <gio/gio.h>
+#include <gst/gst.h>
+#include "audite_app_win.h"
+
+
+typedef struct _AuditeMpris AuditeMpris;
+
+
+AuditeMpris   *audite_mpris_new                (AuditeAppWindow *win);
+void           audite_mpris_free               (AuditeMpris     *mpris);
+
+void           audite_mpris_set_playing        (AuditeMpris     *mpris,
+                                                gboolean         playing,
+                                                GstClockTime     position,
+                                                gdouble          rate);
+void           audite_mpris_set_book           (AuditeMpris     *mpris,
+                                                const gchar     *title,
+                                                const gchar     *artist);
+void           audite_mpris_set_track          (AuditeMpris     *mpris,
+                                                gint             index,
+                                                gint             n_tracks,
+                                                GstClockTime     start,
+                                                GstClockTime     end,
+                                                const gchar     *title);
+void           audite_mpris_set_art            (AuditeMpris     *mpris,
+                                                const gchar     *art_uri);
+void           audite_mpris_set_volume         (AuditeMpris     *mpris,
+                                                gdouble          volume);
+void           audite_mpris_update_position    (AuditeMpris     *mpris,
+                                                GstClockTime     position);
+void           audite_mpris_seeked             (AuditeMpris     *mpris,
+                                                GstClockTime     position);
+GstClockTime   audite_mpris_get_position       (AuditeMpris     *mpris);
+
+
+#endif /* __AUDITE_MPRIS_H */
@@ -0,0 +1,455 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * MPRIS check, started with --mpris-check under a private session bus:
+ *
+ *   dbus-run-session -- audite --mpris-check
+ *
+ * The window opens a synthetic book and starts playing it, and the check
+ * talks to it over a connection of its own, as any MPRIS client would:
+ * Pause must be signalled as PlaybackStatus Paused and read back as such,
+ * Play must be signalled as PlaybackStatus Playing, Position must advance
+ * while playing, and Next must come as one PropertiesChanged carrying the
+ * new Metadata together with CanGoNext and CanGoPrevious. Each step
+ * prints an ok or FAIL line and the exit status is 1 when any failed.
+ * Settings go to the memory backend and the cache to a temporary
+ * directory, as for a soak run.
+ */
+
+#include <gio/gio.h>
+
+#include "audite_mpris_check.h"
+#include "audite_bench.h"
+
+#define CHECK_BUS_NAME "org.mpris.MediaPlayer2.audite"
+#define CHECK_OBJECT_PATH "/org/mpris/MediaPlayer2"
+#define CHECK_PLAYER_INTERFACE "org.mpris.MediaPlayer2.Player"
+#define CHECK_CHAPTERS 10
+#define CHECK_STEP_TIMEOUT 10
+#define CHECK_POSITION_WAIT 1500
+#define CHECK_BATCH_WAIT 1000
+
+const GOptionEntry audite_mpris_check_option_entries[] =
+{
+  { "mpris-check", 0, 0, G_OPTION_ARG_NONE, NULL,
+    "Check the MPRIS interface on a synthetic book, run under dbus-run-session", NULL },
+  { NULL }
+};
+
+typedef enum
+{
+  CHECK_NAME,
+  CHECK_LOADED,
+  CHECK_PAUSED,
+  CHECK_PLAYING,
+  CHECK_POSITION,
+  CHECK_BATCH,
+  CHECK_DONE
+} CheckStep;
+
+static const gchar *check_step_names[] = {
+  "bus name", "book playing", "PlaybackStatus Paused", "PlaybackStatus Playing",
+  "Position", "PropertiesChanged batch", NULL
+};
+
+struct _AuditeMprisCheck
+{
+  gchar           *dir;
+  gchar           *uri;
+
+  AuditeAppWindow *win;
+  GDBusConnection *connection;
+  GCancellable    *cancellable;
+  guint            watch_id;
+  guint            signal_id;
+  guint            deadline_id;
+  guint            timeout_id;
+  CheckStep        step;
+  gint64           position;
+  guint            n_changed;   /* PropertiesChanged since the step began */
+  gboolean         batch_complete;
+  gboolean         failed;
+};
+
+static void check_finish (AuditeMprisCheck *check);
+static gboolean check_get_position (gpointer data);
+
+static void
+check_report (AuditeMprisCheck *check, gboolean ok, const gchar *what, const gchar *detail)
+{
+  if (ok)
+    g_print ("ok %s\n", what);
+  else {
+    g_print ("FAIL %s: %s\n", what, detail);
+    check->failed = TRUE;
+  }
+}
+
+static void
+check_fail (AuditeMprisCheck *check, const gchar *detail)
+{
+  if (check->step == CHECK_DONE)
+    return;
+  check_report (check, FALSE, check_step_names[check->step], detail);
+  check_finish (check);
+}
+
+static gboolean
+check_deadline_handler (gpointer data)
+{
+  AuditeMprisCheck *check = data;
+
+  check->deadline_id = 0;
+  check_fail (check, "timed out");
+  return G_SOURCE_REMOVE;
+}
+
+static void
+check_step (AuditeMprisCheck *check, CheckStep step)
+{
+  check->step = step;
+  check->n_changed = 0;
+  check->batch_complete = FALSE;
+  if (check->deadline_id)
+    g_source_remove (check->deadline_id);
+  check->deadline_id = step == CHECK_DONE ? 0 :
+                       g_timeout_add_seconds (CHECK_STEP_TIMEOUT, check_deadline_handler, check);
+}
+
+static void
+check_finish (AuditeMprisCheck *check)
+{
+  check_step (check, CHECK_DONE);
+  if (check->timeout_id) {
+    g_source_remove (check->timeout_id);
+    check->timeout_id = 0;
+  }
+  g_application_quit (g_application_get_default ());
+}
+
+/* Completes a call made by the check; NULL once the check has been
+ * freed or after the failure was reported. */
+static GVariant *
+check_call_finish (GObject *source, GAsyncResult *result, AuditeMprisCheck **check)
+{
+  GVariant *reply;
+  GError *error = NULL;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+  if (!reply) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      check_fail (*check, error->message);
+    g_error_free (error);
+    *check = NULL;
+  }
+  return reply;
+}
+
+static void
+check_call_ready (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  AuditeMprisCheck *check = user_data;
+  GVariant *reply;
+
+  reply = check_call_finish (source, result, &check);
+  if (reply)
+    g_variant_unref (reply);
+}
+
+static void
+check_call (AuditeMprisCheck *check, const gchar *method)
+{
+  g_dbus_connection_call (check->connection, CHECK_BUS_NAME, CHECK_OBJECT_PATH,
+                          CHECK_PLAYER_INTERFACE, method, NULL, NULL,
+                          G_DBUS_CALL_FLAGS_NONE, -1, check->cancellable,
+                          check_call_ready, check);
+}
+
+static void
+check_get (AuditeMprisCheck *check, const gchar *property, GAsyncReadyCallback callback)
+{
+  g_dbus_connection_call (check->connection, CHECK_BUS_NAME, CHECK_OBJECT_PATH,
+                          "org.freedesktop.DBus.Properties", "Get",
+                          g_variant_new ("(ss)", CHECK_PLAYER_INTERFACE, property),
+                          G_VARIANT_TYPE ("(v)"), G_DBUS_CALL_FLAGS_NONE, -1,
+                          check->cancellable, callback, check);
+}
+
+static gboolean
+check_batch_handler (gpointer data)
+{
+  AuditeMprisCheck *check = data;
+
+  check->timeout_id = 0;
+  if (check->n_changed != 1 || !check->batch_complete) {
+    check_fail (check, check->n_changed == 0 ? "no PropertiesChanged after Next" :
+                       check->n_changed > 1 ? "Next came as several PropertiesChanged" :
+                       "Metadata, CanGoNext or CanGoPrevious missing");
+    return G_SOURCE_REMOVE;
+  }
+  check_report (check, TRUE, check_step_names[check->step], NULL);
+  check_finish (check);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+check_position_ready (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  AuditeMprisCheck *check = user_data;
+  GVariant *reply, *value;
+  gint64 position;
+
+  reply = check_call_finish (source, result, &check);
+  if (!reply)
+    return;
+  g_variant_get (reply, "(v)", &value);
+  position = g_variant_get_int64 (value);
+  g_variant_unref (value);
+  g_variant_unref (reply);
+
+  if (check->position < 0) {
+    check->position = position;
+    check->timeout_id = g_timeout_add (CHECK_POSITION_WAIT, check_get_position, check);
+    return;
+  }
+  if (position <= check->position) {
+    check_fail (check, "did not advance while playing");
+    return;
+  }
+  check_report (check, TRUE, check_step_names[check->step], NULL);
+  check_step (check, CHECK_BATCH);
+  check_call (check, "Next");
+  check->timeout_id = g_timeout_add (CHECK_BATCH_WAIT, check_batch_handler, check);
+}
+
+static gboolean
+check_get_position (gpointer data)
+{
+  AuditeMprisCheck *check = data;
+
+  check->timeout_id = 0;
+  check_get (check, "Position", check_position_ready);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+check_play (AuditeMprisCheck *check)
+{
+  check_step (check, CHECK_PLAYING);
+  check_call (check, "Play");
+}
+
+/* The signal said Paused; the property has to agree. */
+static void
+check_paused_ready (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  AuditeMprisCheck *check = user_data;
+  GVariant *reply, *value;
+  gboolean paused;
+
+  reply = check_call_finish (source, result, &check);
+  if (!reply)
+    return;
+  g_variant_get (reply, "(v)", &value);
+  paused = g_str_equal (g_variant_get_string (value, NULL), "Paused");
+  g_variant_unref (value);
+  g_variant_unref (reply);
+  if (check->step != CHECK_PAUSED)
+    return;
+  if (!paused) {
+    check_fail (check, "signalled, but read back as another status");
+    return;
+  }
+  check_report (check, TRUE, check_step_names[check->step], NULL);
+  check_play (check);
+}
+
+static void
+check_pause (AuditeMprisCheck *check)
+{
+  check_step (check, CHECK_PAUSED);
+  check_call (check, "Pause");
+}
+
+static void
+check_properties_changed (GDBusConnection *connection,
+                          const gchar     *sender,
+                          const gchar     *object_path,
+                          const gchar     *interface_name,
+                          const gchar     *signal_name,
+                          GVariant        *parameters,
+                          gpointer         user_data)
+{
+  AuditeMprisCheck *check = user_data;
+  GVariant *changed;
+  const gchar *status = NULL;
+
+  g_variant_get (parameters, "(&s@a{sv}@as)", NULL, &changed, NULL);
+  check->n_changed++;
+  g_variant_lookup (changed, "PlaybackStatus", "&s", &status);
+  check->batch_complete = g_variant_lookup (changed, "Metadata", "@a{sv}", NULL)
+                          && g_variant_lookup (changed, "CanGoNext", "b", NULL)
+                          && g_variant_lookup (changed, "CanGoPrevious", "b", NULL);
+
+  switch (check->step) {
+    case CHECK_LOADED:
+      if (g_strcmp0 (status, "Playing") == 0)
+        check_pause (check);
+      break;
+    case CHECK_PAUSED:
+      if (g_strcmp0 (status, "Paused") == 0)
+        check_get (check, "PlaybackStatus", check_paused_ready);
+      break;
+    case CHECK_PLAYING:
+      if (g_strcmp0 (status, "Playing") == 0) {
+        check_report (check, TRUE, check_step_names[check->step], NULL);
+        check_step (check, CHECK_POSITION);
+        check->position = -1;
+        check_get (check, "Position", check_position_ready);
+      }
+      break;
+    default:
+      break;
+  }
+  g_variant_unref (changed);
+}
+
+static void
+check_status_ready (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  AuditeMprisCheck *check = user_data;
+  GVariant *reply, *value;
+
+  reply = check_call_finish (source, result, &check);
+  if (!reply)
+    return;
+  g_variant_get (reply, "(v)", &value);
+  /* otherwise the book is still loading, its status comes as a signal */
+  if (check->step == CHECK_LOADED && g_str_equal (g_variant_get_string (value, NULL), "Playing"))
+    check_pause (check);
+  g_variant_unref (value);
+  g_variant_unref (reply);
+}
+
+static void
+check_name_appeared (GDBusConnection *connection,
+                     const gchar     *name,
+                     const gchar     *name_owner,
+                     gpointer         user_data)
+{
+  AuditeMprisCheck *check = user_data;
+  GDBusConnection *own;
+
+  if (check->step != CHECK_NAME)
+    return;
+  /* on the desktop's bus another instance may hold the name */
+  own = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+  if (!own || g_strcmp0 (name_owner, g_dbus_connection_get_unique_name (own)) != 0) {
+    g_clear_object (&own);
+    check_fail (check, "owned by another process, run under dbus-run-session");
+    return;
+  }
+  g_object_unref (own);
+
+  check_step (check, CHECK_LOADED);
+  check->signal_id = g_dbus_connection_signal_subscribe (connection, CHECK_BUS_NAME,
+                                                         "org.freedesktop.DBus.Properties",
+                                                         "PropertiesChanged", CHECK_OBJECT_PATH,
+                                                         CHECK_PLAYER_INTERFACE,
+                                                         G_DBUS_SIGNAL_FLAGS_NONE,
+                                                         check_properties_changed, check, NULL);
+  check_get (check, "PlaybackStatus", check_status_ready);
+}
+
+/* Runs before GSettings or the cache are first used, like a soak run. */
+AuditeMprisCheck *
+audite_mpris_check_new (GError **error)
+{
+  AuditeMprisCheck *check;
+  gchar *address, *filename;
+
+  check = g_slice_new0 (AuditeMprisCheck);
+  check->cancellable = g_cancellable_new ();
+  check->dir = g_dir_make_tmp ("audite-mpris-XXXXXX", error);
+  if (!check->dir) {
+    audite_mpris_check_free (check);
+    return NULL;
+  }
+  g_setenv ("XDG_CACHE_HOME", check->dir, TRUE);
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+  /* a client of its own, the player's connection would talk to itself */
+  address = g_dbus_address_get_for_bus_sync (G_BUS_TYPE_SESSION, NULL, error);
+  if (address)
+    check->connection = g_dbus_connection_new_for_address_sync (address,
+                          G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+                          | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                          NULL, NULL, error);
+  g_free (address);
+  if (!check->connection) {
+    audite_mpris_check_free (check);
+    return NULL;
+  }
+
+  filename = g_build_filename (check->dir, "synthetic.m4b", NULL);
+  if (!audite_bench_write_book (filename, 1, CHECK_CHAPTERS, 0)) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                 "Could not write the synthetic book");
+    g_free (filename);
+    audite_mpris_check_free (check);
+    return NULL;
+  }
+  check->uri = g_filename_to_uri (filename, NULL, NULL);
+  g_free (filename);
+  return check;
+}
+
+void
+audite_mpris_check_free (AuditeMprisCheck *check)
+{
+  if (!check)
+    return;
+
+  g_cancellable_cancel (check->cancellable);
+  if (check->deadline_id)
+    g_source_remove (check->deadline_id);
+  if (check->timeout_id)
+    g_source_remove (check->timeout_id);
+  if (check->watch_id)
+    g_bus_unwatch_name (check->watch_id);
+  if (check->signal_id)
+    g_dbus_connection_signal_unsubscribe (check->connection, check->signal_id);
+  g_clear_object (&check->connection);
+  g_clear_object (&check->cancellable);
+  g_clear_object (&check->win);
+  if (check->dir)
+    audite_bench_remove_dir (check->dir);
+  g_free (check->dir);
+  g_free (check->uri);
+  g_slice_free (AuditeMprisCheck, check);
+}
+
+/* Opens the synthetic book in @win and waits for its MPRIS name. */
+void
+audite_mpris_check_start (AuditeMprisCheck *check, AuditeAppWindow *win)
+{
+  g_return_if_fail (check->win == NULL);
+
+  check->win = g_object_ref (win);
+  audite_app_window_open (win, check->uri);
+  check_step (check, CHECK_NAME);
+  check->watch_id = g_bus_watch_name_on_connection (check->connection, CHECK_BUS_NAME,
+                                                    G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                    check_name_appeared, NULL, check, NULL);
+}
+
+gboolean
+audite_mpris_check_failed (AuditeMprisCheck *check)
+{
+  return check->failed;
+}
@@ -0,0 +1,26 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_MPRIS_CHECK_H
+#define __AUDITE_MPRIS_CHECK_H
+
+#include <gio/gio.h>
+#include "audite_app_win.h"
+
+
+typedef struct _AuditeMprisCheck AuditeMprisCheck;
+
+extern const GOptionEntry audite_mpris_check_option_entries[];
+
+AuditeMprisCheck *audite_mpris_check_new        (GError          **error);
+void              audite_mpris_check_free       (AuditeMprisCheck *check);
+void              audite_mpris_check_start      (AuditeMprisCheck *check,
+                                                 AuditeAppWindow  *win);
+gboolean          audite_mpris_check_failed     (AuditeMprisCheck *check);
+
+
+#endif /* __AUDITE_MPRIS_CHECK_H */
@@ -0,0 +1,200 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Plays a book made of several files as one timeline. Every track is a
+ * chapter of the book, positioned by its start on the book timeline. The
+ * next track is handed to playbin from "about-to-finish", so it prerolls
+ * while the current one is still playing and the change is gapless; the
+ * offset moves on when the new stream actually starts.
+ */
+
+#include <gst/gst.h>
+#include <gst/player/player.h>
+
+#include "audite_chapters.h"
+#include "audite_playlist.h"
+
+struct _AuditePlaylist
+{
+  GstPlayer    *player;
+  GstElement   *pipeline;
+  GstBus       *bus;
+  gulong        about_to_finish_id;
+  gulong        stream_start_id;
+
+  GMutex        lock;
+  GArray       *chapters;
+  gchar       **uris;
+  gint          current;
+  gint          queued;
+};
+
+/* Runs on the streaming thread shortly before the current track drains. */
+static void
+playlist_about_to_finish_handler (GstElement *playbin, AuditePlaylist *playlist)
+{
+  gint next;
+
+  g_mutex_lock (&playlist->lock);
+  if (playlist->chapters && playlist->current >= 0) {
+    next = playlist->current + 1;
+    if (next < (gint) playlist->chapters->len) {
+      g_object_set (playbin, "uri", playlist->uris[next], NULL);
+      playlist->queued = next;
+    }
+  }
+  g_mutex_unlock (&playlist->lock);
+}
+
+/* Runs on the GstPlayer thread, which owns the bus signal watch. */
+static void
+playlist_stream_start_handler (GstBus *bus, GstMessage *message, AuditePlaylist *playlist)
+{
+  g_mutex_lock (&playlist->lock);
+  if (playlist->queued >= 0) {
+    playlist->current = playlist->queued;
+    playlist->queued = -1;
+  }
+  g_mutex_unlock (&playlist->lock);
+}
+
+AuditePlaylist *
+audite_playlist_new (GstPlayer *player)
+{
+  AuditePlaylist *playlist;
+
+  playlist = g_slice_new0 (AuditePlaylist);
+  playlist->player = player;
+  playlist->pipeline = gst_player_get_pipeline (player);
+  playlist->bus = gst_element_get_bus (playlist->pipeline);
+  playlist->current = -1;
+  playlist->queued = -1;
+  g_mutex_init (&playlist->lock);
+
+  playlist->about_to_finish_id = g_signal_connect (playlist->pipeline, "about-to-finish",
+                                                   G_CALLBACK (playlist_about_to_finish_handler),
+                                                   playlist);
+  playlist->stream_start_id = g_signal_connect (playlist->bus, "message::stream-start",
+                                                G_CALLBACK (playlist_stream_start_handler),
+                                                playlist);
+  return playlist;
+}
+
+void
+audite_playlist_free (AuditePlaylist *playlist)
+{
+  if (!playlist)
+    return;
+
+  g_signal_handler_disconnect (playlist->pipeline, playlist->about_to_finish_id);
+  g_signal_handler_disconnect (playlist->bus, playlist->stream_start_id);
+  gst_object_unref (playlist->bus);
+  gst_object_unref (playlist->pipeline);
+  if (playlist->chapters)
+    g_array_unref (playlist->chapters);
+  g_strfreev (playlist->uris);
+  g_mutex_clear (&playlist->lock);
+  g_slice_free (AuditePlaylist, playlist);
+}
+
+/* @uris holds one file per chapter. Nothing is loaded until the first
+ * seek; passing NULL turns the playlist off for single file books. */
+void
+audite_playlist_set_tracks (AuditePlaylist  *playlist,
+                            GArray          *chapters,
+                            gchar          **uris)
+{
+  g_return_if_fail (!chapters || g_strv_length (uris) == chapters->len);
+
+  g_mutex_lock (&playlist->lock);
+  if (playlist->chapters)
+    g_array_unref (playlist->chapters);
+  g_strfreev (playlist->uris);
+  playlist->chapters = chapters ? g_array_ref (chapters) : NULL;
+  playlist->uris = chapters ? g_strdupv (uris) : NULL;
+  playlist->current = -1;
+  playlist->queued = -1;
+  g_mutex_unlock (&playlist->lock);
+}
+
+gboolean
+audite_playlist_is_active (AuditePlaylist *playlist)
+{
+  gboolean active;
+
+  g_mutex_lock (&playlist->lock);
+  active = playlist->chapters != NULL;
+  g_mutex_unlock (&playlist->lock);
+  return active;
+}
+
+/* Maps a position reported by the player onto the book timeline. */
+GstClockTime
+audite_playlist_to_book (AuditePlaylist *playlist, GstClockTime position)
+{
+  g_mutex_lock (&playlist->lock);
+  if (playlist->chapters && playlist->current >= 0 && GST_CLOCK_TIME_IS_VALID (position))
+    position += g_array_index (playlist->chapters, AuditeChapter, playlist->current).start;
+  g_mutex_unlock (&playlist->lock);
+  return position;
+}
+
+/* The track whose stream starts next: the queued one while a gapless
+ * change is under way, otherwise the current one; -1 when none is. Safe
+ * to call from streaming threads. */
+gint
+audite_playlist_get_starting_track (AuditePlaylist *playlist)
+{
+  gint track;
+
+  g_mutex_lock (&playlist->lock);
+  track = playlist->queued >= 0 ? playlist->queued : playlist->current;
+  g_mutex_unlock (&playlist->lock);
+  return track;
+}
+
+/* Seeks to @position on the book timeline. When it lies in another track
+ * that track is loaded and sought, the player is left stopped and TRUE is
+ * returned. Otherwise @track_position receives the position inside the
+ * playing stream for the caller to seek to. */
+gboolean
+audite_playlist_seek (AuditePlaylist *playlist,
+                      GstClockTime    position,
+                      GstClockTime   *track_position)
+{
+  const AuditeChapter *chapter;
+  gboolean switched = FALSE;
+  gint index;
+
+  g_mutex_lock (&playlist->lock);
+  index = audite_chapters_lookup (playlist->chapters, position);
+  /* the very end of the book belongs to the last track */
+  if (index < 0 && playlist->chapters && playlist->chapters->len > 0
+      && GST_CLOCK_TIME_IS_VALID (position))
+    index = playlist->chapters->len - 1;
+  if (index < 0) {
+    if (track_position)
+      *track_position = position;
+    g_mutex_unlock (&playlist->lock);
+    return FALSE;
+  }
+
+  chapter = &g_array_index (playlist->chapters, AuditeChapter, index);
+  if (index != playlist->current) {
+    playlist->current = index;
+    playlist->queued = -1;
+    gst_player_set_uri (playlist->player, playlist->uris[index]);
+    if (position > chapter->start)
+      gst_player_seek (playlist->player, position - chapter->start);
+    switched = TRUE;
+  }
+  else if (track_position)
+    *track_position = position - chapter->start;
+  g_mutex_unlock (&playlist->lock);
+  return switched;
+}
@@ -0,0 +1,32 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_PLAYLIST_H
+#define __AUDITE_PLAYLIST_H
+
+#include <gst/gst.h>
+#include <gst/player/player.h>
+
+
+typedef struct _AuditePlaylist AuditePlaylist;
+
+
+AuditePlaylist *audite_playlist_new            (GstPlayer      *player);
+void            audite_playlist_free           (AuditePlaylist *playlist);
+void            audite_playlist_set_tracks     (AuditePlaylist *playlist,
+                                                GArray         *chapters,
+                                                gchar         **uris);
+gboolean        audite_playlist_is_active      (AuditePlaylist *playlist);
+GstClockTime    audite_playlist_to_book        (AuditePlaylist *playlist,
+                                                GstClockTime    position);
+gint            audite_playlist_get_starting_track (AuditePlaylist *playlist);
+gboolean        audite_playlist_seek           (AuditePlaylist *playlist,
+                                                GstClockTime    position,
+                                                GstClockTime   *track_position);
+
+
+#endif /* __AUDITE_PLAYLIST_H */
@@ -0,0 +1,193 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Container probe. The head of the file is read once, through GIO so any
+ * URI gvfs can open works, and matched against a table of signatures. A
+ * leading ID3v2 tag is read whole on the same stream, since MP3 chapters
+ * live in it, and the bytes after it decide the container. The result
+ * picks the chapter reader and travels with the book, so nothing else
+ * sniffs the file again.
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+
+#include "audite_probe.h"
+
+#define PROBE_SIZE 4096
+#define PROBE_TAIL_SIZE 64
+#define PROBE_ID3_HEADER_SIZE 10
+#define PROBE_ID3_MAX_SIZE (64 * 1024 * 1024)
+
+typedef struct
+{
+  gsize        offset;
+  const gchar *magic;
+} ProbeMatch;
+
+typedef struct
+{
+  AuditeContainer  container;
+  ProbeMatch       match[2];
+} ProbeSignature;
+
+/* first match wins, so refinements come before what they refine */
+static const ProbeSignature probe_signatures[] =
+{
+  { AUDITE_CONTAINER_MP4,      { { 4, "ftyp" } } },
+  { AUDITE_CONTAINER_OPUS,     { { 0, "OggS" }, { 28, "OpusHead" } } },
+  { AUDITE_CONTAINER_OGG,      { { 0, "OggS" } } },
+  { AUDITE_CONTAINER_FLAC,     { { 0, "fLaC" } } },
+  { AUDITE_CONTAINER_MATROSKA, { { 0, "\x1a\x45\xdf\xa3" } } },
+};
+
+static gboolean
+probe_match (const guint8 *data, gsize size, const ProbeMatch *match)
+{
+  gsize length = strlen (match->magic);
+
+  return size >= match->offset + length
+         && memcmp (data + match->offset, match->magic, length) == 0;
+}
+
+/* An MPEG audio frame header: eleven sync bits and a defined layer. */
+static gboolean
+probe_is_mpeg_audio (const guint8 *data, gsize size)
+{
+  return size >= 2 && data[0] == 0xff && (data[1] & 0xe0) == 0xe0
+         && (data[1] & 0x06) != 0;
+}
+
+static AuditeContainer
+probe_classify (const guint8 *data, gsize size)
+{
+  const ProbeSignature *signature;
+  guint i, j;
+
+  for (i = 0; i < G_N_ELEMENTS (probe_signatures); i++) {
+    signature = &probe_signatures[i];
+    for (j = 0; j < G_N_ELEMENTS (signature->match) && signature->match[j].magic; j++)
+      if (!probe_match (data, size, &signature->match[j]))
+        break;
+    if (j == G_N_ELEMENTS (signature->match) || !signature->match[j].magic)
+      return signature->container;
+  }
+  if (probe_is_mpeg_audio (data, size))
+    return AUDITE_CONTAINER_MP3;
+  return AUDITE_CONTAINER_UNKNOWN;
+}
+
+/* Size of the whole ID3v2 tag at @data, or 0 when there is none. */
+static gsize
+probe_id3_size (const guint8 *data, gsize size)
+{
+  gsize tag_size;
+
+  if (size < PROBE_ID3_HEADER_SIZE || memcmp (data, "ID3", 3) != 0
+      || (data[6] | data[7] | data[8] | data[9]) & 0x80)
+    return 0;
+  tag_size = (gsize) data[6] << 21 | (gsize) data[7] << 14 | (gsize) data[8] << 7 | data[9];
+  tag_size += PROBE_ID3_HEADER_SIZE;
+  /* version 4 may append a footer */
+  if (data[3] == 4 && data[5] & 0x10)
+    tag_size += PROBE_ID3_HEADER_SIZE;
+  return tag_size;
+}
+
+/* Reads the head of @uri once and classifies it. Returns NULL only when
+ * the file cannot be read; an unknown container is not an error. */
+AuditeProbe *
+audite_probe_uri (const gchar   *uri,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+  AuditeProbe *probe;
+  GFile *file;
+  GFileInputStream *stream;
+  guint8 *data, tail[PROBE_TAIL_SIZE];
+  gsize n_read, tag_size, n_tail;
+
+  file = g_file_new_for_uri (uri);
+  stream = g_file_read (file, cancellable, error);
+  g_object_unref (file);
+  if (!stream)
+    return NULL;
+
+  data = g_malloc (PROBE_SIZE);
+  if (!g_input_stream_read_all (G_INPUT_STREAM (stream), data, PROBE_SIZE,
+                                &n_read, cancellable, error)) {
+    g_free (data);
+    g_object_unref (stream);
+    return NULL;
+  }
+
+  probe = g_slice_new0 (AuditeProbe);
+  tag_size = probe_id3_size (data, n_read);
+  if (!tag_size) {
+    probe->container = probe_classify (data, n_read);
+    g_free (data);
+    g_object_unref (stream);
+    return probe;
+  }
+
+  /* ID3 is mostly MP3, but FLAC and others are seen tagged as well */
+  if (tag_size > PROBE_ID3_MAX_SIZE) {
+    probe->container = AUDITE_CONTAINER_MP3;
+  }
+  else if (tag_size < n_read) {
+    probe->id3_tag = g_bytes_new (data, tag_size);
+    probe->container = probe_classify (data + tag_size, n_read - tag_size);
+  }
+  else {
+    data = g_realloc (data, tag_size);
+    if (g_input_stream_read_all (G_INPUT_STREAM (stream), data + n_read, tag_size - n_read,
+                                 &n_tail, cancellable, NULL)
+        && n_read + n_tail == tag_size) {
+      probe->id3_tag = g_bytes_new_take (data, tag_size);
+      data = NULL;
+      if (g_input_stream_read_all (G_INPUT_STREAM (stream), tail, sizeof (tail),
+                                   &n_tail, cancellable, NULL))
+        probe->container = probe_classify (tail, n_tail);
+    }
+  }
+  if (probe->container == AUDITE_CONTAINER_UNKNOWN)
+    probe->container = AUDITE_CONTAINER_MP3;
+
+  g_free (data);
+  g_object_unref (stream);
+  return probe;
+}
+
+void
+audite_probe_free (AuditeProbe *probe)
+{
+  if (!probe)
+    return;
+  if (probe->id3_tag)
+    g_bytes_unref (probe->id3_tag);
+  g_slice_free (AuditeProbe, probe);
+}
+
+/* Caps for a typefind that can take the probe's word for it, or NULL
+ * when the file may start with something else (MP3 and FLAC can carry
+ * a leading ID3 tag) and has to be sniffed as usual. */
+const gchar *
+audite_probe_container_caps (AuditeContainer container)
+{
+  switch (container) {
+    case AUDITE_CONTAINER_MP4:
+      return "video/quicktime";
+    case AUDITE_CONTAINER_OGG:
+    case AUDITE_CONTAINER_OPUS:
+      return "application/ogg";
+    case AUDITE_CONTAINER_MATROSKA:
+      return "audio/x-matroska";
+    default:
+      return NULL;
+  }
+}
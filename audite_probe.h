@@ -0,0 +1,41 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_PROBE_H
+#define __AUDITE_PROBE_H
+
+#include <gio/gio.h>
+
+
+typedef enum
+{
+  AUDITE_CONTAINER_UNKNOWN,
+  AUDITE_CONTAINER_MP4,
+  AUDITE_CONTAINER_MP3,
+  AUDITE_CONTAINER_OGG,
+  AUDITE_CONTAINER_OPUS,
+  AUDITE_CONTAINER_FLAC,
+  AUDITE_CONTAINER_MATROSKA
+} AuditeContainer;
+
+typedef struct _AuditeProbe AuditeProbe;
+
+struct _AuditeProbe
+{
+  AuditeContainer  container;
+  GBytes          *id3_tag;     /* the leading ID3v2 tag, header included */
+};
+
+
+AuditeProbe   *audite_probe_uri                (const gchar     *uri,
+                                                GCancellable    *cancellable,
+                                                GError         **error);
+void           audite_probe_free               (AuditeProbe     *probe);
+const gchar   *audite_probe_container_caps     (AuditeContainer  container);
+
+
+#endif /* __AUDITE_PROBE_H */
@@ -0,0 +1,181 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Startup and open latency profiling. Setting AUDITE_PROFILE to a file
+ * name records monotonic timestamps for the stages between main() and
+ * first audio and writes them in Chrome trace event format, which
+ * chrome://tracing, Perfetto or a short script can read and compare
+ * between releases. Without the variable every call returns at once.
+ */
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "audite_profile.h"
+
+typedef struct
+{
+  const gchar *stage;
+  gchar        phase;
+  gint64       time;
+  guint        thread;
+  guint        id;
+} ProfileEvent;
+
+static gboolean  profile_enabled;
+static gchar    *profile_filename;
+static gint64    profile_origin;
+static GArray   *profile_events;
+static GHashTable *profile_once;
+static GMutex    profile_lock;
+static gint      profile_next_thread;
+static GPrivate  profile_thread;
+
+static guint
+profile_thread_id (void)
+{
+  guint id = GPOINTER_TO_UINT (g_private_get (&profile_thread));
+
+  if (id == 0) {
+    id = g_atomic_int_add (&profile_next_thread, 1) + 1;
+    g_private_set (&profile_thread, GUINT_TO_POINTER (id));
+  }
+  return id;
+}
+
+static void
+profile_record (const gchar *stage, gchar phase, guint id)
+{
+  ProfileEvent event;
+
+  event.stage = stage;
+  event.phase = phase;
+  event.time = g_get_monotonic_time ();
+  event.thread = profile_thread_id ();
+  event.id = id;
+
+  g_mutex_lock (&profile_lock);
+  g_array_append_val (profile_events, event);
+  g_mutex_unlock (&profile_lock);
+}
+
+/* Has to run first thing in main(), timestamps are relative to it. */
+void
+audite_profile_init (void)
+{
+  const gchar *filename = g_getenv ("AUDITE_PROFILE");
+
+  if (!filename || !*filename)
+    return;
+
+  profile_enabled = TRUE;
+  profile_filename = g_strdup (filename);
+  profile_origin = g_get_monotonic_time ();
+  profile_events = g_array_sized_new (FALSE, FALSE, sizeof (ProfileEvent), 64);
+  profile_once = g_hash_table_new (g_str_hash, g_str_equal);
+}
+
+gboolean
+audite_profile_enabled (void)
+{
+  return profile_enabled;
+}
+
+/* @stage must be a static string. */
+void
+audite_profile_begin (const gchar *stage)
+{
+  if (profile_enabled)
+    profile_record (stage, 'B', 0);
+}
+
+void
+audite_profile_end (const gchar *stage)
+{
+  if (profile_enabled)
+    profile_record (stage, 'E', 0);
+}
+
+void
+audite_profile_mark (const gchar *stage)
+{
+  if (profile_enabled)
+    profile_record (stage, 'i', 0);
+}
+
+/* Async spans pair up by @id rather than by nesting, for stages such as
+ * a load that a newer one may supersede before it finishes. */
+void
+audite_profile_begin_async (const gchar *stage, guint id)
+{
+  if (profile_enabled)
+    profile_record (stage, 'b', id);
+}
+
+void
+audite_profile_end_async (const gchar *stage, guint id)
+{
+  if (profile_enabled)
+    profile_record (stage, 'e', id);
+}
+
+/* Records @stage the first time only, for signals such as
+ * media-info-updated that fire over and over. Returns TRUE when it did. */
+gboolean
+audite_profile_mark_once (const gchar *stage)
+{
+  gboolean first;
+
+  if (!profile_enabled)
+    return FALSE;
+
+  g_mutex_lock (&profile_lock);
+  first = g_hash_table_add (profile_once, (gpointer) stage);
+  g_mutex_unlock (&profile_lock);
+  if (first)
+    profile_record (stage, 'i', 0);
+  return first;
+}
+
+/* Writes everything recorded so far; calling it again rewrites the
+ * report with the events that came in since. */
+void
+audite_profile_write (void)
+{
+  GString *json;
+  ProfileEvent *event;
+  gchar extra[32];
+  guint i;
+
+  if (!profile_enabled)
+    return;
+
+  json = g_string_new ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  g_mutex_lock (&profile_lock);
+  for (i = 0; i < profile_events->len; i++) {
+    event = &g_array_index (profile_events, ProfileEvent, i);
+    if (event->phase == 'i')
+      g_strlcpy (extra, ",\"s\":\"p\"", sizeof (extra));
+    else if (event->phase == 'b' || event->phase == 'e')
+      g_snprintf (extra, sizeof (extra), ",\"id\":%u", event->id);
+    else
+      extra[0] = '\0';
+    g_string_append_printf (json,
+                            "%s{\"name\":\"%s\",\"cat\":\"audite\",\"ph\":\"%c\","
+                            "\"ts\":%" G_GINT64_FORMAT ",\"pid\":1,\"tid\":%u%s}",
+                            i ? ",\n" : "",
+                            event->stage, event->phase,
+                            event->time - profile_origin, event->thread, extra);
+  }
+  g_mutex_unlock (&profile_lock);
+  g_string_append (json, "\n]}\n");
+
+  if (!g_file_set_contents (profile_filename, json->str, json->len, NULL))
+    g_printerr ("Could not write profile to %s\n", profile_filename);
+  g_string_free (json, TRUE);
+}
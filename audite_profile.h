@@ -0,0 +1,27 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_PROFILE_H
+#define __AUDITE_PROFILE_H
+
+#include <glib.h>
+
+
+void           audite_profile_init             (void);
+gboolean       audite_profile_enabled          (void);
+void           audite_profile_begin            (const gchar *stage);
+void           audite_profile_end              (const gchar *stage);
+void           audite_profile_begin_async      (const gchar *stage,
+                                                guint        id);
+void           audite_profile_end_async        (const gchar *stage,
+                                                guint        id);
+void           audite_profile_mark             (const gchar *stage);
+gboolean       audite_profile_mark_once        (const gchar *stage);
+void           audite_profile_write            (void);
+
+
+#endif /* __AUDITE_PROFILE_H */
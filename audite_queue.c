@@ -0,0 +1,119 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * The books given on the command line, played one after the other. The
+ * queue only keeps the order; reading ahead goes through the loader, whose
+ * book cache turns the open of the next book into a cache hit.
+ */
+
+#include <gio/gio.h>
+
+#include "audite_loader.h"
+#include "audite_profile.h"
+#include "audite_queue.h"
+
+struct _AuditeQueue
+{
+  gchar        **uris;
+  guint          n_uris;
+  guint          current;
+  gint           prefetched;
+  GCancellable  *prefetch_cancellable;
+};
+
+AuditeQueue *
+audite_queue_new (void)
+{
+  AuditeQueue *queue;
+
+  queue = g_slice_new0 (AuditeQueue);
+  queue->prefetched = -1;
+  return queue;
+}
+
+void
+audite_queue_free (AuditeQueue *queue)
+{
+  if (!queue)
+    return;
+
+  g_cancellable_cancel (queue->prefetch_cancellable);
+  g_clear_object (&queue->prefetch_cancellable);
+  g_strfreev (queue->uris);
+  g_slice_free (AuditeQueue, queue);
+}
+
+/* Replaces the queue by a copy of @uris, the first of which is the book
+ * being opened. */
+void
+audite_queue_set_uris (AuditeQueue *queue, gchar **uris)
+{
+  g_cancellable_cancel (queue->prefetch_cancellable);
+  g_clear_object (&queue->prefetch_cancellable);
+  g_strfreev (queue->uris);
+  queue->uris = g_strdupv (uris);
+  queue->n_uris = uris ? g_strv_length (uris) : 0;
+  queue->current = 0;
+  queue->prefetched = -1;
+}
+
+/* The book after the current one, or NULL at the end of the queue. */
+const gchar *
+audite_queue_peek_next (AuditeQueue *queue)
+{
+  if (queue->current + 1 >= queue->n_uris)
+    return NULL;
+  return queue->uris[queue->current + 1];
+}
+
+const gchar *
+audite_queue_advance (AuditeQueue *queue)
+{
+  if (queue->current + 1 >= queue->n_uris)
+    return NULL;
+  queue->current++;
+  return queue->uris[queue->current];
+}
+
+static void
+queue_prefetched_handler (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  AuditeBookInfo *info;
+  GError *error = NULL;
+
+  /* only the cache entry it left behind is wanted */
+  info = audite_loader_open_finish (res, &error);
+  if (!info) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_print ("Prefetch failed: %s\n", error->message);
+    g_error_free (error);
+    return;
+  }
+  audite_profile_mark ("queue-prefetched");
+  audite_book_info_free (info);
+}
+
+/* Reads the tags and chapters of the next book in the background, once
+ * per book. Best called when the current one has finished loading, so
+ * the two do not compete for the disk. */
+void
+audite_queue_prefetch_next (AuditeQueue *queue)
+{
+  const gchar *uri;
+
+  uri = audite_queue_peek_next (queue);
+  if (!uri || queue->prefetched == (gint) queue->current + 1)
+    return;
+  queue->prefetched = queue->current + 1;
+
+  g_cancellable_cancel (queue->prefetch_cancellable);
+  g_clear_object (&queue->prefetch_cancellable);
+  queue->prefetch_cancellable = g_cancellable_new ();
+  audite_loader_open_async (NULL, uri, TRUE, queue->prefetch_cancellable,
+                            NULL, queue_prefetched_handler, NULL);
+}
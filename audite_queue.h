@@ -0,0 +1,26 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_QUEUE_H
+#define __AUDITE_QUEUE_H
+
+#include <glib.h>
+
+
+typedef struct _AuditeQueue AuditeQueue;
+
+
+AuditeQueue    *audite_queue_new               (void);
+void            audite_queue_free              (AuditeQueue    *queue);
+void            audite_queue_set_uris          (AuditeQueue    *queue,
+                                                gchar         **uris);
+const gchar    *audite_queue_peek_next         (AuditeQueue    *queue);
+const gchar    *audite_queue_advance           (AuditeQueue    *queue);
+void            audite_queue_prefetch_next     (AuditeQueue    *queue);
+
+
+#endif /* __AUDITE_QUEUE_H */
@@ -0,0 +1,670 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * An inverted index over the library: every book is one document for its
+ * title, artist, album and genre, and every named chapter another. Words
+ * are folded with g_str_tokenize_and_fold(), ASCII forms included, and
+ * kept sorted in a GTree, so the words starting with a prefix are one
+ * range of it. A query walks the postings of its rarest word only and
+ * checks the other words against the few documents found, which keeps it
+ * far below a millisecond per keystroke even with millions of chapters.
+ *
+ * Removed documents leave a hole behind until more than half of the index
+ * is holes, then it is rebuilt. The documents are saved to the cache after
+ * every scan and read back on a worker at startup, so searching works
+ * before the library has been scanned again.
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+
+#include "audite_search.h"
+
+#define SEARCH_INDEX_VERSION 1
+/* uri, cache key of a book, chapter, start, title, detail, indexed text */
+#define SEARCH_INDEX_TYPE "(ua(ssitsss))"
+#define SEARCH_COMPACT_MIN 4096
+
+typedef struct
+{
+  gchar        *uri;
+  gchar        *key;
+  gint          chapter;
+  GstClockTime  start;
+  gchar        *title;
+  gchar        *detail;
+  gchar        *text;
+  gchar       **words;          /* folded words of @text, ASCII forms too */
+} SearchDoc;
+
+typedef struct
+{
+  gchar  *key;
+  GArray *ids;                  /* guint, the book and its chapters */
+} SearchBook;
+
+typedef struct
+{
+  GPtrArray  *docs;             /* SearchDoc by id, NULL once removed */
+  GTree      *terms;            /* folded word -> GArray of ascending ids */
+  GHashTable *books;            /* uri -> SearchBook */
+  guint       n_removed;
+} SearchIndex;
+
+struct _AuditeSearch
+{
+  SearchIndex  *index;
+  gchar        *filename;
+  GCancellable *cancellable;
+  GHashTable   *retained;       /* uris kept by a retain during the load */
+  gboolean      loading;
+  gboolean      dirty;
+};
+
+typedef struct
+{
+  gchar     *filename;
+  GPtrArray *docs;
+} SearchSnapshot;
+
+static gchar **
+search_tokenize (const gchar *text)
+{
+  gchar **words, **ascii;
+  GPtrArray *all;
+  guint i;
+
+  words = g_str_tokenize_and_fold (text ? text : "", NULL, &ascii);
+  all = g_ptr_array_new ();
+  for (i = 0; words[i]; i++)
+    g_ptr_array_add (all, words[i]);
+  for (i = 0; ascii[i]; i++)
+    g_ptr_array_add (all, ascii[i]);
+  g_ptr_array_add (all, NULL);
+  /* the strings moved over */
+  g_free (words);
+  g_free (ascii);
+  return (gchar **) g_ptr_array_free (all, FALSE);
+}
+
+static SearchDoc *
+search_doc_new (const gchar  *uri,
+                const gchar  *key,
+                gint          chapter,
+                GstClockTime  start,
+                const gchar  *title,
+                const gchar  *detail,
+                const gchar  *text)
+{
+  SearchDoc *doc;
+
+  doc = g_atomic_rc_box_new0 (SearchDoc);
+  doc->uri = g_strdup (uri);
+  doc->key = g_strdup (key);
+  doc->chapter = chapter;
+  doc->start = start;
+  doc->title = g_strdup (title);
+  doc->detail = g_strdup (detail);
+  doc->text = g_strdup (text);
+  doc->words = search_tokenize (text);
+  return doc;
+}
+
+static void
+search_doc_clear (gpointer data)
+{
+  SearchDoc *doc = data;
+
+  g_free (doc->uri);
+  g_free (doc->key);
+  g_free (doc->title);
+  g_free (doc->detail);
+  g_free (doc->text);
+  g_strfreev (doc->words);
+}
+
+/* Documents are shared with the worker saving a snapshot of the index. */
+static void
+search_doc_release (gpointer data)
+{
+  if (data)
+    g_atomic_rc_box_release_full (data, search_doc_clear);
+}
+
+static void
+search_book_free (gpointer data)
+{
+  SearchBook *book = data;
+
+  g_free (book->key);
+  g_array_unref (book->ids);
+  g_slice_free (SearchBook, book);
+}
+
+static gint
+search_term_compare (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  return strcmp (a, b);
+}
+
+static SearchIndex *
+search_index_new (void)
+{
+  SearchIndex *index;
+
+  index = g_slice_new0 (SearchIndex);
+  index->docs = g_ptr_array_new_with_free_func (search_doc_release);
+  index->terms = g_tree_new_full (search_term_compare, NULL,
+                                  g_free, (GDestroyNotify) g_array_unref);
+  index->books = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                        g_free, search_book_free);
+  return index;
+}
+
+static void
+search_index_free (gpointer data)
+{
+  SearchIndex *index = data;
+
+  g_ptr_array_unref (index->docs);
+  g_tree_destroy (index->terms);
+  g_hash_table_destroy (index->books);
+  g_slice_free (SearchIndex, index);
+}
+
+/* Takes over @doc. Ids only grow, so every posting list stays sorted and
+ * a word repeated in one document is caught by looking at the last id. */
+static void
+search_index_insert (SearchIndex *index, SearchDoc *doc)
+{
+  SearchBook *book;
+  GArray *ids;
+  guint id, i;
+
+  id = index->docs->len;
+  g_ptr_array_add (index->docs, doc);
+
+  for (i = 0; doc->words[i]; i++) {
+    ids = g_tree_lookup (index->terms, doc->words[i]);
+    if (!ids) {
+      ids = g_array_new (FALSE, FALSE, sizeof (guint));
+      g_tree_insert (index->terms, g_strdup (doc->words[i]), ids);
+    }
+    else if (g_array_index (ids, guint, ids->len - 1) == id)
+      continue;
+    g_array_append_val (ids, id);
+  }
+
+  book = g_hash_table_lookup (index->books, doc->uri);
+  if (!book) {
+    book = g_slice_new0 (SearchBook);
+    book->ids = g_array_new (FALSE, FALSE, sizeof (guint));
+    g_hash_table_insert (index->books, g_strdup (doc->uri), book);
+  }
+  if (doc->key && !book->key)
+    book->key = g_strdup (doc->key);
+  g_array_append_val (book->ids, id);
+}
+
+/* Leaves holes in the postings, queries skip them. */
+static void
+search_index_release_book (SearchIndex *index, SearchBook *book)
+{
+  guint id, i;
+
+  for (i = 0; i < book->ids->len; i++) {
+    id = g_array_index (book->ids, guint, i);
+    search_doc_release (g_ptr_array_index (index->docs, id));
+    g_ptr_array_index (index->docs, id) = NULL;
+    index->n_removed++;
+  }
+}
+
+static gboolean
+search_index_remove (SearchIndex *index, const gchar *uri)
+{
+  SearchBook *book;
+
+  book = g_hash_table_lookup (index->books, uri);
+  if (!book)
+    return FALSE;
+  search_index_release_book (index, book);
+  g_hash_table_remove (index->books, uri);
+  return TRUE;
+}
+
+static void
+search_compact (AuditeSearch *search)
+{
+  SearchIndex *index = search->index, *compact;
+  SearchDoc *doc;
+  guint i;
+
+  if (index->n_removed < SEARCH_COMPACT_MIN || index->n_removed < index->docs->len / 2)
+    return;
+
+  compact = search_index_new ();
+  for (i = 0; i < index->docs->len; i++) {
+    doc = g_ptr_array_index (index->docs, i);
+    if (doc)
+      search_index_insert (compact, g_atomic_rc_box_acquire (doc));
+  }
+  search_index_free (index);
+  search->index = compact;
+}
+
+static void
+search_retain_index (AuditeSearch *search, GHashTable *uris)
+{
+  GHashTableIter iter;
+  gpointer uri, book;
+
+  g_hash_table_iter_init (&iter, search->index->books);
+  while (g_hash_table_iter_next (&iter, &uri, &book)) {
+    if (g_hash_table_contains (uris, uri))
+      continue;
+    search_index_release_book (search->index, book);
+    g_hash_table_iter_remove (&iter);
+    search->dirty = TRUE;
+  }
+  search_compact (search);
+}
+
+static void
+search_load_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+  const gchar *filename = task_data;
+  const gchar *uri, *key, *title, *detail, *text;
+  SearchIndex *index;
+  GMappedFile *mapped;
+  GVariantIter iter;
+  GVariant *variant, *docs;
+  GBytes *bytes;
+  GstClockTime start;
+  gint32 chapter;
+  guint32 version;
+
+  mapped = g_mapped_file_new (filename, FALSE, NULL);
+  if (!mapped) {
+    g_task_return_pointer (task, NULL, NULL);
+    return;
+  }
+  bytes = g_mapped_file_get_bytes (mapped);
+  g_mapped_file_unref (mapped);
+  variant = g_variant_new_from_bytes (G_VARIANT_TYPE (SEARCH_INDEX_TYPE), bytes, FALSE);
+  g_bytes_unref (bytes);
+
+  g_variant_get_child (variant, 0, "u", &version);
+  if (version != SEARCH_INDEX_VERSION) {
+    g_variant_unref (variant);
+    g_task_return_pointer (task, NULL, NULL);
+    return;
+  }
+
+  index = search_index_new ();
+  docs = g_variant_get_child_value (variant, 1);
+  g_variant_iter_init (&iter, docs);
+  while (!g_cancellable_is_cancelled (cancellable)
+         && g_variant_iter_next (&iter, "(&s&sit&s&s&s)",
+                                 &uri, &key, &chapter, &start, &title, &detail, &text))
+    search_index_insert (index, search_doc_new (uri, *key ? key : NULL, chapter, start,
+                                                title, *detail ? detail : NULL, text));
+  g_variant_unref (docs);
+  g_variant_unref (variant);
+
+  if (!g_task_return_error_if_cancelled (task))
+    g_task_return_pointer (task, index, search_index_free);
+  else
+    search_index_free (index);
+}
+
+/* Books the library reported while the index was read are newer than
+ * their saved documents and win. */
+static void
+search_loaded (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  AuditeSearch *search = user_data;
+  SearchIndex *loaded;
+  GHashTableIter iter;
+  gpointer uri, data;
+  SearchBook *book;
+  GError *error = NULL;
+  guint i;
+
+  loaded = g_task_propagate_pointer (G_TASK (res), &error);
+  if (error) {
+    /* cancelled, @search is gone */
+    g_error_free (error);
+    return;
+  }
+  search->loading = FALSE;
+  if (loaded && g_hash_table_size (search->index->books) == 0) {
+    search_index_free (search->index);
+    search->index = loaded;
+  }
+  else if (loaded) {
+    g_hash_table_iter_init (&iter, loaded->books);
+    while (g_hash_table_iter_next (&iter, &uri, &data)) {
+      book = data;
+      if (g_hash_table_contains (search->index->books, uri))
+        continue;
+      for (i = 0; i < book->ids->len; i++)
+        search_index_insert (search->index,
+                             g_atomic_rc_box_acquire (g_ptr_array_index (loaded->docs,
+                                                      g_array_index (book->ids, guint, i))));
+    }
+    search_index_free (loaded);
+  }
+  if (search->retained) {
+    search_retain_index (search, search->retained);
+    g_clear_pointer (&search->retained, g_hash_table_destroy);
+    audite_search_save (search);
+  }
+}
+
+/* Reads the index saved in @filename on a worker; queries answer from
+ * what has been added so far until it is in. A NULL @filename keeps the
+ * index in memory only. */
+AuditeSearch *
+audite_search_new (const gchar *filename)
+{
+  AuditeSearch *search;
+  GTask *task;
+
+  search = g_slice_new0 (AuditeSearch);
+  search->index = search_index_new ();
+  search->filename = g_strdup (filename);
+  search->cancellable = g_cancellable_new ();
+  if (!filename)
+    return search;
+
+  search->loading = TRUE;
+  task = g_task_new (NULL, search->cancellable, search_loaded, search);
+  g_task_set_task_data (task, g_strdup (filename), g_free);
+  g_task_run_in_thread (task, search_load_thread);
+  g_object_unref (task);
+  return search;
+}
+
+void
+audite_search_free (AuditeSearch *search)
+{
+  if (!search)
+    return;
+
+  g_cancellable_cancel (search->cancellable);
+  g_object_unref (search->cancellable);
+  g_clear_pointer (&search->retained, g_hash_table_destroy);
+  search_index_free (search->index);
+  g_free (search->filename);
+  g_slice_free (AuditeSearch, search);
+}
+
+static gchar *
+search_book_title (const AuditeBookInfo *book)
+{
+  GFile *file;
+  gchar *basename, *title;
+
+  if (book->title && *book->title)
+    return g_strdup (book->title);
+  file = g_file_new_for_uri (book->uri);
+  basename = g_file_get_basename (file);
+  title = g_filename_display_name (basename ? basename : book->uri);
+  g_free (basename);
+  g_object_unref (file);
+  return title;
+}
+
+/* Indexes @book and its chapters, replacing what an older version of it
+ * left. A book whose file has not changed since is skipped. */
+void
+audite_search_add_book (AuditeSearch *search, const AuditeBookInfo *book)
+{
+  const AuditeChapter *chapter;
+  SearchBook *indexed;
+  GString *text;
+  gchar *title;
+  guint i;
+
+  indexed = g_hash_table_lookup (search->index->books, book->uri);
+  if (indexed && book->cache_key && g_strcmp0 (indexed->key, book->cache_key) == 0)
+    return;
+  search_index_remove (search->index, book->uri);
+
+  title = search_book_title (book);
+  text = g_string_new (title);
+  if (book->artist)
+    g_string_append_printf (text, " %s", book->artist);
+  if (book->album)
+    g_string_append_printf (text, " %s", book->album);
+  if (book->genre)
+    g_string_append_printf (text, " %s", book->genre);
+  search_index_insert (search->index,
+                       search_doc_new (book->uri, book->cache_key, -1, 0,
+                                       title, book->artist, text->str));
+  g_string_free (text, TRUE);
+
+  for (i = 0; book->chapters && i < book->chapters->len; i++) {
+    chapter = &g_array_index (book->chapters, AuditeChapter, i);
+    if (!chapter->title || !*chapter->title)
+      continue;
+    search_index_insert (search->index,
+                         search_doc_new (book->uri, NULL, i, chapter->start,
+                                         chapter->title, title, chapter->title));
+  }
+  g_free (title);
+  search->dirty = TRUE;
+  search_compact (search);
+}
+
+void
+audite_search_remove_book (AuditeSearch *search, const gchar *uri)
+{
+  if (!search_index_remove (search->index, uri))
+    return;
+  search->dirty = TRUE;
+  search_compact (search);
+}
+
+/* Drops every book that is not one of @books, AuditeBookInfo, which is
+ * how books deleted while audite was not running leave the saved index. */
+void
+audite_search_retain (AuditeSearch *search, GList *books)
+{
+  GHashTable *uris;
+  GList *l;
+
+  uris = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  for (l = books; l; l = l->next)
+    g_hash_table_add (uris, g_strdup (((AuditeBookInfo *) l->data)->uri));
+
+  if (search->loading) {
+    g_clear_pointer (&search->retained, g_hash_table_destroy);
+    search->retained = uris;
+    return;
+  }
+  search_retain_index (search, uris);
+  g_hash_table_destroy (uris);
+}
+
+static void
+search_snapshot_free (gpointer data)
+{
+  SearchSnapshot *snapshot = data;
+
+  g_free (snapshot->filename);
+  g_ptr_array_unref (snapshot->docs);
+  g_slice_free (SearchSnapshot, snapshot);
+}
+
+static void
+search_save_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+  SearchSnapshot *snapshot = task_data;
+  GVariantBuilder docs;
+  GVariant *variant;
+  SearchDoc *doc;
+  guint i;
+
+  g_variant_builder_init (&docs, G_VARIANT_TYPE ("a(ssitsss)"));
+  for (i = 0; i < snapshot->docs->len; i++) {
+    doc = g_ptr_array_index (snapshot->docs, i);
+    g_variant_builder_add (&docs, "(ssitsss)",
+                           doc->uri, doc->key ? doc->key : "",
+                           doc->chapter, doc->start, doc->title,
+                           doc->detail ? doc->detail : "", doc->text);
+  }
+  variant = g_variant_ref_sink (g_variant_new ("(ua(ssitsss))", SEARCH_INDEX_VERSION, &docs));
+  g_file_set_contents (snapshot->filename,
+                       g_variant_get_data (variant), g_variant_get_size (variant),
+                       NULL);
+  g_variant_unref (variant);
+}
+
+/* Only takes references to the documents on the calling thread; they are
+ * serialized and written out, atomically, on a worker. */
+void
+audite_search_save (AuditeSearch *search)
+{
+  SearchSnapshot *snapshot;
+  SearchDoc *doc;
+  GTask *task;
+  guint i;
+
+  /* saving before the load is in would lose the saved books */
+  if (!search->filename || !search->dirty || search->loading)
+    return;
+
+  snapshot = g_slice_new0 (SearchSnapshot);
+  snapshot->filename = g_strdup (search->filename);
+  snapshot->docs = g_ptr_array_new_full (search->index->docs->len - search->index->n_removed,
+                                         search_doc_release);
+  for (i = 0; i < search->index->docs->len; i++) {
+    doc = g_ptr_array_index (search->index->docs, i);
+    if (doc)
+      g_ptr_array_add (snapshot->docs, g_atomic_rc_box_acquire (doc));
+  }
+  search->dirty = FALSE;
+
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  g_task_set_task_data (task, snapshot, search_snapshot_free);
+  g_task_run_in_thread (task, search_save_thread);
+  g_object_unref (task);
+}
+
+/* Sums the postings of the words starting with @prefix, giving up once
+ * they reach @limit. */
+static guint
+search_count_prefix (SearchIndex *index, const gchar *prefix, guint limit)
+{
+  GTreeNode *node;
+  GArray *ids;
+  guint count = 0;
+
+  for (node = g_tree_lower_bound (index->terms, prefix);
+       node && count < limit && g_str_has_prefix (g_tree_node_key (node), prefix);
+       node = g_tree_node_next (node)) {
+    ids = g_tree_node_value (node);
+    count += ids->len;
+  }
+  return count;
+}
+
+static gboolean
+search_doc_has_prefix (SearchDoc *doc, const gchar *prefix)
+{
+  guint i;
+
+  for (i = 0; doc->words[i]; i++)
+    if (g_str_has_prefix (doc->words[i], prefix))
+      return TRUE;
+  return FALSE;
+}
+
+static AuditeSearchResult *
+search_result_new (SearchDoc *doc)
+{
+  AuditeSearchResult *result;
+
+  result = g_slice_new0 (AuditeSearchResult);
+  result->uri = g_strdup (doc->uri);
+  result->chapter = doc->chapter;
+  result->start = doc->start;
+  result->title = g_strdup (doc->title);
+  result->detail = g_strdup (doc->detail);
+  return result;
+}
+
+void
+audite_search_result_free (AuditeSearchResult *result)
+{
+  g_free (result->uri);
+  g_free (result->title);
+  g_free (result->detail);
+  g_slice_free (AuditeSearchResult, result);
+}
+
+/* Returns up to @limit AuditeSearchResult for the documents having a word
+ * that starts with each word of @text. They come in the order of the words
+ * matching the rarest one, and for each word a book before its chapters. */
+GPtrArray *
+audite_search_query (AuditeSearch *search, const gchar *text, guint limit)
+{
+  SearchIndex *index = search->index;
+  GPtrArray *results;
+  GHashTable *seen;
+  GTreeNode *node;
+  SearchDoc *doc;
+  GArray *ids;
+  gchar **words;
+  guint rarest = 0, fewest = G_MAXUINT, count, id, i, j;
+  gboolean matches;
+
+  results = g_ptr_array_new_with_free_func ((GDestroyNotify) audite_search_result_free);
+  words = g_str_tokenize_and_fold (text, NULL, NULL);
+  for (i = 0; words[i] && fewest > 0; i++) {
+    count = search_count_prefix (index, words[i], fewest);
+    if (count < fewest) {
+      fewest = count;
+      rarest = i;
+    }
+  }
+  if (!words[0] || fewest == 0) {
+    g_strfreev (words);
+    return results;
+  }
+
+  /* a document shows up once for every word of it in the range */
+  seen = g_hash_table_new (NULL, NULL);
+  for (node = g_tree_lower_bound (index->terms, words[rarest]);
+       node && results->len < limit && g_str_has_prefix (g_tree_node_key (node), words[rarest]);
+       node = g_tree_node_next (node)) {
+    ids = g_tree_node_value (node);
+    for (i = 0; i < ids->len && results->len < limit; i++) {
+      id = g_array_index (ids, guint, i);
+      doc = g_ptr_array_index (index->docs, id);
+      if (!doc || !g_hash_table_add (seen, GUINT_TO_POINTER (id)))
+        continue;
+      matches = TRUE;
+      for (j = 0; words[j] && matches; j++)
+        matches = j == rarest || search_doc_has_prefix (doc, words[j]);
+      if (matches)
+        g_ptr_array_add (results, search_result_new (doc));
+    }
+  }
+  g_hash_table_destroy (seen);
+  g_strfreev (words);
+  return results;
+}
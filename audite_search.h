@@ -0,0 +1,43 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_SEARCH_H
+#define __AUDITE_SEARCH_H
+
+#include <gio/gio.h>
+#include "audite_loader.h"
+
+
+typedef struct _AuditeSearch AuditeSearch;
+typedef struct _AuditeSearchResult AuditeSearchResult;
+
+struct _AuditeSearchResult
+{
+  gchar        *uri;
+  gint          chapter;        /* -1 when the book itself matched */
+  GstClockTime  start;
+  gchar        *title;
+  gchar        *detail;         /* the artist of a book, the book of a chapter */
+};
+
+
+AuditeSearch   *audite_search_new             (const gchar          *filename);
+void            audite_search_free            (AuditeSearch         *search);
+void            audite_search_add_book        (AuditeSearch         *search,
+                                               const AuditeBookInfo *book);
+void            audite_search_remove_book     (AuditeSearch         *search,
+                                               const gchar          *uri);
+void            audite_search_retain          (AuditeSearch         *search,
+                                               GList                *books);
+void            audite_search_save            (AuditeSearch         *search);
+GPtrArray      *audite_search_query           (AuditeSearch         *search,
+                                               const gchar          *text,
+                                               guint                 limit);
+void            audite_search_result_free     (AuditeSearchResult   *result);
+
+
+#endif /* __AUDITE_SEARCH_H */
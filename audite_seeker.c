@@ -0,0 +1,260 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Coalesces seeks so that at most one is in flight. A request made while
+ * the pipeline is still settling from the previous seek only replaces the
+ * pending target; when the seek completes the latest target is sent and
+ * every one in between is dropped. Inexact requests (a slider drag) use
+ * key unit seeks, which need no decoding up to the exact sample.
+ *
+ * A seek completes with the ASYNC_DONE carrying its seqnum. Seeks the
+ * pipeline does not take directly (a new track, a seek kept until preroll)
+ * have no seqnum; those complete with the first ASYNC_DONE posted after
+ * them that leaves the pipeline settled in PAUSED or PLAYING. A seek that
+ * never completes times out, and the pending target is sent then.
+ */
+
+#include <gst/gst.h>
+#include <gst/player/player.h>
+
+#include "audite_seeker.h"
+
+/* a seek whose ASYNC_DONE never comes (stop, failed seek) must not block */
+#define SEEKER_TIMEOUT_MS 2000
+
+#define SEEKER_FAST_FLAGS (GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST)
+#define SEEKER_ACCURATE_FLAGS (GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE)
+
+struct _AuditeSeeker
+{
+  gint            ref_count;
+  gboolean        disposed;
+  GMainContext   *context;
+  GstElement     *pipeline;
+  GstBus         *bus;
+  gulong          async_done_id;
+
+  AuditeSeekFunc  seek_func;
+  gpointer        user_data;
+
+  /* main context only */
+  gboolean        in_flight;
+  gint64          sent_time;
+  guint32         sent_seqnum;
+  GstClockTime    sent_target;
+  GSource        *timeout;
+  GstClockTime    pending_target;
+  GstSeekFlags    pending_flags;
+};
+
+static AuditeSeeker *
+seeker_ref (AuditeSeeker *seeker)
+{
+  g_atomic_int_inc (&seeker->ref_count);
+  return seeker;
+}
+
+static void
+seeker_unref (gpointer data)
+{
+  AuditeSeeker *seeker = data;
+
+  if (!g_atomic_int_dec_and_test (&seeker->ref_count))
+    return;
+  g_main_context_unref (seeker->context);
+  g_slice_free (AuditeSeeker, seeker);
+}
+
+typedef struct
+{
+  AuditeSeeker *seeker;
+  guint32       seqnum;
+  gint64        posted;
+} SeekerDone;
+
+static void
+seeker_done_free (gpointer data)
+{
+  SeekerDone *done = data;
+
+  seeker_unref (done->seeker);
+  g_slice_free (SeekerDone, done);
+}
+
+static void
+seeker_clear_timeout (AuditeSeeker *seeker)
+{
+  if (!seeker->timeout)
+    return;
+  g_source_destroy (seeker->timeout);
+  g_source_unref (seeker->timeout);
+  seeker->timeout = NULL;
+}
+
+static gboolean seeker_timeout_handler (gpointer data);
+
+static void
+seeker_send (AuditeSeeker *seeker, GstClockTime position, GstSeekFlags flags)
+{
+  seeker_clear_timeout (seeker);
+  seeker->in_flight = TRUE;
+  seeker->sent_time = g_get_monotonic_time ();
+  seeker->sent_target = position;
+  seeker->sent_seqnum = seeker->seek_func (position, flags, seeker->user_data);
+
+  seeker->timeout = g_timeout_source_new (SEEKER_TIMEOUT_MS);
+  g_source_set_callback (seeker->timeout, seeker_timeout_handler, seeker, NULL);
+  g_source_attach (seeker->timeout, seeker->context);
+}
+
+/* The seek in flight is over, one way or the other: send what was asked
+ * for since, or settle. */
+static void
+seeker_complete (AuditeSeeker *seeker)
+{
+  GstClockTime target;
+
+  seeker_clear_timeout (seeker);
+  target = seeker->pending_target;
+  if (GST_CLOCK_TIME_IS_VALID (target)) {
+    seeker->pending_target = GST_CLOCK_TIME_NONE;
+    seeker_send (seeker, target, seeker->pending_flags);
+  }
+  else
+    seeker->in_flight = FALSE;
+}
+
+static gboolean
+seeker_timeout_handler (gpointer data)
+{
+  AuditeSeeker *seeker = data;
+
+  /* returning removes the source, only our reference is left to drop */
+  g_clear_pointer (&seeker->timeout, g_source_unref);
+  seeker_complete (seeker);
+  return G_SOURCE_REMOVE;
+}
+
+/* Whether an ASYNC_DONE ends the seek in flight rather than an earlier
+ * one or a state change of its own. */
+static gboolean
+seeker_is_done (AuditeSeeker *seeker, SeekerDone *done)
+{
+  GstState state, pending;
+
+  if (seeker->sent_seqnum != GST_SEQNUM_INVALID)
+    return done->seqnum == seeker->sent_seqnum;
+  if (done->posted < seeker->sent_time)
+    return FALSE;
+  return gst_element_get_state (seeker->pipeline, &state, &pending, 0) == GST_STATE_CHANGE_SUCCESS
+    && state >= GST_STATE_PAUSED && pending == GST_STATE_VOID_PENDING;
+}
+
+static gboolean
+seeker_done_dispatch (gpointer data)
+{
+  SeekerDone *done = data;
+  AuditeSeeker *seeker = done->seeker;
+
+  if (seeker->disposed || !seeker->in_flight || !seeker_is_done (seeker, done))
+    return G_SOURCE_REMOVE;
+  seeker_complete (seeker);
+  return G_SOURCE_REMOVE;
+}
+
+/* Runs on the GstPlayer thread, which owns the bus signal watch. */
+static void
+seeker_async_done_handler (GstBus *bus, GstMessage *message, AuditeSeeker *seeker)
+{
+  SeekerDone *done;
+
+  done = g_slice_new (SeekerDone);
+  done->seeker = seeker_ref (seeker);
+  done->seqnum = gst_message_get_seqnum (message);
+  done->posted = g_get_monotonic_time ();
+  g_main_context_invoke_full (seeker->context, G_PRIORITY_DEFAULT,
+                              seeker_done_dispatch, done, seeker_done_free);
+}
+
+/* @seek_func runs on the thread default main context of the caller. */
+AuditeSeeker *
+audite_seeker_new (GstPlayer      *player,
+                   AuditeSeekFunc  seek_func,
+                   gpointer        user_data)
+{
+  AuditeSeeker *seeker;
+
+  seeker = g_slice_new0 (AuditeSeeker);
+  seeker->ref_count = 1;
+  seeker->context = g_main_context_ref_thread_default ();
+  seeker->pipeline = gst_player_get_pipeline (player);
+  seeker->bus = gst_element_get_bus (seeker->pipeline);
+  seeker->seek_func = seek_func;
+  seeker->user_data = user_data;
+  seeker->sent_seqnum = GST_SEQNUM_INVALID;
+  seeker->sent_target = GST_CLOCK_TIME_NONE;
+  seeker->pending_target = GST_CLOCK_TIME_NONE;
+
+  seeker->async_done_id = g_signal_connect (seeker->bus, "message::async-done",
+                                            G_CALLBACK (seeker_async_done_handler),
+                                            seeker);
+  return seeker;
+}
+
+/* Dispatches still queued on the main context see @disposed and return. */
+void
+audite_seeker_free (AuditeSeeker *seeker)
+{
+  if (!seeker)
+    return;
+
+  g_signal_handler_disconnect (seeker->bus, seeker->async_done_id);
+  seeker_clear_timeout (seeker);
+  gst_object_unref (seeker->bus);
+  gst_object_unref (seeker->pipeline);
+  seeker->disposed = TRUE;
+  seeker_unref (seeker);
+}
+
+/* Requests a seek to @position, replacing any target that has not been
+ * sent yet. A drag asks for inexact seeks and finishes with an accurate
+ * one on release; that one always wins since it comes last. */
+void
+audite_seeker_seek (AuditeSeeker *seeker, GstClockTime position, gboolean accurate)
+{
+  GstSeekFlags flags = accurate ? SEEKER_ACCURATE_FLAGS : SEEKER_FAST_FLAGS;
+
+  if (seeker->in_flight) {
+    seeker->pending_target = position;
+    seeker->pending_flags = flags;
+    return;
+  }
+  seeker->pending_target = GST_CLOCK_TIME_NONE;
+  seeker_send (seeker, position, flags);
+}
+
+/* Where the pipeline is heading, or GST_CLOCK_TIME_NONE when it has
+ * settled. Lets repeated relative seeks build on each other. */
+GstClockTime
+audite_seeker_get_target (AuditeSeeker *seeker)
+{
+  if (GST_CLOCK_TIME_IS_VALID (seeker->pending_target))
+    return seeker->pending_target;
+  if (seeker->in_flight)
+    return seeker->sent_target;
+  return GST_CLOCK_TIME_NONE;
+}
+
+/* Forgets the pending target, for when a new stream is loaded. */
+void
+audite_seeker_reset (AuditeSeeker *seeker)
+{
+  seeker_clear_timeout (seeker);
+  seeker->in_flight = FALSE;
+  seeker->pending_target = GST_CLOCK_TIME_NONE;
+}
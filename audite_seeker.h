@@ -0,0 +1,36 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_SEEKER_H
+#define __AUDITE_SEEKER_H
+
+#include <gst/gst.h>
+#include <gst/player/player.h>
+
+
+typedef struct _AuditeSeeker AuditeSeeker;
+
+/* Performs one flushing seek with @flags; called on the main context.
+ * Returns the seqnum of the seek event sent to the pipeline, or
+ * GST_SEQNUM_INVALID when the seek was made some other way. */
+typedef guint32 (*AuditeSeekFunc) (GstClockTime  position,
+                                GstSeekFlags  flags,
+                                gpointer      user_data);
+
+
+AuditeSeeker   *audite_seeker_new              (GstPlayer      *player,
+                                                AuditeSeekFunc  seek_func,
+                                                gpointer        user_data);
+void            audite_seeker_free             (AuditeSeeker   *seeker);
+void            audite_seeker_seek             (AuditeSeeker   *seeker,
+                                                GstClockTime    position,
+                                                gboolean        accurate);
+GstClockTime    audite_seeker_get_target       (AuditeSeeker   *seeker);
+void            audite_seeker_reset            (AuditeSeeker   *seeker);
+
+
+#endif /* __AUDITE_SEEKER_H */
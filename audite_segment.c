@@ -0,0 +1,230 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Plays chapters and A-B ranges as pipeline segments. Only the first seek
+ * of a run flushes; every following range is queued with a non-flushing
+ * segment seek as soon as the demuxer posts SEGMENT_DONE, which happens
+ * while the previous range is still buffered downstream. Chapter changes
+ * and loop repeats therefore never re-preroll the pipeline.
+ */
+
+#include <gst/gst.h>
+#include <gst/player/player.h>
+
+#include "audite_chapters.h"
+#include "audite_segment.h"
+
+struct _AuditeSegment
+{
+  GstPlayer         *player;
+  GstElement        *pipeline;
+  GstBus            *bus;
+  gulong             segment_done_id;
+
+  GMutex             lock;
+  AuditeSegmentMode  mode;
+  GArray            *chapters;
+  gint               queued;
+  GstClockTime       loop_start;
+  GstClockTime       loop_stop;
+};
+
+#define SEGMENT_FLUSH_FLAGS (GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE)
+
+/* A stop of GST_CLOCK_TIME_NONE plays to the end of the stream and lets
+ * the pipeline reach a regular EOS. @flags without FLUSH queue the range
+ * behind the one playing. */
+static gboolean
+segment_send (AuditeSegment *segment,
+              GstClockTime   start,
+              GstClockTime   stop,
+              GstSeekFlags   flags)
+{
+  if (GST_CLOCK_TIME_IS_VALID (stop))
+    flags |= GST_SEEK_FLAG_SEGMENT;
+
+  return gst_element_seek (segment->pipeline,
+                           gst_player_get_rate (segment->player),
+                           GST_FORMAT_TIME, flags,
+                           GST_SEEK_TYPE_SET, start,
+                           GST_SEEK_TYPE_SET, stop);
+}
+
+static void
+segment_queue_chapter (AuditeSegment *segment,
+                       gint           index,
+                       GstClockTime   start,
+                       GstSeekFlags   flags)
+{
+  const AuditeChapter *chapter;
+  gboolean last;
+
+  chapter = &g_array_index (segment->chapters, AuditeChapter, index);
+  last = index + 1 == (gint) segment->chapters->len;
+
+  segment->queued = index;
+  segment_send (segment, start, last ? GST_CLOCK_TIME_NONE : chapter->end, flags);
+}
+
+/* Runs on the GstPlayer thread, which owns the bus signal watch. */
+static void
+segment_done_handler (GstBus *bus, GstMessage *message, AuditeSegment *segment)
+{
+  gint next;
+
+  g_mutex_lock (&segment->lock);
+  switch (segment->mode) {
+    case AUDITE_SEGMENT_MODE_CHAPTERS:
+      next = segment->queued + 1;
+      if (next < (gint) segment->chapters->len)
+        segment_queue_chapter (segment, next,
+                               g_array_index (segment->chapters, AuditeChapter, next).start,
+                               GST_SEEK_FLAG_NONE);
+      break;
+    case AUDITE_SEGMENT_MODE_LOOP:
+      segment_send (segment, segment->loop_start, segment->loop_stop, GST_SEEK_FLAG_NONE);
+      break;
+    default:
+      break;
+  }
+  g_mutex_unlock (&segment->lock);
+}
+
+AuditeSegment *
+audite_segment_new (GstPlayer *player)
+{
+  AuditeSegment *segment;
+
+  segment = g_slice_new0 (AuditeSegment);
+  segment->player = player;
+  segment->pipeline = gst_player_get_pipeline (player);
+  segment->bus = gst_element_get_bus (segment->pipeline);
+  segment->loop_start = GST_CLOCK_TIME_NONE;
+  segment->loop_stop = GST_CLOCK_TIME_NONE;
+  g_mutex_init (&segment->lock);
+
+  segment->segment_done_id = g_signal_connect (segment->bus, "message::segment-done",
+                                               G_CALLBACK (segment_done_handler),
+                                               segment);
+  return segment;
+}
+
+void
+audite_segment_free (AuditeSegment *segment)
+{
+  if (!segment)
+    return;
+
+  g_signal_handler_disconnect (segment->bus, segment->segment_done_id);
+  gst_object_unref (segment->bus);
+  gst_object_unref (segment->pipeline);
+  if (segment->chapters)
+    g_array_unref (segment->chapters);
+  g_mutex_clear (&segment->lock);
+  g_slice_free (AuditeSegment, segment);
+}
+
+/* A new chapter table always means a new stream, so any running segment
+ * mode ends here. */
+void
+audite_segment_set_chapters (AuditeSegment *segment, GArray *chapters)
+{
+  g_mutex_lock (&segment->lock);
+  if (segment->chapters)
+    g_array_unref (segment->chapters);
+  segment->chapters = chapters ? g_array_ref (chapters) : NULL;
+  segment->mode = AUDITE_SEGMENT_MODE_NONE;
+  g_mutex_unlock (&segment->lock);
+}
+
+AuditeSegmentMode
+audite_segment_get_mode (AuditeSegment *segment)
+{
+  AuditeSegmentMode mode;
+
+  g_mutex_lock (&segment->lock);
+  mode = segment->mode;
+  g_mutex_unlock (&segment->lock);
+  return mode;
+}
+
+void
+audite_segment_play_chapters (AuditeSegment *segment, GstClockTime position)
+{
+  gint index;
+
+  g_mutex_lock (&segment->lock);
+  index = audite_chapters_lookup (segment->chapters, position);
+  if (index >= 0) {
+    segment->mode = AUDITE_SEGMENT_MODE_CHAPTERS;
+    segment_queue_chapter (segment, index, position, SEGMENT_FLUSH_FLAGS);
+  }
+  g_mutex_unlock (&segment->lock);
+}
+
+void
+audite_segment_play_loop (AuditeSegment *segment,
+                          GstClockTime   start,
+                          GstClockTime   stop)
+{
+  g_return_if_fail (GST_CLOCK_TIME_IS_VALID (start) && stop > start);
+
+  g_mutex_lock (&segment->lock);
+  segment->mode = AUDITE_SEGMENT_MODE_LOOP;
+  segment->loop_start = start;
+  segment->loop_stop = stop;
+  segment_send (segment, start, stop, SEGMENT_FLUSH_FLAGS);
+  g_mutex_unlock (&segment->lock);
+}
+
+/* Drops the segment stop so playback runs on from @position. */
+void
+audite_segment_stop (AuditeSegment *segment, GstClockTime position)
+{
+  g_mutex_lock (&segment->lock);
+  if (segment->mode != AUDITE_SEGMENT_MODE_NONE) {
+    segment->mode = AUDITE_SEGMENT_MODE_NONE;
+    segment_send (segment, position, GST_CLOCK_TIME_NONE, SEGMENT_FLUSH_FLAGS);
+  }
+  g_mutex_unlock (&segment->lock);
+}
+
+/* Seeks inside the running segment mode with the flushing @flags the
+ * caller chose. Returns FALSE when the caller should do a plain seek
+ * instead; a position outside the A-B range ends the loop. */
+gboolean
+audite_segment_seek (AuditeSegment *segment,
+                     GstClockTime   position,
+                     GstSeekFlags   flags)
+{
+  gboolean handled = FALSE;
+  gint index;
+
+  g_mutex_lock (&segment->lock);
+  switch (segment->mode) {
+    case AUDITE_SEGMENT_MODE_CHAPTERS:
+      index = audite_chapters_lookup (segment->chapters, position);
+      if (index >= 0) {
+        segment_queue_chapter (segment, index, position, flags);
+        handled = TRUE;
+      }
+      break;
+    case AUDITE_SEGMENT_MODE_LOOP:
+      if (position >= segment->loop_start && position < segment->loop_stop) {
+        segment_send (segment, position, segment->loop_stop, flags);
+        handled = TRUE;
+      }
+      else
+        segment->mode = AUDITE_SEGMENT_MODE_NONE;
+      break;
+    default:
+      break;
+  }
+  g_mutex_unlock (&segment->lock);
+  return handled;
+}
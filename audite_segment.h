@@ -0,0 +1,42 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_SEGMENT_H
+#define __AUDITE_SEGMENT_H
+
+#include <gst/gst.h>
+#include <gst/player/player.h>
+
+
+typedef struct _AuditeSegment AuditeSegment;
+
+typedef enum
+{
+  AUDITE_SEGMENT_MODE_NONE,
+  AUDITE_SEGMENT_MODE_CHAPTERS,
+  AUDITE_SEGMENT_MODE_LOOP
+} AuditeSegmentMode;
+
+
+AuditeSegment     *audite_segment_new             (GstPlayer     *player);
+void               audite_segment_free            (AuditeSegment *segment);
+void               audite_segment_set_chapters    (AuditeSegment *segment,
+                                                   GArray        *chapters);
+AuditeSegmentMode  audite_segment_get_mode        (AuditeSegment *segment);
+void               audite_segment_play_chapters   (AuditeSegment *segment,
+                                                   GstClockTime   position);
+void               audite_segment_play_loop       (AuditeSegment *segment,
+                                                   GstClockTime   start,
+                                                   GstClockTime   stop);
+void               audite_segment_stop            (AuditeSegment *segment,
+                                                   GstClockTime   position);
+gboolean           audite_segment_seek            (AuditeSegment *segment,
+                                                   GstClockTime   position,
+                                                   GstSeekFlags   flags);
+
+
+#endif /* __AUDITE_SEGMENT_H */
@@ -0,0 +1,287 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Soak run, started with --soak=HOURS. The normal window plays a synthetic
+ * book at a raised rate, so chapter changes and position ticks come fast,
+ * and the resident set and heap in use are sampled once a minute. Steady
+ * playback should not leak, so after the warm up both lines must stay
+ * flat; the report ends with their growth per hour. The heap is what
+ * mallinfo reports in use, not a count of allocations, so churn freed
+ * between two samples does not show; the report says so. CPU time and
+ * wakeups, counted as voluntary context switches of all threads, are
+ * sampled along, so a run at normal rate with and without
+ * --soak-low-power compares the power profiles. Settings go to the
+ * memory backend and the cache to a temporary directory, so a run leaves
+ * the user's state alone.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <gio/gio.h>
+#include <gst/player/player.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "audite_soak.h"
+#include "audite_bench.h"
+
+#define SOAK_REPORT_VERSION 3
+#define SOAK_SAMPLE_INTERVAL 60
+#define SOAK_WARMUP_SAMPLES 5
+#define SOAK_COVER_SIZE 600
+
+const GOptionEntry audite_soak_option_entries[] =
+{
+  { "soak", 0, 0, G_OPTION_ARG_DOUBLE, NULL,
+    "Play a synthetic book for HOURS and report memory growth", "HOURS" },
+  { "soak-rate", 0, 0, G_OPTION_ARG_DOUBLE, NULL,
+    "Playback rate during the soak run, 0.5 to 16 (default 8)", "RATE" },
+  { "soak-chapters", 0, 0, G_OPTION_ARG_INT, NULL,
+    "Synthetic chapter count, 1 to 10000 (default 2000)", "N" },
+  { "soak-low-power", 0, 0, G_OPTION_ARG_NONE, NULL,
+    "Play in the low power profile during the soak run", NULL },
+  { "soak-report", 0, 0, G_OPTION_ARG_FILENAME, NULL,
+    "Write the soak report to FILE instead of stdout", "FILE" },
+  { NULL }
+};
+
+struct _AuditeSoak
+{
+  gdouble          hours;
+  gdouble          rate;
+  gint             n_chapters;
+  gboolean         low_power;
+  gchar           *report_filename;
+  gchar           *dir;
+  gchar           *uri;
+
+  AuditeAppWindow *win;
+  GString         *report;
+  gint64           start_time;
+  guint            timeout_id;
+  guint            samples;
+  gsize            base_rss;
+  gsize            base_heap;
+  gint64           base_time;
+  gint64           last_cpu;
+  gint64           last_wakeups;
+  gint64           base_cpu;
+  gint64           base_wakeups;
+};
+
+static gsize
+soak_rss (void)
+{
+  gchar *contents;
+  gulong size, resident = 0;
+
+  if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    return 0;
+  if (sscanf (contents, "%lu %lu", &size, &resident) != 2)
+    resident = 0;
+  g_free (contents);
+  return (gsize) resident * sysconf (_SC_PAGESIZE);
+}
+
+/* CPU time of all threads in microseconds and the number of times they
+ * went to sleep and were woken up again. */
+static void
+soak_usage (gint64 *cpu, gint64 *wakeups)
+{
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) != 0) {
+    *cpu = *wakeups = 0;
+    return;
+  }
+  *cpu = (gint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC
+         + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+  *wakeups = usage.ru_nvcsw;
+}
+
+/* Bytes handed out by malloc and not yet freed; 0 when unknown. */
+static gsize
+soak_heap (void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 info = mallinfo2 ();
+
+  return info.uordblks + info.hblkhd;
+#elif defined(__GLIBC__)
+  struct mallinfo info = mallinfo ();
+
+  return (guint) info.uordblks + (guint) info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+static void
+soak_finish (AuditeSoak *soak, gsize rss, gsize heap)
+{
+  GError *error = NULL;
+  gdouble hours, seconds;
+
+  /* runs shorter than the warm up have no baseline */
+  hours = (g_get_monotonic_time () - soak->base_time) / (3600.0 * G_USEC_PER_SEC);
+  seconds = hours * 3600;
+  if (soak->samples >= SOAK_WARMUP_SAMPLES && hours > 0) {
+    g_string_append_printf (soak->report, "# growth rss_kb/h %.1f heap_kb/h %.1f\n",
+                            ((gdouble) rss - soak->base_rss) / 1024 / hours,
+                            ((gdouble) heap - soak->base_heap) / 1024 / hours);
+    g_string_append_printf (soak->report, "# mean cpu_ms/min %.1f wakeups/s %.1f\n",
+                            (soak->last_cpu - soak->base_cpu) / 1000.0 / (seconds / 60),
+                            (soak->last_wakeups - soak->base_wakeups) / seconds);
+  }
+
+  if (soak->report_filename) {
+    if (!g_file_set_contents (soak->report_filename, soak->report->str,
+                              soak->report->len, &error)) {
+      g_print ("Soak: %s\n", error->message);
+      g_error_free (error);
+    }
+  }
+  else
+    g_print ("%s", soak->report->str);
+
+  g_application_quit (g_application_get_default ());
+}
+
+static gboolean
+soak_sample (gpointer data)
+{
+  AuditeSoak *soak = data;
+  GstPlayer *player = audite_app_window_get_player (soak->win);
+  gint64 elapsed = g_get_monotonic_time () - soak->start_time;
+  gsize rss = soak_rss ();
+  gsize heap = soak_heap ();
+  gint64 cpu, wakeups;
+
+  /* carry on through anything that paused playback, such as the end */
+  if (gst_player_get_rate (player) != soak->rate)
+    gst_player_set_rate (player, soak->rate);
+  gst_player_play (player);
+
+  soak_usage (&cpu, &wakeups);
+  if (++soak->samples == SOAK_WARMUP_SAMPLES) {
+    soak->base_rss = rss;
+    soak->base_heap = heap;
+    soak->base_time = g_get_monotonic_time ();
+    soak->base_cpu = cpu;
+    soak->base_wakeups = wakeups;
+  }
+  g_string_append_printf (soak->report, "%" G_GINT64_FORMAT "\t%" G_GSIZE_FORMAT
+                          "\t%" G_GSIZE_FORMAT "\t%" G_GINT64_FORMAT "\t%.1f\n",
+                          elapsed / (60 * G_USEC_PER_SEC), rss / 1024, heap / 1024,
+                          (cpu - soak->last_cpu) / 1000,
+                          (gdouble) (wakeups - soak->last_wakeups) / SOAK_SAMPLE_INTERVAL);
+  soak->last_cpu = cpu;
+  soak->last_wakeups = wakeups;
+
+  if (elapsed < soak->hours * 3600 * G_USEC_PER_SEC)
+    return G_SOURCE_CONTINUE;
+
+  soak->timeout_id = 0;
+  soak_finish (soak, rss, heap);
+  return G_SOURCE_REMOVE;
+}
+
+/* Called from handle-local-options: prepares the environment and the
+ * synthetic book before GSettings or the cache are first used. */
+AuditeSoak *
+audite_soak_new (GVariantDict *options, GError **error)
+{
+  AuditeSoak *soak;
+  GSettings *settings;
+  gchar *filename;
+  gint hours;
+
+  soak = g_slice_new0 (AuditeSoak);
+  g_variant_dict_lookup (options, "soak", "d", &soak->hours);
+  soak->hours = CLAMP (soak->hours, 0.01, 1000.0);
+  if (!g_variant_dict_lookup (options, "soak-rate", "d", &soak->rate))
+    soak->rate = 8.0;
+  soak->rate = CLAMP (soak->rate, 0.5, 16.0);
+  if (!g_variant_dict_lookup (options, "soak-chapters", "i", &soak->n_chapters))
+    soak->n_chapters = 2000;
+  soak->n_chapters = CLAMP (soak->n_chapters, 1, 10000);
+  soak->low_power = g_variant_dict_contains (options, "soak-low-power");
+  g_variant_dict_lookup (options, "soak-report", "^ay", &soak->report_filename);
+
+  soak->dir = g_dir_make_tmp ("audite-soak-XXXXXX", error);
+  if (!soak->dir) {
+    audite_soak_free (soak);
+    return NULL;
+  }
+  g_setenv ("XDG_CACHE_HOME", soak->dir, TRUE);
+  g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+  if (soak->low_power) {
+    settings = g_settings_new ("com.github.alkesta.audite");
+    g_settings_set_boolean (settings, "low-power", TRUE);
+    g_object_unref (settings);
+  }
+
+  /* long enough that the run never reaches the end of the book */
+  hours = MIN ((gint) (soak->hours * soak->rate) + 1, 100);
+  filename = g_build_filename (soak->dir, "synthetic.m4b", NULL);
+  if (!audite_bench_write_book (filename, hours, soak->n_chapters, SOAK_COVER_SIZE)) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                 "Could not write the synthetic book");
+    g_free (filename);
+    audite_soak_free (soak);
+    return NULL;
+  }
+  soak->uri = g_filename_to_uri (filename, NULL, NULL);
+  g_free (filename);
+
+  soak->report = g_string_new (NULL);
+  g_string_append_printf (soak->report, "# audite soak %d\n", SOAK_REPORT_VERSION);
+  g_string_append_printf (soak->report, "# hours %.2f rate %.2f chapters %d profile %s\n",
+                          soak->hours, soak->rate, soak->n_chapters,
+                          soak->low_power ? "low-power" : "default");
+  g_string_append (soak->report, "# heap_kb is malloc memory in use, not an allocation count;"
+                   " allocations freed before the next sample do not show\n");
+  g_string_append (soak->report, "# minute\trss_kb\theap_kb\tcpu_ms\twakeups_s\n");
+  return soak;
+}
+
+void
+audite_soak_free (AuditeSoak *soak)
+{
+  if (!soak)
+    return;
+
+  if (soak->timeout_id)
+    g_source_remove (soak->timeout_id);
+  g_clear_object (&soak->win);
+  if (soak->dir)
+    audite_bench_remove_dir (soak->dir);
+  if (soak->report)
+    g_string_free (soak->report, TRUE);
+  g_free (soak->report_filename);
+  g_free (soak->dir);
+  g_free (soak->uri);
+  g_slice_free (AuditeSoak, soak);
+}
+
+/* Opens the synthetic book in @win and starts sampling. */
+void
+audite_soak_start (AuditeSoak *soak, AuditeAppWindow *win)
+{
+  g_return_if_fail (soak->win == NULL);
+
+  soak->win = g_object_ref (win);
+  audite_app_window_open (win, soak->uri);
+  gst_player_set_rate (audite_app_window_get_player (win), soak->rate);
+
+  soak->start_time = g_get_monotonic_time ();
+  soak_usage (&soak->last_cpu, &soak->last_wakeups);
+  soak->timeout_id = g_timeout_add_seconds (SOAK_SAMPLE_INTERVAL, soak_sample, soak);
+}
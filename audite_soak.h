@@ -0,0 +1,26 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_SOAK_H
+#define __AUDITE_SOAK_H
+
+#include <gio/gio.h>
+#include "audite_app_win.h"
+
+
+typedef struct _AuditeSoak AuditeSoak;
+
+extern const GOptionEntry audite_soak_option_entries[];
+
+AuditeSoak    *audite_soak_new                 (GVariantDict    *options,
+                                                GError         **error);
+void           audite_soak_free                (AuditeSoak      *soak);
+void           audite_soak_start               (AuditeSoak      *soak,
+                                                AuditeAppWindow *win);
+
+
+#endif /* __AUDITE_SOAK_H */
@@ -0,0 +1,344 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Amplitude overview of a whole book for the seek bar. Every file is cut
+ * into chunks of a few minutes and each chunk is decoded by its own small
+ * pipeline, several at a time, down to 8 kHz mono floats that are reduced
+ * to a peak and an RMS level per second. All threads of the pass, the
+ * workers and the streaming threads of their pipelines, are its own and
+ * run at idle scheduling priority, so the playing pipeline always comes
+ * first; see audite_idle.c.
+ * Finished chunks are handed to the main context right away, and a file
+ * whose chunks are all done is cached by its file key.
+ */
+
+#include <math.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+#include "audite_waveform.h"
+#include "audite_cache.h"
+#include "audite_chapters.h"
+#include "audite_idle.h"
+
+#define WAVEFORM_CACHE_VERSION 1
+#define WAVEFORM_RATE 8000
+#define WAVEFORM_CHUNK_LEVELS 300
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define WAVEFORM_FORMAT "F32LE"
+#else
+#define WAVEFORM_FORMAT "F32BE"
+#endif
+
+#define WAVEFORM_PIPELINE \
+  "uridecodebin name=source caps=audio/x-raw ! audioconvert ! audioresample ! " \
+  "audio/x-raw,format=" WAVEFORM_FORMAT ",layout=interleaved,channels=1,rate=" \
+  G_STRINGIFY (WAVEFORM_RATE) " ! fakesink name=sink sync=false signal-handoffs=true"
+
+typedef struct
+{
+  gchar   *uri;
+  gchar   *cache_key;
+  guint    first;               /* first level of the file in the book */
+  guint    n_levels;
+  guint8  *levels;
+  gint     chunks_left;
+} WaveformFile;
+
+typedef struct
+{
+  GArray             *files;    /* WaveformFile */
+  GstTaskPool        *task_pool; /* streaming threads of the chunks */
+  AuditeWaveformFunc  levels_func;
+  gpointer            user_data;
+} WaveformData;
+
+typedef struct
+{
+  GTask        *task;
+  WaveformFile *file;
+  guint         first;          /* first level of the chunk in the file */
+  guint         n_levels;
+  gfloat       *peak;
+  gdouble      *sum;
+  guint32      *count;
+} WaveformChunk;
+
+typedef struct
+{
+  GTask  *task;
+  guint8 *levels;
+  guint   first;
+  guint   n_levels;
+} WaveformDelivery;
+
+static void
+waveform_file_clear (gpointer data)
+{
+  WaveformFile *file = data;
+
+  g_free (file->uri);
+  g_free (file->cache_key);
+  g_free (file->levels);
+}
+
+static void
+waveform_data_free (WaveformData *data)
+{
+  g_array_unref (data->files);
+  g_clear_object (&data->task_pool);
+  g_slice_free (WaveformData, data);
+}
+
+guint
+audite_waveform_n_levels (GstClockTime duration)
+{
+  if (!GST_CLOCK_TIME_IS_VALID (duration))
+    return 0;
+  return (duration + AUDITE_WAVEFORM_RESOLUTION - 1) / AUDITE_WAVEFORM_RESOLUTION;
+}
+
+/* Four independent accumulators break the dependency between iterations,
+ * which lets the compiler keep them in one vector register. */
+static void
+waveform_reduce (const gfloat *samples, gsize n_samples, gfloat *peak, gdouble *sum)
+{
+  gfloat peaks[4] = { 0 }, sums[4] = { 0 }, value;
+  gsize i, j;
+
+  for (i = 0; i + 4 <= n_samples; i += 4) {
+    for (j = 0; j < 4; j++) {
+      value = fabsf (samples[i + j]);
+      peaks[j] = value > peaks[j] ? value : peaks[j];
+      sums[j] += value * value;
+    }
+  }
+  for (j = 0; i < n_samples; i++, j++) {
+    value = fabsf (samples[i]);
+    peaks[j] = value > peaks[j] ? value : peaks[j];
+    sums[j] += value * value;
+  }
+
+  *peak = MAX (*peak, MAX (MAX (peaks[0], peaks[1]), MAX (peaks[2], peaks[3])));
+  *sum += (gdouble) sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+/* Runs on the streaming thread of a chunk pipeline. */
+static void
+waveform_handoff_handler (GstElement    *sink,
+                          GstBuffer     *buffer,
+                          GstPad        *pad,
+                          WaveformChunk *chunk)
+{
+  GstMapInfo map;
+  const gfloat *samples;
+  gsize n_samples, done = 0, run;
+  guint64 sample;
+  gint64 level;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer) || !gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return;
+  samples = (const gfloat *) map.data;
+  n_samples = map.size / sizeof (gfloat);
+  sample = gst_util_uint64_scale (GST_BUFFER_PTS (buffer), WAVEFORM_RATE, GST_SECOND);
+
+  /* a buffer may straddle level boundaries; reduce each part on its own */
+  while (done < n_samples) {
+    level = (gint64) ((sample + done) / WAVEFORM_RATE) - chunk->first;
+    run = MIN (n_samples - done, WAVEFORM_RATE - (sample + done) % WAVEFORM_RATE);
+    if (level >= 0 && level < chunk->n_levels) {
+      waveform_reduce (samples + done, run, &chunk->peak[level], &chunk->sum[level]);
+      chunk->count[level] += run;
+    }
+    done += run;
+  }
+  gst_buffer_unmap (buffer, &map);
+}
+
+static gboolean
+waveform_delivery_dispatch (gpointer user_data)
+{
+  WaveformDelivery *delivery = user_data;
+  WaveformData *data = g_task_get_task_data (delivery->task);
+
+  if (!g_cancellable_is_cancelled (g_task_get_cancellable (delivery->task)))
+    data->levels_func (delivery->levels, delivery->first, delivery->n_levels, data->user_data);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+waveform_delivery_free (gpointer user_data)
+{
+  WaveformDelivery *delivery = user_data;
+
+  g_object_unref (delivery->task);
+  g_free (delivery->levels);
+  g_slice_free (WaveformDelivery, delivery);
+}
+
+static void
+waveform_deliver (GTask *task, const guint8 *levels, guint first, guint n_levels)
+{
+  WaveformDelivery *delivery;
+
+  delivery = g_slice_new (WaveformDelivery);
+  delivery->task = g_object_ref (task);
+  delivery->levels = g_memdup2 (levels, (gsize) n_levels * 2);
+  delivery->first = first;
+  delivery->n_levels = n_levels;
+  g_main_context_invoke_full (g_task_get_context (task), G_PRIORITY_LOW,
+                              waveform_delivery_dispatch, delivery,
+                              waveform_delivery_free);
+}
+
+static guint8
+waveform_scale (gdouble amplitude)
+{
+  return (guint8) MIN (255.0, sqrt (amplitude) * 255.0);
+}
+
+/* Pool worker: one chunk from decode to delivery. */
+static void
+waveform_run_chunk (gpointer item, gpointer user_data)
+{
+  WaveformChunk *chunk = item;
+  WaveformFile *file = chunk->file;
+  WaveformData *data = g_task_get_task_data (chunk->task);
+  GCancellable *cancellable = g_task_get_cancellable (chunk->task);
+  guint8 *levels;
+  guint i;
+
+  if (g_cancellable_is_cancelled (cancellable)
+      || !audite_idle_decode (WAVEFORM_PIPELINE, file->uri,
+                              (GstClockTime) chunk->first * AUDITE_WAVEFORM_RESOLUTION,
+                              (GstClockTime) (chunk->first + chunk->n_levels)
+                              * AUDITE_WAVEFORM_RESOLUTION,
+                              data->task_pool, G_CALLBACK (waveform_handoff_handler),
+                              chunk, cancellable))
+    goto out;
+
+  levels = file->levels + chunk->first * 2;
+  for (i = 0; i < chunk->n_levels; i++) {
+    levels[i * 2] = waveform_scale (chunk->peak[i]);
+    levels[i * 2 + 1] = chunk->count[i] ?
+                        waveform_scale (sqrt (chunk->sum[i] / chunk->count[i])) : 0;
+  }
+  waveform_deliver (chunk->task, levels, file->first + chunk->first, chunk->n_levels);
+
+  /* chunks of a file never overlap, the last one to finish writes it out */
+  if (g_atomic_int_dec_and_test (&file->chunks_left))
+    audite_cache_store_items ("waveforms", file->cache_key, ".levels",
+                              WAVEFORM_CACHE_VERSION, file->levels, file->n_levels, 2);
+
+out:
+  g_object_unref (chunk->task);
+  g_free (chunk->peak);
+  g_free (chunk->sum);
+  g_free (chunk->count);
+  g_slice_free (WaveformChunk, chunk);
+}
+
+static void
+waveform_thread (GTask        *task,
+                 gpointer      source_object,
+                 gpointer      task_data,
+                 GCancellable *cancellable)
+{
+  WaveformData *data = task_data;
+  WaveformFile *file;
+  WaveformChunk *chunk;
+  AuditeIdlePool *pool;
+  guint i, first;
+
+  /* leave half of the cores to playback and the desktop */
+  data->task_pool = audite_idle_task_pool_new ();
+  pool = audite_idle_pool_new (waveform_run_chunk, NULL,
+                               MAX (1, g_get_num_processors () / 2));
+
+  for (i = 0; i < data->files->len && !g_cancellable_is_cancelled (cancellable); i++) {
+    file = &g_array_index (data->files, WaveformFile, i);
+    file->levels = g_malloc0 (file->n_levels * 2);
+    file->cache_key = audite_cache_file_key (file->uri, cancellable);
+    if (audite_cache_load_items ("waveforms", file->cache_key, ".levels",
+                                 WAVEFORM_CACHE_VERSION, file->levels, file->n_levels, 2)) {
+      waveform_deliver (task, file->levels, file->first, file->n_levels);
+      continue;
+    }
+
+    file->chunks_left = (file->n_levels + WAVEFORM_CHUNK_LEVELS - 1) / WAVEFORM_CHUNK_LEVELS;
+    for (first = 0; first < file->n_levels; first += WAVEFORM_CHUNK_LEVELS) {
+      chunk = g_slice_new0 (WaveformChunk);
+      chunk->task = g_object_ref (task);
+      chunk->file = file;
+      chunk->first = first;
+      chunk->n_levels = MIN (WAVEFORM_CHUNK_LEVELS, file->n_levels - first);
+      chunk->peak = g_new0 (gfloat, chunk->n_levels);
+      chunk->sum = g_new0 (gdouble, chunk->n_levels);
+      chunk->count = g_new0 (guint32, chunk->n_levels);
+      audite_idle_pool_push (pool, chunk);
+    }
+  }
+  audite_idle_pool_free (pool);
+
+  if (!g_task_return_error_if_cancelled (task))
+    g_task_return_boolean (task, TRUE);
+}
+
+/* Starts the overview of @book: a single file, or the tracks of a
+ * folder, one per chapter. @levels_func is called on the calling
+ * thread's main context as parts complete, in no particular order. */
+void
+audite_waveform_load_async (gpointer              source_object,
+                            const AuditeBookInfo *book,
+                            GCancellable         *cancellable,
+                            AuditeWaveformFunc    levels_func,
+                            GAsyncReadyCallback   callback,
+                            gpointer              user_data)
+{
+  WaveformData *data;
+  WaveformFile file = { 0 };
+  const AuditeChapter *chapter;
+  GTask *task;
+  guint i;
+
+  data = g_slice_new0 (WaveformData);
+  data->files = g_array_new (FALSE, FALSE, sizeof (WaveformFile));
+  g_array_set_clear_func (data->files, waveform_file_clear);
+  data->levels_func = levels_func;
+  data->user_data = user_data;
+
+  if (book->tracks) {
+    for (i = 0; book->tracks[i] && i < book->chapters->len; i++) {
+      chapter = &g_array_index (book->chapters, AuditeChapter, i);
+      file.uri = g_strdup (book->tracks[i]);
+      file.first = chapter->start / AUDITE_WAVEFORM_RESOLUTION;
+      file.n_levels = audite_waveform_n_levels (chapter->end - chapter->start);
+      g_array_append_val (data->files, file);
+    }
+  }
+  else if (audite_waveform_n_levels (book->duration) > 0) {
+    file.uri = g_strdup (book->uri);
+    file.n_levels = audite_waveform_n_levels (book->duration);
+    g_array_append_val (data->files, file);
+  }
+
+  task = g_task_new (source_object, cancellable, callback, user_data);
+  g_task_set_source_tag (task, audite_waveform_load_async);
+  g_task_set_task_data (task, data, (GDestroyNotify) waveform_data_free);
+  g_task_run_in_thread (task, waveform_thread);
+  g_object_unref (task);
+}
+
+gboolean
+audite_waveform_load_finish (GAsyncResult *result, GError **error)
+{
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
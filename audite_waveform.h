@@ -0,0 +1,38 @@
+/*
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __AUDITE_WAVEFORM_H
+#define __AUDITE_WAVEFORM_H
+
+#include <gio/gio.h>
+#include "audite_loader.h"
+
+
+/* Levels come in pairs, peak then RMS, on a 0-255 square root scale;
+ * one pair per AUDITE_WAVEFORM_RESOLUTION of the book. */
+#define AUDITE_WAVEFORM_RESOLUTION GST_SECOND
+
+/* Called on the main context each time a stretch of the book has been
+ * analysed: @n_levels pairs starting at pair @first. */
+typedef void (*AuditeWaveformFunc) (const guint8 *levels,
+                                    guint         first,
+                                    guint         n_levels,
+                                    gpointer      user_data);
+
+
+guint          audite_waveform_n_levels        (GstClockTime        duration);
+void           audite_waveform_load_async      (gpointer            source_object,
+                                                const AuditeBookInfo *book,
+                                                GCancellable       *cancellable,
+                                                AuditeWaveformFunc  levels_func,
+                                                GAsyncReadyCallback callback,
+                                                gpointer            user_data);
+gboolean       audite_waveform_load_finish     (GAsyncResult       *result,
+                                                GError            **error);
+
+
+#endif /* __AUDITE_WAVEFORM_H */
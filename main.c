@@ -8,10 +8,24 @@
 #include <gtk/gtk.h>
 
 #include "audite_app.h"
+#include "audite_profile.h"
 
 int
 main (int argc, char *argv[]) {
 
+  AuditeApp *app;
+  int status;
+
+  audite_profile_init ();
   g_setenv ("GSETTINGS_SCHEMA_DIR", ".", FALSE);
-  return g_application_run (G_APPLICATION (audite_app_new ()), argc, argv);
+
+  audite_profile_begin ("g_application_run");
+  app = audite_app_new ();
+  status = g_application_run (G_APPLICATION (app), argc, argv);
+  if (status == 0)
+    status = audite_app_get_status (app);
+  audite_profile_end ("g_application_run");
+
+  audite_profile_write ();
+  return status;
 }